@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Build a 10M-element array by pushing one by one,
+# and with a reserved store plus a bulk append.
+
+export LSC_RUNTIME="./runtime"
+export LSC_STD="./std"
+
+BUILD_DIR="./_build_bench"
+
+dune build
+
+for name in array_build_push array_build_reserve; do
+    rm -rf $BUILD_DIR/$name
+    mkdir -p $BUILD_DIR/$name
+    ./_build/default/bin/main.exe build ./bench/$name/main.lc --mode release -D $BUILD_DIR/$name
+
+    start=$(date +%s%N)
+    $BUILD_DIR/$name/release/$name
+    end=$(date +%s%N)
+    echo "$name time: $(( (end - start) / 1000000 ))ms"
+done
@@ -0,0 +1,429 @@
+(*
+ * Copyright 2022 Vincent Chan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *)
+
+(*
+ * The throughput of the compiler on large synthetic programs.
+ *
+ * Every scenario is generated, then compiled to C in a forked process
+ * with the timing of the phases on, the C compiler is not run.
+ * The source is also lexed alone first, the "lex" phase is the throughput of the lexer.
+ * The result is compared with the baseline, a phase slower than
+ * the threshold fails the benchmark, so does a phase missing from
+ * the baseline when the CI variable is set.
+ *)
+open Core
+open Lichenscript_resolver
+open Lichenscript_common.Cli_utils
+module Timing = Lichenscript_common.Timing
+module Lex = Lichenscript_lex.Lex
+module Lex_env = Lichenscript_lex.Lex_env
+module Lex_source = Lichenscript_lex.Lex_source
+
+let help_message = {|
+Compiler throughput benchmark of LichenScript, usage:
+
+compiler_bench --std <dir> --runtime <dir> [<options>]
+
+  --baseline <file>     The baseline to compare with, a phase missing from it
+                        is a warning, and a failure when CI is set
+  --update-baseline     Write the result to the baseline
+  --threshold <ratio>   The allowed slowdown, default: 0.2
+  --scale <ratio>       Scale the size of the programs, default: 1.0
+  -N, --name            Only run the scenario matched the name
+
+|}
+
+(* the phases faster than this are noise *)
+let min_compared_ms = 5.0
+
+(* generators, every one returns the source of a main.lc *)
+
+(* ~10 lines per function *)
+let big_module ~lines =
+  let buf = Buffer.create (lines * 32) in
+  let functions = lines / 10 in
+  for i = 0 to functions - 1 do
+    Buffer.add_string buf (Format.sprintf {|
+function f%d(a: i32, b: i32): i32 {
+    let sum = 0;
+    let i = 0;
+    while i < a {
+        if i %% 3 == 0 { sum += b * %d; } else { sum -= i; }
+        i += 1;
+    }
+    sum
+}
+|} i i)
+  done;
+  Buffer.add_string buf "\nfunction main() {\n    print(f0(10, 2));\n}\n";
+  Buffer.contents buf
+
+let class_hierarchy ~depth =
+  let buf = Buffer.create (depth * 256) in
+  Buffer.add_string buf {|
+class C0 {
+    f0: i32
+
+    static new(): C0 {
+        return C0 { f0: 0 };
+    }
+
+    virtual value(): i32 {
+        return this.f0;
+    }
+}
+|};
+  for i = 1 to depth - 1 do
+    Buffer.add_string buf (Format.sprintf {|
+class C%d extends C%d {
+    f%d: i32
+
+    static new(): C%d {
+        return C%d {
+            ...C%d.new(),
+            f%d: %d,
+        };
+    }
+
+    override value(): i32 {
+        return this.f%d + %d;
+    }
+}
+|} i (i - 1) i i i (i - 1) i i i i)
+  done;
+  Buffer.add_string buf (Format.sprintf "\nfunction main() {\n    const c = C%d.new();\n    print(c.value());\n}\n" (depth - 1));
+  Buffer.contents buf
+
+let enum_match ~cases =
+  let buf = Buffer.create (cases * 64) in
+  Buffer.add_string buf "enum E {\n";
+  for i = 0 to cases - 1 do
+    Buffer.add_string buf (Format.sprintf "    case K%d(i32)\n" i)
+  done;
+  Buffer.add_string buf "}\n\nfunction eval(e: E): i32 {\n    match e {\n";
+  for i = 0 to cases - 1 do
+    Buffer.add_string buf (Format.sprintf "        case K%d(v) => v + %d\n" i i)
+  done;
+  Buffer.add_string buf "    }\n}\n\nfunction main() {\n    print(eval(K1(1)));\n}\n";
+  Buffer.contents buf
+
+let lambdas ~count =
+  let buf = Buffer.create (count * 128) in
+  for i = 0 to count - 1 do
+    Buffer.add_string buf (Format.sprintf {|
+function g%d(x: i32): i32 {
+    const add = (y: i32): i32 => y + x + %d;
+    const twice = (f: (i32) => i32, y: i32): i32 => f(f(y));
+    twice(add, 1)
+}
+|} i i)
+  done;
+  Buffer.add_string buf "\nfunction main() {\n    print(g0(1));\n}\n";
+  Buffer.contents buf
+
+let scenarios ~scale =
+  let n base = Int.max 1 (Float.to_int (Float.of_int base *. scale)) in
+  [
+    "big_module", (fun () -> big_module ~lines:(n 100_000));
+    "class_hierarchy", (fun () -> class_hierarchy ~depth:(n 300));
+    "enum_match", (fun () -> enum_match ~cases:(n 2_000));
+    "lambdas", (fun () -> lambdas ~count:(n 5_000));
+  ]
+
+(* running *)
+
+type result = {
+  (* phase -> wall ms, in the order of the phases *)
+  phases: (string * float) list;
+  heap_mb: float;
+  source_bytes: int;
+  tokens: int;
+}
+
+let compile ~std ~runtime ~work_dir source =
+  let module R = Resolver.S (struct
+
+    let is_directory path = Sys.is_directory_exn path
+
+    let is_file path = Sys.is_file_exn path
+
+    let get_realpath = Filename.realpath
+
+    let ls_dir = Sys.ls_dir
+
+    let mkdir_p path = Unix.mkdir_p path
+
+    let file_exists path = Sys.file_exists_exn path
+
+    let read_file_content = In_channel.read_all
+
+    let write_file_content = Out_channel.write_all
+
+    let rename src dst = Unix.rename ~src ~dst
+
+    (* sequential, the workers would hide the allocation *)
+    let map_files ~f paths = List.map ~f paths
+
+  end) in
+  let src_dir = Filename.concat work_dir "src" in
+  Unix.mkdir_p src_dir;
+  let entry = Filename.concat src_dir "main.lc" in
+  Out_channel.write_all entry ~data:source;
+
+  let config = { R.
+    find_paths = [Filename.realpath std];
+    build_dir = Some (Filename.concat work_dir "build");
+    runtime_dir = Filename.realpath runtime;
+    runtime_cache_dir = None;
+    (* every run parses, the cache would hide the frontend *)
+    ast_cache_dir = None;
+    platform = "native";
+    verbose = false;
+    dump_ir = false;
+    wasm_standalone = false;
+  } in
+  ignore (R.compile_file_path ~config entry)
+
+let lex_all source =
+  let lex_env = Lex_env.new_lex_env None (Lex_source.lexbuf_of_string source) ~enable_types_in_comments:true in
+  Lex.count_tokens lex_env
+
+(* compile in a fork, the heap and the timing of a scenario don't leak into the next *)
+let run_scenario ~std ~runtime ~work_dir generate : result option =
+  let result_path = Filename.concat work_dir "result" in
+  Out_channel.flush Out_channel.stdout;
+  match Unix.fork () with
+  | `In_the_child -> (
+    let code =
+      try
+        let source = generate () in
+        Gc.compact ();
+        Timing.enabled := true;
+        let tokens = Timing.time "lex" (fun () -> lex_all source) in
+        compile ~std ~runtime ~work_dir source;
+        let phases =
+          Timing.totals ()
+          |> List.map ~f:(fun (phase, wall_ms, _) -> phase, wall_ms)
+        in
+        let heap_mb =
+          Float.of_int ((Gc.quick_stat ()).Gc.Stat.top_heap_words * (Stdlib.Sys.word_size / 8)) /. 1024.0 /. 1024.0
+        in
+        let result = { phases; heap_mb; source_bytes = String.length source; tokens } in
+        Out_channel.write_all result_path ~data:(Stdlib.Marshal.to_string result []);
+        0
+      with exn ->
+        Format.eprintf "%s\n" (Exn.to_string exn);
+        1
+    in
+    Unix.exit_immediately code
+  )
+
+  | `In_the_parent pid -> (
+    match Unix.waitpid pid with
+    | Ok () -> Some (Stdlib.Marshal.from_string (In_channel.read_all result_path) 0)
+    | Error _ -> None
+  )
+
+(* baseline *)
+
+let read_baseline path =
+  let baseline = Hashtbl.Poly.create () in
+  if Sys.file_exists_exn path then (
+    In_channel.read_lines path
+    |> List.iter
+      ~f:(fun line ->
+        match String.split ~on:' ' (String.strip line) with
+        | [ scenario; phase; value ] when not (String.is_prefix ~prefix:"#" scenario) ->
+          Hashtbl.set baseline ~key:(scenario, phase) ~data:(Float.of_string value)
+        | _ -> ()
+      )
+  );
+  baseline
+
+let write_baseline path results =
+  let header =
+    if Sys.file_exists_exn path then
+      In_channel.read_lines path
+      |> List.take_while ~f:(String.is_prefix ~prefix:"#")
+    else
+      []
+  in
+  let lines =
+    List.concat_map
+      ~f:(fun (scenario, result) ->
+        List.append
+          (List.map ~f:(fun (phase, ms) -> Format.sprintf "%s %s %.2f" scenario phase ms) result.phases)
+          [ Format.sprintf "%s heap %.2f" scenario result.heap_mb ]
+      )
+      results
+  in
+  Out_channel.write_lines path (List.append header lines)
+
+type compared =
+  | Passed
+  | Regressed
+  | No_baseline
+
+(* print the phases, the regressed ones and the ones without a baseline are returned *)
+let compare_with_baseline ~threshold baseline scenario result =
+  let compare_value phase value unit_name ~min_value =
+    let base = Hashtbl.find baseline (scenario, phase) in
+    let diff =
+      match base with
+      | Some base when Float.(base > 0.0) -> Format.sprintf "%+.1f%%" ((value -. base) /. base *. 100.0)
+      | _ -> "-"
+    in
+    let compared =
+      match base with
+      | Some base when Float.(value >= min_value && value > base *. (1.0 + threshold)) -> Regressed
+      | Some _ -> Passed
+      | None -> No_baseline
+    in
+    Format.printf "  %-12s %10.2f%s %10s%s\n" phase value unit_name diff
+      (match compared with
+      | Regressed -> TermColor.red ^ " regressed" ^ TermColor.reset
+      | No_baseline -> TermColor.yello ^ " no baseline" ^ TermColor.reset
+      | Passed -> "");
+    (phase, compared)
+  in
+  let compared =
+    List.append
+      (List.map
+        ~f:(fun (phase, ms) -> compare_value phase ms "ms" ~min_value:min_compared_ms)
+        result.phases)
+      [ compare_value "heap" result.heap_mb "MB" ~min_value:0.0 ]
+  in
+  (match List.Assoc.find ~equal:String.equal result.phases "lex" with
+  | Some lex_ms when Float.(lex_ms > 0.0) ->
+    Format.printf "  lex: %d tokens, %.1f MB/s, %.0f tokens/ms\n"
+      result.tokens
+      (Float.of_int result.source_bytes /. 1024.0 /. 1024.0 /. (lex_ms /. 1000.0))
+      (Float.of_int result.tokens /. lex_ms)
+  | _ -> ());
+  let phases_of expected =
+    List.filter_map
+      ~f:(fun (phase, compared) -> if Poly.(compared = expected) then Some phase else None)
+      compared
+  in
+  phases_of Regressed, phases_of No_baseline
+
+let main () =
+  let args = Sys.get_argv () in
+  let index = ref 1 in
+  let std = ref None in
+  let runtime = ref None in
+  let baseline_path = ref None in
+  let update_baseline = ref false in
+  let threshold = ref 0.2 in
+  let scale = ref 1.0 in
+  let name = ref None in
+  let next_arg item =
+    if !index >= Array.length args then (
+      Format.printf "not enough args for %s\n" item;
+      ignore (exit 2)
+    );
+    let value = Array.get args !index in
+    index := !index + 1;
+    value
+  in
+  while !index < Array.length args do
+    let item = Array.get args !index in
+    index := !index + 1;
+    match item with
+    | "--std" -> std := Some (next_arg item)
+    | "--runtime" -> runtime := Some (next_arg item)
+    | "--baseline" -> baseline_path := Some (next_arg item)
+    | "--update-baseline" -> update_baseline := true
+    | "--threshold" -> threshold := Float.of_string (next_arg item)
+    | "--scale" -> scale := Float.of_string (next_arg item)
+    | "-N" | "--name" -> name := Some (next_arg item)
+    | "-h" | "--help" ->
+      Format.printf "%s" help_message;
+      ignore (exit 0)
+    | _ ->
+      Format.eprintf "unknown option: %s\n" item;
+      ignore (exit 2)
+  done;
+  let std, runtime =
+    match !std, !runtime with
+    | Some std, Some runtime -> std, runtime
+    | _ ->
+      Format.printf "%s" help_message;
+      exit 2
+  in
+  let baseline =
+    Option.value_map ~default:(Hashtbl.Poly.create ()) ~f:read_baseline !baseline_path
+  in
+  let work_root = Filename.temp_dir "lsc_compiler_bench" "" in
+
+  let results =
+    scenarios ~scale:!scale
+    |> List.filter ~f:(fun (scenario, _) ->
+      Option.value_map ~default:true ~f:(String.equal scenario) !name
+    )
+    |> List.filter_map
+      ~f:(fun (scenario, generate) ->
+        let work_dir = Filename.concat work_root scenario in
+        Unix.mkdir_p work_dir;
+        match run_scenario ~std ~runtime ~work_dir generate with
+        | Some result -> Some (scenario, result)
+        | None ->
+          Format.printf "%s[FAILED]%s %s\n" TermColor.red TermColor.reset scenario;
+          None
+      )
+  in
+
+  let compared =
+    List.map
+      ~f:(fun (scenario, result) ->
+        Format.printf "%s%s%s\n" TermColor.bold scenario TermColor.reset;
+        let regressed, missing = compare_with_baseline ~threshold:!threshold baseline scenario result in
+        let with_scenario = List.map ~f:(fun phase -> scenario ^ "/" ^ phase) in
+        with_scenario regressed, with_scenario missing
+      )
+      results
+  in
+  let regressed = List.concat_map ~f:fst compared in
+  let missing = List.concat_map ~f:snd compared in
+
+  (match !baseline_path with
+  | Some path when !update_baseline -> write_baseline path results
+  | _ -> ());
+
+  (*
+   * a phase without a baseline can not regress,
+   * the baseline has to be recorded again when a scenario or a phase is added
+   *)
+  let missing_fails =
+    Option.is_some !baseline_path &&
+    not !update_baseline &&
+    Option.is_some (Sys.getenv "CI")
+  in
+  if Option.is_some !baseline_path && not !update_baseline && not (List.is_empty missing) then
+    Format.printf "%s[NO BASELINE]%s %s, record it with --update-baseline\n"
+      (if missing_fails then TermColor.red else TermColor.yello) TermColor.reset
+      (String.concat ~sep:", " missing);
+
+  if not (List.is_empty regressed) then (
+    Format.printf "%s[REGRESSED]%s %s\n" TermColor.red TermColor.reset (String.concat ~sep:", " regressed);
+    ignore (exit 1)
+  ) else if missing_fails && not (List.is_empty missing) then
+    ignore (exit 1)
+  else
+    Format.printf "%s[DONE]%s\n" TermColor.green TermColor.reset
+
+let () =
+  main ()
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# A synthetic project of 500 modules in 10 layers,
+# every module imports two modules of the next layer.
+# Build it with one job, then with all the processors.
+
+export LSC_RUNTIME="./runtime"
+export LSC_STD="./std"
+
+BUILD_DIR="./_build_bench/frontend_parallel"
+PROJECT_DIR="$BUILD_DIR/project"
+LAYERS=10
+WIDTH=50
+FUNCTIONS=20
+
+dune build
+rm -rf $BUILD_DIR
+mkdir -p $PROJECT_DIR/node_modules
+
+for layer in $(seq 0 $((LAYERS - 1))); do
+    for index in $(seq 0 $((WIDTH - 1))); do
+        name="lib_${layer}_${index}"
+        dir="$PROJECT_DIR/node_modules/$name"
+        mkdir -p $dir
+        {
+            if [ $layer -lt $((LAYERS - 1)) ]; then
+                echo "import \"lib_$((layer + 1))_${index}\";"
+                echo "import \"lib_$((layer + 1))_$(( (index + 1) % WIDTH ))\";"
+            fi
+            for f in $(seq 0 $((FUNCTIONS - 1))); do
+                echo "public function ${name}_f$f(a: i32, b: i32): i32 {"
+                echo "    let sum = 0;"
+                echo "    let i = 0;"
+                echo "    while i < a {"
+                echo "        if i % 2 == 0 { sum += b; } else { sum -= i; }"
+                echo "        i += 1;"
+                echo "    }"
+                echo "    sum"
+                echo "}"
+            done
+        } > $dir/lib.lc
+    done
+done
+
+{
+    for index in $(seq 0 $((WIDTH - 1))); do
+        echo "import \"lib_0_${index}\";"
+    done
+    echo "function main() {"
+    echo "    print(lib_0_0_f0(10, 2));"
+    echo "}"
+} > $PROJECT_DIR/main.lc
+
+for jobs in 1 $(getconf _NPROCESSORS_ONLN); do
+    rm -rf $BUILD_DIR/out
+    start=$(date +%s%N)
+    LSC_JOBS=$jobs ./_build/default/bin/main.exe build $PROJECT_DIR/main.lc --mode release -D $BUILD_DIR/out
+    end=$(date +%s%N)
+    echo "$jobs jobs time: $(( (end - start) / 1000000 ))ms"
+done
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# The time and the binary size of the release mode,
+# without and with link-time optimization.
+
+export LSC_RUNTIME="./runtime"
+export LSC_STD="./std"
+
+BUILD_DIR="./_build_bench/lto"
+
+PROGRAMS="
+bench/match_interpreter
+bench/array_build_push
+bench/array_build_reserve
+examples/fibonacci
+examples/sorted_map
+"
+
+dune build
+
+for program in $PROGRAMS; do
+    name=$(basename $program)
+    for lto in "" "--lto"; do
+        dir=$BUILD_DIR/$name$lto
+        rm -rf $dir
+        mkdir -p $dir
+        ./_build/default/bin/main.exe build ./$program/main.lc --mode release $lto -D $dir
+
+        start=$(date +%s%N)
+        $dir/release/main > /dev/null
+        end=$(date +%s%N)
+        size=$(wc -c < $dir/release/main)
+        echo "$name${lto:+ (lto)} time: $(( (end - start) / 1000000 ))ms size: ${size}B"
+    done
+done
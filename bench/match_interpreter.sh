@@ -0,0 +1,19 @@
+#!/bin/bash
+
+# An interpreter of a stack machine, dispatching a 16-case enum on every step.
+# The C code of the match is a switch on the tag.
+
+export LSC_RUNTIME="./runtime"
+export LSC_STD="./std"
+
+BUILD_DIR="./_build_bench/match_interpreter"
+
+dune build
+rm -rf $BUILD_DIR
+mkdir -p $BUILD_DIR
+./_build/default/bin/main.exe build ./bench/match_interpreter/main.lc --mode release -D $BUILD_DIR
+
+start=$(date +%s%N)
+$BUILD_DIR/release/match_interpreter
+end=$(date +%s%N)
+echo "match_interpreter time: $(( (end - start) / 1000000 ))ms"
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# The speedup curve of the parallel Array methods,
+# run the same binary from 1 worker to all the cores.
+
+export LSC_RUNTIME="./runtime"
+export LSC_STD="./std"
+
+BUILD_DIR="./_build_bench/parallel_array"
+MAX_THREADS="${MAX_THREADS:-$(getconf _NPROCESSORS_ONLN)}"
+
+dune build
+rm -rf $BUILD_DIR
+mkdir -p $BUILD_DIR
+./_build/default/bin/main.exe build ./bench/parallel_array/main.lc --mode release -D $BUILD_DIR
+
+for n in $(seq 1 $MAX_THREADS); do
+    start=$(date +%s%N)
+    LSC_THREADS=$n $BUILD_DIR/release/parallel_array > /dev/null
+    end=$(date +%s%N)
+    echo "workers: $n time: $(( (end - start) / 1000000 ))ms"
+done
@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# The gain of the pgo mode over the release mode,
+# on the benchmarks and a few examples.
+# Every program is its own training run.
+
+export LSC_RUNTIME="./runtime"
+export LSC_STD="./std"
+
+BUILD_DIR="./_build_bench/pgo"
+
+PROGRAMS="
+bench/match_interpreter
+bench/array_build_push
+bench/array_build_reserve
+examples/fibonacci
+examples/is_prime
+examples/binary_search
+examples/array_sort
+examples/sorted_map
+"
+
+dune build
+
+run_time() {
+    start=$(date +%s%N)
+    "$1" > /dev/null
+    end=$(date +%s%N)
+    echo $(( (end - start) / 1000000 ))
+}
+
+for program in $PROGRAMS; do
+    name=$(basename $program)
+    rm -rf $BUILD_DIR/$name
+    mkdir -p $BUILD_DIR/$name
+    ./_build/default/bin/main.exe build ./$program/main.lc --mode release -D $BUILD_DIR/$name
+    ./_build/default/bin/main.exe build ./$program/main.lc --mode pgo -D $BUILD_DIR/$name > /dev/null
+
+    release=$(run_time $BUILD_DIR/$name/release/main)
+    pgo=$(run_time $BUILD_DIR/$name/pgo/main)
+    echo "$name release: ${release}ms pgo: ${pgo}ms"
+done
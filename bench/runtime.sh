@@ -0,0 +1,11 @@
+#!/bin/bash
+
+# The time, the peak RSS and the malloc counters of the programs
+# in bench/runtime, built in release mode for the native and the js targets.
+# e.g. bench/runtime.sh -n 20 --platform native
+
+export LSC_RUNTIME="./runtime"
+export LSC_STD="./std"
+
+dune build
+./_build/default/bench/runtime/runtime_bench.exe ./bench/runtime -C ./_build/default/bin/main.exe $@
@@ -0,0 +1,246 @@
+(*
+ * Copyright 2022 Vincent Chan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *)
+
+(*
+ * The time and the memory of the compiled programs.
+ *
+ * Every main.lc in the directory is built in release mode for the
+ * native and the js targets, then run repeatedly.
+ * A run is waited by a forked supervisor, so the peak RSS of the
+ * children is the one of this run only.
+ *)
+open Core
+open Lichenscript_common.Cli_utils
+module Spawn = Lichenscript_spawn.Spawn
+
+let help_message = {|
+Runtime benchmark of LichenScript, usage:
+
+runtime_bench <dir> -C <compiler> [<options>]
+
+  -C, --compiler        The path of the compiler
+  -N, --name            Only run the program matched the name
+  -n, --runs <n>        The runs of every program, default: 10
+  --platform <name>     native/js/all, default: all
+  --node <path>         The node to run the js target, default: node
+
+|}
+
+type target = {
+  platform: string;
+  exe: string;
+  (* the program to run the exe, e.g. node *)
+  executor: string option;
+}
+
+type run_result = {
+  wall_ms: float;
+  max_rss_kb: int;
+  output: string;
+}
+
+type malloc_stats = {
+  total: int;
+  peak_bytes: int;
+}
+
+let build ~compiler ~platform ~name main_file =
+  let build_dir = Filename.concat "_bench" (name ^ "-" ^ platform) in
+  Unix.mkdir_p build_dir;
+  let argv = List.concat [
+    [ compiler; "build"; main_file; "--mode"; "release" ];
+    (if String.equal platform "js" then [ "--platform"; "js" ] else []);
+    [ "-D"; build_dir ];
+  ] in
+  match Spawn.run ~merge_stderr:true ~prog:compiler ~argv () with
+  | _, Ok () ->
+    if String.equal platform "js" then
+      Some (Filename.concat build_dir (name ^ ".js"))
+    else
+      Some (Filename.concat (Filename.concat build_dir "release") "main")
+  | output, Error _ ->
+    Format.printf "%s[FAILED]%s build %s for %s:\n%s" TermColor.red TermColor.reset name platform output;
+    None
+
+let run_once ~work_dir target : run_result option =
+  let result_path = Filename.concat work_dir "result" in
+  let prog, argv =
+    match target.executor with
+    | Some executor -> executor, [ executor; target.exe ]
+    | None -> target.exe, [ target.exe ]
+  in
+  Out_channel.flush Out_channel.stdout;
+  match Unix.fork () with
+  | `In_the_child -> (
+    let env = `Extend [ ("LSC_MALLOC_STATS", "1") ] in
+    let start = Time_ns.now () in
+    let output, status = Spawn.run ~env ~merge_stderr:true ~prog ~argv () in
+    let wall_ms = Time_ns.Span.to_ms (Time_ns.diff (Time_ns.now ()) start) in
+    (* the only child of the supervisor *)
+    let max_rss_kb = Int64.to_int_exn (Unix.Resource_usage.maxrss (Unix.Resource_usage.get `Children)) in
+    let code =
+      match status with
+      | Ok () ->
+        Out_channel.write_all result_path ~data:(Stdlib.Marshal.to_string { wall_ms; max_rss_kb; output } []);
+        0
+      | Error _ ->
+        Format.eprintf "%s" output;
+        1
+    in
+    Unix.exit_immediately code
+  )
+
+  | `In_the_parent pid -> (
+    match Unix.waitpid pid with
+    | Ok () -> Some (Stdlib.Marshal.from_string (In_channel.read_all result_path) 0)
+    | Error _ -> None
+  )
+
+(* the line printed by the C runtime when LSC_MALLOC_STATS is set *)
+let parse_malloc_stats output =
+  String.split_lines output
+  |> List.find_map
+    ~f:(fun line ->
+      try
+        Some (Scanf.sscanf line "[LichenScript] malloc total: %d, peak size: %d"
+          (fun total peak_bytes -> { total; peak_bytes }))
+      with _ -> None
+    )
+
+(* nearest rank *)
+let percentile sorted p =
+  let len = Array.length sorted in
+  let rank = Float.to_int (Float.round_up (p *. Float.of_int len)) in
+  Array.get sorted (Int.clamp_exn (rank - 1) ~min:0 ~max:(len - 1))
+
+let megabytes bytes = Float.of_int bytes /. 1024.0 /. 1024.0
+
+let print_header () =
+  Format.printf "%-16s %-8s %10s %10s %10s %12s %10s\n"
+    "program" "platform" "median(ms)" "p95(ms)" "rss(MB)" "mallocs" "peak(MB)"
+
+let bench_target ~runs ~name target =
+  let work_dir = Filename.concat "_bench" (name ^ "-" ^ target.platform) in
+  let results = List.filter_map ~f:(fun _ -> run_once ~work_dir target) (List.range 0 runs) in
+  if List.length results < runs then (
+    Format.printf "%s[FAILED]%s %s on %s\n" TermColor.red TermColor.reset name target.platform;
+    false
+  ) else (
+    let times =
+      results
+      |> List.map ~f:(fun r -> r.wall_ms)
+      |> List.sort ~compare:Float.compare
+      |> Array.of_list
+    in
+    let max_rss_kb = List.fold ~init:0 ~f:(fun acc r -> Int.max acc r.max_rss_kb) results in
+    let malloc_stats = parse_malloc_stats (List.hd_exn results).output in
+    Format.printf "%-16s %-8s %10.2f %10.2f %10.2f %12s %10s\n"
+      name target.platform
+      (percentile times 0.5) (percentile times 0.95)
+      (Float.of_int max_rss_kb /. 1024.0)
+      (Option.value_map ~default:"-" ~f:(fun s -> Int.to_string s.total) malloc_stats)
+      (Option.value_map ~default:"-" ~f:(fun s -> Format.sprintf "%.2f" (megabytes s.peak_bytes)) malloc_stats);
+    true
+  )
+
+let main () =
+  let args = Sys.get_argv () in
+  if Array.length args < 2 then (
+    Format.printf "%s" help_message;
+    ignore (exit 2)
+  );
+  let bench_dir = Array.get args 1 in
+  let index = ref 2 in
+  let compiler = ref None in
+  let name = ref None in
+  let runs = ref 10 in
+  let platforms = ref [ "native"; "js" ] in
+  let node = ref "node" in
+  let next_arg item =
+    if !index >= Array.length args then (
+      Format.printf "not enough args for %s\n" item;
+      ignore (exit 2)
+    );
+    let value = Array.get args !index in
+    index := !index + 1;
+    value
+  in
+  while !index < Array.length args do
+    let item = Array.get args !index in
+    index := !index + 1;
+    match item with
+    | "-C" | "--compiler" -> compiler := Some (next_arg item)
+    | "-N" | "--name" -> name := Some (next_arg item)
+    | "-n" | "--runs" -> runs := Int.max 1 (Int.of_string (next_arg item))
+    | "--platform" -> (
+      match next_arg item with
+      | "all" -> platforms := [ "native"; "js" ]
+      | platform -> platforms := [ platform ]
+    )
+    | "--node" -> node := next_arg item
+    | "-h" | "--help" ->
+      Format.printf "%s" help_message;
+      ignore (exit 0)
+    | _ ->
+      Format.eprintf "unknown option: %s\n" item;
+      ignore (exit 2)
+  done;
+  let compiler =
+    match !compiler with
+    | Some compiler -> Filename.realpath compiler
+    | None ->
+      Format.printf "%s" help_message;
+      exit 2
+  in
+  let bench_dir = Filename.realpath bench_dir in
+  let programs =
+    Sys.ls_dir bench_dir
+    |> List.sort ~compare:String.compare
+    |> List.filter ~f:(fun program ->
+      Sys.is_file_exn (Filename.concat (Filename.concat bench_dir program) "main.lc")
+      && Option.value_map ~default:true ~f:(String.equal program) !name
+    )
+  in
+
+  print_header ();
+  let failed =
+    List.concat_map
+      ~f:(fun program ->
+        let main_file = Filename.concat (Filename.concat bench_dir program) "main.lc" in
+        List.filter_map
+          ~f:(fun platform ->
+            let ok =
+              match build ~compiler ~platform ~name:program main_file with
+              | Some exe ->
+                let executor = if String.equal platform "js" then Some !node else None in
+                bench_target ~runs:!runs ~name:program { platform; exe; executor }
+              | None -> false
+            in
+            if ok then None else Some (program ^ "/" ^ platform)
+          )
+          !platforms
+      )
+      programs
+  in
+
+  if not (List.is_empty failed) then (
+    Format.printf "%s[FAILED]%s %s\n" TermColor.red TermColor.reset (String.concat ~sep:", " failed);
+    ignore (exit 1)
+  ) else
+    Format.printf "%s[DONE]%s\n" TermColor.green TermColor.reset
+
+let () =
+  main ()
@@ -18,6 +18,7 @@ open Lichenscript_parsing
 open Lichenscript_typing
 open Lichenscript_resolver
 open Lichenscript_common.Cli_utils
+module Timing = Lichenscript_common.Timing
 open Core
 
 let help_message = {|
@@ -41,8 +42,17 @@ lsc build <entry> [<args>]
   --build-dir, -D <dir>        Specify a directory to build,
                                a temp directory will be used if this is not specified.
   --platform <platform>        native/wasm32/js, default: native
-  --mode <debug|release>       Choose the mode of debug/release
+  --mode <debug|release|pgo>   Choose the mode of debug/release/pgo,
+                               pgo builds an instrumented binary, runs the training command,
+                               and rebuilds with the collected profile
+  --train <command>            The training command of the pgo mode, run by the shell,
+                               $LSC_BIN is the instrumented binary, default: run it without args
+  --lto                        Link-time optimization of the runtime and the modules,
+                               the unused functions are removed, release/pgo only
   --verbose, -V                Print verbose log
+  --dump-ir                    Print the SSA form of the functions before and after each optimization
+  --time-passes                Print the wall time and the allocation of each phase per file
+  --time-passes-json <file>    Write the timing of the phases to a JSON file
   --search-paths               Show the search paths
   --standalone-wasm <executor> Build the standalone wasm, specify the executor
   -h, --help                   Show help message
@@ -50,6 +60,10 @@ lsc build <entry> [<args>]
 |} ^ TermColor.bold ^ "Environment:" ^ TermColor.reset ^ {|
 LSC_RUNTIME              The directory of runtime.
 LSC_STD                  Specify the directorey of std library.
+LSC_JOBS                 The number of the parallel jobs of parsing and make,
+                         default: the number of processors
+LSC_CACHE_DIR            The directory of the prebuilt runtime,
+                         default: $XDG_CACHE_HOME/lichenscript or ~/.cache/lichenscript
 
 |}
 
@@ -93,7 +107,12 @@ and build_command args index : build_result option =
     let buildDir = ref None in
     let wasm_standalone = ref None in
     let mode = ref "debug" in
+    let train = ref None in
+    let lto = ref false in
     let verbose = ref false in
+    let dump_ir = ref false in
+    let time_passes = ref false in
+    let time_passes_json = ref None in
     let platform = ref "native" in
     let baseDir = ref Filename.current_dir_name in
     while !index < (Array.length args) do
@@ -111,15 +130,42 @@ and build_command args index : build_result option =
         );
         mode := Array.get args !index;
         index := !index + 1;
-        if (not (String.equal !mode  "debug")) && (not (String.equal !mode "release")) then (
-          Format.printf "mode should be debug or release\n";
+        if not (List.mem ~equal:String.equal ["debug"; "release"; "pgo"] !mode) then (
+          Format.printf "mode should be debug, release or pgo\n";
           ignore (exit 2)
         )
       )
 
+      | "--train" -> (
+        if !index >= (Array.length args) then (
+          Format.printf "not enough args for --train\n";
+          ignore (exit 2)
+        );
+        train := Some (Array.get args !index);
+        index := !index + 1;
+      )
+
+      | "--lto" ->
+        lto := true
+
       | "-V" | "--verbose" ->
         verbose := true
 
+      | "--dump-ir" ->
+        dump_ir := true
+
+      | "--time-passes" ->
+        time_passes := true
+
+      | "--time-passes-json" -> (
+        if !index >= (Array.length args) then (
+          Format.printf "not enough args for --time-passes-json\n";
+          ignore (exit 2)
+        );
+        time_passes_json := Some (Array.get args !index);
+        index := !index + 1;
+      )
+
       | "--search-paths" -> (
         let current_dir = Unix.getcwd () in
         let paths = Search_path.get_search_path_from_node current_dir in
@@ -176,10 +222,30 @@ and build_command args index : build_result option =
     ) else (
       let std = Sys.getenv_exn "LSC_STD" in
       let runtimeDir = Sys.getenv_exn "LSC_RUNTIME" in
-      build_entry (Option.value_exn !entry) std !buildDir runtimeDir !mode !verbose !platform !wasm_standalone
+      if String.equal !mode "pgo" && not (String.equal !platform "native") then (
+        Format.printf "pgo mode is only supported on native\n";
+        ignore (exit 2)
+      );
+      if !lto && (String.equal !mode "debug" || not (String.equal !platform "native")) then (
+        Format.printf "--lto is only supported in release or pgo mode on native\n";
+        ignore (exit 2)
+      );
+      let make_args = if !lto then ["LTO=1"] else [] in
+      Timing.enabled := !time_passes || Option.is_some !time_passes_json;
+      let result =
+        build_entry (Option.value_exn !entry) std !buildDir runtimeDir !mode !train make_args !verbose !dump_ir !platform !wasm_standalone
+      in
+      if !time_passes then (
+        Out_channel.output_string Out_channel.stderr (Timing.report ());
+        Out_channel.flush Out_channel.stderr
+      );
+      Option.iter
+        ~f:(fun path -> Out_channel.write_all path ~data:(Timing.to_json ()))
+        !time_passes_json;
+      result
     )
 
-and build_entry (entry: string) std_dir build_dir runtime_dir mode verbose platform wasm_standalone: build_result option =
+and build_entry (entry: string) std_dir build_dir runtime_dir mode train make_args verbose dump_ir platform wasm_standalone: build_result option =
   let module R = Resolver.S (struct
 
     let is_directory path = Sys.is_directory_exn path
@@ -198,6 +264,10 @@ and build_entry (entry: string) std_dir build_dir runtime_dir mode verbose platf
 
     let write_file_content = Out_channel.write_all
 
+    let rename src dst = Unix.rename ~src ~dst
+
+    let map_files ~f paths = Utils.map_parallel ~jobs:(Utils.default_jobs ()) ~f paths
+
   end) in
   let open R in
   try
@@ -211,7 +281,10 @@ and build_entry (entry: string) std_dir build_dir runtime_dir mode verbose platf
       find_paths;
       build_dir;
       runtime_dir;
+      runtime_cache_dir = get_runtime_cache_dir ();
+      ast_cache_dir = get_ast_cache_dir ();
       verbose;
+      dump_ir;
       platform;
       wasm_standalone = Option.is_some wasm_standalone;
     } in
@@ -226,8 +299,10 @@ and build_entry (entry: string) std_dir build_dir runtime_dir mode verbose platf
           )
           profiles
     in
-    if not (String.equal platform "js") then (
-      run_make_in_dir profile.profile_dir
+    if String.equal mode "pgo" then (
+      build_with_profile ~train ~make_args profile.profile_dir profile.profile_exe_path
+    ) else if not (String.equal platform "js") then (
+      run_make_in_dir ~args:make_args profile.profile_dir
     );
     Some {
       build_exe = profile.profile_exe_path;
@@ -282,7 +357,56 @@ and build_entry (entry: string) std_dir build_dir runtime_dir mode verbose platf
       ignore (exit 2);
       None
 
-and run_make_in_dir build_dir =
+and get_runtime_cache_dir () =
+  match Sys.getenv "LSC_CACHE_DIR" with
+  | Some dir -> Some dir
+  | None -> (
+    match Sys.getenv "XDG_CACHE_HOME", Sys.getenv "HOME" with
+    | Some dir, _ -> Some (Filename.concat dir "lichenscript")
+    | None, Some home -> Some (Filename.concat (Filename.concat home ".cache") "lichenscript")
+    | None, None -> None
+  )
+
+(* the marshaled asts are only valid for the same binary of the compiler *)
+and get_ast_cache_dir () =
+  Option.map
+    ~f:(fun dir ->
+      let stat = Unix.stat Sys.executable_name in
+      let compiler_id =
+        Format.sprintf "%s:%Ld:%f" Sys.executable_name stat.Unix.st_size stat.Unix.st_mtime
+        |> Md5.digest_string
+        |> Md5.to_hex
+      in
+      Filename.concat (Filename.concat dir "ast") compiler_id
+    )
+    (get_runtime_cache_dir ())
+
+(*
+ * 1. build the instrumented binary, the old profile is removed
+ * 2. run the training command, the profile of every module is written
+ * 3. rebuild with the profile, clang merges the raw profile first
+ *)
+and build_with_profile ~train ~make_args profile_dir profile_exe_path =
+  run_make_in_dir ~args:["clean-profile"] profile_dir;
+  run_make_in_dir ~args:("PGO=generate"::make_args) profile_dir;
+
+  Out_channel.flush Out_channel.stdout;
+  let command =
+    match train with
+    | Some command -> command
+    | None -> "\"$LSC_BIN\""
+  in
+  let env = `Extend [ ("LSC_BIN", profile_exe_path) ] in
+  let pid = Unix.fork_exec ~prog:"/bin/sh" ~argv:["/bin/sh"; "-c"; command] ~env () in
+  (match Timing.time "train" (fun () -> Unix.waitpid pid) with
+  | Ok _ -> ()
+  | Error _ ->
+    Format.printf "the training command failed: %s\n" command;
+    ignore (exit 2));
+
+  run_make_in_dir ~args:("PGO=use"::make_args) profile_dir
+
+and run_make_in_dir ?(args=[]) build_dir =
   (* Out_channel.printf "Spawn to build in %s\n" (TermColor.bold ^ build_dir ^ TermColor.reset); *)
   Out_channel.flush Out_channel.stdout;
   Out_channel.flush Out_channel.stderr;
@@ -296,14 +420,18 @@ and run_make_in_dir build_dir =
     Unix.close pipe_write;
 
     Unix.chdir build_dir;
-    Unix.exec ~prog:"make" ~argv:["make";] () |> ignore
+    let jobs = Format.sprintf "-j%d" (Utils.default_jobs ()) in
+    Unix.exec ~prog:"make" ~argv:("make"::jobs::args) () |> ignore
 
   | `In_the_parent pid -> (
     Unix.close pipe_write;
 
-    let std_out_content = Utils.read_all_into_buffer pipe_read in
-
-    let result = Unix.waitpid pid in
+    let std_out_content, result =
+      Timing.time "cc" (fun () ->
+        let std_out_content = Utils.read_all_into_buffer pipe_read in
+        std_out_content, Unix.waitpid pid
+      )
+    in
 
     match result with
     | Ok _ -> ()
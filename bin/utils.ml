@@ -27,3 +27,86 @@ let read_all_into_buffer pipe =
   handle_message pipe;
 
   Buffer.contents buffer
+
+(* the online processors, getconf works on Linux, macOS and the BSDs *)
+let count_processors () =
+  let from_getconf () =
+    try
+      let ic = Unix.open_process_in "getconf _NPROCESSORS_ONLN 2>/dev/null" in
+      let line = In_channel.input_line ic in
+      match Unix.close_process_in ic, line with
+      | Ok (), Some line -> Int.of_string_opt (String.strip line)
+      | _ -> None
+    with _ -> None
+  in
+  let from_cpuinfo () =
+    In_channel.read_lines "/proc/cpuinfo"
+    |> List.count ~f:(String.is_prefix ~prefix:"processor")
+  in
+  match from_getconf () with
+  | Some count -> count
+  | None -> (try from_cpuinfo () with _ -> 1)
+
+(* LSC_JOBS, or the number of processors *)
+let default_jobs () =
+  match Sys.getenv "LSC_JOBS" with
+  | Some jobs -> Int.max 1 (Int.of_string jobs)
+  | None -> Int.max 1 (count_processors ())
+
+(* fork only when every worker has enough to do *)
+let min_items_per_job = 4
+
+(*
+ * Map in forked workers, the results are sent back by Marshal.
+ * The workers are forks of the same binary, the closures in the results are valid.
+ * A chunk whose worker fails is mapped again in the parent,
+ * so an exception is raised where the sequential map would raise it.
+ *)
+let map_parallel ~jobs ~f items =
+  let len = List.length items in
+  let jobs = Int.min jobs (len / min_items_per_job) in
+  if jobs <= 1 then
+    List.map ~f items
+  else (
+    let chunk_size = (len + jobs - 1) / jobs in
+    let chunks = List.chunks_of ~length:chunk_size items in
+
+    Out_channel.flush Out_channel.stdout;
+    Out_channel.flush Out_channel.stderr;
+
+    let workers =
+      List.map
+        ~f:(fun chunk ->
+          let pipe_read, pipe_write = Unix.pipe () in
+          match Unix.fork () with
+          | `In_the_child -> (
+            Unix.close pipe_read;
+            let code =
+              try
+                let data = Stdlib.Marshal.to_string (List.map ~f chunk) [Stdlib.Marshal.Closures] in
+                let oc = Unix.out_channel_of_descr pipe_write in
+                Out_channel.output_string oc data;
+                Out_channel.flush oc;
+                0
+              with _ -> 1
+            in
+            Unix.exit_immediately code
+          )
+
+          | `In_the_parent pid ->
+            Unix.close pipe_write;
+            (chunk, pipe_read, pid)
+        )
+        chunks
+    in
+
+    List.concat_map
+      ~f:(fun (chunk, pipe_read, pid) ->
+        let data = read_all_into_buffer pipe_read in
+        Unix.close pipe_read;
+        match Unix.waitpid pid with
+        | Ok () -> Stdlib.Marshal.from_string data 0
+        | Error _ -> List.map ~f chunk
+      )
+      workers
+  )
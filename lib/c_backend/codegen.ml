@@ -49,6 +49,12 @@ type t = {
   mutable buffer: Buffer.t;
   mutable statements: string list;
   mutable scope: Codegen_scope.scope;
+
+  (* the return type of the native function being generated *)
+  mutable current_native_ret: Func.native_ty option;
+
+  (* unboxed locals of the function being generated *)
+  native_locals: (string, Func.native_ty) Hashtbl.t;
 }
 
 let create ?(indent="    ") ~ctx () =
@@ -61,12 +67,39 @@ let create ?(indent="    ") ~ctx () =
     buffer = Buffer.create 1024;
     statements = [];
     scope;
+    current_native_ret = None;
+    native_locals = Hashtbl.create (module String);
   }
 
 let ps env content = Buffer.add_string env.buffer content
 
 let endl env = ps env "\n"
 
+let native_c_type (ty: Func.native_ty) =
+  match ty with
+  | Func.Native_i32 -> "int32_t"
+  | Func.Native_f32 -> "float"
+  | Func.Native_bool -> "bool"
+  | Func.Native_unit -> "void"
+
+(* the field of LCValue to unbox a primitive *)
+let native_value_field (ty: Func.native_ty) =
+  match ty with
+  | Func.Native_f32 -> "float_val"
+  | _ -> "int_val"
+
+let native_box_macro (ty: Func.native_ty) =
+  match ty with
+  | Func.Native_i32 -> "MK_I32"
+  | Func.Native_f32 -> "MK_F32"
+  | Func.Native_bool -> "MK_BOOL"
+  | Func.Native_unit -> failwith "unreachable: unit is not boxed"
+
+(* LCC_fib -> LCN_fib *)
+let native_fun_name name =
+  let name = Option.value ~default:name (String.chop_prefix ~prefix:"LCC_" name) in
+  "LCN_" ^ name
+
 
 let print_indents env =
   let count = ref 0 in
@@ -92,25 +125,44 @@ let rec codegen_statement (env: t) stmt =
     ps env ";"
 
   | VarDecl names -> (
-    ps env "LCValue ";
-    let len_m1 = (List.length names) - 1 in
-    List.iteri
-      ~f:(fun index name ->
-        ps env name;
-        if index <> len_m1 then (
-          ps env ", "
+    let boxed_names =
+      List.filter_map ~f:(fun (name, native_ty) -> if Option.is_none native_ty then Some name else None) names
+    in
+    let native_decls =
+      List.filter_map
+        ~f:(fun (name, native_ty) ->
+          Option.map
+            ~f:(fun native_ty ->
+              Hashtbl.set env.native_locals ~key:name ~data:native_ty;
+              Format.sprintf "%s %s;" (native_c_type native_ty) name
+            )
+            native_ty
         )
+        names
+    in
+    let decls =
+      if List.is_empty boxed_names then
+        native_decls
+      else
+        ("LCValue " ^ (String.concat ~sep:", " boxed_names) ^ ";")::native_decls
+    in
+    List.iteri
+      ~f:(fun index decl ->
+        if index > 0 then (
+          endl env;
+          print_indents env
+        );
+        ps env decl
       )
-      names;
-    ps env ";";
+      decls
   )
 
   | If if_spec -> codegen_expression_if env if_spec
 
   | While (expr, block) -> (
     ps env "while (";
-    codegen_expression env expr;
-    ps env ".int_val) {\n";
+    codegen_native_expression env Func.Native_bool expr;
+    ps env ") {\n";
     with_indent env (fun () -> 
       List.iter
         ~f:(fun stmt ->
@@ -150,23 +202,77 @@ let rec codegen_statement (env: t) stmt =
   | WithLabel(label, stmts) ->
     List.iter ~f:(codegen_statement env) stmts;
     ps env label;
-    ps env ":"
+    (* a label may end a block *)
+    ps env ":;"
+
+  | Label label ->
+    ps env label;
+    ps env ":;"
 
   | Goto label ->
     ps env "goto ";
     ps env label;
     ps env ";"
 
+  | Switch { switch_value; switch_on; switch_cases; switch_default } -> (
+    ps env "switch (";
+    (match switch_on with
+    | Switch_tag ->
+      ps env "LC_UNION_GET_TYPE(";
+      codegen_expression env switch_value;
+      ps env ")"
+
+    | Switch_int ->
+      codegen_native_expression env Func.Native_i32 switch_value
+
+    | Switch_string_length ->
+      ps env "LC_STRING_LENGTH(";
+      codegen_expression env switch_value;
+      ps env ")"
+    );
+    ps env ") {\n";
+    with_indent env (fun () ->
+      List.iter
+        ~f:(fun (value, label) ->
+          print_indents env;
+          ps env (Format.sprintf "case %d: goto %s;\n" value label)
+        )
+        switch_cases;
+      print_indents env;
+      ps env (Format.sprintf "default: goto %s;\n" switch_default)
+    );
+    print_indents env;
+    ps env "}"
+  )
+
   | Return expr_opt -> (
     ps env "return";
-    match expr_opt with
-    | Some expr ->
+    match env.current_native_ret, expr_opt with
+    | Some Func.Native_unit, _
+    | _, None -> ps env ";"
+
+    | Some native_ret, Some expr ->
+      ps env " ";
+      codegen_native_expression env native_ret expr;
+      ps env ";"
+
+    | None, Some expr ->
       ps env " ";
       codegen_expression env expr;
       ps env ";"
 
-    | None -> ps env ";"
+  )
 
+  (* the callee has the same C signature, checked by the tail call pass *)
+  | TailCall expr -> (
+    ps env "LC_MUSTTAIL return ";
+    (match env.current_native_ret, expr with
+    | Some _, Expr.CallNative(fun_name, native_sig, ths, params) ->
+      codegen_native_call env fun_name native_sig ths params
+    | _ ->
+      codegen_expression env expr
+    );
+    ps env ";"
   )
 
 
@@ -220,6 +326,25 @@ and codegen_declaration env decl =
     codegen_symbol env fun_name;
     ps env "(LCRuntime* rt, LCValue this, int argc, LCValue* args);\n"
 
+  (* a static initializer can't use the compound literals of MK_I32, etc *)
+  | StaticArray (name, values) -> (
+    ps env (Format.sprintf "static const LCValue %s[] = {\n" name);
+    List.iter
+      ~f:(fun value ->
+        let field, tag =
+          match value with
+          | Expr.NewInt i -> Format.sprintf ".int_val = %s" i, "LC_TY_I32"
+          | Expr.NewFloat f -> Format.sprintf ".float_val = %s" f, "LC_TY_F32"
+          | Expr.NewChar ch -> Format.sprintf ".int_val = %d" ch, "LC_TY_CHAR"
+          | Expr.NewBoolean bl -> Format.sprintf ".int_val = %d" (if bl then 1 else 0), "LC_TY_BOOL"
+          | _ -> failwith "unreachable: not a static value"
+        in
+        ps env (Format.sprintf "%s{ { %s }, %s },\n" env.indent field tag)
+      )
+      values;
+    ps env "};\n"
+  )
+
   | LambdaDef lambda_def -> (
     ps env (Format.sprintf "LCValue %s(LCRuntime* rt, LCValue this, int argc, LCValue* args) {\n" lambda_def.lambda_gen_name);
     ps env "    return MK_NULL();\n";
@@ -321,6 +446,17 @@ and codegen_declaration env decl =
       ps env "return MK_CLASS_OBJ(obj);\n";
     );
     ps env "}\n";
+
+    ps env (Format.sprintf "LCValue %s_init_stack(LCValue* storage) {\n" name);
+    with_indent env (fun () ->
+      print_indents env;
+      ps env (Format.sprintf "%s* obj = (%s*)storage;\n" name name);
+      print_indents env;
+      ps env (Format.sprintf "lc_init_stack_object(%s_class_id, (LCGCObject*)obj);\n" name);
+      print_indents env;
+      ps env "return MK_CLASS_OBJ(obj);\n";
+    );
+    ps env "}\n";
   )
 
   | EnumCtor ctor -> (
@@ -372,7 +508,17 @@ and codegen_declaration env decl =
 
 and codegen_symbol env sym =
   match sym with
-  | SymLocal name -> ps env name
+  | SymLocal name -> (
+    match Hashtbl.find env.native_locals name with
+    | Some native_ty ->
+      (* box the unboxed local when it's used as a generic value *)
+      ps env (native_box_macro native_ty);
+      ps env "(";
+      ps env name;
+      ps env ")"
+
+    | None -> ps env name
+  )
 
   | SymTemp id ->
     ps env "t[";
@@ -434,8 +580,13 @@ and codegen_expression (env: t) (expr: Expr.t) =
     ps env Primitives.Constant._false
 
   | NewLambda lambda ->
-    let { lambda_name = c_name; lambda_this = this; lambda_capture_symbols = params; _ } = lambda in
-    ps env "LCNewLambda(rt, ";
+    let { lambda_name = c_name; lambda_this = this; lambda_capture_symbols = params; lambda_on_stack; _ } = lambda in
+    if lambda_on_stack then (
+      (* the storage is a compound literal, it lives until the end of the enclosing block *)
+      ps env (Format.sprintf "LCInitStackLambda((LCValue[LC_STACK_LAMBDA_SIZE(%d)]){0}, " (Array.length params))
+    ) else (
+      ps env "LCNewLambda(rt, "
+    );
     ps env c_name;
     ps env ", ";
     codegen_expression env this;
@@ -459,21 +610,40 @@ and codegen_expression (env: t) (expr: Expr.t) =
     );
     ps env ")";
 
-  | NewRef expr ->
-    ps env "LCNewRefCell(rt, ";
-    codegen_expression env expr;
+  | NewEnv size ->
+    ps env "LCNewEnv(rt, ";
+    ps env (Int.to_string size);
     ps env ")"
 
-  | GetRef (ref, _) ->
-    ps env "LCRefCellGetValue(";
-    codegen_symbol env ref;
+  | EnvGet (env_sym, slot, _) ->
+    ps env "LCEnvGet(";
+    codegen_symbol env env_sym;
+    ps env ", ";
+    ps env (Int.to_string slot);
     ps env ")"
 
+  (* an assignment is unit *)
+  | EnvSet (env_sym, slot, _, value) ->
+    ps env "(LCEnvSet(rt, ";
+    codegen_symbol env env_sym;
+    ps env ", ";
+    ps env (Int.to_string slot);
+    ps env ", ";
+    codegen_expression env value;
+    ps env "), MK_NULL())"
+
   | NewArray len ->
     ps env "LCNewArrayLen(rt, ";
     ps env (Int.to_string len);
     ps env ")"
 
+  | NewStaticArray (name, len) ->
+    ps env "LCNewArrayFromStatic(rt, ";
+    ps env name;
+    ps env ", ";
+    ps env (Int.to_string len);
+    ps env ")"
+
   | NewTuple exprs -> (
     ps env "LCNewTuple(rt, MK_NULL(), ";
     let exprs_len = List.length exprs in
@@ -492,6 +662,23 @@ and codegen_expression (env: t) (expr: Expr.t) =
     ps env "})"
   )
 
+  (* the storage is a compound literal, it lives until the end of the enclosing block *)
+  | NewStackTuple exprs -> (
+    let exprs_len = List.length exprs in
+    ps env (Format.sprintf "LCInitStackTuple((LCValue[LC_STACK_TUPLE_SIZE(%d)]){0}, %d, (LCValue[]) {" exprs_len exprs_len);
+
+    List.iteri
+      ~f:(fun index expr ->
+        codegen_expression env expr;
+        if index < (exprs_len - 1) then (
+          ps env ", "
+        )
+      )
+      exprs;
+
+    ps env "})"
+  )
+
   | NewMap init_size ->
     ps env "lc_std_map_new(rt, LC_TY_STRING, ";
     ps env (Int.to_string init_size);
@@ -566,10 +753,42 @@ and codegen_expression (env: t) (expr: Expr.t) =
     ps env "(rt)"
   )
 
-  | CallLambda (callee, _params) -> (
+  | InitStackCall(sym, cls_name) -> (
+    codegen_symbol env sym;
+    ps env "_stack((LCValue[LC_STACK_OBJECT_SIZE(sizeof(";
+    codegen_symbol env cls_name;
+    ps env "))]){0})"
+  )
+
+  | CallNative (fun_name, native_sig, ths, params) -> (
+    match native_sig.native_ret with
+    | Func.Native_unit ->
+      ps env "(";
+      codegen_native_call env fun_name native_sig ths params;
+      ps env ", MK_NULL())"
+
+    | native_ret ->
+      ps env (native_box_macro native_ret);
+      ps env "(";
+      codegen_native_call env fun_name native_sig ths params;
+      ps env ")"
+  )
+
+  | CallLambda (callee, params) -> (
     ps env "LCEvalLambda(rt, ";
     codegen_expression env callee;
-    ps env ", 0, NULL)"
+    ps env ", ";
+    codegen_args env params;
+    ps env ")"
+  )
+
+  | CallLambdaDirect (lambda_name, callee, params) -> (
+    ps env lambda_name;
+    ps env "(rt, ";
+    codegen_expression env callee;
+    ps env ", ";
+    codegen_args env params;
+    ps env ")"
   )
 
   | Temp id ->
@@ -620,6 +839,11 @@ and codegen_expression (env: t) (expr: Expr.t) =
   | Assign(Expr.Ident name, right) -> (
     (* TODO: release the left, retain the right *)
     (match name with
+    | SymLocal name when Hashtbl.mem env.native_locals name ->
+      ps env name;
+      ps env " = ";
+      codegen_native_expression env (Hashtbl.find_exn env.native_locals name) right
+
     | SymLocal name ->
       ps env name;
       ps env " = ";
@@ -639,12 +863,8 @@ and codegen_expression (env: t) (expr: Expr.t) =
       ps env " = ";
       codegen_expression env right
 
-    | SymLambda (index, _) ->
-      ps env "LCLambdaSetRefValue(rt, this, ";
-      ps env (Int.to_string index);
-      ps env ", ";
-      codegen_expression env right;
-      ps env ")"
+    | SymLambda _ ->
+      failwith "unreachable: captured variables are assigned through the environment"
 
     | SymRet ->
       ps env "ret";
@@ -663,7 +883,7 @@ and codegen_expression (env: t) (expr: Expr.t) =
     codegen_expression env right
 
   | TagEqual (expr, tag) -> (
-    ps env "LCUnionGetType(";
+    ps env "LC_UNION_GET_TYPE(";
     codegen_expression env expr;
     ps env ") == ";
     ps env (Int.to_string tag)
@@ -677,13 +897,8 @@ and codegen_expression (env: t) (expr: Expr.t) =
     ps env ")"
   )
 
-  | IntValue(NewInt str_val) ->
-    ps env str_val
-
   | IntValue e ->
-    ps env "(";
-    codegen_expression env e;
-    ps env ").int_val"
+    codegen_native_expression env Func.Native_i32 e
 
   | GetField(expr, cls_name, field_name) -> (
     ps env "LCCast(";
@@ -754,6 +969,111 @@ and codegen_expression (env: t) (expr: Expr.t) =
     )
   )
 
+and codegen_args env params =
+  if List.is_empty params then
+    ps env "0, NULL"
+  else (
+    let params_len = List.length params in
+    ps env (Format.sprintf "%d, (LCValue[]) {" params_len);
+    List.iteri
+      ~f:(fun index param ->
+        if index > 0 then (
+          ps env ", "
+        );
+        codegen_expression env param
+      )
+      params;
+    ps env "}"
+  )
+
+and codegen_native_call env fun_name (native_sig: Func.native_sig) ths params =
+  let fun_name =
+    match fun_name with
+    | SymLocal name -> native_fun_name name
+    | _ -> failwith "unreachable: native function must be global"
+  in
+  ps env fun_name;
+  ps env "(rt";
+  (match ths with
+  | Some e ->
+    ps env ", ";
+    codegen_expression env e
+  | None -> ()
+  );
+  List.iter2_exn
+    ~f:(fun param_ty param ->
+      ps env ", ";
+      codegen_native_expression env param_ty param
+    )
+    native_sig.native_params params;
+  ps env ")"
+
+(*
+ * Generate the unboxed C expression of a primitive,
+ * so the arithmetic on unboxed locals never rebuilds a tagged LCValue.
+ * Fallback to unboxing the generic value.
+ *)
+and codegen_native_expression env native_ty expr =
+  let open Expr in
+  let codegen_unbox () =
+    ps env "(";
+    codegen_expression env expr;
+    ps env ").";
+    ps env (native_value_field native_ty)
+  in
+  let codegen_binary operand_ty op left right =
+    ps env "(";
+    codegen_native_expression env operand_ty left;
+    ps env " ";
+    ps env (Primitives.Bin.to_c_op op);
+    ps env " ";
+    codegen_native_expression env operand_ty right;
+    ps env ")"
+  in
+  match native_ty, expr with
+  | _, Ident (SymLocal name) when Hashtbl.mem env.native_locals name ->
+    ps env name
+
+  | Func.Native_f32, NewFloat value ->
+    ps env "((float)";
+    ps env value;
+    ps env ")"
+
+  | _, NewInt value ->
+    ps env value
+
+  | _, NewChar ch ->
+    ps env (Int.to_string ch)
+
+  | _, NewBoolean bl ->
+    ps env (if bl then "1" else "0")
+
+  | _, IntValue e ->
+    codegen_native_expression env Func.Native_i32 e
+
+  | _, Not e ->
+    ps env "(!";
+    codegen_native_expression env Func.Native_bool e;
+    ps env ")"
+
+  | _, I32Binary(op, left, right) ->
+    codegen_binary Func.Native_i32 op left right
+
+  | _, F32Binary(Lichenscript_parsing.Asttypes.BinaryOp.Mod, _, _) ->
+    codegen_unbox ()
+
+  | _, F32Binary(op, left, right) ->
+    codegen_binary Func.Native_f32 op left right
+
+  | _, CallNative(_, { Func.native_ret = Func.Native_unit; _ }, _, _) ->
+    codegen_unbox ()
+
+  | _, CallNative(fun_name, native_sig, ths, params) ->
+    codegen_native_call env fun_name native_sig ths params
+
+  | _ ->
+    codegen_unbox ()
+
 (* return the number of temp values *)
 and codegen_function_block (env: t) block =
   let open Block in
@@ -769,8 +1089,124 @@ and codegen_function_block (env: t) block =
 (* and codegen_identifier env id =
   ps env (env.scope#codegen_id id) *)
 
+and codegen_native_params env (native_sig: Func.native_sig) =
+  let open Func in
+  ps env "(LCRuntime* rt";
+  if native_sig.native_has_this then (
+    ps env ", LCValue this"
+  );
+  List.iteri
+    ~f:(fun index param_ty ->
+      ps env (Format.sprintf ", %s _arg%d" (native_c_type param_ty) index)
+    )
+    native_sig.native_params;
+  ps env ")"
+
+and codegen_native_prototype env (_fun: Func.t) =
+  let open Func in
+  match _fun.native with
+  | Some native_sig ->
+    let fun_name, _ = _fun.name in
+    ps env "static ";
+    ps env (native_c_type native_sig.native_ret);
+    ps env " ";
+    ps env (native_fun_name fun_name);
+    codegen_native_params env native_sig;
+    ps env ";\n"
+
+  | None -> ()
+
+(*
+ * The native function receives the primitive params directly,
+ * the body still addresses them by "args", which is a local array
+ * of the native function, so the C compiler can keep it in registers.
+ *)
+and codegen_native_function env (_fun: Func.t) (native_sig: Func.native_sig) =
+  let open Func in
+  let fun_name, _ = _fun.name in
+  let native_name = native_fun_name fun_name in
+  Hashtbl.clear env.native_locals;
+  ps env "static ";
+  ps env (native_c_type native_sig.native_ret);
+  ps env " ";
+  ps env native_name;
+  codegen_native_params env native_sig;
+  ps env " {";
+  endl env;
+
+  with_indent env (fun () ->
+    let params_len = List.length native_sig.native_params in
+    if params_len > 0 then (
+      print_indents env;
+      ps env (Format.sprintf "LCValue args[%d] = { " params_len);
+      List.iteri
+        ~f:(fun index param_ty ->
+          if index > 0 then (
+            ps env ", "
+          );
+          ps env (Format.sprintf "%s(_arg%d)" (native_box_macro param_ty) index)
+        )
+        native_sig.native_params;
+      ps env " };\n";
+    );
+
+    print_indents env;
+    ps env "LCValue ret;\n";
+
+    if _fun.tmp_vars_count > 0 then (
+      print_indents env;
+      ps env (Format.sprintf "LCValue t[%d] = {0};\n" _fun.tmp_vars_count)
+    );
+
+    env.current_native_ret <- Some native_sig.native_ret;
+    codegen_function_block env _fun.body;
+    env.current_native_ret <- None;
+  );
+
+  ps env "}\n";
+
+  (* the generic wrapper, only if the function is used as a value *)
+  if native_sig.native_escaped then (
+    ps env "LCValue ";
+    ps env fun_name;
+    ps env "(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {";
+    endl env;
+    with_indent env (fun () ->
+      print_indents env;
+      let call_buf = Buffer.create 64 in
+      Buffer.add_string call_buf native_name;
+      Buffer.add_string call_buf "(rt";
+      if native_sig.native_has_this then (
+        Buffer.add_string call_buf ", this"
+      );
+      List.iteri
+        ~f:(fun index param_ty ->
+          Buffer.add_string call_buf (Format.sprintf ", args[%d].%s" index (native_value_field param_ty))
+        )
+        native_sig.native_params;
+      Buffer.add_string call_buf ")";
+      let call_str = Buffer.contents call_buf in
+      match native_sig.native_ret with
+      | Native_unit ->
+        ps env call_str;
+        ps env ";\n";
+        print_indents env;
+        ps env "return MK_NULL();\n"
+
+      | native_ret ->
+        ps env (Format.sprintf "return %s(%s);\n" (native_box_macro native_ret) call_str)
+    );
+    ps env "}\n"
+  )
+
 and codegen_function env (_fun: Func.t) =
+  match _fun.native with
+  | Some native_sig -> codegen_native_function env _fun native_sig
+  | None -> codegen_generic_function env _fun
+
+and codegen_generic_function env (_fun: Func.t) =
   let open Func in
+  Hashtbl.clear env.native_locals;
   ps env "LCValue ";
   let fun_name, _ = _fun.name in
   ps env fun_name;
@@ -794,7 +1230,7 @@ and codegen_function env (_fun: Func.t) =
 
 let contents env = Buffer.contents env.buffer
 
-let codegen_program ?indent ~ctx (declarations: Typedtree.Declaration.t list) =
+let codegen_program ?indent ?(verbose=false) ?(dump_ir=false) ~ctx (declarations: Typedtree.Declaration.t list) =
   let env = create ?indent ~ctx () in
   ps env {|/* This file is auto generated by the LichenScript Compiler */
 #include <stdint.h>
@@ -804,10 +1240,33 @@ let codegen_program ?indent ~ctx (declarations: Typedtree.Declaration.t list) =
   let transform_config = { Transform.
     arc = true;
     prepend_lambda = true;
+    closure_env = true;
+    match_switch = true;
   } in
-  let c_decls = Transform.transform_declarations ~config:transform_config ctx declarations in
+  let time = Lichenscript_common.Timing.time in
+  let c_decls =
+    time "transform" (fun () -> Transform.transform_declarations ~config:transform_config ctx declarations)
+  in
+  let c_decls = { c_decls with
+    Transform.declarations =
+      c_decls.declarations
+      |> (fun decls -> time "tailcall" (fun () -> Tailcall.rewrite_declarations ~verbose decls))
+      |> (fun decls -> time "inline" (fun () -> Inliner.inline_declarations ~verbose decls))
+      |> (fun decls -> time "optimize" (fun () -> Optimize.optimize_declarations ~verbose ~dump_ir decls));
+  } in
+
+  time "codegen" (fun () ->
+    (* native functions may be called before they are defined *)
+    List.iter
+      ~f:(fun decl ->
+        match decl.Decl.spec with
+        | Decl.Func _fun -> codegen_native_prototype env _fun
+        | _ -> ()
+      )
+      c_decls.declarations;
 
-  List.iter ~f:(codegen_declaration env) c_decls.declarations;
+    List.iter ~f:(codegen_declaration env) c_decls.declarations
+  );
 
   (* if user has a main function *)
   let main_name =
@@ -2,6 +2,6 @@ open Lichenscript_typing
 
 type t
 
-val codegen_program: ?indent: string -> ctx:Type_context.t -> Lichenscript_typing.Typedtree.Declaration.t list -> t
+val codegen_program: ?indent: string -> ?verbose: bool -> ?dump_ir: bool -> ctx:Type_context.t -> Lichenscript_typing.Typedtree.Declaration.t list -> t
 
 val contents: t -> string
@@ -1,5 +1,5 @@
 
 
-let codegen ~ctx tree =
-  let env = Codegen.codegen_program ~ctx tree in
+let codegen ?verbose ?dump_ir ~ctx tree =
+  let env = Codegen.codegen_program ?verbose ?dump_ir ~ctx tree in
   Codegen.contents env
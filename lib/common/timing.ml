@@ -0,0 +1,129 @@
+(*
+ * Copyright 2022 Vincent Chan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *)
+
+(*
+ * The wall time and the allocation of the phases of the compiler,
+ * collected when `--time-passes` is on.
+ *)
+open Core_kernel
+
+type entry = {
+  phase: string;
+
+  (* the file of the phase, None for a phase of the whole program *)
+  unit_name: string option;
+
+  wall_ms: float;
+  allocated_bytes: float;
+}
+
+let enabled = ref false
+
+(* in reverse order *)
+let entries: entry list ref = ref []
+
+(* run `f`, the entry is returned instead of recorded, e.g. to send it back from a worker *)
+let measure ?unit_name phase f =
+  let start = Time_ns.now () in
+  let start_allocated = Gc.allocated_bytes () in
+  let result = f () in
+  let entry = {
+    phase;
+    unit_name;
+    wall_ms = Time_ns.Span.to_ms (Time_ns.diff (Time_ns.now ()) start);
+    allocated_bytes = Gc.allocated_bytes () -. start_allocated;
+  } in
+  result, entry
+
+let add entry =
+  if !enabled then
+    entries := entry::!entries
+
+let time ?unit_name phase f =
+  if !enabled then (
+    let result, entry = measure ?unit_name phase f in
+    add entry;
+    result
+  ) else
+    f ()
+
+(* phase -> wall time, allocation, in the order of the first entry *)
+let totals () =
+  let all = List.rev !entries in
+  let phases = List.dedup_and_sort ~compare:String.compare (List.map ~f:(fun e -> e.phase) all) in
+  let first_index phase =
+    Option.value_exn (List.findi ~f:(fun _ e -> String.equal e.phase phase) all) |> fst
+  in
+  phases
+  |> List.sort ~compare:(fun a b -> Int.compare (first_index a) (first_index b))
+  |> List.map
+    ~f:(fun phase ->
+      let phase_entries = List.filter ~f:(fun e -> String.equal e.phase phase) all in
+      let sum f = List.fold ~init:0.0 ~f:(fun acc e -> acc +. f e) phase_entries in
+      phase, sum (fun e -> e.wall_ms), sum (fun e -> e.allocated_bytes)
+    )
+
+let megabytes bytes = bytes /. 1024.0 /. 1024.0
+
+let report () =
+  let buf = Buffer.create 1024 in
+  let add_line phase unit_name wall_ms allocated_bytes =
+    Buffer.add_string buf
+      (Format.sprintf "%-12s %10.2f %10.2f  %s\n" phase wall_ms (megabytes allocated_bytes) unit_name)
+  in
+  Buffer.add_string buf (Format.sprintf "%-12s %10s %10s  %s\n" "phase" "wall(ms)" "alloc(MB)" "file");
+  List.iter
+    ~f:(fun e ->
+      add_line e.phase (Option.value ~default:"-" e.unit_name) e.wall_ms e.allocated_bytes
+    )
+    (List.rev !entries);
+  Buffer.add_string buf "\n";
+  List.iter
+    ~f:(fun (phase, wall_ms, allocated_bytes) ->
+      add_line phase "total" wall_ms allocated_bytes
+    )
+    (totals ());
+  Buffer.contents buf
+
+let json_string str =
+  let buf = Buffer.create (String.length str + 2) in
+  Buffer.add_char buf '"';
+  String.iter
+    ~f:(fun ch ->
+      match ch with
+      | '"' -> Buffer.add_string buf "\\\""
+      | '\\' -> Buffer.add_string buf "\\\\"
+      | ch when Char.to_int ch < 0x20 -> Buffer.add_string buf (Format.sprintf "\\u%04x" (Char.to_int ch))
+      | ch -> Buffer.add_char buf ch
+    )
+    str;
+  Buffer.add_char buf '"';
+  Buffer.contents buf
+
+let to_json () =
+  let entry_to_json e =
+    Format.sprintf "{\"phase\":%s,\"file\":%s,\"wall_ms\":%.3f,\"allocated_bytes\":%.0f}"
+      (json_string e.phase)
+      (Option.value_map ~default:"null" ~f:json_string e.unit_name)
+      e.wall_ms e.allocated_bytes
+  in
+  let total_to_json (phase, wall_ms, allocated_bytes) =
+    Format.sprintf "{\"phase\":%s,\"wall_ms\":%.3f,\"allocated_bytes\":%.0f}"
+      (json_string phase) wall_ms allocated_bytes
+  in
+  Format.sprintf "{\"entries\":[%s],\"totals\":[%s]}\n"
+    (String.concat ~sep:"," (List.rev_map ~f:entry_to_json !entries))
+    (String.concat ~sep:"," (List.map ~f:total_to_json (totals ())))
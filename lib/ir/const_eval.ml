@@ -0,0 +1,356 @@
+(*
+ * Evaluate pure code at compile time.
+ *
+ * Only a small pure subset is understood:
+ *   - i32, char, boolean and string constants,
+ *   - arithmetic, comparisons and logical operators,
+ *   - local bindings, assignments, if, while, return,
+ *   - calls of the top-level functions written in the same subset.
+ *
+ * Anything else (members, arrays, externals, lambdas, floats...) gives up,
+ * the expression is left to the runtime. A function is pure if it can be
+ * evaluated, there is no separate analysis.
+ *
+ * Floats are left out because the runtime computes in f32,
+ * the compiler can't reproduce the rounding of every step.
+ *
+ * Every step consumes fuel, a call which doesn't finish within the budget
+ * is treated as not constant, so the compiler always terminates.
+ *)
+open Core_kernel
+open Lichenscript_parsing.Asttypes
+open Lichenscript_parsing.Ast
+open Lichenscript_parsing.Ast.Literal
+open Lichenscript_typing.Typedtree
+
+(* the max number of steps to evaluate an expression *)
+let max_fuel = 100_000
+
+(* the max depth of the calls *)
+let max_depth = 64
+
+exception Not_constant
+
+exception Returned of Literal.t
+
+exception Break_loop
+
+exception Continue_loop
+
+type t = {
+  (* var id -> value of the const bindings folded so far *)
+  consts: (int, Literal.t) Hashtbl.t;
+
+  (* var id of the name -> top-level function *)
+  functions: (int, Function.t) Hashtbl.t;
+
+  (* the results of the calls with constant arguments *)
+  calls: (int * Literal.t list, Literal.t option) Hashtbl.t;
+}
+
+type state = {
+  mutable fuel: int;
+  mutable depth: int;
+}
+
+let create (declarations: Declaration.t list) =
+  let functions = Hashtbl.create (module Int) in
+  List.iter
+    ~f:(fun (decl: Declaration.t) ->
+      match decl.spec with
+      | Declaration.Function_ _fun ->
+        let _, fun_id = _fun.header.name in
+        Hashtbl.set functions ~key:fun_id ~data:_fun
+      | _ -> ()
+    )
+    declarations;
+  {
+    consts = Hashtbl.create (module Int);
+    functions;
+    calls = Hashtbl.Poly.create ();
+  }
+
+let add_const env var_id literal =
+  Hashtbl.set env.consts ~key:var_id ~data:literal
+
+let tick state =
+  state.fuel <- state.fuel - 1;
+  if state.fuel < 0 then raise Not_constant
+
+(* the content of a string literal is the raw source, escapes can't be compared *)
+let raw_string str =
+  if String.contains str '\\' then raise Not_constant;
+  str
+
+let eval_integer_binary op (left: int32) (right: int32) : Literal.t =
+  let open Int32 in
+  match op with
+  | BinaryOp.Plus -> Integer (left + right)
+  | BinaryOp.Minus -> Integer (left - right)
+  | BinaryOp.Mult -> Integer (left * right)
+  | BinaryOp.Div | BinaryOp.Mod -> (
+    (* traps in C, leave it to the runtime *)
+    if equal right zero || (equal left min_value && equal right minus_one) then
+      raise Not_constant;
+    if Poly.equal op BinaryOp.Div then
+      Integer (left / right)
+    else
+      Integer (rem left right)
+  )
+  | BinaryOp.LShift | BinaryOp.RShift -> (
+    (* undefined in C *)
+    if right < zero || right >= of_int_exn 32 then raise Not_constant;
+    if Poly.equal op BinaryOp.LShift then
+      Integer (shift_left left (to_int_exn right))
+    else
+      Integer (shift_right left (to_int_exn right))
+  )
+  | BinaryOp.BitOr -> Integer (bit_or left right)
+  | BinaryOp.BitAnd -> Integer (bit_and left right)
+  | BinaryOp.Xor -> Integer (bit_xor left right)
+  | BinaryOp.Equal -> Boolean (left = right)
+  | BinaryOp.NotEqual -> Boolean (left <> right)
+  | BinaryOp.LessThan -> Boolean (left < right)
+  | BinaryOp.LessThanEqual -> Boolean (left <= right)
+  | BinaryOp.GreaterThan -> Boolean (left > right)
+  | BinaryOp.GreaterThanEqual -> Boolean (left >= right)
+  | BinaryOp.And | BinaryOp.Or -> raise Not_constant
+
+let eval_binary op (left: Literal.t) (right: Literal.t) : Literal.t =
+  match left, right with
+  | Integer l, Integer r -> eval_integer_binary op l r
+  | Char l, Char r -> (
+    match op with
+    | BinaryOp.Equal -> Boolean (l = r)
+    | BinaryOp.NotEqual -> Boolean (l <> r)
+    | BinaryOp.LessThan -> Boolean (l < r)
+    | BinaryOp.LessThanEqual -> Boolean (l <= r)
+    | BinaryOp.GreaterThan -> Boolean (l > r)
+    | BinaryOp.GreaterThanEqual -> Boolean (l >= r)
+    | _ -> raise Not_constant
+  )
+  | Boolean l, Boolean r -> (
+    match op with
+    | BinaryOp.Equal -> Boolean (Bool.equal l r)
+    | BinaryOp.NotEqual -> Boolean (not (Bool.equal l r))
+    | _ -> raise Not_constant
+  )
+  | String (l, loc, _), String (r, _, _) -> (
+    match op with
+    | BinaryOp.Plus -> String (l ^ r, loc, None)
+    | BinaryOp.Equal -> Boolean (String.equal (raw_string l) (raw_string r))
+    | BinaryOp.NotEqual -> Boolean (not (String.equal (raw_string l) (raw_string r)))
+    | _ -> raise Not_constant
+  )
+  | _ -> raise Not_constant
+
+let eval_unary op (value: Literal.t) : Literal.t =
+  match op, value with
+  | UnaryOp.Plus, Integer _ -> value
+  | UnaryOp.Minus, Integer i ->
+    if Int32.equal i Int32.min_value then raise Not_constant;
+    Integer (Int32.neg i)
+  | UnaryOp.BitNot, Integer i -> Integer (Int32.bit_not i)
+  | UnaryOp.Not, Boolean b -> Boolean (not b)
+  | _ -> raise Not_constant
+
+let rec eval_expression env state locals (expr: Expression.t) : Literal.t =
+  let open Expression in
+  tick state;
+  match expr.spec with
+  | Constant (Float _) -> raise Not_constant
+  | Constant literal -> literal
+
+  | Identifier (_, var_id) -> (
+    match Hashtbl.find locals var_id with
+    | Some value -> value
+    | None -> (
+      match Hashtbl.find env.consts var_id with
+      | Some value -> value
+      | None -> raise Not_constant
+    )
+  )
+
+  | Unary (op, child) ->
+    eval_unary op (eval_expression env state locals child)
+
+  | Binary (BinaryOp.And, left, right) -> (
+    match eval_expression env state locals left with
+    | Boolean false -> Boolean false
+    | Boolean true -> eval_expression env state locals right
+    | _ -> raise Not_constant
+  )
+
+  | Binary (BinaryOp.Or, left, right) -> (
+    match eval_expression env state locals left with
+    | Boolean true -> Boolean true
+    | Boolean false -> eval_expression env state locals right
+    | _ -> raise Not_constant
+  )
+
+  | Binary (op, left, right) -> (
+    let left = eval_expression env state locals left in
+    let right = eval_expression env state locals right in
+    eval_binary op left right
+  )
+
+  | Assign (op_opt, { spec = Identifier (_, var_id); _ }, value) -> (
+    (* only the locals of the function being evaluated *)
+    let prev =
+      match Hashtbl.find locals var_id with
+      | Some prev -> prev
+      | None -> raise Not_constant
+    in
+    let value = eval_expression env state locals value in
+    let value =
+      match op_opt with
+      | Some op -> eval_binary (AssignOp.to_binary op) prev value
+      | None -> value
+    in
+    Hashtbl.set locals ~key:var_id ~data:value;
+    Unit
+  )
+
+  | If if_desc -> eval_if env state locals if_desc
+
+  | Block block -> eval_block env state locals block
+
+  | Call { callee = { spec = Identifier (_, fun_id); _ }; call_params; _ } -> (
+    let _fun =
+      match Hashtbl.find env.functions fun_id with
+      | Some _fun -> _fun
+      | None -> raise Not_constant
+    in
+    let args = List.map ~f:(eval_expression env state locals) call_params in
+    call_function env state _fun args
+  )
+
+  | _ -> raise Not_constant
+
+and eval_if env state locals (if_desc: Expression.if_desc) =
+  match eval_expression env state locals if_desc.if_test with
+  | Boolean true -> eval_block env state locals if_desc.if_consequent
+  | Boolean false -> (
+    match if_desc.if_alternative with
+    | Some (Expression.If_alt_if desc) -> eval_if env state locals desc
+    | Some (Expression.If_alt_block block) -> eval_block env state locals block
+    | None -> Unit
+  )
+  | _ -> raise Not_constant
+
+(* the value of a block is its last expression without a semicolon *)
+and eval_block env state locals (block: Block.t) =
+  let rec eval_stmts (stmts: Statement.t list) =
+    match stmts with
+    | [] -> Literal.Unit
+    | [{ spec = Statement.Expr expr; _ }] -> eval_expression env state locals expr
+    | stmt::rest ->
+      eval_statement env state locals stmt;
+      eval_stmts rest
+  in
+  eval_stmts block.body
+
+and eval_statement env state locals (stmt: Statement.t) =
+  let open Statement in
+  tick state;
+  match stmt.spec with
+  | Expr expr | Semi expr ->
+    ignore (eval_expression env state locals expr)
+
+  | Binding { binding_pat = { spec = Pattern.Symbol (_, var_id); _ }; binding_init; _ } ->
+    let value = eval_expression env state locals binding_init in
+    Hashtbl.set locals ~key:var_id ~data:value
+
+  | While { while_test; while_block; _ } -> (
+    let rec loop () =
+      match eval_expression env state locals while_test with
+      | Boolean true -> (
+        match eval_block env state locals while_block with
+        | _ -> loop ()
+        | exception Continue_loop -> loop ()
+        | exception Break_loop -> ()
+      )
+      | Boolean false -> ()
+      | _ -> raise Not_constant
+    in
+    loop ()
+  )
+
+  | Break None -> raise Break_loop
+  | Continue None -> raise Continue_loop
+
+  | Return (Some expr) -> raise (Returned (eval_expression env state locals expr))
+  | Return None -> raise (Returned Unit)
+
+  | Empty -> ()
+
+  | _ -> raise Not_constant
+
+and call_function env state (_fun: Function.t) args =
+  let params = _fun.header.params.params_content in
+  if state.depth >= max_depth then raise Not_constant;
+  if List.exists ~f:(fun (param: Function.param) -> param.param_rest) params then
+    raise Not_constant;
+
+  let locals = Hashtbl.create (module Int) in
+  (match List.zip params args with
+  | List.Or_unequal_lengths.Ok pairs ->
+    List.iter
+      ~f:(fun ((param: Function.param), arg) ->
+        let _, param_id = param.param_name in
+        Hashtbl.set locals ~key:param_id ~data:arg
+      )
+      pairs
+  | List.Or_unequal_lengths.Unequal_lengths -> raise Not_constant);
+
+  state.depth <- state.depth + 1;
+  let result =
+    try eval_block env state locals _fun.body with
+    | Returned value -> value
+  in
+  state.depth <- state.depth - 1;
+  result
+
+let eval_with_fuel f =
+  let state = { fuel = max_fuel; depth = 0 } in
+  match f state with
+  | value -> Some value
+  | exception Not_constant -> None
+  (* a return or a jump out of the evaluated expression, e.g. in a const init *)
+  | exception (Returned _ | Break_loop | Continue_loop) -> None
+
+(*
+ * The value of an expression, if it can be computed at compile time.
+ * A call with constant arguments is evaluated once, the result is memorized.
+ *)
+let eval env (expr: Expression.t) : Literal.t option =
+  let open Expression in
+  let result =
+    match expr.spec with
+    | Call { callee = { spec = Identifier (_, fun_id); _ }; call_params; _ }
+      when Hashtbl.mem env.functions fun_id -> (
+      let _fun = Hashtbl.find_exn env.functions fun_id in
+      let locals = Hashtbl.create (module Int) in
+      let args_opt =
+        eval_with_fuel (fun state ->
+          List.map ~f:(eval_expression env state locals) call_params
+        )
+      in
+      Option.bind args_opt ~f:(fun args ->
+        let key = (fun_id, args) in
+        match Hashtbl.find env.calls key with
+        | Some result -> result
+        | None ->
+          let result = eval_with_fuel (fun state -> call_function env state _fun args) in
+          Hashtbl.set env.calls ~key ~data:result;
+          result
+      )
+    )
+
+    | _ ->
+      let locals = Hashtbl.create (module Int) in
+      eval_with_fuel (fun state -> eval_expression env state locals expr)
+  in
+  match result with
+  | Some Unit -> None
+  | _ -> result
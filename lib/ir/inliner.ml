@@ -0,0 +1,441 @@
+(*
+ * Inline small functions into their callers on the IR.
+ *
+ * A call on a statement like `dst = f(args)` is replaced by the body of `f`:
+ *   - `this` and the params are bound to new temps of the caller,
+ *   - the temps of `f` are renumbered after the temps of the caller,
+ *   - the labels of `f` are renamed,
+ *   - a return is turned into an assignment to `dst` and a jump to the end.
+ *
+ * Only one level is inlined, the bodies are the ones before inlining.
+ *
+ * The trivial externals of the runtime are replaced by the macros in runtime.h,
+ * runtime.c is another translation unit, the C compiler can't inline them.
+ *)
+open Core_kernel
+open Ir
+
+(* the max size of a function to be inlined, counted in IR nodes *)
+let inline_threshold = 40
+
+(* stop inlining into a function when it has grown by this size *)
+let growth_limit = 400
+
+(* the macros take the same arguments as the externals *)
+let external_macros = [
+  "lc_std_array_get_length", "LC_ARRAY_GET_LENGTH";
+  "lc_std_string_get_length", "LC_STRING_GET_LENGTH";
+  "lc_std_char_code", "LC_CHAR_CODE";
+  "lc_std_map_size", "LC_MAP_SIZE";
+]
+
+type shape = {
+  (* the number of params it reads *)
+  arity: int;
+  uses_this: bool;
+}
+
+type t = {
+  verbose: bool;
+  (* generated name -> function which can be inlined *)
+  candidates: (string, Func.t * shape) Hashtbl.t;
+  mutable label_counter: int;
+}
+
+type caller = {
+  caller_name: string;
+  mutable caller_tmp_count: int;
+  mutable caller_growth: int;
+}
+
+let rec expr_size (expr: Expr.t) =
+  let open Expr in
+  let sum = List.fold ~init:0 ~f:(fun acc e -> acc + expr_size e) in
+  1 + (
+    match expr with
+    | Null | NewString _ | NewInt _ | NewFloat _ | NewChar _ | NewBoolean _
+    | NewLambda _ | NewEnv _ | EnvGet _ | NewArray _ | NewStaticArray _ | NewMap _
+    | InitCall _ | InitStackCall _ | Ident _ | Temp _ | RawGetField _
+      -> 0
+
+    | EnvSet (_, _, _, e) | Not e | TupleGetValue (e, _) | TagEqual (e, _)
+    | UnionGet (e, _) | IntValue e | GetField (e, _, _) | StringEqUtf8 (e, _)
+    | Retaining e
+      -> expr_size e
+
+    | ArrayGetValue (a, b) | Assign (a, b) | StringCmp (_, a, b)
+    | I32Binary (_, a, b) | F32Binary (_, a, b) | I64Binary (_, a, b) | F64Binary (_, a, b)
+      -> expr_size a + expr_size b
+
+    | ArraySetValue (a, b, c) -> expr_size a + expr_size b + expr_size c
+
+    | NewTuple exprs | NewStackTuple exprs -> sum exprs
+
+    | CallLambda (e, params) | CallLambdaDirect (_, e, params) | Invoke (e, _, params) ->
+      sum (e::params)
+
+    | Call (_, this_opt, params) | CallNative (_, _, this_opt, params) ->
+      sum (List.append (Option.to_list this_opt) params)
+  )
+
+let rec stmts_size stmts =
+  List.fold ~init:0 ~f:(fun acc stmt -> acc + stmt_size stmt) stmts
+
+and stmt_size (stmt: Stmt.t) =
+  let open Stmt in
+  1 + (
+    match stmt.spec with
+    | If if_spec -> if_size if_spec
+    | While (test, block) -> expr_size test + stmts_size block.body
+    | Expr e | Retain e | Release e | Return (Some e) | TailCall e -> expr_size e
+    | WithLabel (_, stmts) -> stmts_size stmts
+    | Switch { switch_value; switch_cases; _ } -> expr_size switch_value + List.length switch_cases
+    | VarDecl _ | Continue | Break | Label _ | Goto _ | Return None -> 0
+  )
+
+and if_size (if_spec: Stmt.if_spec) =
+  expr_size if_spec.if_test + stmts_size if_spec.if_consequent + (
+    match if_spec.if_alternate with
+    | Some (If_alt_if alt) -> if_size alt
+    | Some (If_alt_block stmts) -> stmts_size stmts
+    | None -> 0
+  )
+
+(* children are mapped before the parent *)
+let rec map_expr ~f_sym ~f_expr (expr: Expr.t) : Expr.t =
+  let open Expr in
+  let m = map_expr ~f_sym ~f_expr in
+  let mapped =
+    match expr with
+    | Null | NewString _ | NewInt _ | NewFloat _ | NewChar _ | NewBoolean _
+    | NewLambda _ | NewEnv _ | NewArray _ | NewStaticArray _ | NewMap _ | InitCall _ | InitStackCall _ | RawGetField _
+      -> expr
+
+    | Ident sym -> Ident (f_sym sym)
+    | Temp id -> Ident (f_sym (SymTemp id))
+    | EnvGet (sym, slot, name) -> EnvGet (f_sym sym, slot, name)
+    | EnvSet (sym, slot, name, e) -> EnvSet (f_sym sym, slot, name, m e)
+    | Not e -> Not (m e)
+    | TupleGetValue (e, index) -> TupleGetValue (m e, index)
+    | TagEqual (e, tag) -> TagEqual (m e, tag)
+    | UnionGet (e, index) -> UnionGet (m e, index)
+    | IntValue e -> IntValue (m e)
+    | GetField (e, cls_name, field_name) -> GetField (m e, cls_name, field_name)
+    | StringEqUtf8 (e, str) -> StringEqUtf8 (m e, str)
+    | Retaining e -> Retaining (m e)
+    | ArrayGetValue (a, b) -> ArrayGetValue (m a, m b)
+    | Assign (a, b) -> Assign (m a, m b)
+    | StringCmp (op, a, b) -> StringCmp (op, m a, m b)
+    | I32Binary (op, a, b) -> I32Binary (op, m a, m b)
+    | F32Binary (op, a, b) -> F32Binary (op, m a, m b)
+    | I64Binary (op, a, b) -> I64Binary (op, m a, m b)
+    | F64Binary (op, a, b) -> F64Binary (op, m a, m b)
+    | ArraySetValue (a, b, c) -> ArraySetValue (m a, m b, m c)
+    | NewTuple exprs -> NewTuple (List.map ~f:m exprs)
+    | NewStackTuple exprs -> NewStackTuple (List.map ~f:m exprs)
+    | CallLambda (e, params) -> CallLambda (m e, List.map ~f:m params)
+    | CallLambdaDirect (name, e, params) -> CallLambdaDirect (name, m e, List.map ~f:m params)
+    | Invoke (e, name, params) -> Invoke (m e, name, List.map ~f:m params)
+    | Call (sym, this_opt, params) ->
+      Call (f_sym sym, Option.map ~f:m this_opt, List.map ~f:m params)
+    | CallNative (sym, native_sig, this_opt, params) ->
+      CallNative (f_sym sym, native_sig, Option.map ~f:m this_opt, List.map ~f:m params)
+  in
+  f_expr mapped
+
+(*
+ * map the expressions of the statements,
+ * `on_return` rewrites the return statements and the tail calls.
+ *)
+let rec map_stmts ~f_stmt_expr ~on_return ~rename_label stmts : Stmt.t list =
+  List.concat_map ~f:(map_stmt ~f_stmt_expr ~on_return ~rename_label) stmts
+
+and map_stmt ~f_stmt_expr ~on_return ~rename_label (stmt: Stmt.t) : Stmt.t list =
+  let open Stmt in
+  let m = f_stmt_expr in
+  let map_block = map_stmts ~f_stmt_expr ~on_return ~rename_label in
+  let rec map_if (if_spec: if_spec) = {
+    if_test = m if_spec.if_test;
+    if_consequent = map_block if_spec.if_consequent;
+    if_alternate =
+      match if_spec.if_alternate with
+      | Some (If_alt_if alt) -> Some (If_alt_if (map_if alt))
+      | Some (If_alt_block stmts) -> Some (If_alt_block (map_block stmts))
+      | None -> None
+  } in
+  let with_spec spec = [{ stmt with spec }] in
+  match stmt.spec with
+  | If if_spec -> with_spec (If (map_if if_spec))
+  | While (test, block) -> with_spec (While (m test, { block with body = map_block block.body }))
+  | Expr e -> with_spec (Expr (m e))
+  | Retain e -> with_spec (Retain (m e))
+  | Release e -> with_spec (Release (m e))
+  | WithLabel (label, stmts) -> with_spec (WithLabel (rename_label label, map_block stmts))
+  | Label label -> with_spec (Label (rename_label label))
+  | Goto label -> with_spec (Goto (rename_label label))
+  | Switch switch_spec ->
+    with_spec (Switch {
+      switch_spec with
+      switch_value = m switch_spec.switch_value;
+      switch_cases = List.map ~f:(fun (value, label) -> value, rename_label label) switch_spec.switch_cases;
+      switch_default = rename_label switch_spec.switch_default;
+    })
+  | Return expr_opt -> on_return stmt (Option.map ~f:m expr_opt)
+  | TailCall e -> on_return stmt (Some (m e))
+  | VarDecl _ | Continue | Break -> [stmt]
+
+(* rebuild the return statement with the mapped expression *)
+let rebuild_return (stmt: Stmt.t) expr_opt =
+  match stmt.spec, expr_opt with
+  | Stmt.TailCall _, Some expr -> { stmt with spec = Stmt.TailCall expr }
+  | _ -> { stmt with spec = Stmt.Return expr_opt }
+
+let iter_expr ~f (expr: Expr.t) =
+  ignore (map_expr ~f_sym:Fn.id ~f_expr:(fun e -> f e; e) expr)
+
+let iter_stmts ~f stmts =
+  ignore (map_stmts ~f_stmt_expr:(fun e -> iter_expr ~f e; e) ~on_return:(fun stmt _ -> [stmt]) ~rename_label:Fn.id stmts)
+
+(* test the statements recursively *)
+let rec stmts_exists ~f stmts =
+  List.exists ~f:(stmt_exists ~f) stmts
+
+and stmt_exists ~f (stmt: Stmt.t) =
+  let open Stmt in
+  let rec if_exists (if_spec: if_spec) =
+    stmts_exists ~f if_spec.if_consequent || (
+      match if_spec.if_alternate with
+      | Some (If_alt_if alt) -> if_exists alt
+      | Some (If_alt_block stmts) -> stmts_exists ~f stmts
+      | None -> false
+    )
+  in
+  f stmt || (
+    match stmt.spec with
+    | If if_spec -> if_exists if_spec
+    | While (_, block) -> stmts_exists ~f block.body
+    | WithLabel (_, stmts) -> stmts_exists ~f stmts
+    | _ -> false
+  )
+
+let is_ret_symbol (sym: symbol) =
+  match sym with
+  | SymRet
+  | SymLocal "ret" -> true
+  | _ -> false
+
+(*
+ * A function can be inlined if it has no locals, lambdas and environments,
+ * and doesn't call itself or tail calls another function.
+ *)
+let inlinable_shape (func: Func.t) : shape option =
+  let fun_name, _ = func.name in
+  let ok = ref true in
+  let arity = ref 0 in
+  let uses_this = ref false in
+  let check_sym (sym: symbol) =
+    match sym with
+    | SymParam index -> arity := Int.max !arity (index + 1)
+    | SymThis -> uses_this := true
+    | SymLambda _ | SymLambdaThis -> ok := false
+    | SymLocal name when String.equal name fun_name -> ok := false
+    | _ -> ()
+  in
+  let check_expr (expr: Expr.t) =
+    let open Expr in
+    match expr with
+    | NewLambda _ | NewEnv _ | CallLambdaDirect _ -> ok := false
+    | EnvGet (sym, _, _) | EnvSet (sym, _, _, _) | Ident sym
+    | Call (sym, _, _) | CallNative (sym, _, _, _) -> check_sym sym
+    | _ -> ()
+  in
+  if stmts_exists
+      ~f:(fun (stmt: Stmt.t) ->
+        match stmt.spec with
+        | Stmt.VarDecl _ | Stmt.TailCall _ -> true
+        | _ -> false
+      )
+      func.body.body then
+    ok := false;
+  if !ok then iter_stmts ~f:check_expr func.body.body;
+  if !ok then Some { arity = !arity; uses_this = !uses_this } else None
+
+let callee_name (call: Expr.t) =
+  match call with
+  | Expr.Call (SymLocal name, _, _)
+  | Expr.CallNative (SymLocal name, _, _, _) -> Some name
+  | _ -> None
+
+let rewrite_external env caller (expr: Expr.t) : Expr.t =
+  match expr with
+  | Expr.Call (SymLocal ext_name, (Some _ as this_opt), []) -> (
+    match List.Assoc.find external_macros ~equal:String.equal ext_name with
+    | Some macro -> (
+      if env.verbose then (
+        Format.printf "- inline external %s as %s in %s\n" ext_name macro caller.caller_name
+      );
+      Expr.Call (SymLocal macro, this_opt, [])
+    )
+    | None -> expr
+  )
+  | _ -> expr
+
+let expand env caller ~dst (callee: Func.t) this_opt params : Stmt.t list =
+  let loc = Lichenscript_lex.Loc.none in
+  let base = caller.caller_tmp_count in
+  let this_tmp = base in
+  let params_base = base + 1 in
+  let tmp_base = params_base + List.length params in
+  caller.caller_tmp_count <- tmp_base + callee.tmp_vars_count;
+
+  env.label_counter <- env.label_counter + 1;
+  let suffix = "_inl" ^ (Int.to_string env.label_counter) in
+  let end_label = "inline_end" ^ suffix in
+
+  let f_sym (sym: symbol) : symbol =
+    match sym with
+    | SymParam index -> SymTemp (params_base + index)
+    | SymThis -> SymTemp this_tmp
+    | SymTemp id -> SymTemp (tmp_base + id)
+    | _ when is_ret_symbol sym -> dst
+    | _ -> sym
+  in
+  let f_stmt_expr = map_expr ~f_sym ~f_expr:(rewrite_external env caller) in
+  let on_return (stmt: Stmt.t) (expr_opt: Expr.t option) =
+    let assign =
+      match stmt.spec, expr_opt with
+      | Stmt.Return (Some (Expr.Ident sym)), _ when is_ret_symbol sym -> []
+      | _, Some expr -> [{ Stmt. spec = Stmt.Expr (Expr.Assign (Expr.Ident dst, expr)); loc }]
+      | _, None -> []
+    in
+    List.append assign [{ Stmt. spec = Stmt.Goto end_label; loc }]
+  in
+  let body =
+    map_stmts ~f_stmt_expr ~on_return ~rename_label:(fun label -> label ^ suffix) callee.body.body
+  in
+
+  let assign_tmp id expr = { Stmt. spec = Stmt.Expr (Expr.Assign (Expr.Ident (SymTemp id), expr)); loc } in
+  let bind_this = Option.to_list (Option.map ~f:(assign_tmp this_tmp) this_opt) in
+  let bind_params = List.mapi ~f:(fun index param -> assign_tmp (params_base + index) param) params in
+  (* the temps of the callee are expected to be null *)
+  let reset_tmps = List.init callee.tmp_vars_count ~f:(fun index -> assign_tmp (tmp_base + index) Expr.Null) in
+
+  [{ Stmt.
+    spec = Stmt.WithLabel (end_label, List.concat [ bind_this; bind_params; reset_tmps; body ]);
+    loc;
+  }]
+
+let try_inline env caller ~dst (call: Expr.t) : Stmt.t list option =
+  let target =
+    match call with
+    | Expr.Call (SymLocal name, this_opt, params)
+    | Expr.CallNative (SymLocal name, _, this_opt, params) -> (
+      match Hashtbl.find env.candidates name with
+      | Some (callee, shape) -> Some (name, callee, shape, this_opt, params)
+      | None -> None
+    )
+    | _ -> None
+  in
+  match target with
+  | None -> None
+  | Some (name, callee, shape, this_opt, params) ->
+  let size = stmts_size callee.body.body in
+  if String.equal name caller.caller_name ||
+     shape.arity > List.length params ||
+     (shape.uses_this && Option.is_none this_opt) then
+    None
+  else if size > inline_threshold then (
+    if env.verbose then (
+      Format.printf "- not inline %s into %s: size %d > %d\n" name caller.caller_name size inline_threshold
+    );
+    None
+  ) else if caller.caller_growth + size > growth_limit then (
+    if env.verbose then (
+      Format.printf "- not inline %s into %s: %s has grown too large\n" name caller.caller_name caller.caller_name
+    );
+    None
+  ) else (
+    if env.verbose then (
+      Format.printf "- inline %s into %s (size %d)\n" name caller.caller_name size
+    );
+    caller.caller_growth <- caller.caller_growth + size;
+    let params = List.map ~f:(map_expr ~f_sym:Fn.id ~f_expr:(rewrite_external env caller)) params in
+    let this_opt = Option.map ~f:(map_expr ~f_sym:Fn.id ~f_expr:(rewrite_external env caller)) this_opt in
+    Some (expand env caller ~dst callee this_opt params)
+  )
+
+let rec inline_stmts env caller stmts : Stmt.t list =
+  List.concat_map ~f:(inline_stmt env caller) stmts
+
+and inline_stmt env caller (stmt: Stmt.t) : Stmt.t list =
+  let open Stmt in
+  let rewrite = map_expr ~f_sym:Fn.id ~f_expr:(rewrite_external env caller) in
+  let rec inline_if (if_spec: if_spec) = {
+    if_test = rewrite if_spec.if_test;
+    if_consequent = inline_stmts env caller if_spec.if_consequent;
+    if_alternate =
+      match if_spec.if_alternate with
+      | Some (If_alt_if alt) -> Some (If_alt_if (inline_if alt))
+      | Some (If_alt_block stmts) -> Some (If_alt_block (inline_stmts env caller stmts))
+      | None -> None
+  } in
+  let otherwise () =
+    map_stmt ~f_stmt_expr:rewrite ~on_return:(fun stmt expr_opt -> [rebuild_return stmt expr_opt]) ~rename_label:Fn.id stmt
+  in
+  match stmt.spec with
+  | Expr (Expr.Assign (Expr.Ident dst, call)) when Option.is_some (callee_name call) -> (
+    match try_inline env caller ~dst call with
+    | Some stmts -> stmts
+    | None -> otherwise ()
+  )
+
+  (* the result is dropped into a new temp, same as the call *)
+  | Expr call when Option.is_some (callee_name call) -> (
+    let dst = SymTemp caller.caller_tmp_count in
+    caller.caller_tmp_count <- caller.caller_tmp_count + 1;
+    match try_inline env caller ~dst call with
+    | Some stmts -> stmts
+    | None ->
+      caller.caller_tmp_count <- caller.caller_tmp_count - 1;
+      otherwise ()
+  )
+
+  | If if_spec -> [{ stmt with spec = If (inline_if if_spec) }]
+  | While (test, block) ->
+    [{ stmt with spec = While (rewrite test, { block with body = inline_stmts env caller block.body }) }]
+  | WithLabel (label, stmts) -> [{ stmt with spec = WithLabel (label, inline_stmts env caller stmts) }]
+  | _ -> otherwise ()
+
+let inline_function env (func: Func.t) : Func.t =
+  let caller = {
+    caller_name = fst func.name;
+    caller_tmp_count = func.tmp_vars_count;
+    caller_growth = 0;
+  } in
+  let body = inline_stmts env caller func.body.body in
+  { func with
+    body = { func.body with body };
+    tmp_vars_count = caller.caller_tmp_count;
+  }
+
+let inline_declarations ?(verbose=false) (decls: Decl.t list) : Decl.t list =
+  let candidates = Hashtbl.create (module String) in
+  List.iter
+    ~f:(fun (decl: Decl.t) ->
+      match decl.spec with
+      | Decl.Func func -> (
+        match inlinable_shape func with
+        | Some shape -> Hashtbl.set candidates ~key:(fst func.name) ~data:(func, shape)
+        | None -> ()
+      )
+      | _ -> ()
+    )
+    decls;
+  let env = { verbose; candidates; label_counter = 0 } in
+  List.map
+    ~f:(fun (decl: Decl.t) ->
+      match decl.spec with
+      | Decl.Func func -> { decl with spec = Decl.Func (inline_function env func) }
+      | _ -> decl
+    )
+    decls
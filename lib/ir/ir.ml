@@ -89,6 +89,7 @@ module%gen rec Decl : sig
   | Class of _class
   | EnumCtor of enum_ctor
   | GlobalClassInit of string * class_init list
+  | StaticArray of string * Expr.t list  (* name, constant values *)
   [@@deriving show]
 
   type t = {
@@ -113,18 +114,39 @@ and Stmt : sig
     | If_alt_block of Stmt.t list
   [@@deriving show]
 
+  type switch_on =
+    | Switch_tag  (* the tag of an enum *)
+    | Switch_int  (* an i32 or a char *)
+    | Switch_string_length
+  [@@deriving show]
+
+  type switch_spec = {
+    switch_value: Expr.t;
+    switch_on: switch_on;
+    (* value -> label *)
+    switch_cases: (int * string) list;
+    switch_default: string;
+  }
+  [@@deriving show]
+
   type spec =
   | If of if_spec
   | While of Expr.t * Block.t
   | Expr of Expr.t
-  | VarDecl of string list
+  (* a local with a native type is declared as a C primitive *)
+  | VarDecl of (string * Func.native_ty option) list
   | Continue
   | Break
   | Retain of Expr.t
   | Release of Expr.t
   | WithLabel of string * t list
+  | Label of string
   | Goto of string
+  (* jump to the label of the value, a jump table in C *)
+  | Switch of switch_spec
   | Return of Expr.t option
+  (* return the result of a call in tail position, the C compiler may reuse the frame *)
+  | TailCall of Expr.t
   [@@deriving show]
 
   and t = {
@@ -143,6 +165,8 @@ and Expr : sig
     lambda_this: t;
     lambda_capture_symbols: symbol array;
     lambda_decl: Decl.t;
+    (* the lambda never escapes, the environment can be allocated on the stack *)
+    lambda_on_stack: bool;
   }
   [@@deriving show]
 
@@ -154,10 +178,13 @@ and Expr : sig
   | NewChar of int
   | NewLambda of lambda_spec
   | NewBoolean of bool
-  | NewRef of t
-  | GetRef of (symbol * string)  (* deref symbol, original_name *)
+  | NewEnv of int  (* the environment of captured variables, size *)
+  | EnvGet of (symbol * int * string)  (* env symbol, slot, original_name *)
+  | EnvSet of (symbol * int * string * t)  (* env symbol, slot, original_name, value *)
   | NewArray of int
+  | NewStaticArray of string * int  (* a copy of the static array, name, size *)
   | NewTuple of t list
+  | NewStackTuple of t list  (* the tuple never escapes, the storage is on the stack *)
   | NewMap of int
   | Not of t
   | TupleGetValue of (t * int)
@@ -168,10 +195,13 @@ and Expr : sig
   | I64Binary of Asttypes.BinaryOp.t * t * t
   | F64Binary of Asttypes.BinaryOp.t * t * t
   | CallLambda of t * t list
+  | CallLambdaDirect of string * t * t list  (* the target is known, lambda name, lambda, params *)
   | Invoke of t * string * t list
   | Assign of t * t
   | Call of symbol * t option * t list
+  | CallNative of symbol * Func.native_sig * t option * t list
   | InitCall of (symbol * symbol)  (* init call function, meta name *)
+  | InitStackCall of (symbol * symbol)  (* the object never escapes, init function, meta name *)
   | Ident of symbol
   | TagEqual of t * int
   | UnionGet of t * int
@@ -189,11 +219,33 @@ end
 
 and Func : sig
 
+  (* primitive types which can be passed to C directly without boxing *)
+  type native_ty =
+  | Native_i32
+  | Native_f32
+  | Native_bool
+  | Native_unit
+  [@@deriving show]
+
+  (*
+   * A statically typed function with only primitive parameters
+   * is generated as a native C function,
+   * the generic LCCFunction wrapper is only generated when it escapes as a value.
+   *)
+  type native_sig = {
+    native_has_this: bool;
+    native_params: native_ty list;
+    native_ret: native_ty;
+    native_escaped: bool;
+  }
+  [@@deriving show]
+
   type t = {
     name: (string * Loc.t);
     tmp_vars_count: int;
     body: Block.t;
     comments: Loc.t Lichenscript_lex.Comment.t list;
+    native: native_sig option;
   }
   [@@deriving show]
   
@@ -0,0 +1,689 @@
+(*
+ * Optimization passes on the SSA form of the functions.
+ *
+ * Every pass builds the SSA form of the body, analyzes it,
+ * and rewrites the structured IR through `Ssa.rewrite_body`:
+ *   - sccp: sparse conditional constant propagation,
+ *     folds the constant variables and removes the dead branches,
+ *   - cse: reuses a pure computation done on a dominating statement,
+ *   - licm: hoists the pure runtime readers out of the loop tests,
+ *   - dce: removes the assignments which are never read.
+ *
+ * Only the integer, char and boolean values are tracked,
+ * the other values are the runtime's business.
+ *)
+open Core_kernel
+open Lichenscript_parsing
+open Ir
+
+type pass = {
+  pass_name: string;
+  pass_run: Func.t -> Func.t;
+}
+
+(* the externals without side effects, they read a field of their receiver *)
+let pure_readers = [
+  "lc_std_array_get_length"; "LC_ARRAY_GET_LENGTH";
+  "lc_std_string_get_length"; "LC_STRING_GET_LENGTH";
+  "lc_std_map_size"; "LC_MAP_SIZE";
+  "lc_std_char_code"; "LC_CHAR_CODE";
+]
+
+let is_pure_reader (sym: symbol) =
+  match sym with
+  | SymLocal name -> List.mem pure_readers name ~equal:String.equal
+  | _ -> false
+
+(* the expression has no side effect and never traps *)
+let rec is_pure (expr: Expr.t) =
+  let open Expr in
+  match expr with
+  | Null | NewInt _ | NewFloat _ | NewChar _ | NewBoolean _ | Ident _ | Temp _ -> true
+
+  (* traps in C *)
+  | I32Binary ((Asttypes.BinaryOp.Div | Asttypes.BinaryOp.Mod), left, right) -> (
+    match right with
+    | NewInt value when not (String.equal value "0" || String.equal value "-1") -> is_pure left
+    | _ -> false
+  )
+
+  | I32Binary (_, left, right) | F32Binary (_, left, right) | StringCmp (_, left, right) ->
+    is_pure left && is_pure right
+
+  | Not e | TagEqual (e, _) | IntValue e | StringEqUtf8 (e, _) -> is_pure e
+
+  | Call (sym, this_opt, params) when is_pure_reader sym ->
+    List.for_all ~f:is_pure (List.append (Option.to_list this_opt) params)
+
+  | _ -> false
+
+(* computed from the values of the variables only *)
+let rec is_arithmetic (expr: Expr.t) =
+  let open Expr in
+  match expr with
+  | NewInt _ | NewFloat _ | NewChar _ | NewBoolean _ | Ident _ | Temp _ -> true
+  | I32Binary (_, left, right) | F32Binary (_, left, right) ->
+    is_arithmetic left && is_arithmetic right
+  | Not e | IntValue e -> is_arithmetic e
+  | _ -> false
+
+let is_constant (expr: Expr.t) =
+  let open Expr in
+  match expr with
+  | NewInt _ | NewChar _ | NewBoolean _ -> true
+  | _ -> false
+
+let literal_of_constant (expr: Expr.t) : Ast.Literal.t option =
+  let open Expr in
+  match expr with
+  | NewInt value -> Some (Ast.Literal.Integer (Int32.of_string value))
+  | NewChar ch -> Some (Ast.Literal.Char ch)
+  | NewBoolean bl -> Some (Ast.Literal.Boolean bl)
+  | _ -> None
+
+let constant_of_literal (literal: Ast.Literal.t) : Expr.t option =
+  let open Expr in
+  match literal with
+  | Ast.Literal.Integer i -> Some (NewInt (Int32.to_string i))
+  | Ast.Literal.Char ch -> Some (NewChar ch)
+  | Ast.Literal.Boolean bl -> Some (NewBoolean bl)
+  | _ -> None
+
+(* the same rules as the compile time evaluation *)
+let fold_binary op (left: Expr.t) (right: Expr.t) : Expr.t option =
+  match literal_of_constant left, literal_of_constant right with
+  | Some left, Some right -> (
+    match Const_eval.eval_binary op left right with
+    | value -> constant_of_literal value
+    | exception Const_eval.Not_constant -> None
+  )
+  | _ -> None
+
+(* fold the constant operations of the expression, the children are folded first *)
+let rec fold_expr (expr: Expr.t) : Expr.t =
+  let open Expr in
+  let expr = Ssa.map_children ~f:fold_expr expr in
+  match expr with
+  | I32Binary (op, left, right) ->
+    Option.value ~default:expr (fold_binary op left right)
+  | Not (NewBoolean bl) -> NewBoolean (not bl)
+  | _ -> expr
+
+let has_label stmts =
+  Inliner.stmts_exists
+    ~f:(fun stmt ->
+      match stmt.spec with
+      | Stmt.Label _ | Stmt.WithLabel _ -> true
+      | _ -> false
+    )
+    stmts
+
+let has_decl stmts =
+  List.exists ~f:(fun (stmt: Stmt.t) -> match stmt.spec with Stmt.VarDecl _ -> true | _ -> false) stmts
+
+(* sparse conditional constant propagation, Wegman and Zadeck *)
+
+type lattice =
+  | Top
+  | Const of Expr.t
+  | Bottom
+
+let meet a b =
+  match a, b with
+  | Top, x | x, Top -> x
+  | Const x, Const y when Poly.equal x y -> a
+  | _ -> Bottom
+
+let rec eval_lattice ~value_of uses (expr: Expr.t) =
+  let open Expr in
+  let eval = eval_lattice ~value_of uses in
+  match expr with
+  | NewInt _ | NewChar _ | NewBoolean _ -> Const expr
+
+  | Ident _ | Temp _ -> (
+    match Option.bind (Ssa.var_of_expr expr) ~f:(Hashtbl.find uses) with
+    | Some def_id -> value_of def_id
+    | None -> Bottom
+  )
+
+  | Assign (_, value) | Retaining value -> eval value
+
+  | Not e -> (
+    match eval e with
+    | Const (NewBoolean bl) -> Const (NewBoolean (not bl))
+    | Const _ | Bottom -> Bottom
+    | Top -> Top
+  )
+
+  | I32Binary (op, left, right) -> (
+    match eval left, eval right with
+    | Bottom, _ | _, Bottom -> Bottom
+    | Top, _ | _, Top -> Top
+    | Const left, Const right -> (
+      match fold_binary op left right with
+      | Some value -> Const value
+      | None -> Bottom
+    )
+  )
+
+  | _ -> Bottom
+
+let sccp (func: Func.t) : Func.t =
+  let body = func.body.body in
+  let t = Ssa.build body in
+  let users = Ssa.compute_users t in
+  let blocks_count = Array.length t.blocks in
+
+  let values = Hashtbl.create (module Int) in
+  let value_of def_id = Option.value ~default:Top (Hashtbl.find values def_id) in
+  let executable = Array.create ~len:blocks_count false in
+  let edges = Hash_set.create (module Int) in
+  let edge_key from_block to_block = from_block * blocks_count + to_block in
+  let edge_worklist = Queue.create () in
+  let def_worklist = Queue.create () in
+
+  let set_value def_id value =
+    let prev = value_of def_id in
+    let next = meet prev value in
+    if not (Poly.equal prev next) then (
+      Hashtbl.set values ~key:def_id ~data:next;
+      Queue.enqueue def_worklist def_id
+    )
+  in
+
+  (* the values defined at the entry or by a declaration are unknown *)
+  Hashtbl.iter
+    ~f:(fun (def: Ssa.def) ->
+      match def.def_kind with
+      | Ssa.Def_entry | Ssa.Def_decl _ -> Hashtbl.set values ~key:def.def_id ~data:Bottom
+      | _ -> ()
+    )
+    t.defs;
+
+  let eval_inst inst_id expr =
+    match Ssa.uses_of t inst_id with
+    | Some uses when not (Hash_set.mem t.mixed inst_id) -> eval_lattice ~value_of uses expr
+    | _ -> Bottom
+  in
+
+  let visit_inst inst_id =
+    List.iter
+      ~f:(fun def_id ->
+        let def = Ssa.find_def t def_id in
+        match def.def_kind with
+        | Ssa.Def_assign (_, value) -> set_value def_id (eval_inst inst_id value)
+        | _ -> set_value def_id Bottom
+      )
+      (Option.value ~default:[] (Hashtbl.find t.inst_defs inst_id))
+  in
+
+  let visit_phi block_id phi_id =
+    let phi = Ssa.find_def t phi_id in
+    let value =
+      List.fold
+        ~init:Top
+        ~f:(fun acc (pred, arg) ->
+          if Hash_set.mem edges (edge_key pred block_id) then
+            meet acc (value_of arg)
+          else
+            acc
+        )
+        phi.def_phi_args
+    in
+    set_value phi_id value
+  in
+
+  let visit_term block_id =
+    let block = t.blocks.(block_id) in
+    let add_edge target = Queue.enqueue edge_worklist (block_id, target) in
+    Option.iter ~f:(fun (id, _) -> if id >= 0 then visit_inst id) (Ssa.term_inst block);
+    match block.term with
+    | Some (Ssa.T_jump target) -> add_edge target
+    | Some (Ssa.T_branch (id, test, then_block, else_block)) -> (
+      match eval_inst id test with
+      | Const (Expr.NewBoolean true) -> add_edge then_block
+      | Const (Expr.NewBoolean false) -> add_edge else_block
+      | Top -> ()
+      | _ ->
+        add_edge then_block;
+        add_edge else_block
+    )
+    | Some (Ssa.T_switch (_, _, targets)) -> List.iter ~f:add_edge targets
+    | Some (Ssa.T_exit _) | None -> ()
+  in
+
+  let is_term_inst block_id inst_id =
+    match Ssa.term_inst t.blocks.(block_id) with
+    | Some (id, _) -> id = inst_id
+    | None -> false
+  in
+
+  Queue.enqueue edge_worklist (-1, 0);
+  while not (Queue.is_empty edge_worklist && Queue.is_empty def_worklist) do
+    (match Queue.dequeue edge_worklist with
+    | Some (from_block, to_block) ->
+      let is_new_edge = from_block < 0 || not (Hash_set.mem edges (edge_key from_block to_block)) in
+      if is_new_edge then (
+        if from_block >= 0 then
+          Hash_set.add edges (edge_key from_block to_block);
+        List.iter ~f:(visit_phi to_block) t.phis.(to_block);
+        if not executable.(to_block) then (
+          executable.(to_block) <- true;
+          List.iter
+            ~f:(function
+              | Ssa.I_eval (id, _) | Ssa.I_decl (id, _) -> visit_inst id
+            )
+            t.blocks.(to_block).insts;
+          visit_term to_block
+        )
+      )
+    | None -> ());
+
+    match Queue.dequeue def_worklist with
+    | Some def_id ->
+      List.iter
+        ~f:(function
+          | Ssa.User_phi phi_id ->
+            let phi = Ssa.find_def t phi_id in
+            if executable.(phi.def_block) then
+              visit_phi phi.def_block phi_id
+          | Ssa.User_inst inst_id ->
+            let block_id = Hashtbl.find_exn t.inst_block inst_id in
+            if executable.(block_id) then (
+              if is_term_inst block_id inst_id then
+                visit_term block_id
+              else
+                visit_inst inst_id
+            )
+        )
+        (Option.value ~default:[] (Hashtbl.find users def_id))
+    | None -> ()
+  done;
+
+  (* the operands of retain and release are kept *)
+  let refcounted = Hash_set.create (module Int) in
+  Ssa.iter_body
+    ~f:(fun id stmt ->
+      match stmt.spec with
+      | Stmt.Retain _ | Stmt.Release _ -> Hash_set.add refcounted id
+      | _ -> ()
+    )
+    body;
+
+  let f_expr inst_id expr =
+    match Ssa.uses_of t inst_id with
+    | Some uses
+      when not (Hash_set.mem t.mixed inst_id || Hash_set.mem refcounted inst_id) ->
+      let rec subst (expr: Expr.t) =
+        let open Expr in
+        match expr with
+        | Assign (left, right) when Option.is_some (Ssa.var_of_expr left) ->
+          Assign (left, subst right)
+        | Ident _ | Temp _ -> (
+          match Option.bind (Ssa.var_of_expr expr) ~f:(Hashtbl.find uses) with
+          | Some def_id -> (
+            match value_of def_id with
+            | Const value -> value
+            | _ -> expr
+          )
+          | None -> expr
+        )
+        | _ -> Ssa.map_children ~f:subst expr
+      in
+      fold_expr (subst expr)
+    | _ -> expr
+  in
+
+  let f_stmt _ (stmt: Stmt.t) =
+    let open Stmt in
+    match stmt.spec with
+    | If { if_test = Expr.NewBoolean test; if_consequent; if_alternate } -> (
+      let alternate =
+        match if_alternate with
+        | Some (If_alt_if alt) -> [{ stmt with spec = If alt }]
+        | Some (If_alt_block stmts) -> stmts
+        | None -> []
+      in
+      let taken, dropped =
+        if test then if_consequent, alternate else alternate, if_consequent
+      in
+      (* a label may be the target of a jump, a declaration must keep its scope *)
+      if has_label dropped || has_decl taken then
+        [stmt]
+      else
+        taken
+    )
+
+    | While (Expr.NewBoolean false, block) when not (has_label block.body) -> []
+
+    | _ -> [stmt]
+  in
+
+  let body = Ssa.rewrite_body ~f_expr ~f_stmt body in
+  { func with body = { func.body with body } }
+
+(* common subexpression elimination *)
+
+let cse (func: Func.t) : Func.t =
+  let body = func.body.body in
+  let t = Ssa.build body in
+
+  (* var -> the number of assignments *)
+  let assign_count = Hashtbl.create (module String) in
+  Hashtbl.iter
+    ~f:(fun (def: Ssa.def) ->
+      match def.def_kind with
+      | Ssa.Def_assign _ | Ssa.Def_decl _ -> Hashtbl.incr assign_count def.def_var
+      | _ -> ()
+    )
+    t.defs;
+
+  (* the value of the expression, the variables are named by their defs *)
+  let rec key uses (expr: Expr.t) =
+    let open Expr in
+    match expr with
+    | Ident _ | Temp _ -> (
+      let var = Option.value_exn (Ssa.var_of_expr expr) in
+      Format.sprintf "%s.%d" var (Hashtbl.find_exn uses var)
+    )
+    | I32Binary (op, left, right) ->
+      Format.sprintf "(%s i32%s %s)" (key uses left) (Primitives.Bin.to_c_op op) (key uses right)
+    | F32Binary (op, left, right) ->
+      Format.sprintf "(%s f32%s %s)" (key uses left) (Primitives.Bin.to_c_op op) (key uses right)
+    | Not e -> Format.sprintf "!%s" (key uses e)
+    | IntValue e -> Format.sprintf "int(%s)" (key uses e)
+    | _ -> Ssa.expr_to_string expr
+  in
+
+  let candidate inst_id (stmt: Stmt.t) =
+    match stmt.spec, Ssa.uses_of t inst_id with
+    | Stmt.Expr (Expr.Assign (left, right)), Some uses
+      when not (Hash_set.mem t.mixed inst_id)
+        && is_arithmetic right
+        && is_pure right
+        && not (is_constant right) ->
+      Option.map
+        ~f:(fun var -> left, var, key uses right)
+        (Ssa.var_of_expr left)
+    | _ -> None
+  in
+
+  (* key -> the computations seen so far, inst id, the variable holding the value *)
+  let computed = Hashtbl.create (module String) in
+  let replaced = Hashtbl.create (module Int) in
+  Ssa.iter_body
+    ~f:(fun inst_id stmt ->
+      match candidate inst_id stmt with
+      | Some (left, var, value_key) -> (
+        let block_id = Hashtbl.find_exn t.inst_block inst_id in
+        let previous =
+          List.find
+            ~f:(fun (prev_id, prev_var, _) ->
+              Ssa.dominates t (Hashtbl.find_exn t.inst_block prev_id) block_id
+              && not (String.equal prev_var var)
+            )
+            (Hashtbl.find_multi computed value_key)
+        in
+        match previous with
+        | Some (_, _, prev_left) -> Hashtbl.set replaced ~key:inst_id ~data:prev_left
+        | None -> (
+          (* a temp assigned only once holds the value until the end *)
+          match left with
+          | Expr.Temp _ | Expr.Ident (SymTemp _) when Option.equal Int.equal (Hashtbl.find assign_count var) (Some 1) ->
+            Hashtbl.add_multi computed ~key:value_key ~data:(inst_id, var, left)
+          | _ -> ()
+        )
+      )
+      | None -> ()
+    )
+    body;
+
+  let f_expr inst_id (expr: Expr.t) =
+    match Hashtbl.find replaced inst_id, expr with
+    | Some prev_left, Expr.Assign (left, _) -> Expr.Assign (left, prev_left)
+    | _ -> expr
+  in
+
+  let body = Ssa.rewrite_body ~f_expr ~f_stmt:(fun _ stmt -> [stmt]) body in
+  { func with body = { func.body with body } }
+
+(* loop invariant code motion *)
+
+(* the loop can't change the state read by a pure reader *)
+let rec is_loop_safe_expr (expr: Expr.t) =
+  let open Expr in
+  let safe_children () = List.for_all ~f:is_loop_safe_expr (Ssa.children expr) in
+  match expr with
+  | Call (sym, _, _) when is_pure_reader sym -> safe_children ()
+  | Call _ | CallNative _ | CallLambda _ | CallLambdaDirect _ | Invoke _ | InitCall _ | InitStackCall _
+  | ArraySetValue _ | EnvSet _ ->
+    false
+  | Assign (left, right) ->
+    Option.is_some (Ssa.var_of_expr left) && is_loop_safe_expr right
+  | _ -> safe_children ()
+
+let rec is_loop_safe_stmts stmts =
+  List.for_all ~f:is_loop_safe_stmt stmts
+
+and is_loop_safe_stmt (stmt: Stmt.t) =
+  let open Stmt in
+  let rec is_loop_safe_if (if_spec: if_spec) =
+    is_loop_safe_expr if_spec.if_test
+    && is_loop_safe_stmts if_spec.if_consequent
+    && (
+      match if_spec.if_alternate with
+      | Some (If_alt_if alt) -> is_loop_safe_if alt
+      | Some (If_alt_block stmts) -> is_loop_safe_stmts stmts
+      | None -> true
+    )
+  in
+  match stmt.spec with
+  | Expr e | Retain e | Release e | Return (Some e) | TailCall e -> is_loop_safe_expr e
+  | If if_spec -> is_loop_safe_if if_spec
+  | While (test, block) -> is_loop_safe_expr test && is_loop_safe_stmts block.body
+  | WithLabel (_, stmts) -> is_loop_safe_stmts stmts
+  | Switch { switch_value; _ } -> is_loop_safe_expr switch_value
+  | VarDecl _ | Continue | Break | Label _ | Goto _ | Return None -> true
+
+let licm (func: Func.t) : Func.t =
+  let body = func.body.body in
+  let t = Ssa.build body in
+
+  (* the blocks of the natural loop, the header and the back edges *)
+  let loop_blocks header =
+    let in_loop = Hash_set.create (module Int) in
+    Hash_set.add in_loop header;
+    let rec walk block_id =
+      if not (Hash_set.mem in_loop block_id) && Ssa.is_reachable t block_id then (
+        Hash_set.add in_loop block_id;
+        List.iter ~f:walk t.blocks.(block_id).preds
+      )
+    in
+    List.iter
+      ~f:(fun pred -> if Ssa.dominates t header pred then walk pred)
+      t.blocks.(header).preds;
+    in_loop
+  in
+
+  let header_of_test test_id =
+    Array.find_map
+      ~f:(fun (block: Ssa.block) ->
+        match block.term with
+        | Some (Ssa.T_branch (id, _, _, _)) when id = test_id -> Some block.block_id
+        | _ -> None
+      )
+      t.blocks
+  in
+
+  (* the operands are defined before the loop *)
+  let invariant_operands uses in_loop (call: Expr.t) =
+    List.for_all
+      ~f:(fun (operand: Expr.t) ->
+        match operand with
+        | Expr.Ident SymThis -> true
+        | Expr.Ident _ | Expr.Temp _ -> (
+          match Option.bind (Ssa.var_of_expr operand) ~f:(Hashtbl.find uses) with
+          | Some def_id -> not (Hash_set.mem in_loop (Ssa.find_def t def_id).def_block)
+          | None -> false
+        )
+        | _ -> false
+      )
+      (Ssa.children call)
+  in
+
+  let tmp_count = ref func.tmp_vars_count in
+
+  (* inst id of the loop -> the hoisted calls and their temps *)
+  let hoisted = Hashtbl.create (module Int) in
+
+  let rec collect_calls acc (expr: Expr.t) =
+    match expr with
+    | Expr.Call (sym, _, _) when is_pure_reader sym -> expr::acc
+    | _ -> List.fold ~init:acc ~f:collect_calls (Ssa.children expr)
+  in
+
+  Ssa.iter_body
+    ~f:(fun inst_id stmt ->
+      match stmt.spec, Ssa.uses_of t inst_id, header_of_test inst_id with
+      | Stmt.While (test, _), Some uses, Some header
+        when not (Hash_set.mem t.mixed inst_id) && is_loop_safe_stmt stmt -> (
+        let in_loop = loop_blocks header in
+        let calls =
+          collect_calls [] test
+          |> List.rev
+          |> List.filter ~f:(invariant_operands uses in_loop)
+          |> List.dedup_and_sort ~compare:Poly.compare
+        in
+        if not (List.is_empty calls) then (
+          let temps =
+            List.map
+              ~f:(fun call ->
+                let tmp_id = !tmp_count in
+                tmp_count := tmp_id + 1;
+                call, tmp_id
+              )
+              calls
+          in
+          Hashtbl.set hoisted ~key:inst_id ~data:temps
+        )
+      )
+      | _ -> ()
+    )
+    body;
+
+  if Hashtbl.is_empty hoisted then
+    func
+  else (
+    (* the operands are not assigned in the loop, the calls are the same in the body *)
+    let rec replace temps (expr: Expr.t) =
+      match List.Assoc.find temps expr ~equal:Poly.equal with
+      | Some tmp_id -> Expr.Ident (SymTemp tmp_id)
+      | None -> Ssa.map_children ~f:(replace temps) expr
+    in
+    let f_stmt inst_id (stmt: Stmt.t) =
+      match Hashtbl.find hoisted inst_id, stmt.spec with
+      | Some temps, Stmt.While (test, block) ->
+        let hoist =
+          List.map
+            ~f:(fun (call, tmp_id) -> { stmt with spec = Stmt.Expr (Expr.Assign (Temp tmp_id, call)) })
+            temps
+        in
+        let block_body =
+          Inliner.map_stmts
+            ~f_stmt_expr:(replace temps)
+            ~on_return:(fun stmt expr_opt -> [Inliner.rebuild_return stmt expr_opt])
+            ~rename_label:Fn.id
+            block.body
+        in
+        List.append hoist [{ stmt with spec = Stmt.While (replace temps test, { block with body = block_body }) }]
+      | _ -> [stmt]
+    in
+    let body = Ssa.rewrite_body ~f_expr:(fun _ e -> e) ~f_stmt body in
+    { func with body = { func.body with body }; tmp_vars_count = !tmp_count }
+  )
+
+(* dead code elimination *)
+
+let dce (func: Func.t) : Func.t =
+  let body = func.body.body in
+  let t = Ssa.build body in
+
+  (* inst id -> def, the assignments which can be removed *)
+  let candidates = Hashtbl.create (module Int) in
+  Ssa.iter_body
+    ~f:(fun inst_id stmt ->
+      match stmt.spec, Hashtbl.find t.inst_defs inst_id with
+      | Stmt.Expr (Expr.Assign (left, right)), Some [def_id]
+        when Option.is_some (Ssa.var_of_expr left)
+          && is_pure right
+          && not (Hash_set.mem t.mixed inst_id) ->
+        Hashtbl.set candidates ~key:inst_id ~data:def_id
+      | _ -> ()
+    )
+    body;
+
+  let live = Hash_set.create (module Int) in
+  let worklist = Queue.create () in
+  let mark_live def_id =
+    if not (Hash_set.mem live def_id) then (
+      Hash_set.add live def_id;
+      Queue.enqueue worklist def_id
+    )
+  in
+  Hashtbl.iteri
+    ~f:(fun ~key:inst_id ~data:uses ->
+      if not (Hashtbl.mem candidates inst_id) then
+        Hashtbl.iter ~f:mark_live uses
+    )
+    t.uses;
+  while not (Queue.is_empty worklist) do
+    let def = Ssa.find_def t (Queue.dequeue_exn worklist) in
+    match def.def_kind with
+    | Ssa.Def_phi -> List.iter ~f:(fun (_, arg) -> mark_live arg) def.def_phi_args
+    | Ssa.Def_assign (inst_id, _) when Hashtbl.mem candidates inst_id ->
+      Option.iter ~f:(Hashtbl.iter ~f:mark_live) (Ssa.uses_of t inst_id)
+    | _ -> ()
+  done;
+
+  let f_stmt inst_id stmt =
+    match Hashtbl.find candidates inst_id with
+    | Some def_id when not (Hash_set.mem live def_id) -> []
+    | _ -> [stmt]
+  in
+  let body = Ssa.rewrite_body ~f_expr:(fun _ e -> e) ~f_stmt body in
+  { func with body = { func.body with body } }
+
+let passes = [
+  { pass_name = "sccp"; pass_run = sccp };
+  { pass_name = "cse"; pass_run = cse };
+  { pass_name = "licm"; pass_run = licm };
+  { pass_name = "dce"; pass_run = dce };
+]
+
+let dump_function stage (func: Func.t) =
+  let fun_name, _ = func.name in
+  Format.printf "=== %s: %s ===\n%s%!" stage fun_name (Ssa.dump (Ssa.build func.body.body))
+
+let optimize_function ~verbose ~dump_ir (func: Func.t) =
+  if dump_ir then dump_function "input" func;
+  List.fold
+    ~init:func
+    ~f:(fun func pass ->
+      let result = pass.pass_run func in
+      if verbose && not (Poly.equal result.body func.body) then (
+        let fun_name, _ = func.name in
+        Format.printf "- %s changed %s\n" pass.pass_name fun_name
+      );
+      if dump_ir then dump_function pass.pass_name result;
+      result
+    )
+    passes
+
+let optimize_declarations ?(verbose=false) ?(dump_ir=false) (decls: Decl.t list) : Decl.t list =
+  List.map
+    ~f:(fun (decl: Decl.t) ->
+      match decl.spec with
+      | Decl.Func func -> { decl with spec = Decl.Func (optimize_function ~verbose ~dump_ir func) }
+      | _ -> decl
+    )
+    decls
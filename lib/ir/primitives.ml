@@ -76,6 +76,28 @@ module Bin = struct
     | Mod -> "LC_I32_MOD"
     | _ -> failwith "unsupport binary op for f32"
 
+  (* the C operator used on unboxed primitives *)
+  let to_c_op (op: Asttypes.BinaryOp.t) =
+    match op with
+    | Equal -> "=="
+    | NotEqual -> "!="
+    | LessThan -> "<"
+    | LessThanEqual -> "<="
+    | GreaterThan -> ">"
+    | GreaterThanEqual -> ">="
+    | LShift -> "<<"
+    | RShift -> ">>"
+    | Plus -> "+"
+    | Minus -> "-"
+    | Mult -> "*"
+    | Div -> "/"
+    | Mod -> "%"
+    | BitOr -> "|"
+    | Xor -> "^"
+    | BitAnd -> "&"
+    | And -> "&&"
+    | Or -> "||"
+
   let to_cmp (op: Asttypes.BinaryOp.t) =
     match op with
     | Equal -> "LC_CMP_EQ"
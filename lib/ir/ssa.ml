@@ -0,0 +1,820 @@
+(*
+ * The CFG/SSA form of a function, used by the optimization passes.
+ *
+ * The IR stays structured, the CFG is built on the side:
+ *   - every statement gets an instruction id in pre-order,
+ *     the tests of `else if` get their own ids,
+ *   - a pass reads the SSA form and rewrites the structured body
+ *     through `rewrite_body`, which numbers the statements in the same order.
+ *
+ * The variables are the locals, the temps, the params and the return value.
+ * Every variable has a definition at the entry of the function,
+ * the phis are placed on the dominance frontiers.
+ *)
+open Core_kernel
+open Ir
+
+(* the name of the variable in C *)
+let var_of_symbol (sym: symbol) =
+  match sym with
+  | SymLocal "ret" | SymRet -> Some "ret"
+  | SymLocal name -> Some name
+  | SymTemp id -> Some (Format.sprintf "t[%d]" id)
+  | SymParam index -> Some (Format.sprintf "args[%d]" index)
+  | SymLambda _ | SymThis | SymLambdaThis -> None
+
+let var_of_expr (expr: Expr.t) =
+  match expr with
+  | Expr.Ident sym -> var_of_symbol sym
+  | Expr.Temp id -> var_of_symbol (SymTemp id)
+  | _ -> None
+
+let children (expr: Expr.t) : Expr.t list =
+  let open Expr in
+  match expr with
+  | Null | NewString _ | NewInt _ | NewFloat _ | NewChar _ | NewBoolean _
+  | NewEnv _ | EnvGet _ | NewArray _ | NewStaticArray _ | NewMap _ | InitCall _ | InitStackCall _
+  | Ident _ | Temp _ | RawGetField _
+    -> []
+
+  | NewLambda spec -> [spec.lambda_this]
+
+  | EnvSet (_, _, _, e) | Not e | TupleGetValue (e, _) | TagEqual (e, _)
+  | UnionGet (e, _) | IntValue e | GetField (e, _, _) | StringEqUtf8 (e, _)
+  | Retaining e
+    -> [e]
+
+  | ArrayGetValue (a, b) | Assign (a, b) | StringCmp (_, a, b)
+  | I32Binary (_, a, b) | F32Binary (_, a, b) | I64Binary (_, a, b) | F64Binary (_, a, b)
+    -> [a; b]
+
+  | ArraySetValue (a, b, c) -> [a; b; c]
+
+  | NewTuple exprs | NewStackTuple exprs -> exprs
+
+  | CallLambda (e, params) | CallLambdaDirect (_, e, params) | Invoke (e, _, params) ->
+    e::params
+
+  | Call (_, this_opt, params) | CallNative (_, _, this_opt, params) ->
+    List.append (Option.to_list this_opt) params
+
+(* map the direct children, the symbols are kept *)
+let map_children ~f (expr: Expr.t) : Expr.t =
+  let open Expr in
+  match expr with
+  | Null | NewString _ | NewInt _ | NewFloat _ | NewChar _ | NewBoolean _
+  | NewEnv _ | EnvGet _ | NewArray _ | NewStaticArray _ | NewMap _ | InitCall _ | InitStackCall _
+  | Ident _ | Temp _ | RawGetField _
+    -> expr
+
+  | NewLambda spec -> NewLambda { spec with lambda_this = f spec.lambda_this }
+  | EnvSet (sym, slot, name, e) -> EnvSet (sym, slot, name, f e)
+  | Not e -> Not (f e)
+  | TupleGetValue (e, index) -> TupleGetValue (f e, index)
+  | TagEqual (e, tag) -> TagEqual (f e, tag)
+  | UnionGet (e, index) -> UnionGet (f e, index)
+  | IntValue e -> IntValue (f e)
+  | GetField (e, cls_name, field_name) -> GetField (f e, cls_name, field_name)
+  | StringEqUtf8 (e, str) -> StringEqUtf8 (f e, str)
+  | Retaining e -> Retaining (f e)
+  | ArrayGetValue (a, b) -> ArrayGetValue (f a, f b)
+  | Assign (a, b) -> Assign (f a, f b)
+  | StringCmp (op, a, b) -> StringCmp (op, f a, f b)
+  | I32Binary (op, a, b) -> I32Binary (op, f a, f b)
+  | F32Binary (op, a, b) -> F32Binary (op, f a, f b)
+  | I64Binary (op, a, b) -> I64Binary (op, f a, f b)
+  | F64Binary (op, a, b) -> F64Binary (op, f a, f b)
+  | ArraySetValue (a, b, c) -> ArraySetValue (f a, f b, f c)
+  | NewTuple exprs -> NewTuple (List.map ~f exprs)
+  | NewStackTuple exprs -> NewStackTuple (List.map ~f exprs)
+  | CallLambda (e, params) -> CallLambda (f e, List.map ~f params)
+  | CallLambdaDirect (name, e, params) -> CallLambdaDirect (name, f e, List.map ~f params)
+  | Invoke (e, name, params) -> Invoke (f e, name, List.map ~f params)
+  | Call (sym, this_opt, params) -> Call (sym, Option.map ~f this_opt, List.map ~f params)
+  | CallNative (sym, native_sig, this_opt, params) ->
+    CallNative (sym, native_sig, Option.map ~f this_opt, List.map ~f params)
+
+(*
+ * Visit the variables of an expression in the order of evaluation,
+ * the value of an assignment is evaluated before the variable is defined.
+ *)
+let rec visit_expr ~on_use ~on_def (expr: Expr.t) =
+  let visit = visit_expr ~on_use ~on_def in
+  let use_sym sym = Option.iter ~f:on_use (var_of_symbol sym) in
+  match expr with
+  | Expr.Assign (left, right) -> (
+    visit right;
+    match var_of_expr left with
+    | Some var -> on_def var right
+    | None -> visit left
+  )
+
+  | Expr.Ident sym -> use_sym sym
+  | Expr.Temp id -> use_sym (SymTemp id)
+
+  | Expr.EnvGet (sym, _, _) -> use_sym sym
+  | Expr.RawGetField (name, _) -> on_use name
+  | Expr.EnvSet (sym, _, _, e) ->
+    use_sym sym;
+    visit e
+
+  | Expr.NewLambda spec ->
+    visit spec.lambda_this;
+    Array.iter ~f:use_sym spec.lambda_capture_symbols
+
+  | _ -> List.iter ~f:visit (children expr)
+
+type inst =
+  | I_eval of int * Expr.t  (* id, an expression evaluated for its effects *)
+  | I_decl of int * string list  (* id, the declared locals, their values are undefined *)
+
+type terminator =
+  | T_jump of int
+  | T_branch of int * Expr.t * int * int  (* id, test, then block, else block *)
+  | T_switch of int * Expr.t * int list  (* id, value, target blocks *)
+  | T_exit of int * Expr.t option  (* id, returned value *)
+
+type block = {
+  block_id: int;
+  mutable insts: inst list;
+  mutable term: terminator option;
+  mutable preds: int list;
+}
+
+type def_kind =
+  | Def_entry
+  | Def_decl of int  (* inst id *)
+  | Def_assign of int * Expr.t  (* inst id, assigned value *)
+  | Def_phi
+
+type def = {
+  def_id: int;
+  def_var: string;
+  def_block: int;
+  def_kind: def_kind;
+  (* pred block -> def, only for a phi *)
+  mutable def_phi_args: (int * int) list;
+}
+
+type t = {
+  blocks: block array;
+
+  (* the reachable blocks in reverse postorder *)
+  rpo: int list;
+
+  (* the immediate dominators, -1 for an unreachable block *)
+  idom: int array;
+  dom_children: int list array;
+
+  defs: (int, def) Hashtbl.t;
+  phis: int list array;
+
+  (* inst id -> var -> the def reaching the instruction *)
+  uses: (int, (string, int) Hashtbl.t) Hashtbl.t;
+
+  (* inst id -> the defs of the instruction *)
+  inst_defs: (int, int list) Hashtbl.t;
+
+  (* inst id -> block *)
+  inst_block: (int, int) Hashtbl.t;
+
+  (* the instructions reading a variable after defining it, their uses are not precise *)
+  mixed: int Hash_set.t;
+}
+
+let succs (block: block) =
+  match block.term with
+  | Some (T_jump target) -> [target]
+  | Some (T_branch (_, _, then_block, else_block)) -> [then_block; else_block]
+  | Some (T_switch (_, _, targets)) -> targets
+  | Some (T_exit _) | None -> []
+
+let term_inst (block: block) =
+  match block.term with
+  | Some (T_branch (id, test, _, _)) -> Some (id, Some test)
+  | Some (T_switch (id, value, _)) -> Some (id, Some value)
+  | Some (T_exit (id, e_opt)) -> Some (id, e_opt)
+  | Some (T_jump _) | None -> None
+
+(* building the CFG *)
+
+type builder = {
+  mutable all_blocks: block list;
+  mutable blocks_count: int;
+  mutable current: block;
+  labels: (string, int) Hashtbl.t;
+  (* header, exit *)
+  mutable loops: (int * int) list;
+  mutable inst_counter: int;
+  b_inst_block: (int, int) Hashtbl.t;
+}
+
+let new_block b =
+  let block = {
+    block_id = b.blocks_count;
+    insts = [];
+    term = None;
+    preds = [];
+  } in
+  b.blocks_count <- b.blocks_count + 1;
+  b.all_blocks <- block::b.all_blocks;
+  block
+
+let find_block b id =
+  List.find_exn ~f:(fun block -> block.block_id = id) b.all_blocks
+
+let label_block b label =
+  match Hashtbl.find b.labels label with
+  | Some id -> id
+  | None ->
+    let block = new_block b in
+    Hashtbl.set b.labels ~key:label ~data:block.block_id;
+    block.block_id
+
+let fresh_inst b =
+  let id = b.inst_counter in
+  b.inst_counter <- b.inst_counter + 1;
+  id
+
+let emit b inst id =
+  Hashtbl.set b.b_inst_block ~key:id ~data:b.current.block_id;
+  b.current.insts <- inst::b.current.insts
+
+let terminate b ?id term =
+  Option.iter ~f:(fun id -> Hashtbl.set b.b_inst_block ~key:id ~data:b.current.block_id) id;
+  if Option.is_none b.current.term then
+    b.current.term <- Some term
+
+let switch_to b (block: block) =
+  b.current <- block
+
+(* start a block after a jump, it's reachable only by a label *)
+let continue_unreachable b =
+  switch_to b (new_block b)
+
+let rec build_stmts b stmts =
+  List.iter ~f:(build_stmt b) stmts
+
+and build_stmt b (stmt: Stmt.t) =
+  let open Stmt in
+  let id = fresh_inst b in
+  match stmt.spec with
+  | Expr e | Retain e | Release e ->
+    emit b (I_eval (id, e)) id
+
+  | VarDecl decls ->
+    emit b (I_decl (id, List.map ~f:fst decls)) id
+
+  | If if_spec -> build_if b id if_spec
+
+  | While (test, block) -> (
+    let header = new_block b in
+    let body = new_block b in
+    let exit = new_block b in
+    terminate b (T_jump header.block_id);
+    switch_to b header;
+    terminate b ~id (T_branch (id, test, body.block_id, exit.block_id));
+    switch_to b body;
+    b.loops <- (header.block_id, exit.block_id)::b.loops;
+    build_stmts b block.body;
+    b.loops <- List.tl_exn b.loops;
+    terminate b (T_jump header.block_id);
+    switch_to b exit
+  )
+
+  | Continue ->
+    let header, _ = List.hd_exn b.loops in
+    terminate b (T_jump header);
+    continue_unreachable b
+
+  | Break ->
+    let _, exit = List.hd_exn b.loops in
+    terminate b (T_jump exit);
+    continue_unreachable b
+
+  | WithLabel (label, stmts) ->
+    build_stmts b stmts;
+    let target = label_block b label in
+    terminate b (T_jump target);
+    switch_to b (find_block b target)
+
+  | Label label ->
+    let target = label_block b label in
+    terminate b (T_jump target);
+    switch_to b (find_block b target)
+
+  | Goto label ->
+    terminate b (T_jump (label_block b label));
+    continue_unreachable b
+
+  | Switch { switch_value; switch_cases; switch_default; _ } ->
+    let targets =
+      List.map ~f:(fun (_, label) -> label_block b label) switch_cases
+    in
+    terminate b ~id (T_switch (id, switch_value, List.append targets [label_block b switch_default]));
+    continue_unreachable b
+
+  | Return e_opt ->
+    terminate b ~id (T_exit (id, e_opt));
+    continue_unreachable b
+
+  | TailCall e ->
+    terminate b ~id (T_exit (id, Some e));
+    continue_unreachable b
+
+and build_if b id (if_spec: Stmt.if_spec) =
+  let open Stmt in
+  let then_block = new_block b in
+  let else_block = new_block b in
+  let join = new_block b in
+  terminate b ~id (T_branch (id, if_spec.if_test, then_block.block_id, else_block.block_id));
+  switch_to b then_block;
+  build_stmts b if_spec.if_consequent;
+  terminate b (T_jump join.block_id);
+  switch_to b else_block;
+  (match if_spec.if_alternate with
+  | Some (If_alt_if alt) ->
+    let alt_id = fresh_inst b in
+    build_if b alt_id alt
+  | Some (If_alt_block stmts) -> build_stmts b stmts
+  | None -> ());
+  terminate b (T_jump join.block_id);
+  switch_to b join
+
+(*
+ * Rewrite the structured body, the ids are the ones of the CFG.
+ * `f_expr` maps the expressions of an instruction,
+ * `f_stmt` replaces a statement after its children are rewritten.
+ *)
+let rewrite_body ~f_expr ~f_stmt stmts =
+  let counter = ref 0 in
+  let fresh () =
+    let id = !counter in
+    counter := id + 1;
+    id
+  in
+  let rec rewrite_stmts stmts =
+    List.concat_map ~f:rewrite_stmt stmts
+
+  and rewrite_stmt (stmt: Stmt.t) =
+    let open Stmt in
+    let id = fresh () in
+    let spec =
+      match stmt.spec with
+      | Expr e -> Expr (f_expr id e)
+      | Retain e -> Retain (f_expr id e)
+      | Release e -> Release (f_expr id e)
+      | If if_spec -> If (rewrite_if id if_spec)
+      | While (test, block) ->
+        let test = f_expr id test in
+        While (test, { block with body = rewrite_stmts block.body })
+      | WithLabel (label, stmts) -> WithLabel (label, rewrite_stmts stmts)
+      | Switch switch_spec ->
+        Switch { switch_spec with switch_value = f_expr id switch_spec.switch_value }
+      | Return e_opt -> Return (Option.map ~f:(f_expr id) e_opt)
+      | TailCall e -> TailCall (f_expr id e)
+      | VarDecl _ | Continue | Break | Label _ | Goto _ -> stmt.spec
+    in
+    f_stmt id { stmt with spec }
+
+  and rewrite_if id (if_spec: Stmt.if_spec) : Stmt.if_spec =
+    let open Stmt in
+    let if_test = f_expr id if_spec.if_test in
+    let if_consequent = rewrite_stmts if_spec.if_consequent in
+    let if_alternate =
+      match if_spec.if_alternate with
+      | Some (If_alt_if alt) ->
+        let alt_id = fresh () in
+        Some (Stmt.If_alt_if (rewrite_if alt_id alt))
+      | Some (If_alt_block stmts) -> Some (Stmt.If_alt_block (rewrite_stmts stmts))
+      | None -> None
+    in
+    { if_test; if_consequent; if_alternate }
+  in
+  rewrite_stmts stmts
+
+let iter_body ~f stmts =
+  ignore (rewrite_body ~f_expr:(fun _ e -> e) ~f_stmt:(fun id stmt -> f id stmt; [stmt]) stmts)
+
+(* dominators, Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm" *)
+
+let compute_rpo (blocks: block array) =
+  let visited = Array.create ~len:(Array.length blocks) false in
+  let order = ref [] in
+  let rec dfs id =
+    if not visited.(id) then (
+      visited.(id) <- true;
+      List.iter ~f:dfs (succs blocks.(id));
+      order := id::!order
+    )
+  in
+  dfs 0;
+  !order
+
+let compute_idom (blocks: block array) rpo =
+  let len = Array.length blocks in
+  let rpo_index = Array.create ~len (-1) in
+  List.iteri ~f:(fun index id -> rpo_index.(id) <- index) rpo;
+  let idom = Array.create ~len (-1) in
+  idom.(0) <- 0;
+  let rec intersect b1 b2 =
+    if b1 = b2 then b1
+    else if rpo_index.(b1) > rpo_index.(b2) then intersect idom.(b1) b2
+    else intersect b1 idom.(b2)
+  in
+  let changed = ref true in
+  while !changed do
+    changed := false;
+    List.iter
+      ~f:(fun id ->
+        if id <> 0 then (
+          let processed = List.filter ~f:(fun pred -> idom.(pred) >= 0) blocks.(id).preds in
+          match processed with
+          | [] -> ()
+          | first::rest ->
+            let new_idom = List.fold ~init:first ~f:intersect rest in
+            if idom.(id) <> new_idom then (
+              idom.(id) <- new_idom;
+              changed := true
+            )
+        )
+      )
+      rpo
+  done;
+  idom
+
+let dominates t a b =
+  let rec walk b =
+    if a = b then true
+    else if b = 0 || t.idom.(b) < 0 then false
+    else walk t.idom.(b)
+  in
+  t.idom.(b) >= 0 && walk b
+
+let is_reachable t block_id = t.idom.(block_id) >= 0
+
+let build (body: Stmt.t list) : t =
+  let entry = {
+    block_id = 0;
+    insts = [];
+    term = None;
+    preds = [];
+  } in
+  let b = {
+    all_blocks = [entry];
+    blocks_count = 1;
+    current = entry;
+    labels = Hashtbl.create (module String);
+    loops = [];
+    inst_counter = 0;
+    b_inst_block = Hashtbl.create (module Int);
+  } in
+  build_stmts b body;
+  terminate b (T_exit (-1, None));
+
+  let blocks = Array.of_list_rev b.all_blocks in
+  Array.iter ~f:(fun block -> block.insts <- List.rev block.insts) blocks;
+  Array.iter
+    ~f:(fun block ->
+      List.iter
+        ~f:(fun succ -> blocks.(succ).preds <- block.block_id::blocks.(succ).preds)
+        (succs block)
+    )
+    blocks;
+
+  let len = Array.length blocks in
+  let rpo = compute_rpo blocks in
+  let idom = compute_idom blocks rpo in
+  let dom_children = Array.create ~len [] in
+  List.iter
+    ~f:(fun id ->
+      if id <> 0 then
+        dom_children.(idom.(id)) <- id::dom_children.(idom.(id))
+    )
+    (List.rev rpo);
+
+  let t = {
+    blocks;
+    rpo;
+    idom;
+    dom_children;
+    defs = Hashtbl.create (module Int);
+    phis = Array.create ~len [];
+    uses = Hashtbl.create (module Int);
+    inst_defs = Hashtbl.create (module Int);
+    inst_block = b.b_inst_block;
+    mixed = Hash_set.create (module Int);
+  } in
+
+  let new_def var block_id kind =
+    let def_id = Hashtbl.length t.defs in
+    Hashtbl.set t.defs ~key:def_id ~data:{
+      def_id;
+      def_var = var;
+      def_block = block_id;
+      def_kind = kind;
+      def_phi_args = [];
+    };
+    def_id
+  in
+
+  (* the blocks defining a variable *)
+  let def_blocks = Hashtbl.create (module String) in
+  let add_def_block var block_id =
+    Hashtbl.update def_blocks var ~f:(fun prev ->
+      let prev = Option.value ~default:[] prev in
+      if List.mem prev block_id ~equal:Int.equal then prev else block_id::prev
+    )
+  in
+  let visit_vars block_id expr =
+    visit_expr
+      ~on_use:(fun var -> if not (Hashtbl.mem def_blocks var) then Hashtbl.set def_blocks ~key:var ~data:[])
+      ~on_def:(fun var _ -> add_def_block var block_id)
+      expr
+  in
+  List.iter
+    ~f:(fun block_id ->
+      let block = blocks.(block_id) in
+      List.iter
+        ~f:(function
+          | I_eval (_, e) -> visit_vars block_id e
+          | I_decl (_, names) -> List.iter ~f:(fun name -> add_def_block name block_id) names
+        )
+        block.insts;
+      Option.iter ~f:(fun (_, e_opt) -> Option.iter ~f:(visit_vars block_id) e_opt) (term_inst block)
+    )
+    rpo;
+
+  (* dominance frontiers *)
+  let frontiers = Array.create ~len [] in
+  List.iter
+    ~f:(fun id ->
+      let preds = List.filter ~f:(fun pred -> idom.(pred) >= 0) blocks.(id).preds in
+      if List.length preds >= 2 then
+        List.iter
+          ~f:(fun pred ->
+            let runner = ref pred in
+            while !runner <> idom.(id) do
+              if not (List.mem frontiers.(!runner) id ~equal:Int.equal) then
+                frontiers.(!runner) <- id::frontiers.(!runner);
+              runner := idom.(!runner)
+            done
+          )
+          preds
+    )
+    rpo;
+
+  (* place the phis, every variable is defined at the entry *)
+  let phi_vars = Array.create ~len [] in
+  Hashtbl.iteri
+    ~f:(fun ~key:var ~data:blocks_of_var ->
+      let worklist = Queue.of_list (0::blocks_of_var) in
+      let has_phi = Hash_set.create (module Int) in
+      while not (Queue.is_empty worklist) do
+        let block_id = Queue.dequeue_exn worklist in
+        List.iter
+          ~f:(fun frontier ->
+            if not (Hash_set.mem has_phi frontier) then (
+              Hash_set.add has_phi frontier;
+              phi_vars.(frontier) <- var::phi_vars.(frontier);
+              Queue.enqueue worklist frontier
+            )
+          )
+          frontiers.(block_id)
+      done
+    )
+    def_blocks;
+
+  (* rename *)
+  let stacks = Hashtbl.create (module String) in
+  let push var def_id =
+    Hashtbl.update stacks var ~f:(fun prev -> def_id::(Option.value ~default:[] prev))
+  in
+  let pop var =
+    Hashtbl.update stacks var ~f:(fun prev -> List.tl_exn (Option.value_exn prev))
+  in
+  let top var = List.hd_exn (Hashtbl.find_exn stacks var) in
+  Hashtbl.iter_keys
+    ~f:(fun var -> push var (new_def var 0 Def_entry))
+    def_blocks;
+
+  List.iter
+    ~f:(fun id ->
+      t.phis.(id) <- List.map ~f:(fun var -> new_def var id Def_phi) phi_vars.(id)
+    )
+    rpo;
+
+  let rec rename block_id =
+    let block = blocks.(block_id) in
+    let pushed = ref [] in
+    let define var def_id =
+      push var def_id;
+      pushed := var::!pushed
+    in
+    List.iter
+      ~f:(fun def_id -> define (Hashtbl.find_exn t.defs def_id).def_var def_id)
+      t.phis.(block_id);
+
+    let rename_inst id expr =
+      let uses = Hashtbl.create (module String) in
+      let defined = Hash_set.create (module String) in
+      let inst_defs = ref [] in
+      visit_expr
+        ~on_use:(fun var ->
+          if Hash_set.mem defined var then
+            Hash_set.add t.mixed id
+          else if not (Hashtbl.mem uses var) then
+            Hashtbl.set uses ~key:var ~data:(top var)
+        )
+        ~on_def:(fun var value ->
+          let def_id = new_def var block_id (Def_assign (id, value)) in
+          Hash_set.add defined var;
+          inst_defs := def_id::!inst_defs;
+          define var def_id
+        )
+        expr;
+      Hashtbl.set t.uses ~key:id ~data:uses;
+      Hashtbl.set t.inst_defs ~key:id ~data:(List.rev !inst_defs)
+    in
+
+    List.iter
+      ~f:(function
+        | I_eval (id, e) -> rename_inst id e
+        | I_decl (id, names) ->
+          let defs = List.map ~f:(fun name -> new_def name block_id (Def_decl id)) names in
+          List.iter2_exn ~f:define names defs;
+          Hashtbl.set t.uses ~key:id ~data:(Hashtbl.create (module String));
+          Hashtbl.set t.inst_defs ~key:id ~data:defs
+      )
+      block.insts;
+
+    (match term_inst block with
+    | Some (id, Some e) -> rename_inst id e
+    | Some (id, None) when id >= 0 -> rename_inst id Expr.Null
+    | _ -> ());
+
+    List.iter
+      ~f:(fun succ ->
+        List.iter
+          ~f:(fun phi_id ->
+            let phi = Hashtbl.find_exn t.defs phi_id in
+            phi.def_phi_args <- (block_id, top phi.def_var)::phi.def_phi_args
+          )
+          t.phis.(succ)
+      )
+      (succs block);
+
+    List.iter ~f:rename t.dom_children.(block_id);
+    List.iter ~f:pop !pushed
+  in
+  rename 0;
+  t
+
+(* the uses of the instruction, None if it's unreachable *)
+let uses_of t inst_id = Hashtbl.find t.uses inst_id
+
+let find_def t def_id = Hashtbl.find_exn t.defs def_id
+
+(* def -> the instructions and the phis using it *)
+type user =
+  | User_inst of int
+  | User_phi of int
+
+let compute_users t =
+  let users = Hashtbl.create (module Int) in
+  let add def_id user =
+    Hashtbl.add_multi users ~key:def_id ~data:user
+  in
+  Hashtbl.iteri
+    ~f:(fun ~key:inst_id ~data:uses ->
+      Hashtbl.iter ~f:(fun def_id -> add def_id (User_inst inst_id)) uses
+    )
+    t.uses;
+  Hashtbl.iter
+    ~f:(fun def ->
+      List.iter ~f:(fun (_, arg) -> add arg (User_phi def.def_id)) def.def_phi_args
+    )
+    t.defs;
+  users
+
+(* printing, for --dump-ir *)
+
+let rec expr_to_string (expr: Expr.t) =
+  let open Expr in
+  let list exprs = String.concat ~sep:", " (List.map ~f:expr_to_string exprs) in
+  let sym_name sym =
+    match var_of_symbol sym with
+    | Some name -> name
+    | None -> (
+      match sym with
+      | SymLambda (index, _) -> Format.sprintf "lambda[%d]" index
+      | SymLambdaThis -> "lambda_this"
+      | _ -> "this"
+    )
+  in
+  let call_name sym =
+    match sym with
+    | SymLocal name -> name
+    | _ -> sym_name sym
+  in
+  match expr with
+  | Null -> "null"
+  | NewString str -> Format.sprintf "%S" str
+  | NewInt i -> i
+  | NewFloat f -> f
+  | NewChar ch -> Format.sprintf "'\\u%04x'" ch
+  | NewBoolean bl -> Bool.to_string bl
+  | NewLambda spec -> Format.sprintf "lambda %s" spec.lambda_name
+  | NewEnv size -> Format.sprintf "env(%d)" size
+  | EnvGet (sym, slot, _) -> Format.sprintf "%s.env[%d]" (sym_name sym) slot
+  | EnvSet (sym, slot, _, e) -> Format.sprintf "%s.env[%d] = %s" (sym_name sym) slot (expr_to_string e)
+  | NewArray len -> Format.sprintf "array(%d)" len
+  | NewStaticArray (name, len) -> Format.sprintf "array(%s, %d)" name len
+  | NewTuple exprs -> Format.sprintf "tuple(%s)" (list exprs)
+  | NewStackTuple exprs -> Format.sprintf "stack tuple(%s)" (list exprs)
+  | NewMap size -> Format.sprintf "map(%d)" size
+  | Not e -> Format.sprintf "!%s" (expr_to_string e)
+  | TupleGetValue (e, index) -> Format.sprintf "%s.%d" (expr_to_string e) index
+  | ArrayGetValue (a, b) -> Format.sprintf "%s[%s]" (expr_to_string a) (expr_to_string b)
+  | ArraySetValue (a, b, c) ->
+    Format.sprintf "%s[%s] = %s" (expr_to_string a) (expr_to_string b) (expr_to_string c)
+  | I32Binary (op, a, b) | F32Binary (op, a, b) | I64Binary (op, a, b) | F64Binary (op, a, b)
+  | StringCmp (op, a, b) ->
+    Format.sprintf "(%s %s %s)" (expr_to_string a) (Primitives.Bin.to_c_op op) (expr_to_string b)
+  | CallLambda (e, params) | CallLambdaDirect (_, e, params) ->
+    Format.sprintf "%s(%s)" (expr_to_string e) (list params)
+  | Invoke (e, name, params) -> Format.sprintf "%s.%s(%s)" (expr_to_string e) name (list params)
+  | Assign (a, b) -> Format.sprintf "%s = %s" (expr_to_string a) (expr_to_string b)
+  | Call (sym, this_opt, params) | CallNative (sym, _, this_opt, params) ->
+    Format.sprintf "%s(%s)" (call_name sym) (list (List.append (Option.to_list this_opt) params))
+  | InitCall (sym, _) -> Format.sprintf "init %s" (call_name sym)
+  | InitStackCall (sym, _) -> Format.sprintf "stack init %s" (call_name sym)
+  | Ident sym -> sym_name sym
+  | Temp id -> sym_name (SymTemp id)
+  | TagEqual (e, tag) -> Format.sprintf "tag(%s) == %d" (expr_to_string e) tag
+  | UnionGet (e, index) -> Format.sprintf "%s.union[%d]" (expr_to_string e) index
+  | IntValue e -> Format.sprintf "int(%s)" (expr_to_string e)
+  | GetField (e, _, field) -> Format.sprintf "%s->%s" (expr_to_string e) field
+  | RawGetField (name, field) -> Format.sprintf "%s->%s" name field
+  | StringEqUtf8 (e, str) -> Format.sprintf "(%s == %S)" (expr_to_string e) str
+  | Retaining e -> Format.sprintf "retain(%s)" (expr_to_string e)
+
+let dump t =
+  let buf = Buffer.create 256 in
+  let pr fmt = Printf.bprintf buf fmt in
+  let def_name def_id =
+    let def = find_def t def_id in
+    Format.sprintf "%s.%d" def.def_var def_id
+  in
+  let print_uses id =
+    match uses_of t id with
+    | Some uses when not (Hashtbl.is_empty uses) ->
+      let names = List.map ~f:(fun (_, def_id) -> def_name def_id) (Hashtbl.to_alist uses) in
+      pr "  ; %s" (String.concat ~sep:" " (List.sort ~compare:String.compare names))
+    | _ -> ()
+  in
+  List.iter
+    ~f:(fun block_id ->
+      let block = t.blocks.(block_id) in
+      pr "  b%d: ; preds %s\n" block_id
+        (String.concat ~sep:" " (List.map ~f:(Format.sprintf "b%d") block.preds));
+      List.iter
+        ~f:(fun phi_id ->
+          let phi = find_def t phi_id in
+          let args =
+            List.map
+              ~f:(fun (pred, arg) -> Format.sprintf "b%d: %s" pred (def_name arg))
+              (List.rev phi.def_phi_args)
+          in
+          pr "    %s = phi(%s)\n" (def_name phi_id) (String.concat ~sep:", " args)
+        )
+        t.phis.(block_id);
+      List.iter
+        ~f:(function
+          | I_eval (id, e) ->
+            pr "    %%%d %s" id (expr_to_string e);
+            print_uses id;
+            pr "\n"
+          | I_decl (id, names) ->
+            pr "    %%%d decl %s\n" id (String.concat ~sep:", " names)
+        )
+        block.insts;
+      (match block.term with
+      | Some (T_jump target) -> pr "    jump b%d\n" target
+      | Some (T_branch (id, test, then_block, else_block)) ->
+        pr "    %%%d branch %s b%d b%d" id (expr_to_string test) then_block else_block;
+        print_uses id;
+        pr "\n"
+      | Some (T_switch (id, value, targets)) ->
+        pr "    %%%d switch %s %s" id (expr_to_string value)
+          (String.concat ~sep:" " (List.map ~f:(Format.sprintf "b%d") targets));
+        print_uses id;
+        pr "\n"
+      | Some (T_exit (id, e_opt)) ->
+        pr "    %%%d exit %s" id (Option.value_map ~default:"" ~f:expr_to_string e_opt);
+        print_uses id;
+        pr "\n"
+      | None -> ())
+    )
+    t.rpo;
+  Buffer.contents buf
@@ -0,0 +1,360 @@
+(*
+ * Rewrite the calls in tail position on the IR.
+ *
+ * A call is in tail position if the statements after it only release
+ * the values of the frame and return its result,
+ * through the assignments to "ret", the ends of the branches and the gotos of a match.
+ *
+ * A tail call to the function itself is turned into a jump to the beginning:
+ *   - the new arguments are evaluated into temps before anything is released,
+ *   - the releases on the way to the return are run,
+ *   - the params are replaced by the new arguments and the temps are reset.
+ *
+ * The params of a generic function are borrowed from the caller,
+ * but a new argument may be owned by the frame, which is released before the jump.
+ * So the params of a looping generic function are copied into temps and retained at the entry,
+ * the old values are released when they are replaced, and on returning.
+ * The params of a native function are primitives in a local array, they are written in place.
+ *
+ * A tail call to another function with the same C signature is returned with LC_MUSTTAIL,
+ * so the mutually recursive functions run in constant stack.
+ * A generic call passes the arguments in an array on the stack of the caller,
+ * only the generic calls without arguments can be returned this way.
+ *)
+open Core_kernel
+open Ir
+
+let loop_label = "tail_loop"
+
+type cont =
+  | Not_tail
+  (* the symbol returned, none if the result is dropped, and the releases before returning *)
+  | Tail of symbol option * Stmt.t list
+
+type t = {
+  verbose: bool;
+  (* the generic functions of the program, can be the target of a generic tail call *)
+  generic_functions: string Hash_set.t;
+}
+
+type func_ctx = {
+  fun_name: string;
+  native: Func.native_sig option;
+  origin_tmp_count: int;
+  (* the number of arguments of the self calls, none if it can't loop *)
+  loop_arity: int option;
+  mutable tmp_count: int;
+  mutable self_calls: int;
+  mutable sibling_calls: int;
+}
+
+let mk_stmt spec = { Stmt. spec; loc = Lichenscript_lex.Loc.none }
+
+let assign sym expr = mk_stmt (Stmt.Expr (Expr.Assign (Expr.Ident sym, expr)))
+
+let new_tmp ctx =
+  let id = ctx.tmp_count in
+  ctx.tmp_count <- id + 1;
+  SymTemp id
+
+let same_symbol (left: symbol) (right: symbol) =
+  match left, right with
+  | SymLocal l, SymLocal r -> String.equal l r
+  | SymTemp l, SymTemp r
+  | SymParam l, SymParam r -> l = r
+  | SymLambda (l, _), SymLambda (r, _) -> l = r
+  | SymThis, SymThis
+  | SymLambdaThis, SymLambdaThis -> true
+  | _ -> Inliner.is_ret_symbol left && Inliner.is_ret_symbol right
+
+let value_symbol (expr: Expr.t) =
+  match expr with
+  | Expr.Ident sym -> Some sym
+  | Expr.Temp id -> Some (SymTemp id)
+  | _ -> None
+
+let mentions (sym: symbol) (expr: Expr.t) =
+  let found = ref false in
+  Inliner.iter_expr
+    ~f:(fun e ->
+      match value_symbol e with
+      | Some s when same_symbol s sym -> found := true
+      | _ -> ()
+    )
+    expr;
+  !found
+
+let stmt_mentions (sym: symbol) (stmt: Stmt.t) =
+  match stmt.spec with
+  | Stmt.Release e -> mentions sym e
+  | _ -> true
+
+let returns_unit ctx =
+  match ctx.native with
+  | Some { Func.native_ret = Func.Native_unit; _ } -> true
+  | _ -> false
+
+(*
+ * A self tail call can be turned into a loop
+ * if the params are only read by the statements,
+ * the lambdas and the environments may keep them.
+ *)
+let loop_arity (func: Func.t) =
+  let fun_name, _ = func.name in
+  let ok = ref true in
+  let arity = ref None in
+  let check_expr (expr: Expr.t) =
+    let open Expr in
+    match expr with
+    | NewLambda _ | NewEnv _ | CallLambdaDirect _ | Ident (SymLambda _) -> ok := false
+    | Call (SymLocal name, _, params)
+    | CallNative (SymLocal name, _, _, params) when String.equal name fun_name -> (
+      let len = List.length params in
+      match !arity with
+      | Some a when a <> len -> ok := false
+      | _ -> arity := Some len
+    )
+    | _ -> ()
+  in
+  Inliner.iter_stmts ~f:check_expr func.body.body;
+  if !ok then !arity else None
+
+let same_native_sig (caller: Func.native_sig) (callee: Func.native_sig) =
+  not caller.native_has_this &&
+  not callee.native_has_this &&
+  Poly.equal caller.native_params callee.native_params &&
+  Poly.equal caller.native_ret callee.native_ret
+
+let self_call_this (this_opt: Expr.t option) =
+  match this_opt with
+  | None
+  | Some (Expr.Ident SymThis) -> true
+  | _ -> false
+
+let rewrite_self_call ctx ~releases params : Stmt.t list =
+  let generic = Option.is_none ctx.native in
+  let staged = List.map ~f:(fun _ -> new_tmp ctx) params in
+  let arity = List.length params in
+  ctx.self_calls <- ctx.self_calls + 1;
+  List.concat [
+    List.map2_exn ~f:assign staged params;
+    (if generic then List.map ~f:(fun sym -> mk_stmt (Stmt.Retain (Expr.Ident sym))) staged else []);
+    releases;
+    (if generic then List.init arity ~f:(fun index -> mk_stmt (Stmt.Release (Expr.Ident (SymParam index)))) else []);
+    List.mapi ~f:(fun index sym -> assign (SymParam index) (Expr.Ident sym)) staged;
+    (* the temps are expected to be null at the beginning *)
+    List.init ctx.origin_tmp_count ~f:(fun index -> assign (SymTemp index) Expr.Null);
+    [mk_stmt (Stmt.Goto loop_label)];
+  ]
+
+let rewrite_sibling_call ctx ~releases (call: Expr.t) : Stmt.t list =
+  ctx.sibling_calls <- ctx.sibling_calls + 1;
+  match releases, call with
+  | _::_, Expr.CallNative (sym, native_sig, None, params) ->
+    (* the arguments may read the values released *)
+    let staged = List.map ~f:(fun _ -> new_tmp ctx) params in
+    let staged_call = Expr.CallNative (sym, native_sig, None, List.map ~f:(fun s -> Expr.Ident s) staged) in
+    List.concat [
+      List.map2_exn ~f:assign staged params;
+      releases;
+      [mk_stmt (Stmt.TailCall staged_call)];
+    ]
+
+  | _ -> List.append releases [mk_stmt (Stmt.TailCall call)]
+
+let try_tail_call env ctx ~releases (call: Expr.t) : Stmt.t list option =
+  match ctx.native, call with
+  | _, Expr.Call (SymLocal name, this_opt, params)
+  | _, Expr.CallNative (SymLocal name, _, this_opt, params) when String.equal name ctx.fun_name -> (
+    match ctx.loop_arity with
+    | Some arity when arity = List.length params && self_call_this this_opt ->
+      Some (rewrite_self_call ctx ~releases params)
+    | _ -> None
+  )
+
+  | Some caller_sig, Expr.CallNative (SymLocal _, callee_sig, None, _)
+    when same_native_sig caller_sig callee_sig ->
+    Some (rewrite_sibling_call ctx ~releases call)
+
+  | None, Expr.Call (SymLocal name, None, [])
+    when Hash_set.mem env.generic_functions name ->
+    Some (rewrite_sibling_call ctx ~releases call)
+
+  | _ -> None
+
+(* the statements are walked backward, the continuation is the rest of the function *)
+let rec rewrite_stmts env ctx labels cont stmts : Stmt.t list =
+  let _, stmts =
+    List.fold_right
+      ~init:(cont, [])
+      ~f:(fun stmt (cont, acc) ->
+        let stmts, cont = rewrite_stmt env ctx labels cont stmt in
+        cont, List.append stmts acc
+      )
+      stmts
+  in
+  stmts
+
+and rewrite_stmt env ctx labels cont (stmt: Stmt.t) : Stmt.t list * cont =
+  let open Stmt in
+  (* the call is in tail position if its result is returned, or dropped *)
+  let tail_call ?dst call =
+    match cont, dst with
+    | Tail (Some ret, releases), Some dst when same_symbol dst ret ->
+      try_tail_call env ctx ~releases call
+    | Tail (None, releases), Some dst when not (List.exists ~f:(stmt_mentions dst) releases) ->
+      try_tail_call env ctx ~releases call
+    | Tail (None, releases), None ->
+      try_tail_call env ctx ~releases call
+    | _ -> None
+  in
+  let rec rewrite_if (if_spec: if_spec) = {
+    if_spec with
+    if_consequent = rewrite_stmts env ctx labels cont if_spec.if_consequent;
+    if_alternate =
+      match if_spec.if_alternate with
+      | Some (If_alt_if alt) -> Some (If_alt_if (rewrite_if alt))
+      | Some (If_alt_block stmts) -> Some (If_alt_block (rewrite_stmts env ctx labels cont stmts))
+      | None -> None
+  } in
+  match stmt.spec with
+  | Return (Some (Expr.Ident sym)) when Inliner.is_ret_symbol sym ->
+    [stmt], Tail ((if returns_unit ctx then None else Some SymRet), [])
+
+  | Return _ ->
+    [stmt], (if returns_unit ctx then Tail (None, []) else Not_tail)
+
+  | Release expr -> (
+    match cont with
+    | Tail (Some ret, _) when mentions ret expr -> [stmt], Not_tail
+    | Tail (ret, releases) -> [stmt], Tail (ret, stmt::releases)
+    | Not_tail -> [stmt], Not_tail
+  )
+
+  | Expr (Expr.Assign (Expr.Ident dst, value)) -> (
+    match cont, value_symbol value with
+    | Tail (Some ret, releases), Some src when same_symbol dst ret ->
+      if List.exists ~f:(stmt_mentions src) releases then
+        [stmt], Not_tail
+      else
+        [stmt], Tail (Some src, releases)
+
+    | Tail (None, _), Some _ when Inliner.is_ret_symbol dst ->
+      [stmt], cont
+
+    | _ -> (
+      match tail_call ~dst value with
+      | Some stmts -> stmts, Not_tail
+      | None -> [stmt], Not_tail
+    )
+  )
+
+  | Expr call -> (
+    match tail_call call with
+    | Some stmts -> stmts, Not_tail
+    | None -> [stmt], Not_tail
+  )
+
+  | Goto label ->
+    [stmt], Option.value ~default:Not_tail (Hashtbl.find labels label)
+
+  | Label label ->
+    Hashtbl.set labels ~key:label ~data:cont;
+    [stmt], cont
+
+  | WithLabel (label, stmts) ->
+    Hashtbl.set labels ~key:label ~data:cont;
+    [{ stmt with spec = WithLabel (label, rewrite_stmts env ctx labels cont stmts) }], Not_tail
+
+  | If if_spec ->
+    [{ stmt with spec = If (rewrite_if if_spec) }], Not_tail
+
+  | _ -> [stmt], Not_tail
+
+(* put the label of the loop after the declarations *)
+let make_loop ctx (body: Stmt.t list) : Stmt.t list =
+  let decls, rest =
+    List.split_while
+      ~f:(fun stmt ->
+        match stmt.Stmt.spec with
+        | Stmt.VarDecl _ -> true
+        | _ -> false
+      )
+      body
+  in
+  let label = mk_stmt (Stmt.Label loop_label) in
+  match ctx.native, ctx.loop_arity with
+  | Some _, _
+  | None, None -> List.concat [ decls; [label]; rest ]
+
+  | None, Some arity ->
+    let params = List.init arity ~f:(fun _ -> new_tmp ctx) in
+    let f_sym (sym: symbol) =
+      match sym with
+      | SymParam index -> List.nth_exn params index
+      | _ -> sym
+    in
+    let release_params = List.map ~f:(fun sym -> mk_stmt (Stmt.Release (Expr.Ident sym))) params in
+    let rest =
+      Inliner.map_stmts
+        ~f_stmt_expr:(Inliner.map_expr ~f_sym ~f_expr:Fn.id)
+        ~on_return:(fun stmt expr_opt -> List.append release_params [Inliner.rebuild_return stmt expr_opt])
+        ~rename_label:Fn.id
+        rest
+    in
+    let prologue =
+      List.concat_mapi
+        ~f:(fun index sym -> [
+          assign sym (Expr.Ident (SymParam index));
+          mk_stmt (Stmt.Retain (Expr.Ident sym));
+        ])
+        params
+    in
+    List.concat [ decls; prologue; [label]; rest ]
+
+let rewrite_function env (func: Func.t) : Func.t =
+  let fun_name, _ = func.name in
+  let ctx = {
+    fun_name;
+    native = func.native;
+    origin_tmp_count = func.tmp_vars_count;
+    loop_arity = loop_arity func;
+    tmp_count = func.tmp_vars_count;
+    self_calls = 0;
+    sibling_calls = 0;
+  } in
+  let labels = Hashtbl.create (module String) in
+  let body = rewrite_stmts env ctx labels Not_tail func.body.body in
+  if ctx.self_calls = 0 && ctx.sibling_calls = 0 then
+    func
+  else (
+    if env.verbose then (
+      if ctx.self_calls > 0 then
+        Format.printf "- loop %s on %d self tail call(s)\n" fun_name ctx.self_calls;
+      if ctx.sibling_calls > 0 then
+        Format.printf "- return %d tail call(s) from %s\n" ctx.sibling_calls fun_name
+    );
+    let body = if ctx.self_calls > 0 then make_loop ctx body else body in
+    { func with
+      body = { func.body with body };
+      tmp_vars_count = ctx.tmp_count;
+    }
+  )
+
+let rewrite_declarations ?(verbose=false) (decls: Decl.t list) : Decl.t list =
+  let generic_functions = Hash_set.create (module String) in
+  List.iter
+    ~f:(fun (decl: Decl.t) ->
+      match decl.spec with
+      | Decl.Func ({ Func.native = None; _ } as func) -> Hash_set.add generic_functions (fst func.name)
+      | _ -> ()
+    )
+    decls;
+  let env = { verbose; generic_functions } in
+  List.map
+    ~f:(fun (decl: Decl.t) ->
+      match decl.spec with
+      | Decl.Func func -> { decl with spec = Decl.Func (rewrite_function env func) }
+      | _ -> decl
+    )
+    decls
@@ -32,6 +32,12 @@ module TScope = struct
   type t = {
     name_map: (string, Ir.symbol) Hashtbl.t;
 
+    (*
+     * name -> slot in the environment,
+     * the name is mapped to the symbol of the environment in name_map
+     *)
+    env_slots: (string, int) Hashtbl.t;
+
     local_vars_to_release: Ir.symbol list ref;
 
     raw: scope option;
@@ -42,6 +48,7 @@ module TScope = struct
     let name_map = Hashtbl.create (module String) in
     {
       name_map;
+      env_slots = Hashtbl.create (module String);
       local_vars_to_release = ref [];
       raw = scope;
       prev = None;
@@ -57,6 +64,19 @@ module TScope = struct
     | Some v -> v
     | None -> find_in_prev ()
 
+  (* a name shadowed by a closer scope is not in the environment *)
+  let rec find_env_slot scope name =
+    if Hashtbl.mem scope.name_map name then
+      Hashtbl.find scope.env_slots name
+    else (
+      match scope.prev with
+      | Some prev_scope -> find_env_slot prev_scope name
+      | None -> None
+    )
+
+  let set_env_slot scope =
+    Hashtbl.set scope.env_slots
+
   let distribute_name current_scope name =
     let fun_name = "LCC_" ^ name in
     Hashtbl.set current_scope.name_map ~key:name ~data:(SymLocal fun_name);
@@ -174,7 +194,16 @@ let create_cls_meta cls_id cls_gen_name cls_fields : cls_meta = {
 type current_fun_meta = {
   fun_name: string;
   used_name: string Hash_set.t;
-  mutable def_local_names: string list;
+  mutable def_local_names: (string * Ir.Func.native_ty option) list;
+
+  (* names used as a value in the body, a local lambda not in it never escapes *)
+  mutable value_identifiers: string Hash_set.t;
+
+  (* local name -> generated name of the lambda it's bound to *)
+  known_lambdas: (string, string) Hashtbl.t;
+
+  (* the locals used as a value, and the members accessed on the others *)
+  mutable local_object_uses: Check_helper.local_object_uses option;
 }
 
 let preserved_name = [ "ret"; "rt"; "this"; "argc"; "argv"; "t" ]
@@ -183,12 +212,42 @@ let create_current_fun_meta fun_name = {
   fun_name;
   used_name = Hash_set.of_list (module String) preserved_name;
   def_local_names = [];
+  value_identifiers = Hash_set.create (module String);
+  known_lambdas = Hashtbl.create (module String);
+  local_object_uses = None;
 }
 
+(* the least number of elements of an array literal to be copied from a static table *)
+let static_array_min_len = 4
+
+(* the least number of values of a match to be dispatched by a switch *)
+let match_switch_min_cases = 3
+
+(* the length of a string in the runtime, counted in UTF-16 code units *)
+let utf16_length (str: string) =
+  String.fold
+    ~init:0
+    ~f:(fun acc ch ->
+      let code = Char.to_int ch in
+      if code >= 0xF0 then
+        acc + 2  (* a surrogate pair *)
+      else if code < 0x80 || code >= 0xC0 then
+        acc + 1
+      else
+        acc  (* continuation byte *)
+    )
+    str
+
 type config = {
   (* automatic reference counting *)
   arc: bool;
   prepend_lambda: bool;
+
+  (* captured variables of a scope are stored in a shared environment *)
+  closure_env: bool;
+
+  (* the clauses of a match dispatch by a switch on the tags or the literals *)
+  match_switch: bool;
 }
 
 type t = {
@@ -212,6 +271,14 @@ type t = {
   (* for lambda generation *)
   mutable current_fun_meta: current_fun_meta option;
   mutable lambdas: Ir.Decl.t list;
+
+  (* global functions which are referenced as a value, they need the generic wrapper *)
+  escaped_functions: string Hash_set.t;
+
+  (* the const bindings and pure functions evaluated at compile time *)
+  const_eval: Const_eval.t;
+
+  mutable static_arrays_count: int;
 }
 
 let[@warning "-unused-value-declaration"] is_identifier expr =
@@ -253,7 +320,7 @@ type expr_result = {
   append_stmts: Ir.Stmt.t list;
 }
 
-let create ~config ctx =
+let create ~config ctx declarations =
   let scope = TScope.create None in
   let global_name_map = Hashtbl.create (module Int) in
   let cls_meta_map = Hashtbl.create (module Int) in
@@ -269,6 +336,9 @@ let create ~config ctx =
     cls_meta_map;
     current_fun_meta = None;
     lambdas = [];
+    escaped_functions = Hash_set.create (module String);
+    const_eval = Const_eval.create declarations;
+    static_arrays_count = 0;
   }
 
 let get_local_var_name fun_meta realname ty_int =
@@ -281,6 +351,100 @@ let get_local_var_name fun_meta realname ty_int =
   Hash_set.add fun_meta.used_name name;
   name
 
+(*
+ * The parallel methods of Array are dispatched to the worker pool of runtime
+ * only if the lambda is proved to be pure,
+ * otherwise, call the sequential version.
+ *)
+let select_parallel_external env ext_name (call_params: Typedtree.Expression.t list) =
+  let sequential_name =
+    match ext_name with
+    | "lc_std_array_parallel_map" -> Some "lc_std_array_map"
+    | "lc_std_array_parallel_filter" -> Some "lc_std_array_filter"
+    | "lc_std_array_parallel_sort" -> Some "lc_std_array_sort"
+    | "lc_std_array_parallel_reduce" -> Some "lc_std_array_reduce"
+    | _ -> None
+  in
+  match sequential_name with
+  | Some sequential_name -> (
+    match call_params with
+    | { Typedtree.Expression. spec = Lambda lambda; _ }::_ when Check_helper.is_pure_lambda env.ctx lambda ->
+      ext_name
+    | _ -> sequential_name
+  )
+  | None -> ext_name
+
+let native_ty_of_type env type_expr =
+  if Check_helper.is_i32 env.ctx type_expr then
+    Some Ir.Func.Native_i32
+  else if Check_helper.is_f32 env.ctx type_expr then
+    Some Ir.Func.Native_f32
+  else if Check_helper.is_boolean env.ctx type_expr then
+    Some Ir.Func.Native_bool
+  else
+    None
+
+(*
+ * Returns the native signature if all the params are primitives,
+ * and the return value is a primitive or unit.
+ *
+ * Generic functions and functions with rest params are always called
+ * with the generic convention.
+ *)
+let native_sig_of_params env ~has_this (params: Core_type.TypeExpr.params) return_ty =
+  let open Core_type.TypeExpr in
+  match params.params_rest with
+  | Some _ -> None
+  | None -> (
+    let native_params =
+      List.map ~f:(fun (_, ty) -> native_ty_of_type env ty) params.params_content
+      |> Option.all
+    in
+    let native_ret =
+      if Check_helper.is_unit env.ctx return_ty then
+        Some Ir.Func.Native_unit
+      else
+        native_ty_of_type env return_ty
+    in
+    match native_params, native_ret with
+    | Some native_params, Some native_ret ->
+      Some { Ir.Func.
+        native_has_this = has_this;
+        native_params;
+        native_ret;
+        native_escaped = false;
+      }
+    | _ -> None
+  )
+
+let native_sig_of_typedef env (def: Core_type.TypeDef.t) =
+  let open Core_type.TypeDef in
+  match def.spec with
+  | Function { fun_vars = []; fun_params; fun_return } ->
+    native_sig_of_params env ~has_this:false fun_params fun_return
+
+  | ClassMethod { method_is_virtual = false; method_get_set = None; method_params; method_return; _ } ->
+    native_sig_of_params env ~has_this:true method_params method_return
+
+  | _ -> None
+
+(*
+ * These externals only call the lambda during the call,
+ * they never keep it, so a lambda literal passed to them
+ * can be allocated on the stack.
+ *)
+let external_borrows_lambda ext_name =
+  match ext_name with
+  | "lc_std_array_map"
+  | "lc_std_array_filter"
+  | "lc_std_array_sort"
+  | "lc_std_array_reduce"
+  | "lc_std_array_parallel_map"
+  | "lc_std_array_parallel_filter"
+  | "lc_std_array_parallel_sort"
+  | "lc_std_array_parallel_reduce" -> true
+  | _ -> false
+
 let rec transform_declaration env decl =
   let open Declaration in
   let { spec; loc; attributes } = decl in
@@ -354,8 +518,11 @@ and transform_function env _fun =
     env.main_function_name <- Some fun_name
   );
 
+  let native = native_sig_of_node env node in
+
   let result = transform_function_impl
     env
+    ?native
     ~name:(fun_name, node.loc)
     ~params:header.params
     ~scope ~body ~comments
@@ -366,7 +533,34 @@ and transform_function env _fun =
   [ result ]
 
 
-and distribute_name_to_scope scope fun_meta local_vars : unit =
+and native_sig_of_node env (node: Core_type.node) =
+  match Type_context.deref_type env.ctx node.value with
+  | Core_type.TypeExpr.TypeDef def -> native_sig_of_typedef env def
+  | _ -> None
+
+(*
+ * A primitive local which is not captured by any lambda
+ * is stored unboxed, it's boxed only when it's passed to generic code.
+ *)
+and native_ty_of_local env variable =
+  if !(variable.var_captured) then
+    None
+  else
+    native_ty_of_type env (Type_context.deref_node_type env.ctx variable.var_id)
+
+(*
+ * The captured let variables of a scope are flattened into one environment,
+ * the lambdas capturing them share it.
+ *
+ * Returns the statements to create the environment.
+ *)
+and distribute_name_to_scope env scope fun_meta local_vars : Ir.Stmt.t list =
+  let captured_vars, local_vars =
+    if env.config.closure_env then
+      List.partition_tf ~f:(fun (_, variable) -> should_var_captured variable) local_vars
+    else
+      [], local_vars
+  in
   let local_names =
     local_vars
     |> List.map
@@ -377,15 +571,37 @@ and distribute_name_to_scope scope fun_meta local_vars : unit =
           ~key:var_name
           ~data:(SymLocal gen_name);
 
-        gen_name
+        gen_name, native_ty_of_local env variable
       )
   in
-  fun_meta.def_local_names <- List.append fun_meta.def_local_names local_names
+  fun_meta.def_local_names <- List.append fun_meta.def_local_names local_names;
+
+  match captured_vars with
+  | [] -> []
+  | (_, first_var)::_ -> (
+    let env_name = get_local_var_name fun_meta "env" first_var.var_id in
+    let env_sym = Ir.SymLocal env_name in
+    List.iteri
+      ~f:(fun slot (var_name, _) ->
+        TScope.set_name scope ~key:var_name ~data:env_sym;
+        TScope.set_env_slot scope ~key:var_name ~data:slot;
+      )
+      captured_vars;
+    fun_meta.def_local_names <- List.append fun_meta.def_local_names [env_name, None];
+    TScope.add_vars_to_release scope env_sym;
+    [{ Ir.Stmt.
+      spec = Expr (Ir.Expr.Assign (Ir.Expr.Ident env_sym, Ir.Expr.NewEnv (List.length captured_vars)));
+      loc = Loc.none;
+    }]
+  )
 
-and transform_function_impl env ~name ~params ~body ~scope ~comments =
+and transform_function_impl env ?native ~name ~params ~body ~scope ~comments =
   let open Function in
 
   let fun_meta = Option.value_exn env.current_fun_meta in
+  fun_meta.value_identifiers <- Check_helper.value_identifiers_of_block body;
+  fun_meta.local_object_uses <- Some (Check_helper.local_object_uses_of_block body);
+  let outer_scope = env.scope in
   let fun_scope = TScope.create (Some scope) in
   push_scope env fun_scope;
 
@@ -405,6 +621,10 @@ and transform_function_impl env ~name ~params ~body ~scope ~comments =
   Scope.CapturingVarMap.iteri
     ~f:(fun ~key:name ~data:idx ->
       TScope.set_name fun_scope ~key:name ~data:(SymLambda(idx, name));
+      (* the captured value is the environment of the outer scope *)
+      Option.iter
+        ~f:(fun slot -> TScope.set_env_slot fun_scope ~key:name ~data:slot)
+        (TScope.find_env_slot outer_scope name);
       Hash_set.add params_set name;
     )
     capturing_variables;
@@ -415,7 +635,7 @@ and transform_function_impl env ~name ~params ~body ~scope ~comments =
     |> List.filter ~f:(fun (name, _) -> not (Hash_set.mem params_set name))
   in
 
-  distribute_name_to_scope fun_scope fun_meta local_vars;
+  let env_stmts = distribute_name_to_scope env fun_scope fun_meta local_vars in
 
   let max_tmp_value = ref 0 in
 
@@ -478,7 +698,7 @@ and transform_function_impl env ~name ~params ~body ~scope ~comments =
 
   let new_body = {
     Ir.Block.
-    body = List.concat [ def; stmts; ending_parts ];
+    body = List.concat [ def; env_stmts; stmts; ending_parts ];
     loc = body.loc;
   } in
 
@@ -488,6 +708,7 @@ and transform_function_impl env ~name ~params ~body ~scope ~comments =
     body = new_body;
     tmp_vars_count = !max_tmp_value;
     comments;
+    native;
   } in
 
   pop_scope env;
@@ -500,9 +721,9 @@ and create_scope_and_distribute_vars env raw_scope =
   let scope = TScope.create (Some raw_scope) in
   let local_vars = raw_scope#vars in
 
-  distribute_name_to_scope scope (Option.value_exn env.current_fun_meta) local_vars;
+  let env_stmts = distribute_name_to_scope env scope (Option.value_exn env.current_fun_meta) local_vars in
 
-  scope
+  scope, env_stmts
 
 and transform_statement ?ret env stmt =
   let open Statement in
@@ -575,27 +796,88 @@ and transform_statement ?ret env stmt =
     in
 
     let name = TScope.find_variable scope original_name in
-    let init_expr = transform_expression ~is_move:true env binding.binding_init in
+
+    (* a local lambda which is only called directly, it never escapes *)
+    let fun_meta = Option.value_exn env.current_fun_meta in
+    let known_lambda =
+      match binding.binding_init.spec, name with
+      | Typedtree.Expression.Lambda lambda_content, Ir.SymLocal local_name
+        when (not !(variable.var_captured)) &&
+             (not (Hash_set.mem fun_meta.value_identifiers original_name)) ->
+        Some (local_name, lambda_content)
+
+      | _ -> None
+    in
+
+    let env_slot = TScope.find_env_slot scope original_name in
+
+    (*
+     * A class instance or a tuple which never escapes the function
+     * lives on the stack, in the block of the binding.
+     * It's still counted, the release at the end of the scope drops the fields.
+     *)
+    let on_stack =
+      match name, fun_meta.local_object_uses with
+      | Ir.SymLocal _, Some uses
+        when env.config.arc &&
+             Option.is_none env_slot &&
+             (not !(variable.var_captured)) &&
+             (not (Hash_set.mem uses.escaped original_name)) -> (
+        let members = Hashtbl.find uses.members original_name in
+        match binding.binding_init.spec with
+        | Typedtree.Expression.Init { init_name = (_, init_name_id); _ } -> (
+          let cls_meta = Hashtbl.find_exn env.cls_meta_map init_name_id in
+          match members with
+          | Some members -> Hash_set.for_all ~f:(Hashtbl.mem cls_meta.cls_fields_map) members
+          | None -> true
+        )
+        | Typedtree.Expression.Tuple _ -> Option.is_none members
+        | _ -> false
+      )
+
+      | _ -> false
+    in
+
+    (* the value of a const binding is folded into its uses *)
+    (match binding.binding_kind with
+    | Pvar_const -> (
+      match Const_eval.eval env.const_eval binding.binding_init with
+      | Some literal -> Const_eval.add_const env.const_eval name_id literal
+      | None -> ()
+    )
+    | Pvar_let -> ());
+
+    let init_expr =
+      match known_lambda with
+      | Some (local_name, lambda_content) -> (
+        let expr = transform_lambda_value env ~on_stack:true lambda_content binding.binding_init.ty_var in
+        (match expr with
+        | Ir.Expr.NewLambda { lambda_name; _ } ->
+          Hashtbl.set fun_meta.known_lambdas ~key:local_name ~data:lambda_name
+        | _ -> ());
+        { prepend_stmts = []; expr; append_stmts = [] }
+      )
+
+      | None ->
+        transform_expression ~is_move:true ~on_stack env binding.binding_init
+    in
 
     let node_type = Type_context.deref_node_type env.ctx name_id in
     let need_release =
       env.config.arc &&
+      Option.is_none known_lambda &&
       not (Check_helper.type_should_not_release env.ctx node_type)
     in
-    (*
-     * if a variable is captured, it will be upgraded into a RefCell.
-     * Whatevet type it is, it should be released.
-     *)
-    if need_release || !(variable.var_captured) then (
+
+    (* a variable in the environment is released with the environment *)
+    if need_release && Option.is_none env_slot then (
       TScope.add_vars_to_release scope name
     );
 
     let assign_expr =
-      if should_var_captured variable then (
-        let init_expr = Ir.Expr.NewRef init_expr.expr in
-        Ir.Expr.Assign((Ident name), init_expr)
-      ) else
-        Ir.Expr.Assign((Ident name), init_expr.expr);
+      match env_slot with
+      | Some slot -> Ir.Expr.EnvSet(name, slot, original_name, init_expr.expr)
+      | None -> Ir.Expr.Assign((Ident name), init_expr.expr)
     in
 
     List.concat [
@@ -737,6 +1019,8 @@ and try_folding_literals op left right original_expr =
   in
 
   match (left.spec, right.spec) with
+  (* a division by zero is left to the runtime *)
+  | (Constant(Integer _), Constant(Integer 0l)) when Poly.equal op BinaryOp.Div -> None
   | (Constant(Integer left_int), Constant(Integer right_int)) -> (
     match op with
     | BinaryOp.Plus
@@ -798,8 +1082,45 @@ and try_folding_binary_expression expr: Expression.t option =
   )
   | _ -> None
 
-and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
+(*
+ * Replace an expression computed at compile time by its value.
+ * A string in a const binding is not copied to the uses,
+ * it would be allocated at every use.
+ *)
+and fold_constant env (expr: Expression.t) =
+  let open Expression in
+  match expr.spec with
+  | Binary _ | Unary _ | Call _ | Identifier _ -> (
+    match expr.spec, Const_eval.eval env.const_eval expr with
+    | Identifier _, Some (Literal.String _) -> expr
+    | _, Some literal -> { expr with spec = Constant literal }
+    | _, None -> expr
+  )
+  | _ -> expr
+
+(*
+ * An array of primitive constants is copied from a static table,
+ * instead of setting the elements one by one.
+ *)
+and static_array_values env (elements: Expression.t list) =
+  let open Expression in
+  let static_value element =
+    let element = fold_constant env element in
+    match element.spec with
+    | Constant (Literal.Integer i) -> Some (Ir.Expr.NewInt (Int32.to_string i))
+    | Constant (Literal.Float (fl, _)) -> Some (Ir.Expr.NewFloat fl)
+    | Constant (Literal.Char ch) -> Some (Ir.Expr.NewChar ch)
+    | Constant (Literal.Boolean bl) -> Some (Ir.Expr.NewBoolean bl)
+    | _ -> None
+  in
+  if List.length elements < static_array_min_len then
+    None
+  else
+    Option.all (List.map ~f:static_value elements)
+
+and transform_expression ?(is_move=false) ?(is_borrow=false) ?(on_stack=false) env expr =
   let open Expression in
+  let expr = fold_constant env expr in
   let { spec; loc; ty_var; _ } = expr in
   let prepend_stmts = ref [] in
   let append_stmts = ref [] in
@@ -852,11 +1173,17 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
         let variable_opt = (Option.value_exn env.scope.raw)#find_var_symbol name in
         let variable = Option.value_exn variable_opt in
         let sym = find_variable env name in
+
+        (* a global function is referenced as a value *)
+        (match sym, Type_context.deref_node_type env.ctx variable.var_id with
+        | Ir.SymLocal fun_name, Core_type.TypeExpr.TypeDef { Core_type.TypeDef. spec = Function _; _ } ->
+          Hash_set.add env.escaped_functions fun_name
+        | _ -> ());
+
         let id_expr =
-          if should_var_captured variable then
-            Ir.Expr.GetRef (sym, name)
-          else
-            Ir.Expr.Ident sym
+          match TScope.find_env_slot env.scope name with
+          | Some slot -> Ir.Expr.EnvGet (sym, slot, name)
+          | None -> Ir.Expr.Ident sym
         in
 
         let node_type = Type_context.deref_node_type env.ctx variable.var_id in
@@ -879,42 +1206,7 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
     )
 
     | Lambda lambda_content -> (
-      let parent_scope = env.scope in
-      let fun_meta = Option.value_exn ~message:"current function name not found" env.current_fun_meta in
-      let lambda_name = fun_meta.fun_name ^ "_lambda_" ^ (Int.to_string ty_var) in
-      let lambda_fun_name = "LCC_" ^ lambda_name in
-
-      let capturing_variables = lambda_content.lambda_scope#capturing_variables in
-
-      let capturing_names = Array.create ~len:(Scope.CapturingVarMap.length capturing_variables) (Ir.SymLocal "<unexpected>") in
-
-      (* pass the capturing values into the deeper scope *)
-      Scope.CapturingVarMap.iteri
-      ~f:(fun ~key ~data -> 
-        let name = TScope.find_variable parent_scope key in
-        Array.set capturing_names data name
-      )
-      capturing_variables;
-
-      let lambda = transform_lambda env ~lambda_name lambda_content ty_var in
-
-      if env.config.prepend_lambda then (
-        env.lambdas <- lambda::env.lambdas
-      );
-
-      let this_expr =
-        if TScope.is_in_class env.scope then
-          Ir.Expr.Ident(Ir.SymThis)
-        else
-          Null
-      in
-
-      let expr = Ir.Expr.NewLambda {
-        lambda_name = lambda_fun_name;
-        lambda_this = this_expr;
-        lambda_capture_symbols = capturing_names;
-        lambda_decl = lambda;
-      } in
+      let expr = transform_lambda_value env ~on_stack:false lambda_content ty_var in
       auto_release_expr env ~is_move ~append_stmts ty_var expr
     )
 
@@ -955,7 +1247,23 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
           )
           children
       in
-      Ir.Expr.NewTuple children_expr
+      if on_stack then
+        Ir.Expr.NewStackTuple children_expr
+      else
+        Ir.Expr.NewTuple children_expr
+
+    | Array arr_list when Option.is_some (static_array_values env arr_list) -> (
+      let values = Option.value_exn (static_array_values env arr_list) in
+      let name = Format.sprintf "LCC_static_array_%d" env.static_arrays_count in
+      env.static_arrays_count <- env.static_arrays_count + 1;
+
+      env.prepends_decls <- { Ir.Decl.
+        spec = StaticArray(name, values);
+        loc;
+      }::env.prepends_decls;
+
+      auto_release_expr env ~is_move ~append_stmts ty_var (Ir.Expr.NewStaticArray(name, List.length values))
+    )
 
     | Array arr_list -> (
       let tmp_id = env.tmp_vars_count in
@@ -1077,7 +1385,32 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
       let open Expression in
       (* let current_scope = env.scope in *)
       let { callee; call_params; _ } = call in
-      let params_struct = List.map ~f:(transform_expression ~is_borrow:true env) call_params in
+
+      let callee_borrows_lambda =
+        match callee with
+        | { spec = Member(expr, id); _ } -> (
+          let expr_type = Type_context.deref_node_type env.ctx expr.ty_var in
+          let member = Check_helper.find_member_of_type env.ctx ~scope:(Option.value_exn env.scope.raw) expr_type id.pident_name in
+          match member with
+          | Some ((Method ({ id = method_id; spec = ClassMethod { method_is_virtual = false; method_get_set = None; _ }; _ }, _, _)), _) ->
+            Type_context.find_external_symbol env.ctx method_id
+            |> Option.value_map ~default:false ~f:external_borrows_lambda
+          | _ -> false
+        )
+        | _ -> false
+      in
+
+      let transform_param (param: Expression.t) =
+        match param.spec with
+        | Lambda lambda_content when callee_borrows_lambda ->
+          let expr = transform_lambda_value env ~on_stack:true lambda_content param.ty_var in
+          { prepend_stmts = []; expr; append_stmts = [] }
+
+        | _ ->
+          transform_expression ~is_borrow:true env param
+      in
+
+      let params_struct = List.map ~f:transform_param call_params in
 
       let prepend, params, append = List.map ~f:(fun expr -> expr.prepend_stmts, expr.expr, expr.append_stmts) params_struct |> List.unzip3 in
 
@@ -1101,9 +1434,16 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
             match deref_type with
             | Core_type.TypeExpr.Lambda _ -> (
               let transformed_callee = transform_expression ~is_borrow:true env callee in
-              prepend_stmts := List.append !prepend_stmts (List.append !prepend_stmts transformed_callee.prepend_stmts);
-              append_stmts := List.append !append_stmts (List.append !append_stmts transformed_callee.append_stmts);
-              Ir.Expr.CallLambda(transformed_callee.expr, params)
+              prepend_stmts := List.append !prepend_stmts transformed_callee.prepend_stmts;
+              append_stmts := List.append !append_stmts transformed_callee.append_stmts;
+              let fun_meta = Option.value_exn env.current_fun_meta in
+              match transformed_callee.expr with
+              | Ir.Expr.Ident (Ir.SymLocal local_name) when Hashtbl.mem fun_meta.known_lambdas local_name ->
+                let lambda_name = Hashtbl.find_exn fun_meta.known_lambdas local_name in
+                Ir.Expr.CallLambdaDirect(lambda_name, transformed_callee.expr, params)
+
+              | _ ->
+                Ir.Expr.CallLambda(transformed_callee.expr, params)
             )
 
             (* it's a contructor *)
@@ -1112,7 +1452,10 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
               let ctor_opt = Check_helper.find_typedef_of env.ctx node.value in
               let ctor_name = Option.value_exn ctor_opt in
               let name = find_variable env ctor_name.name in
-              Ir.Expr.Call(name, None, params)
+              (match native_sig_of_typedef env ctor_name with
+              | Some native_sig -> Ir.Expr.CallNative(name, native_sig, None, params)
+              | None -> Ir.Expr.Call(name, None, params)
+              )
           )
 
         )
@@ -1140,6 +1483,7 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
               match Type_context.find_external_symbol env.ctx method_id with
               | Some ext_name -> (
                 (* external method *)
+                let ext_name = select_parallel_external env ext_name call_params in
                 Ir.Expr.Call((Ir.SymLocal ext_name), Some this_expr.expr, params)
               )
               | _ ->
@@ -1148,17 +1492,26 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
                 let ctor = Option.value_exn ~message:"Cannot find typedef of class" ctor_opt in
                 let ctor_ty_id = ctor.id in
                 let global_name = Hashtbl.find_exn env.global_name_map ctor_ty_id in
-                Ir.Expr.Call(global_name, Some this_expr.expr, params)
+                (match native_sig_of_typedef env ctor with
+                | Some native_sig -> Ir.Expr.CallNative(global_name, native_sig, Some this_expr.expr, params)
+                | None -> Ir.Expr.Call(global_name, Some this_expr.expr, params)
+                )
             )
 
             (* it's a static function *)
             | Some (TypeDef { id = fun_id; spec = Function _; _ }, _) -> (
-              let callee_node = Type_context.get_node env.ctx fun_id in
-              let ctor_opt = Check_helper.find_typedef_of env.ctx callee_node.value in
-              let ctor = Option.value_exn ctor_opt in
-              let ctor_ty_id = ctor.id in
-              let global_name = Hashtbl.find_exn env.global_name_map ctor_ty_id in
-              Ir.Expr.Call(global_name, None, params)
+              match Type_context.find_external_symbol env.ctx fun_id with
+              (* declared static method *)
+              | Some ext_name ->
+                Ir.Expr.Call((Ir.SymLocal ext_name), None, params)
+
+              | None ->
+                let callee_node = Type_context.get_node env.ctx fun_id in
+                let ctor_opt = Check_helper.find_typedef_of env.ctx callee_node.value in
+                let ctor = Option.value_exn ctor_opt in
+                let ctor_ty_id = ctor.id in
+                let global_name = Hashtbl.find_exn env.global_name_map ctor_ty_id in
+                Ir.Expr.Call(global_name, None, params)
             )
             | _ -> failwith "unrechable"
 
@@ -1245,15 +1598,33 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
      *
      * 1. Assign to an identifier: a = <expr>
      *   - local variable
-     *   - local RefCel
+     *   - variable in an environment
      *   - captured const
-     *   - captured refcell
+     *   - captured variable in an environment
      * 2. Assign to a member: <expr>.xxx = <expr>
      *   - property of a class
      *   - setter of a class
      *   - Assign to this property: this.xxx = expr
      *)
     | Assign (op_opt, left_expr, right_expr) -> (
+      let assign_value () =
+        match op_opt with
+        | None -> (
+          let expr' = transform_expression ~is_move:true env right_expr in
+
+          prepend_stmts := List.concat [ !prepend_stmts; expr'.prepend_stmts ];
+          append_stmts := List.concat [ !append_stmts; expr'.append_stmts ];
+
+          expr'.expr
+        )
+
+        | Some op -> (
+          let binary_op = AssignOp.to_binary op in
+
+          transform_binary_expr env ~is_move:true ~append_stmts ~prepend_stmts expr binary_op left_expr right_expr
+        )
+      in
+
       let assign_or_update main_expr ty_id =
         let node_type = Type_context.deref_node_type env.ctx ty_id in
         let need_release =
@@ -1277,30 +1648,17 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
           prepend_stmts := List.append !prepend_stmts [assign_stmt];
           append_stmts := List.append [release_stmt] !append_stmts
         );
-        match op_opt with
-        | None -> (
-          let expr' = transform_expression ~is_move:true env right_expr in
-
-          prepend_stmts := List.concat [ !prepend_stmts; expr'.prepend_stmts ];
-          append_stmts := List.concat [ !append_stmts; expr'.append_stmts ];
-
-          Ir.Expr.Assign(main_expr, expr'.expr)
-        )
-
-        | Some op -> (
-          let binary_op = AssignOp.to_binary op in
-
-          let binary_ir = transform_binary_expr env ~is_move:true ~append_stmts ~prepend_stmts expr binary_op left_expr right_expr in
-
-          Ir.Expr.Assign(main_expr, binary_ir)
-        )
+        Ir.Expr.Assign(main_expr, assign_value ())
       in
 
       match (left_expr, op_opt) with
       (* transform_expression env left_expr *)
       | ({ spec = Typedtree.Expression.Identifier (name, name_id); _ }, _) -> (
-        let name = find_variable env name in
-        assign_or_update (Ir.Expr.Ident name) name_id
+        let sym = find_variable env name in
+        match TScope.find_env_slot env.scope name with
+        (* the environment releases the old value *)
+        | Some slot -> Ir.Expr.EnvSet(sym, slot, name, assign_value ())
+        | None -> assign_or_update (Ir.Expr.Ident sym) name_id
       )
 
       (* TODO: maybe it's a setter? *)
@@ -1365,7 +1723,12 @@ and transform_expression ?(is_move=false) ?(is_borrow=false) env expr =
 
       let fun_name = find_variable env init_name in
       let init_call_name = Ir.map_symbol ~f:(fun fun_name -> fun_name ^ "_init") fun_name in
-      let init_call = Ir.Expr.InitCall(init_call_name, fun_name) in
+      let init_call =
+        if on_stack then
+          Ir.Expr.InitStackCall(init_call_name, fun_name)
+        else
+          Ir.Expr.InitCall(init_call_name, fun_name)
+      in
       let init_cls_stmt = { Ir.Stmt.
         spec = Expr (
           Ir.Expr.Assign(
@@ -1569,13 +1932,53 @@ and transform_pattern_matching env ~prepend_stmts:out_prepend_stmts ~append_stmt
     | _ -> false
   in
 
-  let rec transform_pattern_to_test match_expr pat : PMMeta.t =
+  (* the value of a clause in the switch, if the head of its pattern is a constructor or a literal *)
+  let switch_head (pat: Pattern.t) : (Ir.Stmt.switch_on * int) option =
+    let open Pattern in
+    let enum_tag name_id =
+      let name_node = Type_context.get_node env.ctx name_id in
+      let ctor = Option.value_exn (Check_helper.find_typedef_of env.ctx name_node.value) in
+      match ctor.spec with
+      | Core_type.TypeDef.EnumCtor v -> v.enum_ctor_tag_id
+      | _ -> failwith "unrechable"
+    in
+    match pat.spec with
+    | Symbol (name, name_id) when Char.is_uppercase (String.get name 0) ->
+      Some (Ir.Stmt.Switch_tag, enum_tag name_id)
+
+    | EnumCtor ((_, name_id), _) ->
+      Some (Ir.Stmt.Switch_tag, enum_tag name_id)
+
+    | Literal (Literal.Integer i) ->
+      Some (Ir.Stmt.Switch_int, Int32.to_int_exn i)
+
+    | Literal (Literal.Char ch) ->
+      Some (Ir.Stmt.Switch_int, ch)
+
+    (* the length of a literal with escapes is unknown here *)
+    | Literal (Literal.String(str, _, _)) when not (String.contains str '\\') ->
+      Some (Ir.Stmt.Switch_string_length, utf16_length str)
+
+    | _ -> None
+  in
+
+  let is_switch_head pat = Option.is_some (switch_head pat) in
+
+  (*
+   * the test of the head is skipped if the switch has jumped to it,
+   * a string switch only jumps on the length, the content is still tested
+   *)
+  let rec transform_pattern_to_test ?(head_tested=false) match_expr pat : PMMeta.t =
     let open Pattern in
     let { spec; _ } = pat in
     match spec with
     | Underscore ->
       (fun genereator -> genereator ~finalizers:[] ())
 
+    | Literal (Literal.Integer _ | Literal.Char _)
+    | Symbol _ when head_tested && is_switch_head pat ->
+      (fun genereator -> genereator ~finalizers:[] ())
+
     | Literal (Literal.Integer i) -> (
       let i_str = Int32.to_string i in
       let if_test = Ir.Expr.IntValue(I32Binary(BinaryOp.Equal, match_expr, NewInt i_str)) in
@@ -1721,15 +2124,19 @@ and transform_pattern_matching env ~prepend_stmts:out_prepend_stmts ~append_stmt
               [release_stmt];
             ]
         in
-        let if_stmt = { Ir.Stmt.
-          spec = If {
-            if_test;
-            if_consequent;
-            if_alternate = None;
-          };
-          loc = Loc.none;
-        } in
-        [if_stmt]
+        if head_tested then
+          if_consequent
+        else (
+          let if_stmt = { Ir.Stmt.
+            spec = If {
+              if_test;
+              if_consequent;
+              if_alternate = None;
+            };
+            loc = Loc.none;
+          } in
+          [if_stmt]
+        )
       in
       let child_pm = transform_pattern_to_test (Temp match_tmp) child in
       this_pm >>= child_pm
@@ -1893,8 +2300,9 @@ and transform_pattern_matching env ~prepend_stmts:out_prepend_stmts ~append_stmt
 
   in
 
-  let transform_clause clause =
-    let scope = create_scope_and_distribute_vars env clause.clause_scope in
+  let transform_clause ?head_tested clause =
+    (* the bindings of patterns are const, they are never in an environment *)
+    let scope, _ = create_scope_and_distribute_vars env clause.clause_scope in
     with_scope env scope (fun env ->
       let saved_tmp_count = env.tmp_vars_count in
       let body = transform_expression ~is_move:true env clause.clause_consequent in
@@ -1920,18 +2328,80 @@ and transform_pattern_matching env ~prepend_stmts:out_prepend_stmts ~append_stmt
         [done_stmt];
       ] in
 
-      let pm_meta = transform_pattern_to_test match_expr clause.clause_pat in
+      let pm_meta = transform_pattern_to_test ?head_tested match_expr clause.clause_pat in
       let pm_stmts = pm_meta consequent in
 
-      prepend_stmts := List.append
-        !prepend_stmts
-        pm_stmts;
       tmp_counter := env.tmp_vars_count::(!tmp_counter);
       env.tmp_vars_count <- saved_tmp_count;
+      pm_stmts
     )
   in
 
-  List.iter ~f:transform_clause match_clauses;
+  (*
+   * The leading clauses with a constructor or a literal as the head
+   * are dispatched by a switch, jumping to the clauses with the same value,
+   * the head is tested only once for them.
+   * If none of them matches, it goes on with the rest clauses.
+   *)
+  let switch_clauses, rest_clauses =
+    let rec split acc clauses =
+      match clauses with
+      | clause::rest -> (
+        match switch_head clause.clause_pat with
+        | Some (switch_on, value) -> split ((switch_on, value, clause)::acc) rest
+        | None -> List.rev acc, clauses
+      )
+      | [] -> List.rev acc, []
+    in
+    split [] match_clauses
+  in
+
+  let switch_values =
+    List.fold
+      ~init:[]
+      ~f:(fun acc (_, value, _) -> if List.mem acc value ~equal:Int.equal then acc else value::acc)
+      switch_clauses
+    |> List.rev
+  in
+
+  if env.config.match_switch && List.length switch_values >= match_switch_min_cases then (
+    let switch_on, _, _ = List.hd_exn switch_clauses in
+    let next_label = Format.sprintf "match_%d_next" ty_var in
+    let case_label index = Format.sprintf "match_%d_case_%d" ty_var index in
+    let mk_stmt spec = { Ir.Stmt. spec; loc = Loc.none } in
+
+    let switch_stmt = mk_stmt (Ir.Stmt.Switch {
+      switch_value = match_expr;
+      switch_on;
+      switch_cases = List.mapi ~f:(fun index value -> value, case_label index) switch_values;
+      switch_default = next_label;
+    }) in
+
+    let cases =
+      List.concat_mapi
+        ~f:(fun index value ->
+          let clauses =
+            List.filter_map
+              ~f:(fun (_, v, clause) -> if v = value then Some clause else None)
+              switch_clauses
+          in
+          List.concat [
+            [mk_stmt (Ir.Stmt.Label (case_label index))];
+            List.concat_map ~f:(transform_clause ~head_tested:true) clauses;
+            [mk_stmt (Ir.Stmt.Goto next_label)];
+          ]
+        )
+        switch_values
+    in
+
+    prepend_stmts := List.concat [
+      [switch_stmt];
+      cases;
+      [mk_stmt (Ir.Stmt.Label next_label)];
+      List.concat_map ~f:(fun clause -> transform_clause clause) rest_clauses;
+    ]
+  ) else
+    prepend_stmts := List.concat_map ~f:(fun clause -> transform_clause clause) match_clauses;
 
   let end_label = { Ir.Stmt.
     spec = WithLabel(label_name, !prepend_stmts);
@@ -2109,13 +2579,13 @@ and transform_expression_if env ?ret ~prepend_stmts ~append_stmts loc if_desc =
   spec
 
 and transform_block env ?ret (block: Typedtree.Block.t): Ir.Stmt.t list =
-  let block_scope = create_scope_and_distribute_vars env block.scope in
+  let block_scope, env_stmts = create_scope_and_distribute_vars env block.scope in
   with_scope env block_scope (fun env ->
     let stmts = List.map ~f:(transform_statement ?ret env) block.body |> List.concat in
 
     let cleanup = generate_finalize_stmts env.scope in
 
-    List.append stmts cleanup
+    List.concat [ env_stmts; stmts; cleanup ]
   )
 
 (*
@@ -2237,8 +2707,20 @@ and transform_class_method env _method : (Ir.Decl.t list * Ir.Decl.class_method_
       None
   in
 
+  (*
+   * Static methods are called with the generic convention,
+   * because they may reference "this" of the class in lambdas.
+   *)
+  let native =
+    match node_type with
+    | TypeExpr.TypeDef ({ spec = TypeDef.ClassMethod _; _ } as def) ->
+      native_sig_of_typedef env def
+    | _ -> None
+  in
+
   let _fun = { Ir.Decl.
     spec = (transform_function_impl env
+      ?native
       ~name:(new_name, node.loc)
       ~params:cls_method_params
       ~scope:(Option.value_exn cls_method_scope)
@@ -2447,6 +2929,49 @@ and transform_enum env enum loc : Ir.Decl.t list =
 
   result
 
+(*
+ * A lambda on stack is not retained by anyone,
+ * it's only valid in the block where it's created.
+ *)
+and transform_lambda_value env ~on_stack lambda_content ty_var =
+  let parent_scope = env.scope in
+  let fun_meta = Option.value_exn ~message:"current function name not found" env.current_fun_meta in
+  let lambda_name = fun_meta.fun_name ^ "_lambda_" ^ (Int.to_string ty_var) in
+  let lambda_fun_name = "LCC_" ^ lambda_name in
+
+  let capturing_variables = lambda_content.lambda_scope#capturing_variables in
+
+  let capturing_names = Array.create ~len:(Scope.CapturingVarMap.length capturing_variables) (Ir.SymLocal "<unexpected>") in
+
+  (* pass the capturing values into the deeper scope *)
+  Scope.CapturingVarMap.iteri
+  ~f:(fun ~key ~data -> 
+    let name = TScope.find_variable parent_scope key in
+    Array.set capturing_names data name
+  )
+  capturing_variables;
+
+  let lambda = transform_lambda env ~lambda_name lambda_content ty_var in
+
+  if env.config.prepend_lambda then (
+    env.lambdas <- lambda::env.lambdas
+  );
+
+  let this_expr =
+    if TScope.is_in_class env.scope then
+      Ir.Expr.Ident(Ir.SymThis)
+    else
+      Null
+  in
+
+  Ir.Expr.NewLambda {
+    lambda_name = lambda_fun_name;
+    lambda_this = this_expr;
+    lambda_capture_symbols = capturing_names;
+    lambda_decl = lambda;
+    lambda_on_stack = on_stack;
+  }
+
 and transform_lambda env ~lambda_name content _ty_var =
   let prev_fun_meta = env.current_fun_meta in
 
@@ -2494,7 +3019,7 @@ type result = {
 }
 
 let transform_declarations ~config ctx declarations =
-  let env = create ~config ctx in
+  let env = create ~config ctx declarations in
 
   let declarations =
     List.map ~f:(transform_declaration env) declarations
@@ -2517,6 +3042,22 @@ let transform_declarations ~config ctx declarations =
   let prepends_decls = List.rev env.prepends_decls in
   env.prepends_decls <- [];
 
+  (* the main function is called by the runtime, so it always escapes *)
+  Option.iter ~f:(Hash_set.add env.escaped_functions) env.main_function_name;
+
+  let declarations =
+    List.map
+      ~f:(fun decl ->
+        match decl.Ir.Decl.spec with
+        | Ir.Decl.Func ({ Ir.Func. native = Some native_sig; name = (fun_name, _); _ } as _fun)
+          when Hash_set.mem env.escaped_functions fun_name ->
+          let native = Some { native_sig with Ir.Func.native_escaped = true } in
+          { decl with Ir.Decl.spec = Ir.Decl.Func { _fun with Ir.Func.native } }
+        | _ -> decl
+      )
+      declarations
+  in
+
   {
     main_function_name = env.main_function_name;
     declarations = List.append prepends_decls declarations;
@@ -10,6 +10,12 @@ type config = {
   (* automatic reference counting *)
   arc: bool;
   prepend_lambda: bool;
+
+  (* captured variables of a scope are stored in a shared environment *)
+  closure_env: bool;
+
+  (* the clauses of a match dispatch by a switch on the tags or the literals *)
+  match_switch: bool;
 }
 
 val transform_declarations: config:config -> Type_context.t -> Typedtree.Declaration.t list -> result
@@ -1,6 +1,7 @@
 
 
 let codegen ~ctx ~preclude tree =
-  let tree' = Normalize.normalize tree in
-  let env = Transpile.transpile_program ~ctx ~preclude tree' in
+  let time = Lichenscript_common.Timing.time in
+  let tree' = time "normalize" (fun () -> Normalize.normalize tree) in
+  let env = time "transpile" (fun () -> Transpile.transpile_program ~ctx ~preclude tree') in
   Transpile.contents env
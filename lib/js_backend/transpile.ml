@@ -107,6 +107,21 @@ let rec transpile_declaration env (delcaration: Ir.Decl.t) =
     ps env "}\n";
   )
 
+  | StaticArray (name, values) -> (
+    ps env "const ";
+    ps env name;
+    ps env " = [";
+    List.iteri
+      ~f:(fun index value ->
+        if index > 0 then (
+          ps env ", "
+        );
+        transpile_expression env value
+      )
+      values;
+    ps env "];\n"
+  )
+
   | GlobalClassInit _
 
   | FuncDecl _ -> ()
@@ -224,7 +239,7 @@ and transpile_statement env decl =
     if names_len >0 then (
       ps env "var ";
       List.iteri
-        ~f:(fun index name ->
+        ~f:(fun index (name, _) ->
           ps env name;
           if index <> (names_len - 1) then (
             ps env ", ";
@@ -276,6 +291,13 @@ and transpile_statement env decl =
     ps env label;
     ps env ";\n"
 
+  | Label _
+  | TailCall _ ->
+    failwith "unreachable: tail calls are only rewritten for C"
+
+  | Switch _ ->
+    failwith "unreachable: the switch of a match is only generated for C"
+
 
 and transpile_symbol env sym =
   let open Ir in
@@ -331,19 +353,31 @@ and transpile_expression ?(parent_expr=true) env expr =
     ps env ").bind(this)"
   )
 
-  | NewRef expr ->
-    transpile_expression env expr
+  (* JavaScript captures the variables by itself *)
+  | NewEnv _ ->
+    failwith "unreachable: closure environments are only generated for C"
 
-  | GetRef(_, original_name) ->
+  | EnvGet(_, _, original_name) ->
     ps env original_name
 
+  | EnvSet(_, _, original_name, expr) ->
+    ps env original_name;
+    ps env " = ";
+    transpile_expression env expr
+
   | NewArray len -> (
     ps env "Array(";
     ps env (Int.to_string len);
     ps env ")"
   )
 
-  | NewTuple exprs -> (
+  | NewStaticArray (name, _) -> (
+    ps env name;
+    ps env ".slice()"
+  )
+
+  | NewTuple exprs
+  | NewStackTuple exprs -> (
     ps env "[tupleSym, ";
     let exprs_len = List.length exprs in
     List.iteri
@@ -402,7 +436,8 @@ and transpile_expression ?(parent_expr=true) env expr =
   | I64Binary _
   | F64Binary _ -> failwith "unimplemented binary2"
 
-  | CallLambda(expr, params) -> (
+  | CallLambda(expr, params)
+  | CallLambdaDirect(_, expr, params) -> (
     transpile_expression env expr;
     ps env "(";
     let params_len = List.length params in
@@ -446,7 +481,8 @@ and transpile_expression ?(parent_expr=true) env expr =
     );
   )
 
-  | Call(name, this_opt, params) -> (
+  | Call(name, this_opt, params)
+  | CallNative(name, _, this_opt, params) -> (
     transpile_symbol env name;
     ps env ".call(";
     (match this_opt with
@@ -467,7 +503,8 @@ and transpile_expression ?(parent_expr=true) env expr =
     ps env ")"
   )
 
-  | InitCall(_, proto_name) -> (
+  | InitCall(_, proto_name)
+  | InitStackCall(_, proto_name) -> (
     ps env "{ __proto__: ";
     transpile_symbol env proto_name;
     ps env " }"
@@ -720,6 +757,8 @@ let transpile_program ~ctx ~preclude declarations =
   let transform_config = { Transform.
     arc = false;
     prepend_lambda = false;
+    closure_env = false;
+    match_switch = false;
   } in
   let ir_tree = Transform.transform_declarations ~config:transform_config ctx declarations in
 
@@ -0,0 +1,100 @@
+(*
+ * Copyright 2022 Vincent Chan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *)
+
+(*
+ * The identifiers of a file, every distinct name is allocated once.
+ * An ascii lexeme is looked up by its code points in the lexbuf,
+ * the string is only built for a name not seen before.
+ *)
+
+type t = {
+  mutable buckets: string list array;
+  mutable count: int;
+}
+
+let create () = { buckets = Array.make 256 []; count = 0 }
+
+let hash_step h code = (h * 31 + code) land max_int
+
+let hash_string str =
+  let h = ref 0 in
+  String.iter (fun ch -> h := hash_step !h (Char.code ch)) str;
+  !h
+
+let bucket_index t hash = hash land (Array.length t.buckets - 1)
+
+let resize t =
+  let old_buckets = t.buckets in
+  t.buckets <- Array.make (Array.length old_buckets * 2) [];
+  Array.iter
+    (List.iter (fun str ->
+      let index = bucket_index t (hash_string str) in
+      t.buckets.(index) <- str::t.buckets.(index)
+    ))
+    old_buckets
+
+let add t hash str =
+  if t.count >= Array.length t.buckets * 2 then
+    resize t;
+  let index = bucket_index t hash in
+  t.buckets.(index) <- str::t.buckets.(index);
+  t.count <- t.count + 1;
+  str
+
+let intern t str =
+  let hash = hash_string str in
+  match List.find_opt (String.equal str) t.buckets.(bucket_index t hash) with
+  | Some interned -> interned
+  | None -> add t hash str
+
+(* the hash of the current lexeme, -1 if it's not ascii *)
+let lexeme_hash lexbuf =
+  let len = Sedlexing.lexeme_length lexbuf in
+  let rec loop i h =
+    if i >= len then
+      h
+    else
+      let code = Uchar.to_int (Sedlexing.lexeme_char lexbuf i) in
+      if code >= 128 then
+        -1
+      else
+        loop (i + 1) (hash_step h code)
+  in
+  loop 0 0
+
+let equal_lexeme lexbuf len str =
+  let rec loop i =
+    i >= len ||
+    (Uchar.to_int (Sedlexing.lexeme_char lexbuf i) = Char.code (String.unsafe_get str i) && loop (i + 1))
+  in
+  String.length str = len && loop 0
+
+let lexeme t lexbuf =
+  let hash = lexeme_hash lexbuf in
+  if hash < 0 then
+    intern t (Sedlexing.Utf8.lexeme lexbuf)
+  else (
+    let len = Sedlexing.lexeme_length lexbuf in
+    let rec find = function
+      | [] -> add t hash (Sedlexing.Utf8.lexeme lexbuf)
+      | str::rest ->
+        if equal_lexeme lexbuf len str then
+          str
+        else
+          find rest
+    in
+    find t.buckets.(bucket_index t hash)
+  )
@@ -357,10 +357,15 @@ let decode_identifier =
     | _ -> failwith "unreachable"
   in
   fun env raw ->
-    let offset = Sedlexing.lexeme_start env.lex_lb in
-    let lexbuf = Sedlexing.Utf8.from_string raw in
-    let buf = Buffer.create (String.length raw) in
-    id_char env offset buf lexbuf
+    (* only the escapes need decoding, the value is the interned raw string *)
+    if not (String.contains raw '\\') then
+      (env, raw)
+    else (
+      let offset = Sedlexing.lexeme_start env.lex_lb in
+      let lexbuf = Sedlexing.Utf8.from_string raw in
+      let buf = Buffer.create (String.length raw) in
+      id_char env offset buf lexbuf
+    )
 
 let recover env lexbuf ~f =
   let env = illegal env (loc_of_lexbuf env lexbuf) in
@@ -879,7 +884,7 @@ let token (env : Lex_env.t) lexbuf : result =
   (* Identifiers *)
   | (js_id_start, Star js_id_continue) ->
     let loc = loc_of_lexbuf env lexbuf in
-    let raw = lexeme lexbuf in
+    let raw = Intern.lexeme env.lex_interned lexbuf in
     let (env, value) = decode_identifier env raw in
     Token (env, T_IDENTIFIER { loc; value; raw })
   (* Syntax *)
@@ -1706,7 +1711,7 @@ let type_token env lexbuf =
   (* Identifiers *)
   | (js_id_start, Star js_id_continue) ->
     let loc = loc_of_lexbuf env lexbuf in
-    let raw = lexeme lexbuf in
+    let raw = Intern.lexeme env.lex_interned lexbuf in
     let (env, value) = decode_identifier env raw in
     Token (env, T_IDENTIFIER { loc; value; raw })
   | "%checks" -> Token (env, T_CHECKS)
@@ -1799,3 +1804,13 @@ let is_valid_identifier_name lexbuf =
   match%sedlex lexbuf with
   | (js_id_start, Star js_id_continue, eof) -> true
   | _ -> false
+
+(* lex til the end, the number of the tokens is returned, e.g. to measure the throughput *)
+let count_tokens env =
+  let rec loop env count =
+    let (env, result) = wrapped_token env in
+    match result.Lex_result.lex_token with
+    | T_EOF -> count
+    | _ -> loop env (count + 1)
+  in
+  loop env 0
@@ -7,6 +7,8 @@ type t = {
   lex_enable_comment_syntax: bool;
   lex_state: lex_state;
   lex_last_loc: Loc.t;
+  (* shared by the clones *)
+  lex_interned: Intern.t;
 }
 
 (* bol = Beginning Of Line *)
@@ -33,6 +35,7 @@ let new_lex_env lex_source lex_lb ~enable_types_in_comments =
     lex_enable_comment_syntax = enable_types_in_comments;
     lex_state = empty_lex_state;
     lex_last_loc = initial_last_loc;
+    lex_interned = Intern.create ();
   }
 
 let line env = env.lex_bol.line
@@ -0,0 +1,81 @@
+(*
+ * Copyright 2022 Vincent Chan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *)
+
+(*
+ * The lexbuf of a source string.
+ *
+ * The utf-8 is validated and decoded in one loop over the bytes,
+ * instead of a generator call per character.
+ * The code points are all in the lexbuf before lexing,
+ * so the clones of the lookahead never refill a shared buffer.
+ *)
+
+let get str i = Char.code (String.unsafe_get str i)
+
+(* the length of the sequence starting with the byte, 0 if it's invalid *)
+let sequence_length byte =
+  if byte < 0x80 then 1
+  else if byte land 0xE0 = 0xC0 then 2
+  else if byte land 0xF0 = 0xE0 then 3
+  else if byte land 0xF8 = 0xF0 then 4
+  else 0
+
+(* the smallest code point of a sequence, a smaller one is an overlong form *)
+let min_code_point n =
+  match n with
+  | 2 -> 0x80
+  | 3 -> 0x800
+  | 4 -> 0x10000
+  | _ -> 0
+
+let count_code_points src =
+  let len = String.length src in
+  let rec loop pos count =
+    if pos >= len then
+      count
+    else (
+      let n = sequence_length (get src pos) in
+      if n = 0 || pos + n > len then
+        raise Sedlexing.MalFormed;
+      loop (pos + n) (count + 1)
+    )
+  in
+  loop 0 0
+
+let decode src =
+  let codes = Array.make (count_code_points src) 0 in
+  let pos = ref 0 in
+  for i = 0 to Array.length codes - 1 do
+    let byte = get src !pos in
+    let n = sequence_length byte in
+    let code = ref (if n = 1 then byte else byte land (0x7F lsr n)) in
+    for k = 1 to n - 1 do
+      let next = get src (!pos + k) in
+      if next land 0xC0 <> 0x80 then
+        raise Sedlexing.MalFormed;
+      code := (!code lsl 6) lor (next land 0x3F)
+    done;
+    (* overlong forms, surrogates and the values beyond unicode are not scalar values *)
+    let code = !code in
+    if code < min_code_point n || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF) then
+      raise Sedlexing.MalFormed;
+    Array.unsafe_set codes i code;
+    pos := !pos + n
+  done;
+  codes
+
+(* raise Sedlexing.MalFormed *)
+let lexbuf_of_string src = Sedlexing.from_int_array (decode src)
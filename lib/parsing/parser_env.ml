@@ -131,9 +131,9 @@ let lookahead ~i env =
 
 let init_env source content =
   let (lb, errors) =
-  try (Sedlexing.Utf8.from_string content, [])
+  try (Lex_source.lexbuf_of_string content, [])
     with Sedlexing.MalFormed ->
-      (Sedlexing.Utf8.from_string "", [
+      (Lex_source.lexbuf_of_string "", [
         { Parse_error. perr_loc = Loc.none; perr_spec = Parse_error.MalformedUnicode}
       ])
   in
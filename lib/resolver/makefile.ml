@@ -21,9 +21,9 @@ let to_string (entries: entry list) =
         )
         deps;
       Buffer.add_string buf "\n";
-      Buffer.add_string buf "\t";
       List.iter
         ~f:(fun line ->
+          Buffer.add_string buf "\t";
           Buffer.add_string buf line;
           Buffer.add_string buf "\n";
         )
@@ -18,6 +18,8 @@ open Lichenscript_lex
 open Lichenscript_typing
 open Lichenscript_parsing
 
+module Timing = Lichenscript_common.Timing
+
 module type FSProvider = sig
 
   val is_directory: string -> bool
@@ -36,6 +38,11 @@ module type FSProvider = sig
 
   val write_file_content: string -> data:string -> unit
 
+  val rename: string -> string -> unit
+
+  (* map over the files, possibly in parallel, `f` has no side effects *)
+  val map_files: f:(string -> 'a) -> string list -> 'a list
+
 end
 
 module S (FS: FSProvider) = struct
@@ -47,6 +54,12 @@ module S (FS: FSProvider) = struct
     (* absolute path => module *)
     linker: Linker.t;
     find_paths: string list;
+
+    (* file path => the result of parsing, filled by `parse_all_files` *)
+    parsed_files: (string, (Parser.parse_result, Parse_error.t list) Result.t) Hashtbl.t;
+
+    (* the parsed asts by the hash of the sources, not cached if None *)
+    ast_cache_dir: string option;
   }
 
   type profile = {
@@ -55,11 +68,13 @@ module S (FS: FSProvider) = struct
     profile_exe_path: string;
   }
 
-  let create ~find_paths ~ctx () =
+  let create ~find_paths ~ast_cache_dir ~ctx () =
     let linker = Linker.create ~ctx () in
     {
       linker;
       find_paths;
+      parsed_files = Hashtbl.create (module String);
+      ast_cache_dir;
     }
 
   class[@warning "-unused-ancestor"] module_scope ~prev () = object
@@ -162,6 +177,155 @@ module S (FS: FSProvider) = struct
 
   let allow_suffix = Re.Pcre.regexp "^(.+)\\.lc$"
 
+  let lc_files_of_dir dir_path =
+    FS.ls_dir dir_path
+    |> List.filter_map
+      ~f:(fun item ->
+        let child_path = Filename.concat dir_path item in
+        if FS.is_file child_path then (
+          try[@alert "-deprecated"]  (* disable the deprecated alert *)
+            let test_result = Re.exec allow_suffix child_path |> Re.Group.all in
+            if Array.length test_result > 1 then (* is a .lc file *)
+              Some child_path
+            else
+              None
+          with
+          | Not_found -> None
+        ) else None
+      )
+
+  let imports_of_ast (ast: Ast.program) =
+    let collected_imports =
+      List.fold
+        ~init:[]
+        ~f:(fun acc item ->
+          let open Ast.Declaration in
+          match item.spec with
+          | Import import -> import::acc
+          | _ -> acc
+        )
+        ast.pprogram_declarations
+    in
+    let preclude = {
+      Ast.Declaration.
+      source = "std/preclude";
+      source_loc = Loc.none;
+    } in
+    List.rev (preclude::collected_imports)
+
+  (* the real path of the module, and the source *)
+  let resolve_import env source =
+    List.fold
+      ~init:None
+      ~f:(fun acc path ->
+        match acc with
+        | Some _ -> acc
+        | None ->
+          if Filename.is_absolute source then
+            Some (source, source)
+          else (
+            let path = Filename.concat path source in
+            if FS.is_directory path then (
+              Some (FS.get_realpath path, source)
+            ) else None
+          )
+      )
+      env.find_paths
+
+  let read_cached_ast cache_path : Parser.parse_result option =
+    if FS.file_exists cache_path then (
+      try Some (Stdlib.Marshal.from_string (FS.read_file_content cache_path) 0)
+      with _ -> None
+    ) else
+      None
+
+  let write_cached_ast cache_dir cache_path (ast: Parser.parse_result) =
+    try
+      FS.mkdir_p cache_dir;
+      (* written under a temp name, the concurrent builds never read a partial file *)
+      let state = Random.State.make_self_init () in
+      let tmp_path = cache_path ^ "." ^ Int.to_string (Random.State.bits state) in
+      FS.write_file_content tmp_path ~data:(Stdlib.Marshal.to_string ast []);
+      FS.rename tmp_path cache_path
+    with _ -> ()
+
+  (*
+   * The ast of a file is cached by the hash of its path and content,
+   * an unchanged file is not lexed and parsed again.
+   * Parsing doesn't look into the imported modules,
+   * the ast stays valid when they change.
+   *)
+  let parse_file env path =
+    let file_content = FS.read_file_content path in
+    let file_key = File_key.LibFile path in
+    match env.ast_cache_dir with
+    | Some cache_dir -> (
+      let key = Md5.digest_string (path ^ "\000" ^ file_content) |> Md5.to_hex in
+      let cache_path = Filename.concat cache_dir key in
+      match read_cached_ast cache_path with
+      | Some ast -> Result.Ok ast
+      | None ->
+        let result = Parser.parse_string (Some file_key) file_content in
+        Result.iter ~f:(write_cached_ast cache_dir cache_path) result;
+        result
+    )
+    | None ->
+      Parser.parse_string (Some file_key) file_content
+
+  (*
+   * Parse all the files reachable from the entry before resolving them.
+   * The modules are visited level by level in the import graph,
+   * the files of a level don't depend on each other, they are parsed by `FS.map_files`.
+   *)
+  let parse_all_files env entry_dir =
+    let visited = Hash_set.create (module String) in
+    let rec parse_level dirs =
+      let dirs =
+        List.filter
+          ~f:(fun dir ->
+            if Hash_set.mem visited dir || Linker.has_module env.linker dir then
+              false
+            else (
+              Hash_set.add visited dir;
+              true
+            )
+          )
+          dirs
+      in
+      if not (List.is_empty dirs) then (
+        let files = List.concat_map ~f:lc_files_of_dir dirs in
+        (* the lexer runs on demand of the parser, it's timed as a part of parsing *)
+        let results =
+          FS.map_files
+            ~f:(fun path -> Timing.measure ~unit_name:path "parse" (fun () -> parse_file env path))
+            files
+        in
+        let results =
+          List.map2_exn
+            ~f:(fun path (result, entry) ->
+              Timing.add entry;
+              Hashtbl.set env.parsed_files ~key:path ~data:result;
+              result
+            )
+            files results
+        in
+        results
+        |> List.concat_map
+          ~f:(fun result ->
+            match result with
+            | Result.Ok (ast: Parser.parse_result) ->
+              imports_of_ast ast.tree
+              |> List.filter_map
+                ~f:(fun (import: Ast.Declaration.import) ->
+                  Option.map ~f:fst (resolve_import env import.source)
+                )
+            | Result.Error _ -> []
+          )
+        |> parse_level
+      )
+    in
+    parse_level [entry_dir]
+
   let insert_moudule_file env ~mod_path file =
     match Linker.get_module env.linker mod_path with
     | Some m ->
@@ -172,34 +336,20 @@ module S (FS: FSProvider) = struct
     )
 
   let rec compile_file_to_path ~ctx ~mod_path env _mod path =
-    let file_content = FS.read_file_content path in
-    let file_key = File_key.LibFile path in
+    let parse_result =
+      (* taken out of the table, the ast is released after the annotation *)
+      match Hashtbl.find_and_remove env.parsed_files path with
+      | Some result -> result
+      | None -> Timing.time ~unit_name:path "parse" (fun () -> parse_file env path)
+    in
     let ast =
-      match Parser.parse_string (Some file_key) file_content with
+      match parse_result with
       | Result.Ok ast -> ast
       | Result.Error err ->
         raise (ParseError err)
     in
 
-    let imports = Ast.(
-      let collected_imports =
-      List.fold
-        ~init:[]
-        ~f:(fun acc item ->
-          let open Ast.Declaration in
-          match item.spec with
-          | Import import -> import::acc
-          | _ -> acc
-        )
-        ast.tree.pprogram_declarations
-      in
-      let preclude = {
-        Ast.Declaration.
-        source = "std/preclude";
-        source_loc = Loc.none;
-      } in
-      List.rev (preclude::collected_imports)
-    ) in
+    let imports = imports_of_ast ast.tree in
 
     let extern_modules = ref [] in
 
@@ -207,24 +357,7 @@ module S (FS: FSProvider) = struct
       ~f:(fun import ->
         let open Ast.Declaration in
         let { source; _ } = import in
-        let find_paths = env.find_paths in
-        let result =
-          List.fold
-            ~init:None
-            ~f:(fun acc path ->
-              match acc with
-              | Some _ -> acc
-              | None ->
-                if Filename.is_absolute source then
-                  Some (source, source)
-                else (
-                  let path = Filename.concat path source in
-                  if FS.is_directory path then (
-                    Some (FS.get_realpath path, source)
-                  ) else None
-                )
-            )
-            find_paths in
+        let result = resolve_import env source in
         match result with
         | Some (path, source) -> (
           ignore (parse_module_by_dir ~ctx env ~real_path:path source);
@@ -268,22 +401,10 @@ module S (FS: FSProvider) = struct
       let module_scope = new module_scope ~prev:(Type_context.root_scope ctx) () in
       let _mod = Module.create ~full_path:mod_path ~module_scope () in
       Linker.set_module env.linker mod_path _mod;
-      let children = FS.ls_dir mod_path in
       (* only compile files in this level *)
       List.iter
-        ~f:(fun item ->
-          let child_path = Filename.concat mod_path item in
-          if FS.is_file child_path then (
-            try[@alert "-deprecated"]  (* disable the deprecated alert *)
-              let test_result = Re.exec allow_suffix child_path |> Re.Group.all in
-              if Array.length test_result > 1 then ((* is a .lc file *)
-                compile_file_to_path ~ctx ~mod_path env _mod child_path
-              )
-            with
-            | Not_found -> ()
-          ) else ()
-        )
-        children;
+        ~f:(compile_file_to_path ~ctx ~mod_path env _mod)
+        (lc_files_of_dir mod_path);
       Module.finalize_module_exports _mod;
     in
     if not (Linker.has_module env.linker dir_path) then (
@@ -299,10 +420,12 @@ module S (FS: FSProvider) = struct
         let files =
           List.map
             ~f:(fun file -> 
-              let { Module. typed_env; ast; _ } = file in
+              let { Module. typed_env; ast; path; _ } = file in
               let typed_tree =
-                Lichenscript_typing.Annotate.annotate_program
-                typed_env (Option.value_exn ast)
+                Timing.time ~unit_name:path "annotate" (fun () ->
+                  Lichenscript_typing.Annotate.annotate_program
+                  typed_env (Option.value_exn ast)
+                )
               in
               { file with
                 (* clear the ast to released memory,
@@ -327,7 +450,9 @@ module S (FS: FSProvider) = struct
         ~f:(fun file ->
           let open Module in
           let tree = Option.value_exn file.typed_tree in
-          Typecheck.typecheck_module ~verbose ctx tree
+          Timing.time ~unit_name:file.path "typecheck" (fun () ->
+            Typecheck.typecheck_module ~verbose ctx tree
+          )
         )
         files;
         (* Typecheck.typecheck_module ctx m. *)
@@ -338,8 +463,13 @@ module S (FS: FSProvider) = struct
     find_paths: string list;
     build_dir: string option;
     runtime_dir: string;
+    (* the shared directory of the prebuilt runtime, compiled in the build directory if None *)
+    runtime_cache_dir: string option;
+    (* the directory of the cached asts, it belongs to one build of the compiler *)
+    ast_cache_dir: string option;
     platform: string;
     verbose: bool;
+    dump_ir: bool;
     wasm_standalone: bool;
   }
 
@@ -353,14 +483,15 @@ module S (FS: FSProvider) = struct
   * Annotated parsed tree remain the "holes" to type check
   *)
   let rec compile_file_path ~config entry_file_path : profile list =
-    let { find_paths; build_dir; runtime_dir; platform; verbose; wasm_standalone } = config in
+    let { find_paths; build_dir; runtime_dir; runtime_cache_dir; ast_cache_dir; platform; verbose; dump_ir; wasm_standalone } = config in
     try
       (* ctx is a typing context for all modules *)
       let ctx = Lichenscript_typing.Type_context.create () in
-      let env = create ~find_paths ~ctx () in
+      let env = create ~find_paths ~ast_cache_dir ~ctx () in
 
       (* parse the entry dir *)
       let dir_of_entry = Filename.dirname entry_file_path in
+      parse_all_files env (FS.get_realpath dir_of_entry);
       let entry_full_path = parse_module_by_dir ~ctx env ~real_path:(FS.get_realpath dir_of_entry) dir_of_entry  in
 
       typecheck_all_modules ~ctx ~verbose env;
@@ -380,7 +511,11 @@ module S (FS: FSProvider) = struct
         ignore (exit 0)
       );
 
-      let declarations = Linker.link_from_entry env.linker ~verbose (Option.value_exn main_fun_id) in
+      let declarations =
+        Timing.time "link" (fun () ->
+          Linker.link_from_entry env.linker ~verbose (Option.value_exn main_fun_id)
+        )
+      in
 
       let get_build_dir () =
         match build_dir with
@@ -398,13 +533,13 @@ module S (FS: FSProvider) = struct
       match platform with
       | "native"
       | "wasm32" -> (
-        let output = Lichenscript_c.codegen ~ctx declarations in
+        let output = Lichenscript_c.codegen ~verbose ~dump_ir ~ctx declarations in
         let mod_name = entry_file_path |> Filename.dirname |> last_piece_of_path in
         let build_dir = get_build_dir () in
         let output_path = write_to_file build_dir mod_name ~ext:".c" output in
         let bin_name = entry_file_path |> last_piece_of_path |> (Filename.chop_extension) in
         write_makefiles
-          ~bin_name ~runtime_dir ~platform ~wasm_standalone build_dir [ (mod_name, output_path) ]
+          ~bin_name ~runtime_dir ~runtime_cache_dir ~platform ~wasm_standalone build_dir [ (mod_name, output_path) ]
       )
 
       | "js" -> (
@@ -435,10 +570,17 @@ module S (FS: FSProvider) = struct
       FS.mkdir_p build_dir
     );
     let output_file_path = Filename.concat build_dir (mod_name ^ ext) in
-    FS.write_file_content output_file_path ~data:content;
+    (* keep the timestamp of an unchanged output, make won't rebuild its object *)
+    let unchanged =
+      FS.file_exists output_file_path &&
+      String.equal (FS.read_file_content output_file_path) content
+    in
+    if not unchanged then (
+      FS.write_file_content output_file_path ~data:content
+    );
     output_file_path
 
-  and write_makefiles ~bin_name ~runtime_dir ~platform ~wasm_standalone build_dir mods: profile list =
+  and write_makefiles ~bin_name ~runtime_dir ~runtime_cache_dir ~platform ~wasm_standalone build_dir mods: profile list =
     let debug_dir =
       match platform with
       | "native" -> Filename.concat build_dir "debug"
@@ -460,9 +602,9 @@ module S (FS: FSProvider) = struct
     in
     FS.mkdir_p debug_dir;
     FS.mkdir_p release_dir;
-    write_makefiles_with_mode ~bin_name ~runtime_dir ~mode:"debug" ~platform debug_dir mods;
-    write_makefiles_with_mode ~bin_name ~runtime_dir ~mode:"release" ~platform release_dir mods;
-    [
+    write_makefiles_with_mode ~bin_name ~runtime_dir ~runtime_cache_dir ~mode:"debug" ~platform debug_dir mods;
+    write_makefiles_with_mode ~bin_name ~runtime_dir ~runtime_cache_dir ~mode:"release" ~platform release_dir mods;
+    let profiles = [
       {
         profile_name = "debug";
         profile_dir = debug_dir;
@@ -473,64 +615,234 @@ module S (FS: FSProvider) = struct
         profile_dir = release_dir;
         profile_exe_path = Filename.concat release_dir bin_name;
       }
-    ]
+    ] in
+    (* the profile is collected by running the binary, only on native *)
+    match platform with
+    | "native" -> (
+      let pgo_dir = Filename.concat build_dir "pgo" in
+      FS.mkdir_p pgo_dir;
+      write_makefiles_with_mode ~bin_name ~runtime_dir ~runtime_cache_dir ~mode:"pgo" ~platform pgo_dir mods;
+      List.append profiles [
+        {
+          profile_name = "pgo";
+          profile_dir = pgo_dir;
+          profile_exe_path = Filename.concat pgo_dir bin_name;
+        }
+      ]
+    )
+    | _ -> profiles
 
-  and write_makefiles_with_mode ~bin_name ~runtime_dir ~mode ~platform build_dir mods =
+  (*
+   * The pgo mode is built twice with the same Makefile:
+   *   - `make PGO=generate` builds the instrumented binary,
+   *     running it writes the profile of each module into its own directory,
+   *     or one raw profile of the binary with clang,
+   *   - `make PGO=use` rebuilds with the collected profile,
+   *     the raw profile of clang is merged by llvm-profdata first.
+   *)
+  and write_makefiles_with_mode ~bin_name ~runtime_dir ~runtime_cache_dir ~mode ~platform build_dir mods =
     let output_path = Filename.concat build_dir "Makefile" in
     let open Makefile in
     let runtime_dir = Filename.concat runtime_dir "c" in
-    let c_srcs = List.fold ~init:"runtime.o" ~f:(fun acc (m, _) -> (acc ^ " " ^ m ^ ".o")) mods in
+    let runtime_srcs =
+      List.map
+        ~f:(fun name ->
+          (Filename.concat runtime_dir name)
+          |> FS.get_realpath
+        )
+        ["runtime.c"; "runtime.h"]
+    in
+    let runtime_c = List.hd_exn runtime_srcs in
+    let is_pgo = String.equal mode "pgo" in
+    let pgo_flags module_name =
+      if is_pgo then
+        Format.sprintf " -fprofile-$(PGO)=$(call pgo_path,%s) $(PGO_FLAGS_$(PGO))" module_name
+      else
+        ""
+    in
+    let flags =
+      match mode with
+      | "debug" -> "FLAGS=-O0 -g3 -D LSC_DEBUG\n"
+      | "pgo" ->
+        "FLAGS=-O3 -g0\n" ^
+        "PGO=use\n" ^
+        "PROFILE_DIR=$(CURDIR)/profile\n" ^
+        "PGO_LDFLAGS_generate=-fprofile-generate\n" ^
+        (* the worker threads of the runtime update the counters concurrently *)
+        "PGO_FLAGS_generate=-fprofile-update=atomic\n" ^
+        (* cc is clang on macOS *)
+        "ifneq ($(findstring clang,$(shell $(CC) --version)),)\n" ^
+        "PROFDATA=$(if $(filter Darwin,$(shell uname -s)),xcrun llvm-profdata,llvm-profdata)\n" ^
+        "PGO_PROFILE_use=$(PROFILE_DIR)/default.profdata\n" ^
+        "PGO_FLAGS_use=-Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date\n" ^
+        "pgo_path=$(if $(filter use,$(PGO)),$(PGO_PROFILE_use),$(PROFILE_DIR))\n" ^
+        "else\n" ^
+        "PGO_FLAGS_use=-fprofile-correction -Wno-missing-profile\n" ^
+        "pgo_path=$(PROFILE_DIR)/$(1)\n" ^
+        "endif\n"
+      | _ -> "FLAGS=-O3 -g0\n"
+    in
+    let cc =
+      match platform with
+      | "native" -> "cc"
+      | "wasm32" -> "emcc"
+      | _ -> failwith  ("unsupport platform: " ^ platform)
+    in
+
+    (*
+     * The runtime is archived once in the cache directory,
+     * and shared by all the builds with the same sources, flags and compiler.
+     * The profile of the pgo mode belongs to the program, the runtime is compiled in place.
+     *)
+    let runtime_lib =
+      match runtime_cache_dir with
+      | Some cache_dir when not is_pgo -> (
+        let key =
+          List.map ~f:FS.read_file_content runtime_srcs
+          |> List.append [ cc; platform; flags ]
+          |> String.concat ~sep:"\000"
+          |> Md5.digest_string
+          |> Md5.to_hex
+        in
+        Some (Filename.concat cache_dir key)
+      )
+      | _ -> None
+    in
+
+    let mod_objs = List.map ~f:(fun (m, _) -> m ^ ".o") mods in
+    (* the merged profile of clang, empty with gcc *)
+    let pgo_deps = if is_pgo then ["$(PGO_PROFILE_$(PGO))"] else [] in
+    (* the objects are rebuilt when the flags change, e.g. `make LTO=1` *)
+    let flags_stamp = ".flags" in
+    let runtime_entry =
+      match runtime_lib with
+      | Some _ ->
+        {
+          entry_name = "$(RUNTIME_LIB)";
+          deps = runtime_srcs;
+          content = [
+            "mkdir -p $(dir $(RUNTIME_LIB))";
+            (* archived under a temp name, the concurrent builds never see a partial file *)
+            "$(CC) $(FLAGS) -c " ^ runtime_c ^
+            " -o $@.$$$$.o && $(AR) rcs $@.$$$$ $@.$$$$.o && rm $@.$$$$.o && mv $@.$$$$ $@"
+          ];
+        }
+
+      | None ->
+        {
+          entry_name = "runtime.o";
+          deps = List.concat [runtime_srcs; [flags_stamp]; pgo_deps];
+          content = [
+            Format.sprintf "$(CC) $(FLAGS)%s -c %s" (pgo_flags "runtime") runtime_c
+          ];
+        }
+    in
+    let link_objs =
+      match runtime_lib with
+      | Some _ -> List.append mod_objs ["$(RUNTIME_LIB)"]
+      | None -> "runtime.o"::mod_objs
+    in
     let entries = List.concat [
       [
         {
           entry_name = "all";
-          deps = List.concat [ ["runtime"]; (List.map ~f:(fun (m, _) -> m) mods)];
-          content = [
-            Format.sprintf "$(CC) $(FLAGS) %s -o %s" c_srcs bin_name
-          ];
+          deps = [bin_name];
+          content = [];
         };
         {
-          entry_name = "runtime";
-          deps =
-            List.map
-            ~f:(fun name ->
-              (Filename.concat runtime_dir name)
-              |> FS.get_realpath
-            )
-            ["runtime.c"; "runtime.h"];
+          entry_name = bin_name;
+          deps = link_objs;
           content = [
-            "$(CC) $(FLAGS) -c " ^ Filename.(concat runtime_dir "runtime.c"|> FS.get_realpath)
+            Format.sprintf "$(CC) $(FLAGS)%s %s -o %s $(LDFLAGS) $(LIBS)"
+              (if is_pgo then " $(PGO_LDFLAGS_$(PGO))" else "") (String.concat ~sep:" " link_objs) bin_name
           ];
-        }
+        };
+        runtime_entry;
       ];
       List.map
         ~f:(fun (m, output) ->
           let output_full_path = FS.get_realpath output in
           {
-            entry_name = m;
-            deps = [output_full_path];
+            entry_name = m ^ ".o";
+            deps = List.append [output_full_path; List.last_exn runtime_srcs; flags_stamp] pgo_deps;
             content = [
-              Format.sprintf "$(CC) $(FLAGS) -I%s -c %s" (FS.get_realpath runtime_dir) output_full_path
+              Format.sprintf "$(CC) $(FLAGS)%s -I%s -c %s" (pgo_flags m) (FS.get_realpath runtime_dir) output_full_path
             ];
           }
         )
         mods;
-    ] in
-    let flags =
-      if String.equal mode "debug" then
-        "FLAGS=-O0 -g3 -D LSC_DEBUG\n"
+      if is_pgo then
+        [
+          {
+            entry_name = "clean-profile";
+            deps = [];
+            content = [ "rm -rf $(PROFILE_DIR)" ];
+          };
+          {
+            entry_name = "$(PROFILE_DIR)/default.profdata";
+            deps = [ "$(wildcard $(PROFILE_DIR)/*.profraw)" ];
+            content = [ "$(PROFDATA) merge -output=$@ $^" ];
+          }
+        ]
       else
-        "FLAGS=-O3 -g0\n"
+        [];
+    ] in
+    (*
+     * the worker pool of runtime is disabled on wasm32,
+     * libm is needed by the std (sqrt in Bench.run)
+     *)
+    let libs =
+      match platform with
+      | "native" -> "LIBS=-lpthread -lm\n"
+      | _ -> "LIBS=\n"
     in
-    let cc =
+    let ar =
       match platform with
-      | "native" -> "cc"
-      | "wasm32" -> "emcc"
-      | _ -> failwith  ("unsupport platform: " ^ platform)
+      | "wasm32" -> "AR=emar\n"
+      | _ -> ""
+    in
+    (*
+     * `make LTO=1` optimizes the runtime and the modules together,
+     * the helpers of the runtime can be inlined into the generated code,
+     * and the unused functions are removed from the binary.
+     *)
+    let lto =
+      match platform, mode with
+      | "native", ("release" | "pgo") ->
+        "ifeq ($(LTO),1)\n" ^
+        "FLAGS+=-flto -ffunction-sections -fdata-sections\n" ^
+        (* the linker of macOS has no --gc-sections *)
+        "ifeq ($(shell uname -s),Darwin)\n" ^
+        "LDFLAGS+=-Wl,-dead_strip\n" ^
+        "else\n" ^
+        "LDFLAGS+=-Wl,--gc-sections\n" ^
+        "endif\n" ^
+        (if Option.is_some runtime_lib then "RUNTIME_VARIANT=" ^ mode ^ "-lto\n" else "") ^
+        "endif\n"
+      | _ -> ""
+    in
+    (* debug, release and release-lto are side by side, per compiler version *)
+    let runtime_lib_vars =
+      match runtime_lib with
+      | Some dir ->
+        "RUNTIME_VARIANT=" ^ mode ^ "\n" ^
+        "CC_VERSION:=$(shell $(CC) -dumpversion)\n" ^
+        "RUNTIME_LIB=" ^ dir ^ "/$(notdir $(CC))-$(CC_VERSION)/$(RUNTIME_VARIANT)/libLichenRuntime.a\n"
+      | None -> ""
+    in
+    let stamp =
+      Format.sprintf
+        "$(shell echo '$(CC) $(FLAGS) $(LDFLAGS) $(PGO)' > %s.tmp; cmp -s %s.tmp %s || mv %s.tmp %s; rm -f %s.tmp)\n"
+        flags_stamp flags_stamp flags_stamp flags_stamp flags_stamp flags_stamp
     in
     let data =
       "CC=" ^ cc ^ "\n" ^
+      ar ^
       flags ^
+      libs ^
+      runtime_lib_vars ^
+      lto ^
+      stamp ^
       to_string entries in
     FS.write_file_content output_path ~data
   
@@ -1111,7 +1111,7 @@ and annotate_class env cls =
         )
 
         | Cls_declare declare -> (
-          let { cls_decl_method_attributes; cls_decl_method_name; cls_decl_method_type_vars; cls_decl_method_params; cls_decl_method_loc; cls_decl_method_return_ty; cls_decl_method_get_set; _ } = declare in
+          let { cls_decl_method_attributes; cls_decl_method_modifier; cls_decl_method_name; cls_decl_method_type_vars; cls_decl_method_params; cls_decl_method_loc; cls_decl_method_return_ty; cls_decl_method_get_set; _ } = declare in
           let type_visibility = Visibility.Public in
 
           let declare_id = Type_context.size ctx in
@@ -1154,23 +1154,44 @@ and annotate_class env cls =
               cls_decl_method_get_set
             in
 
+            let is_static =
+              match cls_decl_method_modifier with
+              | Some Ast.Declaration.Cls_modifier_static -> true
+              | _ -> false
+            in
+
             let new_type =
-              { TypeDef.
-                id = declare_id;
-                builtin = false;
-                name = cls_decl_method_name.pident_name;
-                spec = ClassMethod {
-                  method_cls_id = cls_var.var_id;
-                  method_get_set;
-                  method_is_virtual = false;
-                  method_params = method_params;
-                  method_return;
-                };
-              }
+              if is_static then
+                { TypeDef.
+                  id = declare_id;
+                  builtin = false;
+                  name = cls_decl_method_name.pident_name;
+                  spec = Function {
+                    fun_vars = List.map ~f:(fun id -> id.pident_name) cls_decl_method_type_vars;
+                    fun_params = method_params;
+                    fun_return = method_return;
+                  };
+                }
+              else
+                { TypeDef.
+                  id = declare_id;
+                  builtin = false;
+                  name = cls_decl_method_name.pident_name;
+                  spec = ClassMethod {
+                    method_cls_id = cls_var.var_id;
+                    method_get_set;
+                    method_is_virtual = false;
+                    method_params = method_params;
+                    method_return;
+                  };
+                }
             in
 
             let cls_elm = 
               match cls_decl_method_get_set with
+              | _ when is_static ->
+                Core_type.TypeDef.Cls_elm_method(type_visibility, new_type)
+
               | Some Ast.Declaration.Cls_getter ->
                 Core_type.TypeDef.Cls_elm_get_set(type_visibility, Some new_type, None)
 
@@ -1182,7 +1203,10 @@ and annotate_class env cls =
 
             in
 
-            add_tcls_element (cls_decl_method_name.pident_name, cls_elm) cls_decl_method_loc;
+            if is_static then
+              add_tcls_static_element (cls_decl_method_name.pident_name, cls_elm) cls_decl_method_loc
+            else
+              add_tcls_element (cls_decl_method_name.pident_name, cls_elm) cls_decl_method_loc;
 
             ignore (Type_context.new_id ctx
               { Core_type.
@@ -1195,6 +1219,9 @@ and annotate_class env cls =
               });
 
             (match cls_decl_method_get_set with
+            (* static elements are not visible in the class scope *)
+            | _ when is_static -> ()
+
             | Some Cls_getter -> 
               class_scope#insert_cls_element
                 { Scope.ClsElm.
@@ -39,6 +39,13 @@ let find_typedef_of ctx type_expr =
   | TypeDef sym -> Some sym
   | _ -> None
 
+(*
+ * The type var of a call result which is not bound by the params,
+ * e.g. T of Array.withCapacity(), renamed apart per call.
+ * Its type is inferred from the first method call on the result.
+ *)
+let is_inference_var name = String.contains name '\''
+
 let rec type_assinable_with_maps ctx var_maps left right =
   let open TypeExpr in
   let left = Type_context.deref_type ctx left in
@@ -51,7 +58,7 @@ let rec type_assinable_with_maps ctx var_maps left right =
   | (String, String) -> var_maps, true
 
   | (TypeSymbol a, TypeSymbol b) ->
-    var_maps, String.equal a b
+    var_maps, (String.equal a b || is_inference_var a || is_inference_var b)
 
   | (TypeSymbol a, _) ->
     (TypeVarMap.set var_maps ~key:a ~data:right), true
@@ -80,13 +87,20 @@ let rec type_assinable_with_maps ctx var_maps left right =
     var_maps, (type_equal ctx left_arr right_arr)
 
   | (Lambda (params1, rt1), Lambda (params2, rt2)) -> (
-    let test_params =
+    let var_maps, test_params =
       List.fold2_exn
-        ~init:true
-        ~f:(fun acc (_, item1) (_, item2) ->
-          if not acc then acc
-          else
-            type_assinable ctx item2 item1
+        ~init:(var_maps, true)
+        ~f:(fun (var_maps, acc) (_, item1) (_, item2) ->
+          if not acc then (var_maps, acc)
+          else (
+            match Type_context.deref_type ctx item1 with
+            (* a unresolved param, e.g. the comparator passed to a static constructor *)
+            | TypeSymbol _ ->
+              type_assinable_with_maps ctx var_maps item1 item2
+
+            | _ ->
+              var_maps, type_assinable ctx item2 item1
+          )
         )
         params1.params_content
         params2.params_content
@@ -368,6 +382,28 @@ let is_string type_expr =
   | TypeExpr.String -> true
   | _ -> false
 
+(* the types PriorityQueue orders without a comparator, see lc_heap_order_of() *)
+let is_ordered ctx type_expr =
+  is_string (Type_context.deref_type ctx type_expr) ||
+  List.exists
+    ~f:(fun name -> is_primitive_with_name ctx ~name type_expr)
+    [ "i32"; "i64"; "u64"; "f32"; "f64"; "char"; "boolean" ]
+
+let rec type_symbols_of type_expr =
+  let open Core_type.TypeExpr in
+  let of_params { params_content; params_rest } =
+    List.append
+      (List.concat_map ~f:(fun (_, t) -> type_symbols_of t) params_content)
+      (Option.value_map ~default:[] ~f:(fun (_, t) -> type_symbols_of t) params_rest)
+  in
+  match type_expr with
+  | TypeSymbol sym_name -> [sym_name]
+  | Ctor (m, list) -> List.append (type_symbols_of m) (List.concat_map ~f:type_symbols_of list)
+  | Lambda (params, ret) -> List.append (of_params params) (type_symbols_of ret)
+  | Tuple children -> List.concat_map ~f:type_symbols_of children
+  | Array arr -> type_symbols_of arr
+  | Unknown | Any | Ref _ | Method _ | String | TypeDef _ -> []
+
 let rec replace_type_vars_with_maps ctx type_map type_expr =
   let open Core_type.TypeExpr in
   match type_expr with
@@ -657,3 +693,281 @@ type pattern_exhausted =
   | Pat_tuple of Typedtree.Pattern.t list array
   | Pat_enum_branch of (Typedtree.identifier * Typedtree.Pattern.t) list
 [@@deriving show]
+
+(*
+ * A lambda is "pure" if it can run on the worker pool of the runtime:
+ * 1. it only takes and returns primitives
+ * 2. it only captures immutable primitives, so nothing is upgraded to a RefCell
+ * 3. the body never calls, allocates or touches an object,
+ *    so it never changes a refcount.
+ *
+ * It's conservative, a lambda rejected here runs sequentially.
+ *)
+let is_pure_lambda ctx (lambda: Typedtree.Expression.lambda) =
+  let open Typedtree in
+  let is_prim_ty_var ty_var =
+    type_should_not_release ctx (Type_context.deref_node_type ctx ty_var)
+  in
+
+  let params_are_prim =
+    List.for_all
+      ~f:(fun { Function. param_ty; param_rest; _ } -> (not param_rest) && is_prim_ty_var param_ty)
+      lambda.lambda_params.params_content
+  in
+
+  let captured_are_prim () =
+    Scope.CapturingVarMap.keys lambda.lambda_scope#capturing_variables
+    |> List.for_all
+      ~f:(fun name ->
+        match lambda.lambda_scope#find_var_symbol name with
+        | Some { Scope. var_kind = Lichenscript_parsing.Ast.Pvar_const; var_id; _ } ->
+          is_prim_ty_var var_id
+        | _ -> false
+      )
+  in
+
+  let rec is_pure_expr (expr: Expression.t) =
+    let open Expression in
+    is_prim_ty_var expr.ty_var &&
+    match expr.spec with
+    | Constant (Lichenscript_parsing.Ast.Literal.String _) -> false
+    | Constant _ -> true
+    | Identifier (name, _) -> not (Char.is_uppercase (String.get name 0))
+    | Unary (_, e) -> is_pure_expr e
+    | Binary (_, left, right) -> is_pure_expr left && is_pure_expr right
+    | Assign (_, ({ spec = Identifier _; _ } as left), right) ->
+      is_pure_expr left && is_pure_expr right
+    | If if_desc -> is_pure_if if_desc
+    | Block block -> is_pure_block block
+    | _ -> false
+
+  and is_pure_if (if_desc: Expression.if_desc) =
+    is_pure_expr if_desc.if_test &&
+    is_pure_block if_desc.if_consequent &&
+    (match if_desc.if_alternative with
+    | Some (If_alt_if if_desc) -> is_pure_if if_desc
+    | Some (If_alt_block block) -> is_pure_block block
+    | None -> true)
+
+  and is_pure_block (block: Block.t) =
+    List.for_all ~f:is_pure_stmt block.body
+
+  and is_pure_stmt (stmt: Statement.t) =
+    let open Statement in
+    match stmt.spec with
+    | Expr e
+    | Semi e -> is_pure_expr e
+    | Binding binding -> is_pure_expr binding.binding_init
+    | While { while_test; while_block; _ } ->
+      is_pure_expr while_test && is_pure_block while_block
+    | Break _
+    | Continue _
+    | Debugger
+    | Empty -> true
+    | Return _ -> false
+  in
+
+  params_are_prim &&
+  captured_are_prim () &&
+  is_pure_expr lambda.lambda_body
+
+(*
+ * Collect the names of all the identifiers which are used as a value
+ * in the block, i.e. everywhere except the callee of a call.
+ *
+ * A local lambda whose name is not collected is only called directly,
+ * so it never escapes the function.
+ * Shadowed names are merged, which is conservative.
+ *)
+let value_identifiers_of_block (block: Typedtree.Block.t) =
+  let open Typedtree in
+  let result = Hash_set.create (module String) in
+
+  let rec visit_expr (expr: Expression.t) =
+    let open Expression in
+    match expr.spec with
+    | Identifier (name, _) -> Hash_set.add result name
+    | Constant _
+    | This
+    | Super -> ()
+    | Lambda lambda -> visit_expr lambda.lambda_body
+    | If if_desc -> visit_if if_desc
+    | Array items
+    | Tuple items -> List.iter ~f:visit_expr items
+    | Map entries -> List.iter ~f:(fun entry -> visit_expr entry.map_entry_value) entries
+    | Call { callee; call_params; _ } -> (
+      (match callee.spec with
+      | Identifier _ -> ()
+      | _ -> visit_expr callee);
+      List.iter ~f:visit_expr call_params
+    )
+    | Member (e, _)
+    | Unary (_, e)
+    | Try e -> visit_expr e
+    | Index (left, right)
+    | Binary (_, left, right)
+    | Assign (_, left, right) ->
+      visit_expr left;
+      visit_expr right
+    | Block block -> visit_block block
+    | Init init ->
+      List.iter
+        ~f:(fun elm ->
+          match elm with
+          | InitSpread e -> visit_expr e
+          | InitEntry entry -> visit_expr entry.init_entry_value
+        )
+        init.init_elements
+    | Match _match ->
+      visit_expr _match.match_expr;
+      List.iter ~f:(fun clause -> visit_expr clause.clause_consequent) _match.match_clauses
+
+  and visit_if (if_desc: Expression.if_desc) =
+    visit_expr if_desc.if_test;
+    visit_block if_desc.if_consequent;
+    match if_desc.if_alternative with
+    | Some (Expression.If_alt_if if_desc) -> visit_if if_desc
+    | Some (Expression.If_alt_block block) -> visit_block block
+    | None -> ()
+
+  and visit_block (block: Block.t) =
+    List.iter ~f:visit_stmt block.body
+
+  and visit_stmt (stmt: Statement.t) =
+    let open Statement in
+    match stmt.spec with
+    | Expr e
+    | Semi e
+    | Return (Some e) -> visit_expr e
+    | Binding binding -> visit_expr binding.binding_init
+    | While { while_test; while_block; _ } ->
+      visit_expr while_test;
+      visit_block while_block
+    | Break _
+    | Continue _
+    | Debugger
+    | Return None
+    | Empty -> ()
+  in
+
+  visit_block block;
+  result
+
+type local_object_uses = {
+  (* the names used as a value somewhere *)
+  escaped: string Hash_set.t;
+
+  (* name -> the members read or written on it *)
+  members: (string, string Hash_set.t) Hashtbl.t;
+}
+
+(*
+ * Find the local objects which never escape the block.
+ *
+ * A name escapes when it's used as a value: passed to a call,
+ * returned, stored, assigned, captured by a lambda, or used as
+ * the receiver of a method call.
+ * Accessing a member, and matching against tuple patterns, don't make it escape.
+ * The caller checks the members are fields.
+ *
+ * Shadowed names are merged, which is conservative.
+ *)
+let local_object_uses_of_block (block: Typedtree.Block.t) =
+  let open Typedtree in
+  let result = {
+    escaped = Hash_set.create (module String);
+    members = Hashtbl.create (module String);
+  } in
+
+  let add_member name member =
+    let set =
+      Hashtbl.find_or_add result.members name
+        ~default:(fun () -> Hash_set.create (module String))
+    in
+    Hash_set.add set member
+  in
+
+  let is_destructuring (pat: Pattern.t) =
+    match pat.spec with
+    | Pattern.Tuple _
+    | Pattern.Underscore -> true
+    | _ -> false
+  in
+
+  let rec visit_expr (expr: Expression.t) =
+    let open Expression in
+    match expr.spec with
+    | Identifier (name, _) -> Hash_set.add result.escaped name
+    | Constant _
+    | This
+    | Super -> ()
+    | Lambda lambda -> visit_expr lambda.lambda_body
+    | If if_desc -> visit_if if_desc
+    | Array items
+    | Tuple items -> List.iter ~f:visit_expr items
+    | Map entries -> List.iter ~f:(fun entry -> visit_expr entry.map_entry_value) entries
+    | Call { callee; call_params; _ } -> (
+      (match callee.spec with
+      | Identifier _ -> ()
+      | Member (e, _) -> visit_expr e
+      | _ -> visit_expr callee);
+      List.iter ~f:visit_expr call_params
+    )
+    | Member ({ spec = Identifier (name, _); _ }, member) ->
+      add_member name member.pident_name
+    | Member (e, _)
+    | Unary (_, e)
+    | Try e -> visit_expr e
+    | Index (left, right)
+    | Binary (_, left, right)
+    | Assign (_, left, right) ->
+      visit_expr left;
+      visit_expr right
+    | Block block -> visit_block block
+    | Init init ->
+      List.iter
+        ~f:(fun elm ->
+          match elm with
+          | InitSpread e -> visit_expr e
+          | InitEntry entry -> visit_expr entry.init_entry_value
+        )
+        init.init_elements
+    | Match _match -> (
+      (match _match.match_expr.spec with
+      | Identifier _
+        when List.for_all ~f:(fun clause -> is_destructuring clause.clause_pat) _match.match_clauses ->
+        ()
+      | _ -> visit_expr _match.match_expr);
+      List.iter ~f:(fun clause -> visit_expr clause.clause_consequent) _match.match_clauses
+    )
+
+  and visit_if (if_desc: Expression.if_desc) =
+    visit_expr if_desc.if_test;
+    visit_block if_desc.if_consequent;
+    match if_desc.if_alternative with
+    | Some (Expression.If_alt_if if_desc) -> visit_if if_desc
+    | Some (Expression.If_alt_block block) -> visit_block block
+    | None -> ()
+
+  and visit_block (block: Block.t) =
+    List.iter ~f:visit_stmt block.body
+
+  and visit_stmt (stmt: Statement.t) =
+    let open Statement in
+    match stmt.spec with
+    | Expr e
+    | Semi e
+    | Return (Some e) -> visit_expr e
+    | Binding binding -> visit_expr binding.binding_init
+    | While { while_test; while_block; _ } ->
+      visit_expr while_test;
+      visit_block while_block
+    | Break _
+    | Continue _
+    | Debugger
+    | Return None
+    | Empty -> ()
+  in
+
+  visit_block block;
+  result
@@ -170,6 +170,9 @@ module PP = struct
     | CannotUsedForTryExpression ty ->
       Format.fprintf formatter "The type '%s' can not be used in a try expression." (pp_ty ty)
 
+    | NotComparable ty ->
+      Format.fprintf formatter "The type '%s' is not comparable, use PriorityQueue.withComparator()." (pp_ty ty)
+
   let error ~ctx formatter diagnosis =
     let { spec; loc; _ } = diagnosis in
     match spec with
@@ -41,3 +41,4 @@ type t =
   | WhileTestShouldBeBoolean of TypeExpr.t
   | IfTestShouldBeBoolean of TypeExpr.t
   | CannotUsedForTryExpression of TypeExpr.t
+  | NotComparable of TypeExpr.t
@@ -33,6 +33,15 @@ type env = {
    * a function can have multiple return
    *)
   mutable return_types: (TypeExpr.t * Loc.t) list;
+
+  (*
+   * the type vars a call can not bind, e.g. T of Array.withCapacity(),
+   * are inferred from the first method call on the result
+   *)
+  mutable inferred_types: TypeExpr.t Check_helper.TypeVarMap.t;
+
+  (* the inference vars which must be ordered, e.g. T of PriorityQueue.create() *)
+  ordered_vars: string Hash_set.t;
 }
 
 let add_return_type env ret = env.return_types <- ret::env.return_types
@@ -81,6 +90,8 @@ let rec typecheck_module ctx ~verbose (typedtree: T.program) =
       ctx;
       scope = tprogram_scope;
       return_types = [];
+      inferred_types = Check_helper.TypeVarMap.empty;
+      ordered_vars = Hash_set.create (module String);
     } in
     List.iter ~f:(check_declaration env) tprogram_declarations;
     if verbose then (
@@ -238,6 +249,52 @@ and check_statement env stmt =
 
   | Empty -> ()
 
+(*
+ * The type vars of the return type not bound by the params are renamed apart,
+ * so the results of two calls are inferred separately.
+ *)
+and bind_inference_vars env ~is_ordered ty_var symbol_map return_type =
+  List.fold
+    ~init:symbol_map
+    ~f:(fun acc name ->
+      if Check_helper.TypeVarMap.mem acc name || env.scope#is_generic_type_symbol name then
+        acc
+      else (
+        let inference_var = name ^ "'" ^ (Int.to_string ty_var) in
+        if is_ordered then
+          Hash_set.add env.ordered_vars inference_var;
+        Check_helper.TypeVarMap.set acc ~key:name ~data:(TypeExpr.TypeSymbol inference_var)
+      )
+    )
+    (Check_helper.type_symbols_of return_type)
+
+(* the first concrete type passed to an inference var is its type *)
+and infer_type_vars env loc symbol_map =
+  Check_helper.TypeVarMap.iteri
+    ~f:(fun ~key ~data ->
+      match Type_context.deref_type env.ctx data with
+      | TypeExpr.TypeSymbol _ -> ()
+      | _ when Check_helper.is_inference_var key && not (Check_helper.TypeVarMap.mem env.inferred_types key) -> (
+        if Hash_set.mem env.ordered_vars key && not (Check_helper.is_ordered env.ctx data) then (
+          let err = Diagnosis.(make_error env.ctx loc (NotComparable data)) in
+          raise (Diagnosis.Error err)
+        );
+        env.inferred_types <- Check_helper.TypeVarMap.set env.inferred_types ~key ~data
+      )
+      | _ -> ()
+    )
+    symbol_map
+
+(* the items of PriorityQueue.create() are ordered by the runtime *)
+and is_priority_queue_create env (callee: T.Expression.t) =
+  match callee.spec with
+  | T.Expression.Member (obj, { Identifier. pident_name = "create"; _ }) -> (
+    match Type_context.deref_node_type env.ctx obj.ty_var with
+    | TypeExpr.TypeDef { TypeDef. builtin = true; name = "PriorityQueue"; _ } -> true
+    | _ -> false
+  )
+  | _ -> false
+
 and check_expression_if env if_spec =
   let open T.Expression in
   let { if_test; if_consequent; if_alternative; if_ty_var; if_loc; _ } = if_spec in
@@ -514,7 +571,10 @@ and check_expression env expr =
     )
 
     | TypeExpr.Method(_, params, ret) -> (
+      let params = Check_helper.replace_params_with_type ctx env.inferred_types params in
       let symbol_map = check_params Check_helper.TypeVarMap.empty params in
+      infer_type_vars env expr_loc symbol_map;
+      let ret = Check_helper.replace_type_vars_with_maps env.ctx env.inferred_types ret in
       Type_context.update_node_type ctx expr.ty_var (Check_helper.replace_type_vars_with_maps env.ctx symbol_map ret)
     )
 
@@ -524,6 +584,11 @@ and check_expression env expr =
         match deref_type_expr with
         | TypeExpr.TypeDef { TypeDef. spec = Function _fun; _ } ->
           let symbol_map = check_params Check_helper.TypeVarMap.empty _fun.fun_params in
+          let symbol_map =
+            bind_inference_vars env
+              ~is_ordered:(is_priority_queue_create env callee)
+              expr.ty_var symbol_map _fun.fun_return
+          in
           Type_context.update_node_type ctx expr.ty_var (Check_helper.replace_type_vars_with_maps env.ctx symbol_map _fun.fun_return)
 
         | TypeExpr.TypeDef { TypeDef. spec = EnumCtor enum_ctor; _} -> (
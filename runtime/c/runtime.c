@@ -29,10 +29,23 @@
 #include <execinfo.h>
 #endif
 
+#if defined(__EMSCRIPTEN__) && !defined(LC_NO_THREADS)
+#define LC_NO_THREADS
+#endif
+
+#ifndef LC_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #define LC_INIT_SYMBOL_BUCKET_SIZE 128
 #define LC_INIT_CLASS_META_CAP 8
 #define LC_SMALL_MAP_THRESHOLD 8
 #define I64_POOL_SIZE 1024
+#define LC_ARRAY_MIN_CAP 2
+#define LC_ARRAY_LARGE_CAP (1024 * 1024)
+#define LC_PARALLEL_MIN_LEN 4096
+#define LC_PARALLEL_MAX_WORKERS 64
 
 #define lc_raw_malloc malloc
 #define lc_raw_realloc realloc
@@ -205,6 +218,8 @@ typedef struct LCClassMeta {
     size_t cls_method_size;
 } LCClassMeta;
 
+typedef struct LCThreadPool LCThreadPool;
+
 typedef struct LCRuntime {
     LCMallocState malloc_state;
     uint32_t seed;
@@ -216,14 +231,103 @@ typedef struct LCRuntime {
     uint8_t      gc_phase;
     GCObjectList gc_objs;
     GCObjectList tmp_objs;
+    LCThreadPool* thread_pool;
 } LCRuntime;
 
-typedef struct LCArray {
+/**
+ * Ring buffer, the capacity is always a power of 2
+ */
+typedef struct LCDeque {
+    LCGCObjectHeader header;
+    uint32_t head;
+    uint32_t len;
+    uint32_t capacity;
+    LCValue* data;
+} LCDeque;
+
+/**
+ * How the items of a PriorityQueue are compared,
+ * decided by the first item pushed if no comparator is given.
+ */
+typedef enum LCHeapOrder {
+    LC_HEAP_ORDER_UNKNOWN = 0,
+    LC_HEAP_ORDER_INT,
+    LC_HEAP_ORDER_F32,
+    LC_HEAP_ORDER_I64,
+    LC_HEAP_ORDER_U64,
+    LC_HEAP_ORDER_F64,
+    LC_HEAP_ORDER_STRING,
+    LC_HEAP_ORDER_LAMBDA,
+} LCHeapOrder;
+
+/**
+ * Binary min-heap stored in an array
+ */
+typedef struct LCPriorityQueue {
     LCGCObjectHeader header;
     uint32_t len;
     uint32_t capacity;
+    LCHeapOrder order;
+    LCValue cmp;
     LCValue* data;
-} LCArray;
+} LCPriorityQueue;
+
+typedef struct LCSetEntry {
+    uint32_t hash;
+    // LC_TY_NULL if the entry is deleted
+    LCValue key;
+} LCSetEntry;
+
+/**
+ * The entries are kept in insertion order in a dense array,
+ * the open-addressing index table maps hashes to the entries.
+ * The keys are never GCObjects, so Set is only refcounted.
+ */
+typedef struct LCSet {
+    LCRefCountHeader header;
+    // decided by the first key, LC_TY_NULL before that
+    int key_ty;
+    uint32_t size;
+    uint32_t entries_len;
+    uint32_t entries_cap;
+    uint32_t index_bits;
+    LCSetEntry* entries;
+    int32_t* index;
+} LCSet;
+
+#define LC_BTREE_MAX_KEYS 32
+#define LC_BTREE_MIN_KEYS (LC_BTREE_MAX_KEYS / 2)
+
+/**
+ * Nodes of the B+tree of SortedMap.
+ * The keys of a node are contiguous, the values live in the leaves,
+ * and the leaves are linked for range scans.
+ */
+typedef struct LCBTreeNode {
+    uint32_t is_leaf;
+    uint32_t len;
+    LCValue keys[LC_BTREE_MAX_KEYS];
+} LCBTreeNode;
+
+typedef struct LCBTreeLeaf {
+    LCBTreeNode base;
+    LCValue values[LC_BTREE_MAX_KEYS];
+    struct LCBTreeLeaf* prev;
+    struct LCBTreeLeaf* next;
+} LCBTreeLeaf;
+
+typedef struct LCBTreeInner {
+    LCBTreeNode base;
+    LCBTreeNode* children[LC_BTREE_MAX_KEYS + 1];
+} LCBTreeInner;
+
+typedef struct LCSortedMap {
+    LCGCObjectHeader header;
+    // decided by the first key, LC_TY_NULL before that
+    int key_ty;
+    uint32_t size;
+    LCBTreeNode* root;
+} LCSortedMap;
 
 struct LCMapTuple {
     LCMapTuple* prev;
@@ -275,6 +379,17 @@ void lc_init_object(LCRuntime* rt, LCClassID cls_id, LCGCObject* obj) {
     lc_gc_objs_list_add(&rt->gc_objs, obj);
 }
 
+/*
+ * The object never escapes, it lives in the storage of the caller.
+ * It's counted as usual, the fields are released when the count drops to zero,
+ * but it's not in the GC list and it's never freed.
+ */
+void lc_init_stack_object(LCClassID cls_id, LCGCObject* obj) {
+    obj->header.count = 1;
+    obj->header.class_id = cls_id;
+    obj->header.gc_ty = LC_GC_STACK_CLASS_OBJECT;
+}
+
 // -511 - 512 is the range in the pool
 static LCValue* init_i64_pool(LCRuntime* rt) {
     LCValue* result = (LCValue*)lc_malloc(rt, sizeof(LCValue) * I64_POOL_SIZE);
@@ -348,6 +463,14 @@ static void LCFreeClassObject(LCRuntime* rt, LCGCObject* cls_obj) {
     lc_free(rt, cls_obj);
 }
 
+static void LCDropStackClassObject(LCRuntime* rt, LCGCObject* cls_obj) {
+    LCClassMeta* meta = &rt->cls_meta_data[cls_obj->header.class_id];
+    LCFinalizer finalizer = meta->cls_def->finalizer;
+    if (finalizer) {
+        finalizer(rt, cls_obj);
+    }
+}
+
 static inline void LCFreeTuple(LCRuntime* rt, LCTuple* tuple) {
     size_t i;
 
@@ -361,6 +484,14 @@ static inline void LCFreeTuple(LCRuntime* rt, LCTuple* tuple) {
     lc_free(rt, tuple);
 }
 
+static inline void LCDropStackTuple(LCRuntime* rt, LCTuple* tuple) {
+    size_t i;
+
+    for (i = 0; i < tuple->len; i++) {
+        LCRelease(rt, tuple->data[i]);
+    }
+}
+
 static inline void LCFreeArray(LCRuntime* rt, LCArray* arr) {
     uint32_t i;
     for (i = 0; i < arr->len; i++) {
@@ -377,6 +508,62 @@ static inline void LCFreeArray(LCRuntime* rt, LCArray* arr) {
     lc_free(rt, arr);
 }
 
+static inline void LCFreeDeque(LCRuntime* rt, LCDeque* q) {
+    uint32_t i;
+    for (i = 0; i < q->len; i++) {
+        LCRelease(rt, q->data[(q->head + i) & (q->capacity - 1)]);
+    }
+    lc_free(rt, q->data);
+
+    if (rt->gc_phase != LC_GC_PHASE_REMOVING_CYCLES) {
+        lc_gc_objs_list_remove(&rt->gc_objs, (LCGCObject*)q);
+    }
+    lc_free(rt, q);
+}
+
+static inline void LCFreePriorityQueue(LCRuntime* rt, LCPriorityQueue* q) {
+    uint32_t i;
+    for (i = 0; i < q->len; i++) {
+        LCRelease(rt, q->data[i]);
+    }
+    LCRelease(rt, q->cmp);
+    lc_free(rt, q->data);
+
+    if (rt->gc_phase != LC_GC_PHASE_REMOVING_CYCLES) {
+        lc_gc_objs_list_remove(&rt->gc_objs, (LCGCObject*)q);
+    }
+    lc_free(rt, q);
+}
+
+static void lc_btree_free_node(LCRuntime* rt, LCBTreeNode* node) {
+    uint32_t i;
+
+    for (i = 0; i < node->len; i++) {
+        LCRelease(rt, node->keys[i]);
+    }
+
+    if (node->is_leaf) {
+        for (i = 0; i < node->len; i++) {
+            LCRelease(rt, ((LCBTreeLeaf*)node)->values[i]);
+        }
+    } else {
+        for (i = 0; i <= node->len; i++) {
+            lc_btree_free_node(rt, ((LCBTreeInner*)node)->children[i]);
+        }
+    }
+
+    lc_free(rt, node);
+}
+
+static inline void LCFreeSortedMap(LCRuntime* rt, LCSortedMap* map) {
+    lc_btree_free_node(rt, map->root);
+
+    if (rt->gc_phase != LC_GC_PHASE_REMOVING_CYCLES) {
+        lc_gc_objs_list_remove(&rt->gc_objs, (LCGCObject*)map);
+    }
+    lc_free(rt, map);
+}
+
 static inline void LCFreeRefCell(LCRuntime* rt, LCRefCell* cell) {
     LCRelease(rt, cell->value);
 
@@ -386,6 +573,18 @@ static inline void LCFreeRefCell(LCRuntime* rt, LCRefCell* cell) {
     lc_free(rt, cell);
 }
 
+static inline void LCFreeEnv(LCRuntime* rt, LCEnv* env) {
+    uint32_t i;
+    for (i = 0; i < env->size; i++) {
+        LCRelease(rt, env->values[i]);
+    }
+
+    if (rt->gc_phase != LC_GC_PHASE_REMOVING_CYCLES) {
+        lc_gc_objs_list_remove(&rt->gc_objs, (LCGCObject*)env);
+    }
+    lc_free(rt, env);
+}
+
 static inline void LCFreeUnionObject(LCRuntime* rt, LCUnionObject* union_obj) {
     int i;
     for (i = 0; i < union_obj->size; i++) {
@@ -399,6 +598,7 @@ static inline void LCFreeUnionObject(LCRuntime* rt, LCUnionObject* union_obj) {
 }
 
 void lc_std_map_free(LCRuntime* rt, LCMap* map);
+static void lc_std_set_free(LCRuntime* rt, LCSet* set);
 
 static void LCFreeGCObject(LCRuntime* rt, LCGCObject* gc_obj) {
     switch (gc_obj->header.gc_ty) {
@@ -430,6 +630,30 @@ static void LCFreeGCObject(LCRuntime* rt, LCGCObject* gc_obj) {
             lc_std_map_free(rt, (LCMap*)gc_obj);
             break;
 
+        case LC_GC_DEQUE:
+            LCFreeDeque(rt, (LCDeque*)gc_obj);
+            break;
+
+        case LC_GC_PRIORITY_QUEUE:
+            LCFreePriorityQueue(rt, (LCPriorityQueue*)gc_obj);
+            break;
+
+        case LC_GC_SORTED_MAP:
+            LCFreeSortedMap(rt, (LCSortedMap*)gc_obj);
+            break;
+
+        case LC_GC_ENV:
+            LCFreeEnv(rt, (LCEnv*)gc_obj);
+            break;
+
+        case LC_GC_STACK_CLASS_OBJECT:
+            LCDropStackClassObject(rt, gc_obj);
+            break;
+
+        case LC_GC_STACK_TUPLE:
+            LCDropStackTuple(rt, (LCTuple*)gc_obj);
+            break;
+
     }
 
 }
@@ -443,6 +667,10 @@ static void LCFreeObject(LCRuntime* rt, LCValue val) {
     case LC_TY_TUPLE:
     case LC_TY_ARRAY:
     case LC_TY_MAP:
+    case LC_TY_DEQUE:
+    case LC_TY_PRIORITY_QUEUE:
+    case LC_TY_SORTED_MAP:
+    case LC_TY_ENV:
         LCFreeGCObject(rt, (LCGCObject*)val.ptr_val);
         break;
 
@@ -454,6 +682,10 @@ static void LCFreeObject(LCRuntime* rt, LCValue val) {
     case LC_TY_BOXED_F64:
         lc_free(rt, val.ptr_val);
         break;
+
+    case LC_TY_SET:
+        lc_std_set_free(rt, (LCSet*)val.ptr_val);
+        break;
     
     default:
         fprintf(stderr, "[LichenScript] internal error, unkown tag: %" PRId64 "\n", val.tag);
@@ -481,7 +713,11 @@ void* lc_malloc(LCRuntime* rt, size_t size) {
         return NULL;
     }
     rt->malloc_state.malloc_count++;
+    rt->malloc_state.malloc_total_count++;
     rt->malloc_state.malloc_size += lc_malloc_usable_size(rt, ptr);
+    if (rt->malloc_state.malloc_size > rt->malloc_state.malloc_peak_size) {
+        rt->malloc_state.malloc_peak_size = rt->malloc_state.malloc_size;
+    }
     return ptr;
 }
 
@@ -513,6 +749,9 @@ void *lc_realloc2(LCRuntime *rt, void *ptr, size_t size, size_t *pslack)
         *pslack = (new_size > size) ? new_size - size : 0;
     }
     rt->malloc_state.malloc_size += lc_malloc_usable_size(rt, ret) - old_size;
+    if (rt->malloc_state.malloc_size > rt->malloc_state.malloc_peak_size) {
+        rt->malloc_state.malloc_peak_size = rt->malloc_state.malloc_size;
+    }
     return ret;
 }
 
@@ -532,7 +771,8 @@ static LCValue LC_Object_toString(LCRuntime* rt, LCValue this, int argc, LCValue
 }
 
 static char* LCStringToUTF8(LCRuntime* rt, LCString* str) {
-    char* space = lc_malloc(rt, str->length * 2 + 1);
+    // a UTF-16 code unit takes 3 bytes at most
+    char* space = lc_malloc(rt, str->length * 3 + 1);
     int idx = 0;
     int len;
     uint8_t* buf = (uint8_t*)space;
@@ -562,7 +802,7 @@ int LCStringEqUtf8(LCRuntime* rt, LCValue this, const char* cmp_str, size_t len)
 
     char* utf8_str = LCStringToUTF8(rt, str);
 
-    result = strcmp(utf8_str, cmp_str);
+    result = strcmp(utf8_str, cmp_str) == 0;
 
     lc_free(rt, utf8_str);
     return result;
@@ -597,13 +837,25 @@ LCRuntime* LCNewRuntime() {
     return runtime;
 }
 
+static void lc_free_thread_pool(LCRuntime* rt);
+
 void LCFreeRuntime(LCRuntime* rt) {
     uint32_t i;
 
+    lc_free_thread_pool(rt);
+
     free_i64_pool(rt);
 
     lc_free(rt, rt->cls_meta_data);
 
+    // read by the benchmark runner
+    if (getenv("LSC_MALLOC_STATS") != NULL) {
+        fprintf(stderr, "[LichenScript] malloc total: %zu, peak size: %zu, live: %zu\n",
+            rt->malloc_state.malloc_total_count,
+            rt->malloc_state.malloc_peak_size,
+            rt->malloc_state.malloc_count - 1);
+    }
+
 #ifdef LSC_DEBUG
     if (rt->malloc_state.malloc_count != 1) {
         fprintf(stderr, "[LichenScript] memory leaks, count: %zu, size: %zu\n", rt->malloc_state.malloc_count, rt->malloc_state.malloc_size);
@@ -658,6 +910,10 @@ static void lc_mark_val(LCRuntime *rt, LCValue val, LCMarkFunc mark_fun) {
         case LC_TY_TUPLE:
         case LC_TY_ARRAY:
         case LC_TY_MAP:
+        case LC_TY_DEQUE:
+        case LC_TY_PRIORITY_QUEUE:
+        case LC_TY_SORTED_MAP:
+        case LC_TY_ENV:
             mark_fun(rt, (LCGCObject*)val.ptr_val);
             break;
         
@@ -707,6 +963,49 @@ static force_inline void lc_mark_array(LCRuntime* rt, LCArray* arr, LCMarkFunc m
     }
 }
 
+static void lc_mark_deque(LCRuntime* rt, LCDeque* q, LCMarkFunc mark_fun) {
+    uint32_t i;
+
+    for (i = 0; i < q->len; i++) {
+        lc_mark_val(rt, q->data[(q->head + i) & (q->capacity - 1)], mark_fun);
+    }
+}
+
+static void lc_mark_priority_queue(LCRuntime* rt, LCPriorityQueue* q, LCMarkFunc mark_fun) {
+    uint32_t i;
+
+    for (i = 0; i < q->len; i++) {
+        lc_mark_val(rt, q->data[i], mark_fun);
+    }
+
+    lc_mark_val(rt, q->cmp, mark_fun);
+}
+
+static void lc_mark_sorted_map(LCRuntime* rt, LCSortedMap* map, LCMarkFunc mark_fun) {
+    LCBTreeNode* node = map->root;
+    LCBTreeLeaf* leaf;
+    uint32_t i;
+
+    while (!node->is_leaf) {
+        node = ((LCBTreeInner*)node)->children[0];
+    }
+
+    // the keys are never GCObjects, same as Map
+    for (leaf = (LCBTreeLeaf*)node; leaf != NULL; leaf = leaf->next) {
+        for (i = 0; i < leaf->base.len; i++) {
+            lc_mark_val(rt, leaf->values[i], mark_fun);
+        }
+    }
+}
+
+static void lc_mark_env(LCRuntime* rt, LCEnv* env, LCMarkFunc mark_fun) {
+    uint32_t i;
+
+    for (i = 0; i < env->size; i++) {
+        lc_mark_val(rt, env->values[i], mark_fun);
+    }
+}
+
 static void lc_mark_map(LCRuntime* rt, LCMap* map, LCMarkFunc mark_fun) {
     LCMapTuple *tuple, *tmp;
     tuple = map->head;
@@ -752,6 +1051,22 @@ void lc_mark_children(LCRuntime* rt, LCGCObject* obj, LCMarkFunc mark_fun) {
         case LC_GC_MAP:
             lc_mark_map(rt, (LCMap*)obj, mark_fun);
             break;
+
+        case LC_GC_DEQUE:
+            lc_mark_deque(rt, (LCDeque*)obj, mark_fun);
+            break;
+
+        case LC_GC_PRIORITY_QUEUE:
+            lc_mark_priority_queue(rt, (LCPriorityQueue*)obj, mark_fun);
+            break;
+
+        case LC_GC_SORTED_MAP:
+            lc_mark_sorted_map(rt, (LCSortedMap*)obj, mark_fun);
+            break;
+
+        case LC_GC_ENV:
+            lc_mark_env(rt, (LCEnv*)obj, mark_fun);
+            break;
     }
 
 }
@@ -1158,6 +1473,39 @@ LCValue LCRefCellGetValue(LCValue cell) {
     return ref->value;
 }
 
+LCValue LCNewEnv(LCRuntime* rt, int size) {
+    LCEnv* env = (LCEnv*)lc_mallocz(rt, sizeof(LCEnv) + size * sizeof(LCValue));
+    init_gc_object(rt, (LCGCObject*)env, LC_GC_ENV);
+    env->size = size;
+    // lc_mallocz zeroes the slots, they are all null before initialized
+    return (LCValue){ { .ptr_val = (LCObject*)env }, LC_TY_ENV };
+}
+
+/*
+ * The value is moved into the environment,
+ * the old value is released.
+ */
+void LCEnvSet(LCRuntime* rt, LCValue env_val, int index, LCValue value) {
+    LCEnv* env = (LCEnv*)env_val.ptr_val;
+#ifdef LSC_DEBUG
+    if (env_val.tag != LC_TY_ENV || index < 0 || (uint32_t)index >= env->size) {
+        fprintf(stderr, "[LichenScript] invalid access to environment\n");
+        lc_panic_internal();
+    }
+#endif
+    LCRelease(rt, env->values[index]);
+    env->values[index] = value;
+}
+
+LCValue LCEnvGetChecked(LCValue env_val, int index) {
+    LCEnv* env = (LCEnv*)env_val.ptr_val;
+    if (env_val.tag != LC_TY_ENV || index < 0 || (uint32_t)index >= env->size) {
+        fprintf(stderr, "[LichenScript] invalid access to environment\n");
+        lc_panic_internal();
+    }
+    return env->values[index];
+}
+
 LCValue LCNewUnionObject(LCRuntime* rt, int tag, int size, LCValue* args) {
     size_t malloc_size = sizeof(LCUnionObject) + size * sizeof(LCValue);
     LCUnionObject* union_obj = (LCUnionObject*)lc_mallocz(rt, malloc_size);
@@ -1213,6 +1561,27 @@ LCValue LCNewLambda(LCRuntime* rt, LCCFunction c_fun, LCValue this, int argc, LC
     return (LCValue){ { .ptr_val = (LCObject*)lambda }, LC_TY_LAMBDA };
 }
 
+/*
+ * The lambda never escapes, it lives in the storage of the caller.
+ * It's never counted nor collected, and it only borrows the captured values.
+ */
+LCValue LCInitStackLambda(LCValue* storage, LCCFunction c_fun, LCValue this, int argc, LCValue* args) {
+    LCLambda* lambda = (LCLambda*)storage;
+
+    lambda->header.count = LC_NO_GC;
+    lambda->header.gc_ty = LC_GC_LAMBDA;
+
+    lambda->c_fun = c_fun;
+    lambda->captured_this = this;
+    lambda->captured_values_size = argc;
+
+    if (argc > 0) {
+        memcpy(lambda->captured_values, args, argc * sizeof(LCValue));
+    }
+
+    return (LCValue){ { .ptr_val = (LCObject*)lambda }, LC_TY_LAMBDA };
+}
+
 LCValue LCLambdaGetValue(LCRuntime* rt, LCValue lambda_val, int index) {
     LCLambda* lambda = (LCLambda*)lambda_val.ptr_val;
     LCValue ret = lambda->captured_values[index];
@@ -1227,10 +1596,12 @@ LCValue* LCLambdaGetValuePointer(LCRuntime* rt, LCValue lambda_val, int index) {
 LCValue LCLambdaGetRefValue(LCRuntime* rt, LCValue lambda_val, int index) {
     LCLambda* lambda = (LCLambda*)lambda_val.ptr_val;
     LCValue ret = lambda->captured_values[index];
-    if (ret.tag != LC_TY_REFCELL) {  // TODO: do NOT check in release
+#ifdef LSC_DEBUG
+    if (ret.tag != LC_TY_REFCELL) {
         fprintf(stderr, "[LichenScript] value is not a ref\n");
         lc_panic_internal();
     }
+#endif
     return LCRefCellGetValue(ret);
 }
 
@@ -1244,10 +1615,12 @@ void LCLambdaSetValue(LCRuntime* rt, LCValue lambda_val, int index, LCValue valu
 void LCLambdaSetRefValue(LCRuntime* rt, LCValue lambda_val, int index, LCValue value) {
     LCLambda* lambda = (LCLambda*)lambda_val.ptr_val;
     LCValue ref = lambda->captured_values[index];
-    if (ref.tag != LC_TY_REFCELL) {  // TODO: do NOT check in release
+#ifdef LSC_DEBUG
+    if (ref.tag != LC_TY_REFCELL) {
         fprintf(stderr, "[LichenScript] value is not a ref\n");
         lc_panic_internal();
     }
+#endif
     LCRefCellSetValue(rt, ref, value);
 }
 
@@ -1277,6 +1650,14 @@ LCValue LCNewArrayLen(LCRuntime* rt, size_t size) {
     return (LCValue) { { .ptr_val = (LCObject*)arr },  LC_TY_ARRAY };
 }
 
+// the values are primitives, they are not retained
+LCValue LCNewArrayFromStatic(LCRuntime* rt, const LCValue* values, size_t size) {
+    LCValue result = LCNewArrayLen(rt, size);
+    LCArray* arr = (LCArray*)result.ptr_val;
+    memcpy(arr->data, values, sizeof(LCValue) * size);
+    return result;
+}
+
 LCValue LCArrayGetValue(LCRuntime* rt, LCValue this, int index) {
     LCValue item;
     LCArray* arr = (LCArray*)this.ptr_val;
@@ -1319,6 +1700,27 @@ LCValue LCNewTuple(LCRuntime* rt, LCValue this, int32_t arg_len, LCValue* args)
     return (LCValue) { { .ptr_val = (LCObject*)tuple }, LC_TY_TUPLE };
 }
 
+/*
+ * The tuple never escapes, it lives in the storage of the caller.
+ * See lc_init_stack_object.
+ */
+LCValue LCInitStackTuple(LCValue* storage, int32_t arg_len, LCValue* args) {
+    int32_t i;
+    LCTuple* tuple = (LCTuple*)storage;
+
+    tuple->header.count = 1;
+    tuple->header.gc_ty = LC_GC_STACK_TUPLE;
+
+    tuple->len = arg_len;
+
+    for (i = 0; i < arg_len; i++) {
+        LCRetain(args[i]);
+        tuple->data[i] = args[i];
+    }
+
+    return (LCValue) { { .ptr_val = (LCObject*)tuple }, LC_TY_TUPLE };
+}
+
 LCValue LCNewI64(LCRuntime* rt, int64_t val) {
     LCBox64* ptr = (LCBox64*)lc_malloc(rt, sizeof(LCBox64));
 
@@ -1489,6 +1891,26 @@ static void std_print_val(LCRuntime* rt, LCValue val) {
     case LC_TY_MAP:
         printf("Map");
         break;
+
+    case LC_TY_DEQUE:
+        printf("Deque");
+        break;
+
+    case LC_TY_PRIORITY_QUEUE:
+        printf("PriorityQueue");
+        break;
+
+    case LC_TY_SORTED_MAP:
+        printf("SortedMap");
+        break;
+
+    case LC_TY_SET:
+        printf("Set");
+        break;
+
+    case LC_TY_ENV:
+        printf("Env");
+        break;
     
     default:
         break;
@@ -1586,27 +2008,74 @@ LCValue lc_std_array_get_length(LCRuntime* rt, LCValue this, int arg_len, LCValu
     return MK_I32(arr->len);
 }
 
+/**
+ * Reallocate the store of the array to hold exactly `new_cap` items,
+ * the slack returned by the allocator is counted into the capacity.
+ */
+static void lc_array_set_capacity(LCRuntime* rt, LCArray* arr, size_t new_cap) {
+    size_t slack = 0;
+    LCValue* data;
+
+    if (new_cap < LC_ARRAY_MIN_CAP) {
+        new_cap = LC_ARRAY_MIN_CAP;
+    }
+
+    data = (LCValue*)lc_realloc2(rt, arr->data, new_cap * sizeof(LCValue), &slack);
+    if (unlikely(data == NULL)) {
+        fprintf(stderr, "[LichenScript] out of memory\n");
+        lc_panic_internal();
+    }
+
+    new_cap += slack / sizeof(LCValue);
+    if (new_cap > UINT32_MAX) {
+        new_cap = UINT32_MAX;
+    }
+
+    arr->data = data;
+    arr->capacity = new_cap;
+}
+
+/**
+ * Grow the array to hold at least `min_cap` items.
+ * Small arrays are doubled, large arrays grow by 1.5x to bound the waste.
+ */
+static no_inline void lc_array_grow(LCRuntime* rt, LCArray* arr, size_t min_cap) {
+    size_t new_cap = arr->capacity;
+
+    if (min_cap > UINT32_MAX) {
+        fprintf(stderr, "[LichenScript] array length exceeds the limit\n");
+        lc_panic_internal();
+    }
+
+    if (new_cap < LC_ARRAY_LARGE_CAP) {
+        new_cap *= 2;
+    } else {
+        new_cap += new_cap / 2;
+    }
+
+    if (new_cap < min_cap) {
+        new_cap = min_cap;
+    }
+
+    lc_array_set_capacity(rt, arr, new_cap);
+}
+
+static inline void lc_array_ensure_capacity(LCRuntime* rt, LCArray* arr, size_t min_cap) {
+    if (unlikely(min_cap > arr->capacity)) {
+        lc_array_grow(rt, arr, min_cap);
+    }
+}
+
 LCValue lc_std_array_resize(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
     LCArray* arr = (LCArray*)this.ptr_val;
     int new_len = args[0].int_val;
     int i;
-    size_t new_cap;
 
-    if (new_len == arr->len) {
-        return MK_NULL();
+    if (new_len < 0) {
+        new_len = 0;
     }
 
-    if (new_len == 0) {
-        for (i = 0; i < arr->len; i++) {
-            LCRelease(rt, arr->data[i]);
-            arr->data[i] = MK_NULL();
-        }
-        arr->len = 0;
-
-        new_cap = 2;
-        arr->data = lc_realloc(rt, arr->data, sizeof(LCValue) * new_cap);
-        arr->capacity = new_cap;
-
+    if (new_len == arr->len) {
         return MK_NULL();
     }
 
@@ -1616,19 +2085,18 @@ LCValue lc_std_array_resize(LCRuntime* rt, LCValue this, int arg_len, LCValue* a
             arr->data[i] = MK_NULL();
         }
         arr->len = new_len;
+
+        // give the memory back when most of the store is unused,
+        // keep some room so resizing back and forth is not quadratic
+        if ((size_t)new_len * 4 <= arr->capacity && arr->capacity > LC_ARRAY_MIN_CAP) {
+            lc_array_set_capacity(rt, arr, (size_t)new_len * 2);
+        }
+
         return MK_NULL();
     }
 
     // assert(new_len > arr->len)
-    new_cap = arr->capacity;
-    while (new_cap < new_len) {
-        new_cap *= 2;
-    }
-
-    if (new_cap != arr->capacity) {
-        arr->data = lc_realloc(rt, arr->data, new_cap * sizeof(LCValue));
-        arr->capacity = new_cap;
-    }
+    lc_array_ensure_capacity(rt, arr, new_len);
 
     for (i = arr->len; i < new_len; i++) {
         LCRetain(args[1]);
@@ -1639,22 +2107,87 @@ LCValue lc_std_array_resize(LCRuntime* rt, LCValue this, int arg_len, LCValue* a
     return MK_NULL();
 }
 
-typedef struct lc_sort_ctx {
-    LCRuntime* rt;
-    LCValue lambda;
-} lc_sort_ctx;
-
-typedef void (*exchange_f)(void *a, void *b, size_t size);
-typedef int (*cmp_f)(const void *, const void *, void *opaque);
-
-static void exchange_bytes(void *a, void *b, size_t size) {
-    uint8_t *ap = (uint8_t *)a;
-    uint8_t *bp = (uint8_t *)b;
+LCValue lc_std_array_reserve(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+    int32_t cap = args[0].int_val;
 
-    while (size-- != 0) {
-        uint8_t t = *ap;
-        *ap++ = *bp;
-        *bp++ = t;
+    // reserve the exact size, the caller knows how many items are coming
+    if (cap > 0 && (uint32_t)cap > arr->capacity) {
+        lc_array_set_capacity(rt, arr, cap);
+    }
+
+    return MK_NULL();
+}
+
+LCValue lc_std_array_shrink_to_fit(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+
+    if (arr->capacity > arr->len && arr->capacity > LC_ARRAY_MIN_CAP) {
+        lc_array_set_capacity(rt, arr, arr->len);
+    }
+
+    return MK_NULL();
+}
+
+/**
+ * Append all the items of another array.
+ * The items are copied in one memcpy and retained afterward,
+ * so `arr.append(arr)` is fine.
+ */
+LCValue lc_std_array_append(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+    LCArray* other = (LCArray*)args[0].ptr_val;
+    uint32_t other_len = other->len;
+    uint32_t i;
+    LCValue* dst;
+
+    if (other_len == 0) {
+        return MK_NULL();
+    }
+
+    lc_array_ensure_capacity(rt, arr, (size_t)arr->len + other_len);
+
+    dst = arr->data + arr->len;
+    memcpy(dst, other->data, other_len * sizeof(LCValue));
+
+    for (i = 0; i < other_len; i++) {
+        if (dst[i].tag > 0) {
+            LCRetain(dst[i]);
+        }
+    }
+
+    arr->len += other_len;
+    return MK_NULL();
+}
+
+LCValue lc_std_array_with_capacity(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    int32_t cap = args[0].int_val;
+    LCArray* arr;
+
+    if (cap < LC_ARRAY_MIN_CAP) {
+        cap = LC_ARRAY_MIN_CAP;
+    }
+
+    arr = LCNewArrayWithCap(rt, cap);
+    return (LCValue) { { .ptr_val = (LCObject*)arr },  LC_TY_ARRAY };
+}
+
+typedef struct lc_sort_ctx {
+    LCRuntime* rt;
+    LCValue lambda;
+} lc_sort_ctx;
+
+typedef void (*exchange_f)(void *a, void *b, size_t size);
+typedef int (*cmp_f)(const void *, const void *, void *opaque);
+
+static void exchange_bytes(void *a, void *b, size_t size) {
+    uint8_t *ap = (uint8_t *)a;
+    uint8_t *bp = (uint8_t *)b;
+
+    while (size-- != 0) {
+        uint8_t t = *ap;
+        *ap++ = *bp;
+        *bp++ = t;
     }
 }
 
@@ -2026,9 +2559,8 @@ LCValue lc_std_array_filter(LCRuntime* rt, LCValue this, int arg_len, LCValue* a
 LCValue lc_std_array_push(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
     LCArray* arr = (LCArray*)this.ptr_val;
 
-    if (arr->len == arr->capacity) {
-        arr->capacity *= 2;
-        arr->data = lc_realloc(rt, arr->data, arr->capacity * sizeof(LCValue));
+    if (unlikely(arr->len == arr->capacity)) {
+        lc_array_grow(rt, arr, (size_t)arr->len + 1);
     }
 
     LCRetain(args[0]);
@@ -2037,645 +2569,2490 @@ LCValue lc_std_array_push(LCRuntime* rt, LCValue this, int arg_len, LCValue* arg
     return MK_NULL();
 }
 
-LCValue lc_std_char_code(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
-    return MK_I32(this.int_val);
-}
+/**
+ * Worker pool for the data-parallel Array methods.
+ *
+ * Every job is split into chunks, the chunks are dealt to the workers
+ * as contiguous ranges. A worker pops chunks from the front of its own
+ * range, and steals from the back of the others' when it runs out.
+ * The range is packed into one 64bit word, so both sides only need a CAS.
+ *
+ * The calling thread is worker 0, so a pool of N workers spawns N - 1 threads.
+ * The size of the pool is the number of online cores, or LSC_THREADS.
+ *
+ * The lambdas running on the pool are proved to be pure by the compiler,
+ * they never allocate or touch the refcounts, so the runtime is not locked.
+ */
+typedef void (*LCParallelTask)(void* ctx, uint32_t begin, uint32_t end);
 
-LCValue lc_std_char_to_string(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
-    unsigned char buf[4];
-    int len;
+typedef struct LCParallelJob {
+    LCParallelTask task;
+    void* ctx;
+    uint32_t len;
+    uint32_t grain;
+} LCParallelJob;
+
+#ifndef LC_NO_THREADS
+
+#define LC_RANGE_PACK(begin, end) (((uint64_t)(begin) << 32) | (uint64_t)(end))
+#define LC_RANGE_BEGIN(r) ((uint32_t)((r) >> 32))
+#define LC_RANGE_END(r) ((uint32_t)((r) & 0xFFFFFFFF))
+
+typedef struct LCWorkerRange {
+    uint64_t range;
+    char padding[56];  // avoid false sharing
+} LCWorkerRange;
+
+struct LCThreadPool {
+    uint32_t worker_count;
+    pthread_t* threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_cond;
+    pthread_cond_t done_cond;
+    LCParallelJob* job;
+    uint64_t job_seq;
+    uint32_t active_count;
+    int shutdown;
+    LCWorkerRange ranges[LC_PARALLEL_MAX_WORKERS];
+};
 
-    if (this.int_val < 128) {
-        buf[0] = this.int_val;
-        return lc_new_string8(rt, buf, 1);
+typedef struct LCWorkerArg {
+    LCThreadPool* pool;
+    uint32_t id;
+} LCWorkerArg;
+
+static int lc_range_pop_front(LCWorkerRange* r, uint32_t* chunk) {
+    uint64_t old = __atomic_load_n(&r->range, __ATOMIC_ACQUIRE);
+    uint32_t begin, end;
+    for (;;) {
+        begin = LC_RANGE_BEGIN(old);
+        end = LC_RANGE_END(old);
+        if (begin >= end) {
+            return 0;
+        }
+        if (__atomic_compare_exchange_n(&r->range, &old, LC_RANGE_PACK(begin + 1, end),
+                                        0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *chunk = begin;
+            return 1;
+        }
     }
-
-    uint32_t acquire_len = sizeof(LCString) + 2;
-    LCString* result = lc_mallocz(rt, acquire_len);
-
-    result->header.count = 1;
-
-    result->is_wide_char = 1;
-    result->length = 1;
-    result->hash = 0;
-    result->u.str16[0] = this.int_val;
-    
-    return MK_STRING(result);
 }
 
-static void copy_str16(uint16_t *dst, const LCString *p, int offset, int len)
-{
-    if (p->is_wide_char) {
-        memcpy(dst, p->u.str16 + offset, len * 2);
-    } else {
-        const uint8_t *src1 = p->u.str8 + offset;
-        int i;
+static int lc_range_steal_back(LCWorkerRange* r, uint32_t* chunk) {
+    uint64_t old = __atomic_load_n(&r->range, __ATOMIC_ACQUIRE);
+    uint32_t begin, end;
+    for (;;) {
+        begin = LC_RANGE_BEGIN(old);
+        end = LC_RANGE_END(old);
+        if (begin >= end) {
+            return 0;
+        }
+        if (__atomic_compare_exchange_n(&r->range, &old, LC_RANGE_PACK(begin, end - 1),
+                                        0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *chunk = end - 1;
+            return 1;
+        }
+    }
+}
 
-        for(i = 0; i < len; i++)
-            dst[i] = src1[i];
+static void lc_run_chunk(LCParallelJob* job, uint32_t chunk) {
+    uint32_t begin = chunk * job->grain;
+    uint32_t end = begin + job->grain;
+    if (end > job->len) {
+        end = job->len;
     }
+    job->task(job->ctx, begin, end);
 }
 
-LCValue lc_std_string_concat(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
-    LCString *p;
-    int is_wide_char;
+static void lc_worker_run_job(LCThreadPool* pool, LCParallelJob* job, uint32_t id) {
+    uint32_t chunk, i;
 
-    LCString* s1 = (LCString*)(args[0].ptr_val);
-    LCString* s2 = (LCString*)(args[1].ptr_val);
-    is_wide_char = s1->is_wide_char | s2->is_wide_char;
+    for (;;) {
+        while (lc_range_pop_front(&pool->ranges[id], &chunk)) {
+            lc_run_chunk(job, chunk);
+        }
 
-    uint32_t len = s1->length + s2->length;
+        // no chunks are added after a job starts,
+        // so the job is drained once a whole round finds nothing
+        for (i = 1; i < pool->worker_count; i++) {
+            if (lc_range_steal_back(&pool->ranges[(id + i) % pool->worker_count], &chunk)) {
+                lc_run_chunk(job, chunk);
+                break;
+            }
+        }
 
-    p = lc_alloc_string_rt(rt, len, is_wide_char);
-    if (!is_wide_char) {
-        memcpy(p->u.str8, s1->u.str8, s1->length);
-        memcpy(p->u.str8 + s1->length, s2->u.str8, s2->length);
-        p->u.str8[len] = '\0';
-    } else {
-        copy_str16(p->u.str16, s1, 0, s1->length);
-        copy_str16(p->u.str16 + s1->length, s2, 0, s2->length);
+        if (i == pool->worker_count) {
+            return;
+        }
     }
-
-    return (LCValue){ { .ptr_val = (LCObject*)p }, LC_TY_STRING };
 }
 
-LCValue lc_std_string_get_length(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
-    LCString* str = (LCString*)this.ptr_val;
-    return MK_I32(str->length);
-}
+static void* lc_worker_main(void* ptr) {
+    LCWorkerArg arg = *(LCWorkerArg*)ptr;
+    LCThreadPool* pool = arg.pool;
+    uint64_t seen_seq = 0;
+    LCParallelJob* job;
 
-static force_inline uint16_t* new_widen_string(LCString* s) {
-    uint16_t* r = malloc(sizeof(uint16_t) * s->length);
-    for (int i = 0; i < s->length; i++) {
-        r[i] = s->u.str8[i];
+    lc_raw_free(ptr);
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->shutdown && pool->job_seq == seen_seq) {
+            pthread_cond_wait(&pool->job_cond, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        seen_seq = pool->job_seq;
+        job = pool->job;
+        pthread_mutex_unlock(&pool->mutex);
+
+        lc_worker_run_job(pool, job, arg.id);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->active_count == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+        pthread_mutex_unlock(&pool->mutex);
     }
-    return r;
 }
 
-static no_inline int lc_std_string_cmp_slow(LCString* s1, LCString* s2) {
-    const uint16_t* str1;
-    const uint16_t* str2;
-    uint16_t* r1 = NULL;
-    uint16_t* r2 = NULL;
+static uint32_t lc_parallel_worker_count() {
+    long count;
+    const char* env = getenv("LSC_THREADS");
 
-    if (s1->is_wide_char) {
-        str1 = s1->u.str16;
+    if (env != NULL) {
+        count = strtol(env, NULL, 10);
     } else {
-        r1 = new_widen_string(s1);
-        str1 = r1;
+        count = sysconf(_SC_NPROCESSORS_ONLN);
     }
 
-    if (s2->is_wide_char) {
-        str2 = s2->u.str16;
-    } else {
-        r2 = new_widen_string(s2);
-        str2 = r2;
+    if (count < 1) {
+        count = 1;
+    } else if (count > LC_PARALLEL_MAX_WORKERS) {
+        count = LC_PARALLEL_MAX_WORKERS;
     }
 
-    int result = memcmp(str1, str2, s1->length * 2);
+    return (uint32_t)count;
+}
 
-    if (r1) {
-        free(r1);
-    }
+static LCThreadPool* lc_get_thread_pool(LCRuntime* rt) {
+    LCThreadPool* pool;
+    LCWorkerArg* arg;
+    uint32_t i, count;
 
-    if (r2) {
-        free(r2);
+    if (rt->thread_pool != NULL) {
+        return rt->thread_pool;
     }
 
-    return result;
-}
+    count = lc_parallel_worker_count();
 
-static int memcmp16_8(const uint16_t *src1, const uint8_t *src2, int len)
-{
-    int c, i;
-    for(i = 0; i < len; i++) {
-        c = src1[i] - src2[i];
-        if (c != 0)
-            return c;
+    pool = (LCThreadPool*)lc_mallocz(rt, sizeof(LCThreadPool));
+    pool->worker_count = count;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->job_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    if (count > 1) {
+        pool->threads = (pthread_t*)lc_mallocz(rt, sizeof(pthread_t) * (count - 1));
     }
-    return 0;
-}
 
-static int memcmp16(const uint16_t *src1, const uint16_t *src2, int len)
-{
-    int c, i;
-    for(i = 0; i < len; i++) {
-        c = src1[i] - src2[i];
-        if (c != 0)
-            return c;
+    for (i = 1; i < count; i++) {
+        arg = (LCWorkerArg*)lc_raw_malloc(sizeof(LCWorkerArg));
+        arg->pool = pool;
+        arg->id = i;
+        if (pthread_create(&pool->threads[i - 1], NULL, lc_worker_main, arg) != 0) {
+            // run with the workers we have got
+            lc_raw_free(arg);
+            pool->worker_count = i;
+            break;
+        }
     }
-    return 0;
+
+    rt->thread_pool = pool;
+    return pool;
 }
 
-static int lc_string_memcmp(const LCString* s1, const LCString* s2, int len) {
-    int res;
+static void lc_free_thread_pool(LCRuntime* rt) {
+    LCThreadPool* pool = rt->thread_pool;
+    uint32_t i;
 
-    if (likely(!s1->is_wide_char)) {
-        if (likely(!s2->is_wide_char)) {
-            res = memcmp(s1->u.str8, s2->u.str8, len);
-        } else {
-            res = -memcmp16_8(s2->u.str16, s1->u.str8, len);
-        }
-    } else {
-        if (!s2->is_wide_char) {
-            res = memcmp16_8(s1->u.str16, s2->u.str8, len);
-        } else {
-            res = memcmp16(s1->u.str16, s2->u.str16, len);
-        }
+    if (pool == NULL) {
+        return;
     }
 
-    return res;
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->job_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 1; i < pool->worker_count; i++) {
+        pthread_join(pool->threads[i - 1], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->job_cond);
+    pthread_mutex_destroy(&pool->mutex);
+
+    if (pool->threads != NULL) {
+        lc_free(rt, pool->threads);
+    }
+    lc_free(rt, pool);
+    rt->thread_pool = NULL;
 }
 
-LCValue lc_std_string_cmp(LCRuntime* rt, LCCmpType cmp_type, LCValue left, LCValue right) {
-    int cmp_result, hash1, hash2, len;
-    LCString* s1 = (LCString*)(left.ptr_val);
-    LCString* s2 = (LCString*)(right.ptr_val);
+/**
+ * Run task over [0, len) in chunks of grain.
+ * Fallback to the calling thread if the job is too small to pay for the pool.
+ */
+static void lc_parallel_for(LCRuntime* rt, uint32_t len, uint32_t grain, LCParallelTask task, void* ctx) {
+    LCThreadPool* pool;
+    LCParallelJob job;
+    uint32_t chunk_count, per_worker, rest, begin, i;
 
-    // quick check
-    if (cmp_type == LC_CMP_EQ) {
-        if (s1->length != s2->length) {
-            return LCFalse;
-        }
+    if (len == 0) {
+        return;
+    }
 
-        if (s1->is_wide_char != s2->is_wide_char) {
-            return LCFalse;
-        }
-        hash1 = s1->hash;
-        hash2 = s2->hash;
+    chunk_count = (len + grain - 1) / grain;
+    if (chunk_count <= 1) {
+        task(ctx, 0, len);
+        return;
+    }
 
-        if (hash1 != 0 && hash2 != 0 && hash1 != hash2) {
-            return LCFalse;
-        }
+    pool = lc_get_thread_pool(rt);
+    if (pool->worker_count <= 1) {
+        task(ctx, 0, len);
+        return;
     }
 
-    len = min_int(s1->length, s2->length);
-    cmp_result = lc_string_memcmp(s1, s2, len);
-    if (cmp_result == 0) {
-        if (s1->length == s2->length) {
-            cmp_result = 0;
-        } else if (s1->length < s2->length) {
-            cmp_result = -1;
-        } else {
-            cmp_result = 1;
-        }
+    job.task = task;
+    job.ctx = ctx;
+    job.len = len;
+    job.grain = grain;
+
+    per_worker = chunk_count / pool->worker_count;
+    rest = chunk_count % pool->worker_count;
+    begin = 0;
+    for (i = 0; i < pool->worker_count; i++) {
+        uint32_t size = per_worker + (i < rest ? 1 : 0);
+        __atomic_store_n(&pool->ranges[i].range, LC_RANGE_PACK(begin, begin + size), __ATOMIC_RELEASE);
+        begin += size;
     }
 
-cmp:
-    switch (cmp_type) {
-    case LC_CMP_EQ:
-        return cmp_result == 0 ? LCTrue : LCFalse;
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = &job;
+    pool->active_count = pool->worker_count - 1;
+    pool->job_seq++;
+    pthread_cond_broadcast(&pool->job_cond);
+    pthread_mutex_unlock(&pool->mutex);
 
-    case LC_CMP_NEQ:
-        return cmp_result != 0 ? LCTrue : LCFalse;
+    lc_worker_run_job(pool, &job, 0);
 
-    case LC_CMP_LT:
-        return cmp_result < 0 ? LCTrue : LCFalse;
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->active_count > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+}
 
-    case LC_CMP_LTEQ:
-        return cmp_result <= 0 ? LCTrue : LCFalse;
+static uint32_t lc_parallel_worker_hint(LCRuntime* rt) {
+    return lc_get_thread_pool(rt)->worker_count;
+}
 
-    case LC_CMP_GT:
-        return cmp_result > 0 ? LCTrue : LCFalse;
+#else
 
-    case LC_CMP_GTEQ:
-        return cmp_result >= 0 ? LCTrue : LCFalse;
+static void lc_free_thread_pool(LCRuntime* rt) {}
 
+static void lc_parallel_for(LCRuntime* rt, uint32_t len, uint32_t grain, LCParallelTask task, void* ctx) {
+    if (len > 0) {
+        task(ctx, 0, len);
     }
-    return LCFalse;
 }
 
-LCValue lc_std_string_slice(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
-    int begin = args[0].int_val;
-    int end = args[1].int_val;
-    LCString* s = (LCString*)(this.ptr_val);
-    LCString* result;
-    int max_len = s->length;
-    int need_len; 
+static uint32_t lc_parallel_worker_hint(LCRuntime* rt) {
+    return 1;
+}
+
+#endif
+
+static force_inline uint32_t lc_parallel_grain(LCRuntime* rt, uint32_t len) {
+    uint32_t grain = len / (lc_parallel_worker_hint(rt) * 8);
+    return grain < 1024 ? 1024 : grain;
+}
+
+typedef struct lc_parallel_map_ctx {
+    LCRuntime* rt;
+    LCValue lambda;
+    LCValue* src;
+    LCValue* dst;
+} lc_parallel_map_ctx;
+
+static void lc_parallel_map_task(void* ptr, uint32_t begin, uint32_t end) {
+    lc_parallel_map_ctx* ctx = (lc_parallel_map_ctx*)ptr;
+    uint32_t i;
+    for (i = begin; i < end; i++) {
+        ctx->dst[i] = LCEvalLambda(ctx->rt, ctx->lambda, 1, &ctx->src[i]);
+    }
+}
+
+LCValue lc_std_array_parallel_map(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+    LCArray* new_arr;
+    lc_parallel_map_ctx ctx;
+
+    if (arr->len < LC_PARALLEL_MIN_LEN) {
+        return lc_std_array_map(rt, this, arg_len, args);
+    }
+
+    new_arr = LCNewArrayWithCap(rt, arr->len);
+
+    ctx.rt = rt;
+    ctx.lambda = args[0];
+    ctx.src = arr->data;
+    ctx.dst = new_arr->data;
+    lc_parallel_for(rt, arr->len, lc_parallel_grain(rt, arr->len), lc_parallel_map_task, &ctx);
+
+    new_arr->len = arr->len;
+
+    return (LCValue) { { .ptr_val = (LCObject*)new_arr },  LC_TY_ARRAY };
+}
+
+typedef struct lc_parallel_filter_ctx {
+    LCRuntime* rt;
+    LCValue lambda;
+    LCValue* src;
+    uint8_t* mask;
+} lc_parallel_filter_ctx;
+
+static void lc_parallel_filter_task(void* ptr, uint32_t begin, uint32_t end) {
+    lc_parallel_filter_ctx* ctx = (lc_parallel_filter_ctx*)ptr;
+    uint32_t i;
+    for (i = begin; i < end; i++) {
+        ctx->mask[i] = LCEvalLambda(ctx->rt, ctx->lambda, 1, &ctx->src[i]).int_val != 0;
+    }
+}
+
+LCValue lc_std_array_parallel_filter(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+    LCArray* new_arr;
+    lc_parallel_filter_ctx ctx;
+    uint32_t i, count;
+
+    if (arr->len < LC_PARALLEL_MIN_LEN) {
+        return lc_std_array_filter(rt, this, arg_len, args);
+    }
+
+    ctx.rt = rt;
+    ctx.lambda = args[0];
+    ctx.src = arr->data;
+    ctx.mask = (uint8_t*)lc_malloc(rt, arr->len);
+    lc_parallel_for(rt, arr->len, lc_parallel_grain(rt, arr->len), lc_parallel_filter_task, &ctx);
+
+    count = 0;
+    for (i = 0; i < arr->len; i++) {
+        count += ctx.mask[i];
+    }
+
+    new_arr = LCNewArrayWithCap(rt, count == 0 ? 2 : count);
+    for (i = 0; i < arr->len; i++) {
+        if (ctx.mask[i]) {
+            LCRetain(arr->data[i]);
+            new_arr->data[new_arr->len++] = arr->data[i];
+        }
+    }
+
+    lc_free(rt, ctx.mask);
+
+    return (LCValue) { { .ptr_val = (LCObject*)new_arr },  LC_TY_ARRAY };
+}
+
+typedef struct lc_parallel_sort_ctx {
+    lc_sort_ctx cmp_ctx;
+    LCValue* src;
+    LCValue* dst;
+    uint32_t len;
+    uint32_t run_size;
+} lc_parallel_sort_ctx;
+
+static void lc_parallel_sort_runs_task(void* ptr, uint32_t begin, uint32_t end) {
+    lc_parallel_sort_ctx* ctx = (lc_parallel_sort_ctx*)ptr;
+    uint32_t run, lo, hi;
+    for (run = begin; run < end; run++) {
+        lo = run * ctx->run_size;
+        hi = min_int(lo + ctx->run_size, ctx->len);
+        rqsort(ctx->src + lo, hi - lo, sizeof(LCValue), lc_cmp_generic, &ctx->cmp_ctx);
+    }
+}
+
+// merge the pairs of runs in [begin, end) from src to dst
+static void lc_parallel_merge_task(void* ptr, uint32_t begin, uint32_t end) {
+    lc_parallel_sort_ctx* ctx = (lc_parallel_sort_ctx*)ptr;
+    uint32_t pair, lo, mid, hi, i, j, k;
+    for (pair = begin; pair < end; pair++) {
+        lo = pair * ctx->run_size * 2;
+        mid = min_int(lo + ctx->run_size, ctx->len);
+        hi = min_int(mid + ctx->run_size, ctx->len);
+        i = lo;
+        j = mid;
+        k = lo;
+        while (i < mid && j < hi) {
+            if (lc_cmp_generic(&ctx->src[j], &ctx->src[i], &ctx->cmp_ctx) < 0) {
+                ctx->dst[k++] = ctx->src[j++];
+            } else {
+                ctx->dst[k++] = ctx->src[i++];
+            }
+        }
+        while (i < mid) {
+            ctx->dst[k++] = ctx->src[i++];
+        }
+        while (j < hi) {
+            ctx->dst[k++] = ctx->src[j++];
+        }
+    }
+}
+
+LCValue lc_std_array_parallel_sort(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+    lc_parallel_sort_ctx ctx;
+    LCValue* tmp;
+    LCValue* swap;
+    uint32_t run_count, pair_count;
+
+    run_count = lc_parallel_worker_hint(rt) * 2;
+    if (arr->len < LC_PARALLEL_MIN_LEN || run_count <= 2) {
+        return lc_std_array_sort(rt, this, arg_len, args);
+    }
+
+    ctx.cmp_ctx.rt = rt;
+    ctx.cmp_ctx.lambda = args[0];
+    ctx.src = arr->data;
+    ctx.len = arr->len;
+    ctx.run_size = (arr->len + run_count - 1) / run_count;
+    run_count = (arr->len + ctx.run_size - 1) / ctx.run_size;
+
+    lc_parallel_for(rt, run_count, 1, lc_parallel_sort_runs_task, &ctx);
+
+    tmp = (LCValue*)lc_malloc(rt, sizeof(LCValue) * arr->len);
+    ctx.dst = tmp;
+
+    while (ctx.run_size < ctx.len) {
+        pair_count = (run_count + 1) / 2;
+        lc_parallel_for(rt, pair_count, 1, lc_parallel_merge_task, &ctx);
+
+        swap = ctx.src;
+        ctx.src = ctx.dst;
+        ctx.dst = swap;
+
+        ctx.run_size *= 2;
+        run_count = pair_count;
+    }
+
+    if (ctx.src != arr->data) {
+        memcpy(arr->data, ctx.src, sizeof(LCValue) * arr->len);
+    }
+
+    lc_free(rt, tmp);
+
+    return MK_NULL();
+}
+
+LCValue lc_std_array_reduce(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+    LCValue acc = args[1];
+    LCValue next;
+    uint32_t i;
+
+    LCRetain(acc);
+    for (i = 0; i < arr->len; i++) {
+        next = LCEvalLambda(rt, args[0], 2, (LCValue[]) { acc, arr->data[i] });
+        LCRelease(rt, acc);
+        acc = next;
+    }
+
+    return acc;
+}
+
+typedef struct lc_parallel_reduce_ctx {
+    LCRuntime* rt;
+    LCValue lambda;
+    LCValue* src;
+    uint32_t len;
+    uint32_t block_size;
+    LCValue* partials;
+} lc_parallel_reduce_ctx;
+
+static void lc_parallel_reduce_task(void* ptr, uint32_t begin, uint32_t end) {
+    lc_parallel_reduce_ctx* ctx = (lc_parallel_reduce_ctx*)ptr;
+    uint32_t block, lo, hi, i;
+    LCValue acc;
+    for (block = begin; block < end; block++) {
+        lo = block * ctx->block_size;
+        hi = min_int(lo + ctx->block_size, ctx->len);
+        acc = ctx->src[lo];
+        for (i = lo + 1; i < hi; i++) {
+            acc = LCEvalLambda(ctx->rt, ctx->lambda, 2, (LCValue[]) { acc, ctx->src[i] });
+        }
+        ctx->partials[block] = acc;
+    }
+}
+
+/**
+ * Every block is folded from its first element,
+ * the partial results are folded into the initial value in order.
+ * So the lambda MUST be associative.
+ */
+LCValue lc_std_array_parallel_reduce(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCArray* arr = (LCArray*)this.ptr_val;
+    lc_parallel_reduce_ctx ctx;
+    uint32_t block_count, i;
+    LCValue acc;
+
+    if (arr->len < LC_PARALLEL_MIN_LEN) {
+        return lc_std_array_reduce(rt, this, arg_len, args);
+    }
+
+    ctx.rt = rt;
+    ctx.lambda = args[0];
+    ctx.src = arr->data;
+    ctx.len = arr->len;
+    ctx.block_size = lc_parallel_grain(rt, arr->len);
+    block_count = (arr->len + ctx.block_size - 1) / ctx.block_size;
+    ctx.partials = (LCValue*)lc_malloc(rt, sizeof(LCValue) * block_count);
+
+    lc_parallel_for(rt, block_count, 1, lc_parallel_reduce_task, &ctx);
+
+    acc = args[1];
+    for (i = 0; i < block_count; i++) {
+        acc = LCEvalLambda(rt, args[0], 2, (LCValue[]) { acc, ctx.partials[i] });
+    }
+
+    lc_free(rt, ctx.partials);
+
+    return acc;
+}
+
+LCValue lc_std_char_code(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    return MK_I32(this.int_val);
+}
+
+LCValue lc_std_char_to_string(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    unsigned char buf[4];
+    int len;
+
+    if (this.int_val < 128) {
+        buf[0] = this.int_val;
+        return lc_new_string8(rt, buf, 1);
+    }
+
+    uint32_t acquire_len = sizeof(LCString) + 2;
+    LCString* result = lc_mallocz(rt, acquire_len);
+
+    result->header.count = 1;
+
+    result->is_wide_char = 1;
+    result->length = 1;
+    result->hash = 0;
+    result->u.str16[0] = this.int_val;
+    
+    return MK_STRING(result);
+}
+
+static void copy_str16(uint16_t *dst, const LCString *p, int offset, int len)
+{
+    if (p->is_wide_char) {
+        memcpy(dst, p->u.str16 + offset, len * 2);
+    } else {
+        const uint8_t *src1 = p->u.str8 + offset;
+        int i;
+
+        for(i = 0; i < len; i++)
+            dst[i] = src1[i];
+    }
+}
+
+LCValue lc_std_string_concat(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCString *p;
+    int is_wide_char;
+
+    LCString* s1 = (LCString*)(args[0].ptr_val);
+    LCString* s2 = (LCString*)(args[1].ptr_val);
+    is_wide_char = s1->is_wide_char | s2->is_wide_char;
+
+    uint32_t len = s1->length + s2->length;
+
+    p = lc_alloc_string_rt(rt, len, is_wide_char);
+    if (!is_wide_char) {
+        memcpy(p->u.str8, s1->u.str8, s1->length);
+        memcpy(p->u.str8 + s1->length, s2->u.str8, s2->length);
+        p->u.str8[len] = '\0';
+    } else {
+        copy_str16(p->u.str16, s1, 0, s1->length);
+        copy_str16(p->u.str16 + s1->length, s2, 0, s2->length);
+    }
+
+    return (LCValue){ { .ptr_val = (LCObject*)p }, LC_TY_STRING };
+}
+
+LCValue lc_std_string_get_length(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    LCString* str = (LCString*)this.ptr_val;
+    return MK_I32(str->length);
+}
+
+static force_inline uint16_t* new_widen_string(LCString* s) {
+    uint16_t* r = malloc(sizeof(uint16_t) * s->length);
+    for (int i = 0; i < s->length; i++) {
+        r[i] = s->u.str8[i];
+    }
+    return r;
+}
+
+static no_inline int lc_std_string_cmp_slow(LCString* s1, LCString* s2) {
+    const uint16_t* str1;
+    const uint16_t* str2;
+    uint16_t* r1 = NULL;
+    uint16_t* r2 = NULL;
+
+    if (s1->is_wide_char) {
+        str1 = s1->u.str16;
+    } else {
+        r1 = new_widen_string(s1);
+        str1 = r1;
+    }
+
+    if (s2->is_wide_char) {
+        str2 = s2->u.str16;
+    } else {
+        r2 = new_widen_string(s2);
+        str2 = r2;
+    }
+
+    int result = memcmp(str1, str2, s1->length * 2);
+
+    if (r1) {
+        free(r1);
+    }
+
+    if (r2) {
+        free(r2);
+    }
+
+    return result;
+}
+
+static int memcmp16_8(const uint16_t *src1, const uint8_t *src2, int len)
+{
+    int c, i;
+    for(i = 0; i < len; i++) {
+        c = src1[i] - src2[i];
+        if (c != 0)
+            return c;
+    }
+    return 0;
+}
+
+static int memcmp16(const uint16_t *src1, const uint16_t *src2, int len)
+{
+    int c, i;
+    for(i = 0; i < len; i++) {
+        c = src1[i] - src2[i];
+        if (c != 0)
+            return c;
+    }
+    return 0;
+}
+
+static int lc_string_memcmp(const LCString* s1, const LCString* s2, int len) {
+    int res;
+
+    if (likely(!s1->is_wide_char)) {
+        if (likely(!s2->is_wide_char)) {
+            res = memcmp(s1->u.str8, s2->u.str8, len);
+        } else {
+            res = -memcmp16_8(s2->u.str16, s1->u.str8, len);
+        }
+    } else {
+        if (!s2->is_wide_char) {
+            res = memcmp16_8(s1->u.str16, s2->u.str8, len);
+        } else {
+            res = memcmp16(s1->u.str16, s2->u.str16, len);
+        }
+    }
+
+    return res;
+}
+
+/**
+ * Three-way comparison of the contents
+ */
+static int lc_string_compare(const LCString* s1, const LCString* s2) {
+    int len = min_int(s1->length, s2->length);
+    int cmp_result = lc_string_memcmp(s1, s2, len);
+
+    if (cmp_result == 0) {
+        if (s1->length == s2->length) {
+            cmp_result = 0;
+        } else if (s1->length < s2->length) {
+            cmp_result = -1;
+        } else {
+            cmp_result = 1;
+        }
+    }
+
+    return cmp_result;
+}
+
+LCValue lc_std_string_cmp(LCRuntime* rt, LCCmpType cmp_type, LCValue left, LCValue right) {
+    int cmp_result, hash1, hash2;
+    LCString* s1 = (LCString*)(left.ptr_val);
+    LCString* s2 = (LCString*)(right.ptr_val);
+
+    // quick check
+    if (cmp_type == LC_CMP_EQ) {
+        if (s1->length != s2->length) {
+            return LCFalse;
+        }
+
+        if (s1->is_wide_char != s2->is_wide_char) {
+            return LCFalse;
+        }
+        hash1 = s1->hash;
+        hash2 = s2->hash;
+
+        if (hash1 != 0 && hash2 != 0 && hash1 != hash2) {
+            return LCFalse;
+        }
+    }
+
+    cmp_result = lc_string_compare(s1, s2);
+
+cmp:
+    switch (cmp_type) {
+    case LC_CMP_EQ:
+        return cmp_result == 0 ? LCTrue : LCFalse;
+
+    case LC_CMP_NEQ:
+        return cmp_result != 0 ? LCTrue : LCFalse;
+
+    case LC_CMP_LT:
+        return cmp_result < 0 ? LCTrue : LCFalse;
+
+    case LC_CMP_LTEQ:
+        return cmp_result <= 0 ? LCTrue : LCFalse;
+
+    case LC_CMP_GT:
+        return cmp_result > 0 ? LCTrue : LCFalse;
+
+    case LC_CMP_GTEQ:
+        return cmp_result >= 0 ? LCTrue : LCFalse;
+
+    }
+    return LCFalse;
+}
+
+LCValue lc_std_string_slice(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    int begin = args[0].int_val;
+    int end = args[1].int_val;
+    LCString* s = (LCString*)(this.ptr_val);
+    LCString* result;
+    int max_len = s->length;
+    int need_len; 
     uint32_t acquire_len;
 
-    begin = min_int(max_int(begin, 0), max_len);
-    end = min_int(max_int(end, 0), max_len);
+    begin = min_int(max_int(begin, 0), max_len);
+    end = min_int(max_int(end, 0), max_len);
+
+    need_len = end - begin;
+
+    if (begin >= end) {
+        return lc_new_string8(rt, NULL, 0);
+    }
+
+    if (!s->is_wide_char) {
+        acquire_len = sizeof(LCString) + need_len + 1;
+        result = lc_mallocz(rt, acquire_len);
+
+        result->header.count = 1;
+
+        memcpy(result->u.str8, s->u.str8 + begin, need_len);
+        result->u.str8[need_len] = 0;
+
+        result->length = need_len;
+        result->is_wide_char = 0;
+        result->hash = 0;
+
+        return MK_STRING(result);
+    }
+
+    acquire_len = sizeof(LCString) + need_len * 2;
+    result = lc_mallocz(rt, acquire_len);
+    result->header.count = 1;
+    memcpy(result->u.str16, s->u.str16 + begin, need_len * 2);
+    result->length = need_len;
+    result->is_wide_char = 1;
+    result->hash = 0;
+
+    return MK_STRING(result);
+}
+
+LCValue lc_std_string_get_char(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
+    int index = args[0].int_val;
+    LCString* str = (LCString*)this.ptr_val;
+    if (index < 0 || index >= str->length) {
+        fprintf(stderr, "[LichenScript] Panic: index %d out of range, size: %d\n", index, str->length);
+        lc_panic_internal();
+    }
+    if (str->is_wide_char) {
+        return MK_CHAR(str->u.str16[index]);
+    }
+    return MK_CHAR(str->u.str8[index]);
+}
+
+LCValue lc_std_map_new(LCRuntime* rt, int key_ty, int init_size) {
+    LCMap* map = (LCMap*)lc_mallocz(rt, sizeof (LCMap));
+
+    init_gc_object(rt, (LCGCObject*)map, LC_GC_MAP);
+
+    map->key_ty = key_ty;
+    if (init_size >= 0 && init_size < 8) {
+        map->is_small = 1;
+    } else {
+        map->is_small = 0;
+    }
+
+    if (key_ty == LC_TY_BOOL) {
+        map->is_small = 1;
+    }
+
+    map->buckets = NULL;
+
+    return (LCValue){ { .ptr_val = (LCObject*)map }, LC_TY_MAP };
+}
+
+static uint32_t LCGetStringHash(LCRuntime*rt, LCValue val) {
+    LCString* str = (LCString*)val.ptr_val;
+    if (str->hash != 0) {
+        return str->hash;
+    }
+
+    if (str->is_wide_char) {
+        str->hash = hash_string16(str->u.str16, str->length, rt->seed);
+    } else {
+        str->hash = hash_string8(str->u.str8, str->length, rt->seed);
+    }
+
+    return str->hash;
+}
+
+static inline uint32_t LCValueHash(LCRuntime* rt, LCValue val) {
+    switch (val.tag) {
+    case LC_TY_I32:
+    case LC_TY_BOOL:
+    case LC_TY_CHAR:
+        return hash_int(val.int_val, rt->seed);
+
+    case LC_TY_STRING:
+        return LCGetStringHash(rt, val);
+    
+    default:
+        return 0;
+    }
+}
+
+static inline int LCMapKeyEq(LCRuntime* rt, LCValue a, LCValue b) {
+    switch (a.tag) {
+    case LC_TY_I32:
+    case LC_TY_BOOL:
+    case LC_TY_CHAR:
+        if (a.int_val == b.int_val) {
+            return 1;
+        }
+        break;
+
+    case LC_TY_STRING:
+        if (lc_std_string_cmp(rt, LC_CMP_EQ, a, b).int_val != 0) {
+            return 1;
+        }
+
+        break;
+    
+    default:
+        break;
+    }
+    return 0;
+}
+
+static no_inline LCMapTuple* lc_std_map_find_tuple(LCRuntime*rt, LCMap* map, LCValue key) {
+    LCMapTuple* t = map->head;
+    LCMapTuple* tmp;
+    LCMapBucket *b, *bt;
+    uint32_t hash;
+
+    if (!map->is_small) {
+        hash = LCValueHash(rt, key);
+        uint32_t bucket_index = hash % (uint32_t)map->bucket_size;
+        b = map->buckets[bucket_index];
+
+        while (b != NULL) {
+            bt = b->next;
+
+            if (b->hash == hash && LCMapKeyEq(rt, b->data->key, key)) {
+                return b->data;
+            }
+
+            b = bt;
+        }
+
+        return NULL;
+    }
+
+    while (t != NULL) {
+        tmp = t->next;
+
+        if (LCMapKeyEq(rt, t->key, key)) {
+            return t;
+        }
+
+        t = tmp;
+    }
+
+    return NULL;
+}
+
+#define LC_MAP_DEFAULT_BUCKET_SIZE 16
+
+static void lc_std_map_construct_hashtable(LCRuntime* rt, LCMap* map) {
+    LCMapTuple *t, *tmp;
+    uint32_t hash;
+    LCMapBucket* bucket;
+    int bucket_index;
+    t = map->head;
+
+    int bucket_size = LC_MAP_DEFAULT_BUCKET_SIZE;
+    LCMapBucket** buckets = lc_mallocz(rt, sizeof(LCMapBucket*) * bucket_size);
+
+    while (t != NULL) {
+        tmp = t->next;
+
+        hash = LCValueHash(rt, t->key);
+        bucket_index = hash % bucket_size;
+
+        bucket = lc_malloc(rt, sizeof(LCMapBucket));
+        bucket->data = t;
+        bucket->hash = hash;
+        bucket->next = buckets[bucket_index];
+
+        buckets[bucket_index] = bucket;
+
+        t = tmp;
+    }
+
+    map->bucket_size = bucket_size;
+    map->buckets = buckets;
+    map->is_small = 0;
+}
+
+LCValue lc_std_map_set(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCMapTuple *found_tuple, *tuple;
+    LCMapBucket *bucket;
+    uint32_t hash;
+    int index;
+    LCMap* map = (LCMap*)this.ptr_val;
+
+    found_tuple = lc_std_map_find_tuple(rt, map, args[0]);
+    if (found_tuple == NULL) { // not found, add to the linked list
+        LCRetain(args[0]);
+        LCRetain(args[1]);
+
+        tuple = (LCMapTuple*)lc_malloc(rt, sizeof(LCMapTuple));
+        tuple->key = args[0];
+        tuple->value = args[1];
+
+        tuple->prev = map->last;
+        tuple->next = NULL;
+
+        map->size++;
+        if (map->last != NULL) {
+            map->last->next = tuple;
+        }
+        map->last = tuple;
+        if (map->head == NULL) {
+            map->head = tuple;
+        }
+
+        if (map->is_small) {
+            if (map->size >= LC_SMALL_MAP_THRESHOLD && (
+                map->key_ty == LC_TY_STRING || map->key_ty == LC_TY_I32 || map->key_ty == LC_TY_CHAR)) {
+
+                lc_std_map_construct_hashtable(rt, map);
+            }
+
+            return MK_NULL();
+        } else {
+            hash = LCValueHash(rt, args[0]);
+            index = hash % map->bucket_size;
+
+            bucket = (LCMapBucket*)lc_malloc(rt, sizeof(LCMapBucket));
+            bucket->data = tuple;
+            bucket->hash = hash;
+            bucket->next = map->buckets[index];
+
+            map->buckets[index] = bucket;
+
+            return MK_NULL();
+        }
+    } else {  // found in hashmap, replace exist value
+        LCRelease(rt, tuple->value);
+        LCRetain(args[1]);
+        tuple->value = args[1];
+        return MK_NULL();
+    }
+}
+
+static inline void lc_free_map_tuple(LCRuntime* rt, LCMapTuple* tuple) {
+    LCRelease(rt, tuple->key);
+    LCRelease(rt, tuple->value);
+    lc_free(rt, tuple);
+}
+
+void lc_std_map_free(LCRuntime* rt, LCMap* map) {
+    LCMapTuple *ptr, *tmp;
+    LCMapBucket *bucket, *bp;
+
+    if (likely(map->size > 0)) {
+        if (map->is_small) {
+            ptr = map->head;
+
+            while (ptr != NULL) {
+                tmp = ptr->next;
+
+                lc_free_map_tuple(rt, ptr);
+
+                ptr = tmp;
+            }
+
+            goto clean;
+        }
+
+        for (int i = 0; i < map->bucket_size; i++) {
+            bucket = map->buckets[i];
+
+            while (bucket != NULL) {
+                bp = bucket->next;
+
+                lc_free_map_tuple(rt, bucket->data);
+
+                lc_free(rt, bucket);
+
+                bucket = bp;
+            }
+        }
+        lc_free(rt, map->buckets);
+    }
+
+clean:
+    if (rt->gc_phase != LC_GC_PHASE_REMOVING_CYCLES) {
+        lc_gc_objs_list_remove(&rt->gc_objs, (LCGCObject*)map);
+    }
+    lc_free(rt, map);
+}
+
+LCValue lc_std_map_get(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCMapTuple *t, *tmp;
+    LCMap* map = (LCMap*)this.ptr_val;
+
+    t = lc_std_map_find_tuple(rt, map, args[0]);
+    if (t == NULL) {
+        return /* None */MK_UNION(1);
+    }
+
+    return /* Some(result) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { t->value });
+}
+
+static void lc_std_map_become_small(LCRuntime* rt, LCMap* map) {
+    int i;
+    LCMapBucket *bucket, *next;
+
+    for (i = 0; i < map->bucket_size; i++) {
+        bucket = map->buckets[i];
+
+        while (bucket != NULL) {
+            next = bucket->next;
+
+            lc_free(rt, bucket);
+
+            bucket = next;
+        }
+    }
+
+    lc_free(rt, map->buckets);
+    map->buckets = NULL;
+
+    map->is_small = 1;
+}
+
+static inline LCValue lc_std_map_remove_complex(LCRuntime* rt, LCMap* map, LCValue key) {
+    LCMapTuple* t;
+    LCMapBucket **bucket_ref, *next_bucket;
+    uint32_t hash = LCValueHash(rt, key);
+    int index = hash % map->bucket_size;
+    LCValue result;
+
+    bucket_ref = &map->buckets[index];
+
+    while ((*bucket_ref) != NULL) {
+
+        if ((*bucket_ref)->hash == hash && LCMapKeyEq(rt, (*bucket_ref)->data->key, key)) {
+            t = (*bucket_ref)->data;
+            result = LCNewUnionObject(rt, 0, 1, (LCValue[]){ t->value });
+
+            if (t->prev) {
+                t->prev->next = t->next;
+            } else {  // is first
+                map->head = t->next;
+            }
+
+            if (t->next) {
+                t->next->prev = t->prev;
+            } else {  // is last
+                map->last = t->prev;
+            }
+
+            lc_free_map_tuple(rt, t);
+
+            next_bucket = (*bucket_ref)->next;
+            lc_free(rt, *bucket_ref);
+            (*bucket_ref) = next_bucket;
+
+            if (--map->size < LC_SMALL_MAP_THRESHOLD) {
+                lc_std_map_become_small(rt, map);
+            }
+
+            return result;
+        }
+
+        bucket_ref = &((*bucket_ref)->next);
+    }
+
+    return  /* None */MK_UNION(1);
+}
+
+LCValue lc_std_map_remove(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCMapTuple *t, *tmp;
+    LCMap* map = (LCMap*)this.ptr_val;
+    LCValue result;
+
+    if (map->is_small) {
+        t = map->head;
+
+        while (t != NULL) {
+            tmp = t->next;
+
+            if (LCMapKeyEq(rt, t->key, args[0])) {
+                result = LCNewUnionObject(rt, 0, 1, (LCValue[]){ t->value });
+
+                if (t->prev) {
+                    t->prev->next = t->next;
+                } else {  // is first
+                    map->head = t->next;
+                }
+
+                if (t->next) {
+                    t->next->prev = t->prev;
+                } else {  // is last
+                    map->last = t->prev;
+                }
+
+                lc_free_map_tuple(rt, t);
+                map->size--;
+
+                return result;
+            }
+
+            t = tmp;
+        }
+
+        return  /* None */MK_UNION(1);
+    }
+
+    return lc_std_map_remove_complex(rt, map, args[0]);
+}
+
+LCValue lc_std_map_size(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCMap* map = (LCMap*)this.ptr_val;
+    return MK_I32(map->size);
+}
+
+#define LC_DEQUE_INIT_CAP 8
+
+#define lc_deque_index(q, i) (((q)->head + (i)) & ((q)->capacity - 1))
+
+LCValue lc_std_deque_new(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)lc_malloc(rt, sizeof(LCDeque));
+    init_gc_object(rt, (LCGCObject*)q, LC_GC_DEQUE);
+    q->head = 0;
+    q->len = 0;
+    q->capacity = LC_DEQUE_INIT_CAP;
+    q->data = (LCValue*)lc_malloc(rt, sizeof(LCValue) * LC_DEQUE_INIT_CAP);
+    return (LCValue){ { .ptr_val = (LCObject*)q }, LC_TY_DEQUE };
+}
+
+/**
+ * Double the ring, the wrapped part of the items
+ * is moved right after the old end.
+ */
+static no_inline void lc_deque_grow(LCRuntime* rt, LCDeque* q) {
+    uint32_t old_cap = q->capacity;
+    uint32_t wrapped;
+
+    if (unlikely(old_cap >= (UINT32_MAX >> 1))) {
+        fprintf(stderr, "[LichenScript] deque length exceeds the limit\n");
+        lc_panic_internal();
+    }
+
+    q->data = (LCValue*)lc_realloc2(rt, q->data, sizeof(LCValue) * old_cap * 2, NULL);
+    if (unlikely(q->data == NULL)) {
+        fprintf(stderr, "[LichenScript] out of memory\n");
+        lc_panic_internal();
+    }
+
+    if (q->head + q->len > old_cap) {
+        wrapped = q->head + q->len - old_cap;
+        memcpy(q->data + old_cap, q->data, sizeof(LCValue) * wrapped);
+    }
+
+    q->capacity = old_cap * 2;
+}
+
+LCValue lc_std_deque_push_back(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)this.ptr_val;
+
+    if (unlikely(q->len == q->capacity)) {
+        lc_deque_grow(rt, q);
+    }
+
+    LCRetain(args[0]);
+    q->data[lc_deque_index(q, q->len)] = args[0];
+    q->len++;
+
+    return MK_NULL();
+}
+
+LCValue lc_std_deque_push_front(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)this.ptr_val;
+
+    if (unlikely(q->len == q->capacity)) {
+        lc_deque_grow(rt, q);
+    }
+
+    LCRetain(args[0]);
+    q->head = (q->head - 1) & (q->capacity - 1);
+    q->data[q->head] = args[0];
+    q->len++;
+
+    return MK_NULL();
+}
+
+/**
+ * Move the item into an Option, the deque gives up its reference.
+ */
+static inline LCValue lc_deque_take(LCRuntime* rt, LCValue item) {
+    LCValue result = LCNewUnionObject(rt, 0, 1, (LCValue[]) { item });
+    LCRelease(rt, item);
+    return /* Some(item) */result;
+}
+
+LCValue lc_std_deque_pop_back(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)this.ptr_val;
+    LCValue item;
+
+    if (q->len == 0) {
+        return /* None */MK_UNION(1);
+    }
+
+    q->len--;
+    item = q->data[lc_deque_index(q, q->len)];
+
+    return lc_deque_take(rt, item);
+}
+
+LCValue lc_std_deque_pop_front(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)this.ptr_val;
+    LCValue item;
+
+    if (q->len == 0) {
+        return /* None */MK_UNION(1);
+    }
+
+    item = q->data[q->head];
+    q->head = (q->head + 1) & (q->capacity - 1);
+    q->len--;
+
+    return lc_deque_take(rt, item);
+}
+
+LCValue lc_std_deque_peek_back(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)this.ptr_val;
+
+    if (q->len == 0) {
+        return /* None */MK_UNION(1);
+    }
+
+    return /* Some(result) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { q->data[lc_deque_index(q, q->len - 1)] });
+}
+
+LCValue lc_std_deque_peek_front(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)this.ptr_val;
+
+    if (q->len == 0) {
+        return /* None */MK_UNION(1);
+    }
+
+    return /* Some(result) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { q->data[q->head] });
+}
+
+LCValue lc_std_deque_size(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCDeque* q = (LCDeque*)this.ptr_val;
+    return MK_I32(q->len);
+}
+
+#define LC_HEAP_INIT_CAP 8
+
+static LCPriorityQueue* lc_priority_queue_alloc(LCRuntime* rt, LCHeapOrder order, LCValue cmp) {
+    LCPriorityQueue* q = (LCPriorityQueue*)lc_malloc(rt, sizeof(LCPriorityQueue));
+    init_gc_object(rt, (LCGCObject*)q, LC_GC_PRIORITY_QUEUE);
+    q->len = 0;
+    q->capacity = LC_HEAP_INIT_CAP;
+    q->order = order;
+    LCRetain(cmp);
+    q->cmp = cmp;
+    q->data = (LCValue*)lc_malloc(rt, sizeof(LCValue) * LC_HEAP_INIT_CAP);
+    return q;
+}
+
+LCValue lc_std_priority_queue_new(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCPriorityQueue* q = lc_priority_queue_alloc(rt, LC_HEAP_ORDER_UNKNOWN, MK_NULL());
+    return (LCValue){ { .ptr_val = (LCObject*)q }, LC_TY_PRIORITY_QUEUE };
+}
+
+LCValue lc_std_priority_queue_with_comparator(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCPriorityQueue* q = lc_priority_queue_alloc(rt, LC_HEAP_ORDER_LAMBDA, args[0]);
+    return (LCValue){ { .ptr_val = (LCObject*)q }, LC_TY_PRIORITY_QUEUE };
+}
+
+static LCHeapOrder lc_heap_order_of(LCValue item) {
+    switch (item.tag) {
+    case LC_TY_I32:
+    case LC_TY_CHAR:
+    case LC_TY_BOOL:
+        return LC_HEAP_ORDER_INT;
+
+    case LC_TY_F32:
+        return LC_HEAP_ORDER_F32;
+
+    case LC_TY_BOXED_I64:
+        return LC_HEAP_ORDER_I64;
+
+    case LC_TY_BOXED_U64:
+        return LC_HEAP_ORDER_U64;
+
+    case LC_TY_BOXED_F64:
+        return LC_HEAP_ORDER_F64;
+
+    case LC_TY_STRING:
+        return LC_HEAP_ORDER_STRING;
+
+    default:
+        fprintf(stderr, "[LichenScript] the items of PriorityQueue are not comparable, use PriorityQueue.withComparator()\n");
+        lc_panic_internal();
+        return LC_HEAP_ORDER_UNKNOWN;
+    }
+}
+
+#define LC_HEAP_LESS_INT(rt, q, a, b) ((a).int_val < (b).int_val)
+#define LC_HEAP_LESS_F32(rt, q, a, b) ((a).float_val < (b).float_val)
+#define LC_HEAP_LESS_I64(rt, q, a, b) (((LCBox64*)(a).ptr_val)->u.i64 < ((LCBox64*)(b).ptr_val)->u.i64)
+#define LC_HEAP_LESS_U64(rt, q, a, b) (((LCBox64*)(a).ptr_val)->u.u64 < ((LCBox64*)(b).ptr_val)->u.u64)
+#define LC_HEAP_LESS_F64(rt, q, a, b) (((LCBox64*)(a).ptr_val)->u.f64 < ((LCBox64*)(b).ptr_val)->u.f64)
+#define LC_HEAP_LESS_STRING(rt, q, a, b) (lc_std_string_cmp(rt, LC_CMP_LT, a, b).int_val != 0)
+#define LC_HEAP_LESS_LAMBDA(rt, q, a, b) (LCEvalLambda(rt, (q)->cmp, 2, (LCValue[]) { a, b }).int_val < 0)
+
+/**
+ * One pair of sift functions for every order,
+ * so the comparison of primitives is inlined into the loops.
+ */
+#define LC_DEFINE_HEAP_SIFT(suffix, LESS) \
+static void lc_heap_sift_up_##suffix(LCRuntime* rt, LCPriorityQueue* q, uint32_t i) { \
+    LCValue item = q->data[i]; \
+    uint32_t parent; \
+    while (i > 0) { \
+        parent = (i - 1) >> 1; \
+        if (!LESS(rt, q, item, q->data[parent])) { \
+            break; \
+        } \
+        q->data[i] = q->data[parent]; \
+        i = parent; \
+    } \
+    q->data[i] = item; \
+} \
+static void lc_heap_sift_down_##suffix(LCRuntime* rt, LCPriorityQueue* q, uint32_t i) { \
+    LCValue item = q->data[i]; \
+    uint32_t half = q->len >> 1; \
+    uint32_t child; \
+    while (i < half) { \
+        child = 2 * i + 1; \
+        if (child + 1 < q->len && LESS(rt, q, q->data[child + 1], q->data[child])) { \
+            child++; \
+        } \
+        if (!LESS(rt, q, q->data[child], item)) { \
+            break; \
+        } \
+        q->data[i] = q->data[child]; \
+        i = child; \
+    } \
+    q->data[i] = item; \
+}
+
+LC_DEFINE_HEAP_SIFT(int, LC_HEAP_LESS_INT)
+LC_DEFINE_HEAP_SIFT(f32, LC_HEAP_LESS_F32)
+LC_DEFINE_HEAP_SIFT(i64, LC_HEAP_LESS_I64)
+LC_DEFINE_HEAP_SIFT(u64, LC_HEAP_LESS_U64)
+LC_DEFINE_HEAP_SIFT(f64, LC_HEAP_LESS_F64)
+LC_DEFINE_HEAP_SIFT(string, LC_HEAP_LESS_STRING)
+LC_DEFINE_HEAP_SIFT(lambda, LC_HEAP_LESS_LAMBDA)
+
+static void lc_heap_sift_up(LCRuntime* rt, LCPriorityQueue* q, uint32_t i) {
+    switch (q->order) {
+    case LC_HEAP_ORDER_INT: lc_heap_sift_up_int(rt, q, i); break;
+    case LC_HEAP_ORDER_F32: lc_heap_sift_up_f32(rt, q, i); break;
+    case LC_HEAP_ORDER_I64: lc_heap_sift_up_i64(rt, q, i); break;
+    case LC_HEAP_ORDER_U64: lc_heap_sift_up_u64(rt, q, i); break;
+    case LC_HEAP_ORDER_F64: lc_heap_sift_up_f64(rt, q, i); break;
+    case LC_HEAP_ORDER_STRING: lc_heap_sift_up_string(rt, q, i); break;
+    case LC_HEAP_ORDER_LAMBDA: lc_heap_sift_up_lambda(rt, q, i); break;
+    default: break;
+    }
+}
+
+static void lc_heap_sift_down(LCRuntime* rt, LCPriorityQueue* q, uint32_t i) {
+    switch (q->order) {
+    case LC_HEAP_ORDER_INT: lc_heap_sift_down_int(rt, q, i); break;
+    case LC_HEAP_ORDER_F32: lc_heap_sift_down_f32(rt, q, i); break;
+    case LC_HEAP_ORDER_I64: lc_heap_sift_down_i64(rt, q, i); break;
+    case LC_HEAP_ORDER_U64: lc_heap_sift_down_u64(rt, q, i); break;
+    case LC_HEAP_ORDER_F64: lc_heap_sift_down_f64(rt, q, i); break;
+    case LC_HEAP_ORDER_STRING: lc_heap_sift_down_string(rt, q, i); break;
+    case LC_HEAP_ORDER_LAMBDA: lc_heap_sift_down_lambda(rt, q, i); break;
+    default: break;
+    }
+}
+
+LCValue lc_std_priority_queue_push(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCPriorityQueue* q = (LCPriorityQueue*)this.ptr_val;
+
+    if (unlikely(q->order == LC_HEAP_ORDER_UNKNOWN)) {
+        q->order = lc_heap_order_of(args[0]);
+    }
+
+    if (unlikely(q->len == q->capacity)) {
+        if (unlikely(q->capacity >= (UINT32_MAX >> 1))) {
+            fprintf(stderr, "[LichenScript] priority queue length exceeds the limit\n");
+            lc_panic_internal();
+        }
+        q->capacity *= 2;
+        q->data = (LCValue*)lc_realloc2(rt, q->data, sizeof(LCValue) * q->capacity, NULL);
+        if (unlikely(q->data == NULL)) {
+            fprintf(stderr, "[LichenScript] out of memory\n");
+            lc_panic_internal();
+        }
+    }
+
+    LCRetain(args[0]);
+    q->data[q->len++] = args[0];
+    lc_heap_sift_up(rt, q, q->len - 1);
+
+    return MK_NULL();
+}
+
+LCValue lc_std_priority_queue_pop(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCPriorityQueue* q = (LCPriorityQueue*)this.ptr_val;
+    LCValue top, result;
+
+    if (q->len == 0) {
+        return /* None */MK_UNION(1);
+    }
+
+    top = q->data[0];
+    q->len--;
+    if (q->len > 0) {
+        q->data[0] = q->data[q->len];
+        lc_heap_sift_down(rt, q, 0);
+    }
+
+    result = LCNewUnionObject(rt, 0, 1, (LCValue[]) { top });
+    LCRelease(rt, top);
+
+    return /* Some(top) */result;
+}
+
+LCValue lc_std_priority_queue_peek(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCPriorityQueue* q = (LCPriorityQueue*)this.ptr_val;
+
+    if (q->len == 0) {
+        return /* None */MK_UNION(1);
+    }
+
+    return /* Some(top) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { q->data[0] });
+}
 
-    need_len = end - begin;
+LCValue lc_std_priority_queue_size(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCPriorityQueue* q = (LCPriorityQueue*)this.ptr_val;
+    return MK_I32(q->len);
+}
 
-    if (begin >= end) {
-        return lc_new_string8(rt, NULL, 0);
+static LCBTreeNode* lc_btree_new_node(LCRuntime* rt, int is_leaf) {
+    LCBTreeNode* node;
+    if (is_leaf) {
+        node = (LCBTreeNode*)lc_mallocz(rt, sizeof(LCBTreeLeaf));
+    } else {
+        node = (LCBTreeNode*)lc_mallocz(rt, sizeof(LCBTreeInner));
     }
+    node->is_leaf = is_leaf;
+    return node;
+}
 
-    if (!s->is_wide_char) {
-        acquire_len = sizeof(LCString) + need_len + 1;
-        result = lc_mallocz(rt, acquire_len);
+LCValue lc_std_sorted_map_new(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)lc_malloc(rt, sizeof(LCSortedMap));
+    init_gc_object(rt, (LCGCObject*)map, LC_GC_SORTED_MAP);
+    map->key_ty = LC_TY_NULL;
+    map->size = 0;
+    map->root = lc_btree_new_node(rt, 1);
+    return (LCValue){ { .ptr_val = (LCObject*)map }, LC_TY_SORTED_MAP };
+}
 
-        result->header.count = 1;
+static void lc_sorted_map_check_key(LCSortedMap* map, LCValue key) {
+    if (likely(map->key_ty == key.tag)) {
+        return;
+    }
 
-        memcpy(result->u.str8, s->u.str8 + begin, need_len);
-        result->u.str8[need_len] = 0;
+    if (map->key_ty == LC_TY_NULL) {
+        switch (key.tag) {
+        case LC_TY_I32:
+        case LC_TY_CHAR:
+        case LC_TY_BOOL:
+        case LC_TY_STRING:
+            map->key_ty = key.tag;
+            return;
 
-        result->length = need_len;
-        result->is_wide_char = 0;
-        result->hash = 0;
+        default:
+            break;
+        }
+    }
 
-        return MK_STRING(result);
+    fprintf(stderr, "[LichenScript] invalid key of SortedMap, tag: %" PRId64 "\n", key.tag);
+    lc_panic_internal();
+}
+
+static force_inline int lc_sorted_map_key_cmp(LCSortedMap* map, LCValue a, LCValue b) {
+    if (map->key_ty == LC_TY_STRING) {
+        return lc_string_compare((LCString*)a.ptr_val, (LCString*)b.ptr_val);
     }
+    return (a.int_val > b.int_val) - (a.int_val < b.int_val);
+}
 
-    acquire_len = sizeof(LCString) + need_len * 2;
-    result = lc_mallocz(rt, acquire_len);
-    result->header.count = 1;
-    memcpy(result->u.str16, s->u.str16 + begin, need_len * 2);
-    result->length = need_len;
-    result->is_wide_char = 1;
-    result->hash = 0;
+/**
+ * The first index whose key is not less than `key`
+ */
+static uint32_t lc_btree_lower_bound(LCSortedMap* map, LCBTreeNode* node, LCValue key) {
+    uint32_t lo = 0, hi = node->len, mid;
 
-    return MK_STRING(result);
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        if (lc_sorted_map_key_cmp(map, node->keys[mid], key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
 }
 
-LCValue lc_std_string_get_char(LCRuntime* rt, LCValue this, int arg_len, LCValue* args) {
-    int index = args[0].int_val;
-    LCString* str = (LCString*)this.ptr_val;
-    if (index < 0 || index >= str->length) {
-        fprintf(stderr, "[LichenScript] Panic: index %d out of range, size: %d\n", index, str->length);
-        lc_panic_internal();
+/**
+ * The first index whose key is greater than `key`
+ */
+static uint32_t lc_btree_upper_bound(LCSortedMap* map, LCBTreeNode* node, LCValue key) {
+    uint32_t lo = 0, hi = node->len, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        if (lc_sorted_map_key_cmp(map, node->keys[mid], key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
-    if (str->is_wide_char) {
-        return MK_CHAR(str->u.str16[index]);
+
+    return lo;
+}
+
+static LCBTreeLeaf* lc_btree_find_leaf(LCSortedMap* map, LCValue key) {
+    LCBTreeNode* node = map->root;
+
+    while (!node->is_leaf) {
+        node = ((LCBTreeInner*)node)->children[lc_btree_upper_bound(map, node, key)];
     }
-    return MK_CHAR(str->u.str8[index]);
+
+    return (LCBTreeLeaf*)node;
 }
 
-LCValue lc_std_map_new(LCRuntime* rt, int key_ty, int init_size) {
-    LCMap* map = (LCMap*)lc_mallocz(rt, sizeof (LCMap));
+static void lc_btree_leaf_insert_at(LCBTreeLeaf* leaf, uint32_t pos, LCValue key, LCValue value) {
+    uint32_t n = leaf->base.len - pos;
+    memmove(&leaf->base.keys[pos + 1], &leaf->base.keys[pos], n * sizeof(LCValue));
+    memmove(&leaf->values[pos + 1], &leaf->values[pos], n * sizeof(LCValue));
+    leaf->base.keys[pos] = key;
+    leaf->values[pos] = value;
+    leaf->base.len++;
+}
 
-    init_gc_object(rt, (LCGCObject*)map, LC_GC_MAP);
+static void lc_btree_inner_insert_at(LCBTreeInner* inner, uint32_t pos, LCValue key, LCBTreeNode* right) {
+    uint32_t n = inner->base.len - pos;
+    memmove(&inner->base.keys[pos + 1], &inner->base.keys[pos], n * sizeof(LCValue));
+    memmove(&inner->children[pos + 2], &inner->children[pos + 1], n * sizeof(LCBTreeNode*));
+    inner->base.keys[pos] = key;
+    inner->children[pos + 1] = right;
+    inner->base.len++;
+}
 
-    map->key_ty = key_ty;
-    if (init_size >= 0 && init_size < 8) {
-        map->is_small = 1;
+typedef struct LCBTreeSplit {
+    // the separator, owned by the parent after the split
+    LCValue key;
+    LCBTreeNode* right;
+} LCBTreeSplit;
+
+/**
+ * Returns 1 if the node is split, the new right sibling is written to `split`.
+ */
+static int lc_btree_insert(LCRuntime* rt, LCSortedMap* map, LCBTreeNode* node, LCValue key, LCValue value, LCBTreeSplit* split) {
+    LCBTreeLeaf *leaf, *right_leaf;
+    LCBTreeInner *inner, *right_inner;
+    LCBTreeSplit child_split;
+    uint32_t pos, mid;
+
+    if (node->is_leaf) {
+        leaf = (LCBTreeLeaf*)node;
+        pos = lc_btree_lower_bound(map, node, key);
+
+        if (pos < node->len && lc_sorted_map_key_cmp(map, node->keys[pos], key) == 0) {
+            LCRetain(value);
+            LCRelease(rt, leaf->values[pos]);
+            leaf->values[pos] = value;
+            return 0;
+        }
+
+        LCRetain(key);
+        LCRetain(value);
+        map->size++;
+
+        if (node->len < LC_BTREE_MAX_KEYS) {
+            lc_btree_leaf_insert_at(leaf, pos, key, value);
+            return 0;
+        }
+
+        mid = LC_BTREE_MAX_KEYS / 2;
+        right_leaf = (LCBTreeLeaf*)lc_btree_new_node(rt, 1);
+        right_leaf->base.len = LC_BTREE_MAX_KEYS - mid;
+        memcpy(right_leaf->base.keys, &node->keys[mid], right_leaf->base.len * sizeof(LCValue));
+        memcpy(right_leaf->values, &leaf->values[mid], right_leaf->base.len * sizeof(LCValue));
+        node->len = mid;
+
+        right_leaf->prev = leaf;
+        right_leaf->next = leaf->next;
+        if (leaf->next != NULL) {
+            leaf->next->prev = right_leaf;
+        }
+        leaf->next = right_leaf;
+
+        if (pos <= mid) {
+            lc_btree_leaf_insert_at(leaf, pos, key, value);
+        } else {
+            lc_btree_leaf_insert_at(right_leaf, pos - mid, key, value);
+        }
+
+        LCRetain(right_leaf->base.keys[0]);
+        split->key = right_leaf->base.keys[0];
+        split->right = (LCBTreeNode*)right_leaf;
+        return 1;
+    }
+
+    inner = (LCBTreeInner*)node;
+    pos = lc_btree_upper_bound(map, node, key);
+
+    if (!lc_btree_insert(rt, map, inner->children[pos], key, value, &child_split)) {
+        return 0;
+    }
+
+    if (node->len < LC_BTREE_MAX_KEYS) {
+        lc_btree_inner_insert_at(inner, pos, child_split.key, child_split.right);
+        return 0;
+    }
+
+    // the middle key moves up
+    mid = LC_BTREE_MAX_KEYS / 2;
+    right_inner = (LCBTreeInner*)lc_btree_new_node(rt, 0);
+    right_inner->base.len = LC_BTREE_MAX_KEYS - mid - 1;
+    memcpy(right_inner->base.keys, &node->keys[mid + 1], right_inner->base.len * sizeof(LCValue));
+    memcpy(right_inner->children, &inner->children[mid + 1], (right_inner->base.len + 1) * sizeof(LCBTreeNode*));
+    split->key = node->keys[mid];
+    node->len = mid;
+
+    if (pos <= mid) {
+        lc_btree_inner_insert_at(inner, pos, child_split.key, child_split.right);
     } else {
-        map->is_small = 0;
+        lc_btree_inner_insert_at(right_inner, pos - mid - 1, child_split.key, child_split.right);
     }
 
-    if (key_ty == LC_TY_BOOL) {
-        map->is_small = 1;
+    split->right = (LCBTreeNode*)right_inner;
+    return 1;
+}
+
+LCValue lc_std_sorted_map_set(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    LCBTreeSplit split;
+    LCBTreeInner* root;
+
+    lc_sorted_map_check_key(map, args[0]);
+
+    if (lc_btree_insert(rt, map, map->root, args[0], args[1], &split)) {
+        root = (LCBTreeInner*)lc_btree_new_node(rt, 0);
+        root->base.len = 1;
+        root->base.keys[0] = split.key;
+        root->children[0] = map->root;
+        root->children[1] = split.right;
+        map->root = (LCBTreeNode*)root;
     }
 
-    map->buckets = NULL;
+    return MK_NULL();
+}
 
-    return (LCValue){ { .ptr_val = (LCObject*)map }, LC_TY_MAP };
+LCValue lc_std_sorted_map_get(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    LCBTreeLeaf* leaf;
+    uint32_t pos;
+
+    if (map->size == 0) {
+        return /* None */MK_UNION(1);
+    }
+
+    lc_sorted_map_check_key(map, args[0]);
+
+    leaf = lc_btree_find_leaf(map, args[0]);
+    pos = lc_btree_lower_bound(map, &leaf->base, args[0]);
+    if (pos < leaf->base.len && lc_sorted_map_key_cmp(map, leaf->base.keys[pos], args[0]) == 0) {
+        return /* Some(result) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { leaf->values[pos] });
+    }
+
+    return /* None */MK_UNION(1);
 }
 
-static uint32_t LCGetStringHash(LCRuntime*rt, LCValue val) {
-    LCString* str = (LCString*)val.ptr_val;
-    if (str->hash != 0) {
-        return str->hash;
+static void lc_btree_borrow_from_left(LCRuntime* rt, LCBTreeInner* parent, uint32_t idx) {
+    LCBTreeNode* left = parent->children[idx - 1];
+    LCBTreeNode* child = parent->children[idx];
+    LCBTreeLeaf *left_leaf, *child_leaf;
+    LCBTreeInner *left_inner, *child_inner;
+
+    memmove(&child->keys[1], &child->keys[0], child->len * sizeof(LCValue));
+
+    if (child->is_leaf) {
+        left_leaf = (LCBTreeLeaf*)left;
+        child_leaf = (LCBTreeLeaf*)child;
+        memmove(&child_leaf->values[1], &child_leaf->values[0], child->len * sizeof(LCValue));
+        child->keys[0] = left->keys[left->len - 1];
+        child_leaf->values[0] = left_leaf->values[left->len - 1];
+
+        LCRelease(rt, parent->base.keys[idx - 1]);
+        LCRetain(child->keys[0]);
+        parent->base.keys[idx - 1] = child->keys[0];
+    } else {
+        left_inner = (LCBTreeInner*)left;
+        child_inner = (LCBTreeInner*)child;
+        memmove(&child_inner->children[1], &child_inner->children[0], (child->len + 1) * sizeof(LCBTreeNode*));
+        child->keys[0] = parent->base.keys[idx - 1];
+        child_inner->children[0] = left_inner->children[left->len];
+        parent->base.keys[idx - 1] = left->keys[left->len - 1];
+    }
+
+    left->len--;
+    child->len++;
+}
+
+static void lc_btree_borrow_from_right(LCRuntime* rt, LCBTreeInner* parent, uint32_t idx) {
+    LCBTreeNode* child = parent->children[idx];
+    LCBTreeNode* right = parent->children[idx + 1];
+    LCBTreeLeaf *right_leaf, *child_leaf;
+    LCBTreeInner *right_inner, *child_inner;
+
+    if (child->is_leaf) {
+        right_leaf = (LCBTreeLeaf*)right;
+        child_leaf = (LCBTreeLeaf*)child;
+        child->keys[child->len] = right->keys[0];
+        child_leaf->values[child->len] = right_leaf->values[0];
+        memmove(&right_leaf->values[0], &right_leaf->values[1], (right->len - 1) * sizeof(LCValue));
+        memmove(&right->keys[0], &right->keys[1], (right->len - 1) * sizeof(LCValue));
+
+        LCRelease(rt, parent->base.keys[idx]);
+        LCRetain(right->keys[0]);
+        parent->base.keys[idx] = right->keys[0];
+    } else {
+        right_inner = (LCBTreeInner*)right;
+        child_inner = (LCBTreeInner*)child;
+        child->keys[child->len] = parent->base.keys[idx];
+        child_inner->children[child->len + 1] = right_inner->children[0];
+        parent->base.keys[idx] = right->keys[0];
+        memmove(&right->keys[0], &right->keys[1], (right->len - 1) * sizeof(LCValue));
+        memmove(&right_inner->children[0], &right_inner->children[1], right->len * sizeof(LCBTreeNode*));
     }
 
-    if (str->is_wide_char) {
-        str->hash = hash_string16(str->u.str16, str->length, rt->seed);
+    right->len--;
+    child->len++;
+}
+
+/**
+ * Merge the child `idx + 1` into the child `idx`
+ */
+static void lc_btree_merge(LCRuntime* rt, LCBTreeInner* parent, uint32_t idx) {
+    LCBTreeNode* left = parent->children[idx];
+    LCBTreeNode* right = parent->children[idx + 1];
+    LCBTreeLeaf *left_leaf, *right_leaf;
+    LCBTreeInner *left_inner, *right_inner;
+    uint32_t n;
+
+    if (left->is_leaf) {
+        left_leaf = (LCBTreeLeaf*)left;
+        right_leaf = (LCBTreeLeaf*)right;
+        memcpy(&left->keys[left->len], right->keys, right->len * sizeof(LCValue));
+        memcpy(&left_leaf->values[left->len], right_leaf->values, right->len * sizeof(LCValue));
+        left->len += right->len;
+
+        left_leaf->next = right_leaf->next;
+        if (right_leaf->next != NULL) {
+            right_leaf->next->prev = left_leaf;
+        }
+
+        LCRelease(rt, parent->base.keys[idx]);
     } else {
-        str->hash = hash_string8(str->u.str8, str->length, rt->seed);
+        left_inner = (LCBTreeInner*)left;
+        right_inner = (LCBTreeInner*)right;
+        left->keys[left->len] = parent->base.keys[idx];
+        memcpy(&left->keys[left->len + 1], right->keys, right->len * sizeof(LCValue));
+        memcpy(&left_inner->children[left->len + 1], right_inner->children, (right->len + 1) * sizeof(LCBTreeNode*));
+        left->len += right->len + 1;
     }
 
-    return str->hash;
+    n = parent->base.len - idx - 1;
+    memmove(&parent->base.keys[idx], &parent->base.keys[idx + 1], n * sizeof(LCValue));
+    memmove(&parent->children[idx + 1], &parent->children[idx + 2], n * sizeof(LCBTreeNode*));
+    parent->base.len--;
+
+    lc_free(rt, right);
 }
 
-static inline uint32_t LCValueHash(LCRuntime* rt, LCValue val) {
-    switch (val.tag) {
-    case LC_TY_I32:
-    case LC_TY_BOOL:
-    case LC_TY_CHAR:
-        return hash_int(val.int_val, rt->seed);
+static void lc_btree_rebalance(LCRuntime* rt, LCBTreeInner* parent, uint32_t idx) {
+    LCBTreeNode* left = idx > 0 ? parent->children[idx - 1] : NULL;
+    LCBTreeNode* right = idx < parent->base.len ? parent->children[idx + 1] : NULL;
 
-    case LC_TY_STRING:
-        return LCGetStringHash(rt, val);
-    
-    default:
-        return 0;
+    if (left != NULL && left->len > LC_BTREE_MIN_KEYS) {
+        lc_btree_borrow_from_left(rt, parent, idx);
+    } else if (right != NULL && right->len > LC_BTREE_MIN_KEYS) {
+        lc_btree_borrow_from_right(rt, parent, idx);
+    } else if (left != NULL) {
+        lc_btree_merge(rt, parent, idx - 1);
+    } else if (right != NULL) {
+        lc_btree_merge(rt, parent, idx);
     }
 }
 
-static inline int LCMapKeyEq(LCRuntime* rt, LCValue a, LCValue b) {
-    switch (a.tag) {
-    case LC_TY_I32:
-    case LC_TY_BOOL:
-    case LC_TY_CHAR:
-        if (a.int_val == b.int_val) {
-            return 1;
+/**
+ * Returns 1 if the key is found, the reference of the value
+ * is moved to `removed`.
+ */
+static int lc_btree_remove(LCRuntime* rt, LCSortedMap* map, LCBTreeNode* node, LCValue key, LCValue* removed) {
+    LCBTreeLeaf* leaf;
+    LCBTreeInner* inner;
+    uint32_t pos, n;
+
+    if (node->is_leaf) {
+        leaf = (LCBTreeLeaf*)node;
+        pos = lc_btree_lower_bound(map, node, key);
+        if (pos >= node->len || lc_sorted_map_key_cmp(map, node->keys[pos], key) != 0) {
+            return 0;
         }
-        break;
 
-    case LC_TY_STRING:
-        if (lc_std_string_cmp(rt, LC_CMP_EQ, a, b).int_val != 0) {
-            return 1;
-        }
+        LCRelease(rt, node->keys[pos]);
+        *removed = leaf->values[pos];
 
-        break;
-    
-    default:
-        break;
+        n = node->len - pos - 1;
+        memmove(&node->keys[pos], &node->keys[pos + 1], n * sizeof(LCValue));
+        memmove(&leaf->values[pos], &leaf->values[pos + 1], n * sizeof(LCValue));
+        node->len--;
+        map->size--;
+        return 1;
     }
-    return 0;
+
+    inner = (LCBTreeInner*)node;
+    pos = lc_btree_upper_bound(map, node, key);
+    if (!lc_btree_remove(rt, map, inner->children[pos], key, removed)) {
+        return 0;
+    }
+
+    if (inner->children[pos]->len < LC_BTREE_MIN_KEYS) {
+        lc_btree_rebalance(rt, inner, pos);
+    }
+
+    return 1;
 }
 
-static no_inline LCMapTuple* lc_std_map_find_tuple(LCRuntime*rt, LCMap* map, LCValue key) {
-    LCMapTuple* t = map->head;
-    LCMapTuple* tmp;
-    LCMapBucket *b, *bt;
-    uint32_t hash;
+LCValue lc_std_sorted_map_remove(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    LCBTreeNode* old_root;
+    LCValue removed, result;
 
-    if (!map->is_small) {
-        hash = LCValueHash(rt, key);
-        uint32_t bucket_index = hash % (uint32_t)map->bucket_size;
-        b = map->buckets[bucket_index];
+    if (map->size == 0) {
+        return /* None */MK_UNION(1);
+    }
 
-        while (b != NULL) {
-            bt = b->next;
+    lc_sorted_map_check_key(map, args[0]);
 
-            if (b->hash == hash && LCMapKeyEq(rt, b->data->key, key)) {
-                return b->data;
-            }
+    if (!lc_btree_remove(rt, map, map->root, args[0], &removed)) {
+        return /* None */MK_UNION(1);
+    }
 
-            b = bt;
-        }
+    // the tree gets lower
+    if (!map->root->is_leaf && map->root->len == 0) {
+        old_root = map->root;
+        map->root = ((LCBTreeInner*)old_root)->children[0];
+        lc_free(rt, old_root);
+    }
 
-        return NULL;
+    result = LCNewUnionObject(rt, 0, 1, (LCValue[]) { removed });
+    LCRelease(rt, removed);
+
+    return /* Some(removed) */result;
+}
+
+LCValue lc_std_sorted_map_size(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    return MK_I32(map->size);
+}
+
+/**
+ * The greatest key less than or equal to the given key
+ */
+LCValue lc_std_sorted_map_floor(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    LCBTreeLeaf* leaf;
+    uint32_t pos;
+
+    if (map->size == 0) {
+        return /* None */MK_UNION(1);
     }
 
-    while (t != NULL) {
-        tmp = t->next;
+    lc_sorted_map_check_key(map, args[0]);
 
-        if (LCMapKeyEq(rt, t->key, key)) {
-            return t;
-        }
+    leaf = lc_btree_find_leaf(map, args[0]);
+    pos = lc_btree_upper_bound(map, &leaf->base, args[0]);
+    if (pos > 0) {
+        return /* Some(key) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { leaf->base.keys[pos - 1] });
+    }
 
-        t = tmp;
+    leaf = leaf->prev;
+    if (leaf != NULL && leaf->base.len > 0) {
+        return /* Some(key) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { leaf->base.keys[leaf->base.len - 1] });
     }
 
-    return NULL;
+    return /* None */MK_UNION(1);
 }
 
-#define LC_MAP_DEFAULT_BUCKET_SIZE 16
+/**
+ * The least key greater than or equal to the given key
+ */
+LCValue lc_std_sorted_map_ceil(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    LCBTreeLeaf* leaf;
+    uint32_t pos;
 
-static void lc_std_map_construct_hashtable(LCRuntime* rt, LCMap* map) {
-    LCMapTuple *t, *tmp;
-    uint32_t hash;
-    LCMapBucket* bucket;
-    int bucket_index;
-    t = map->head;
+    if (map->size == 0) {
+        return /* None */MK_UNION(1);
+    }
 
-    int bucket_size = LC_MAP_DEFAULT_BUCKET_SIZE;
-    LCMapBucket** buckets = lc_mallocz(rt, sizeof(LCMapBucket*) * bucket_size);
+    lc_sorted_map_check_key(map, args[0]);
 
-    while (t != NULL) {
-        tmp = t->next;
+    leaf = lc_btree_find_leaf(map, args[0]);
+    pos = lc_btree_lower_bound(map, &leaf->base, args[0]);
+    if (pos < leaf->base.len) {
+        return /* Some(key) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { leaf->base.keys[pos] });
+    }
 
-        hash = LCValueHash(rt, t->key);
-        bucket_index = hash % bucket_size;
+    leaf = leaf->next;
+    if (leaf != NULL && leaf->base.len > 0) {
+        return /* Some(key) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { leaf->base.keys[0] });
+    }
+
+    return /* None */MK_UNION(1);
+}
+
+/**
+ * Collect the keys from the leaf until the upper bound (exclusive),
+ * no upper bound if `high` is NULL.
+ */
+static LCValue lc_sorted_map_collect_keys(LCRuntime* rt, LCSortedMap* map, LCBTreeLeaf* leaf, uint32_t pos, LCValue* high) {
+    LCValue result = LCNewArray(rt);
+    LCArray* arr = (LCArray*)result.ptr_val;
+    LCValue key;
+
+    for (; leaf != NULL; leaf = leaf->next, pos = 0) {
+        for (; pos < leaf->base.len; pos++) {
+            key = leaf->base.keys[pos];
+            if (high != NULL && lc_sorted_map_key_cmp(map, key, *high) >= 0) {
+                return result;
+            }
+
+            lc_array_ensure_capacity(rt, arr, (size_t)arr->len + 1);
+            LCRetain(key);
+            arr->data[arr->len++] = key;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * The keys in [low, high) in order
+ */
+LCValue lc_std_sorted_map_range(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    LCBTreeLeaf* leaf;
+    uint32_t pos;
+
+    if (map->size == 0) {
+        return LCNewArray(rt);
+    }
+
+    lc_sorted_map_check_key(map, args[0]);
+    lc_sorted_map_check_key(map, args[1]);
 
-        bucket = lc_malloc(rt, sizeof(LCMapBucket));
-        bucket->data = t;
-        bucket->hash = hash;
-        bucket->next = buckets[bucket_index];
+    leaf = lc_btree_find_leaf(map, args[0]);
+    pos = lc_btree_lower_bound(map, &leaf->base, args[0]);
 
-        buckets[bucket_index] = bucket;
+    return lc_sorted_map_collect_keys(rt, map, leaf, pos, &args[1]);
+}
 
-        t = tmp;
+LCValue lc_std_sorted_map_keys(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSortedMap* map = (LCSortedMap*)this.ptr_val;
+    LCBTreeNode* node = map->root;
+
+    while (!node->is_leaf) {
+        node = ((LCBTreeInner*)node)->children[0];
     }
 
-    map->bucket_size = bucket_size;
-    map->buckets = buckets;
-    map->is_small = 0;
+    return lc_sorted_map_collect_keys(rt, map, (LCBTreeLeaf*)node, 0, NULL);
 }
 
-LCValue lc_std_map_set(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
-    LCMapTuple *found_tuple, *tuple;
-    LCMapBucket *bucket;
-    uint32_t hash;
-    int index;
-    LCMap* map = (LCMap*)this.ptr_val;
+#define LC_SET_INIT_CAP 8
+#define LC_SET_EMPTY_SLOT -1
+#define LC_SET_DELETED_SLOT -2
 
-    found_tuple = lc_std_map_find_tuple(rt, map, args[0]);
-    if (found_tuple == NULL) { // not found, add to the linked list
-        LCRetain(args[0]);
-        LCRetain(args[1]);
+static LCSet* lc_set_alloc(LCRuntime* rt, int key_ty, uint32_t cap) {
+    LCSet* set = (LCSet*)lc_malloc(rt, sizeof(LCSet));
+    uint32_t index_size;
 
-        tuple = (LCMapTuple*)lc_malloc(rt, sizeof(LCMapTuple));
-        tuple->key = args[0];
-        tuple->value = args[1];
+    set->header.count = 1;
+    set->key_ty = key_ty;
+    set->size = 0;
+    set->entries_len = 0;
 
-        tuple->prev = map->last;
-        tuple->next = NULL;
+    if (cap < LC_SET_INIT_CAP) {
+        cap = LC_SET_INIT_CAP;
+    }
+    set->entries_cap = cap;
+    set->entries = (LCSetEntry*)lc_malloc(rt, sizeof(LCSetEntry) * cap);
 
-        map->size++;
-        if (map->last != NULL) {
-            map->last->next = tuple;
-        }
-        map->last = tuple;
-        if (map->head == NULL) {
-            map->head = tuple;
-        }
+    // keep the load factor of the index under 1/2
+    set->index_bits = 4;
+    while ((1u << set->index_bits) < cap * 2) {
+        set->index_bits++;
+    }
+    index_size = 1u << set->index_bits;
+    set->index = (int32_t*)lc_malloc(rt, sizeof(int32_t) * index_size);
+    memset(set->index, 0xFF, sizeof(int32_t) * index_size);  // LC_SET_EMPTY_SLOT
 
-        if (map->is_small) {
-            if (map->size >= LC_SMALL_MAP_THRESHOLD && (
-                map->key_ty == LC_TY_STRING || map->key_ty == LC_TY_I32 || map->key_ty == LC_TY_CHAR)) {
+    return set;
+}
 
-                lc_std_map_construct_hashtable(rt, map);
-            }
+LCValue lc_std_set_new(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* set = lc_set_alloc(rt, LC_TY_NULL, LC_SET_INIT_CAP);
+    return (LCValue){ { .ptr_val = (LCObject*)set }, LC_TY_SET };
+}
 
-            return MK_NULL();
-        } else {
-            hash = LCValueHash(rt, args[0]);
-            index = hash % map->bucket_size;
+static void lc_std_set_free(LCRuntime* rt, LCSet* set) {
+    uint32_t i;
 
-            bucket = (LCMapBucket*)lc_malloc(rt, sizeof(LCMapBucket));
-            bucket->data = tuple;
-            bucket->hash = hash;
-            bucket->next = map->buckets[index];
+    for (i = 0; i < set->entries_len; i++) {
+        LCRelease(rt, set->entries[i].key);
+    }
 
-            map->buckets[index] = bucket;
+    lc_free(rt, set->entries);
+    lc_free(rt, set->index);
+    lc_free(rt, set);
+}
 
-            return MK_NULL();
+static void lc_set_check_key(LCSet* set, LCValue key) {
+    if (likely(set->key_ty == key.tag)) {
+        return;
+    }
+
+    // same keys as Map
+    if (set->key_ty == LC_TY_NULL) {
+        switch (key.tag) {
+        case LC_TY_I32:
+        case LC_TY_CHAR:
+        case LC_TY_BOOL:
+        case LC_TY_STRING:
+            set->key_ty = key.tag;
+            return;
+
+        default:
+            break;
         }
-    } else {  // found in hashmap, replace exist value
-        LCRelease(rt, tuple->value);
-        LCRetain(args[1]);
-        tuple->value = args[1];
-        return MK_NULL();
     }
+
+    fprintf(stderr, "[LichenScript] invalid item of Set, tag: %" PRId64 "\n", key.tag);
+    lc_panic_internal();
 }
 
-static inline void lc_free_map_tuple(LCRuntime* rt, LCMapTuple* tuple) {
-    LCRelease(rt, tuple->key);
-    LCRelease(rt, tuple->value);
-    lc_free(rt, tuple);
+/**
+ * Fibonacci hashing, the hashes of Map are too weak
+ * to be masked directly.
+ */
+static force_inline uint32_t lc_set_slot_of(LCSet* set, uint32_t hash) {
+    return (hash * 2654435769u) >> (32 - set->index_bits);
 }
 
-void lc_std_map_free(LCRuntime* rt, LCMap* map) {
-    LCMapTuple *ptr, *tmp;
-    LCMapBucket *bucket, *bp;
+/**
+ * Returns the slot of the key in the index, or -1.
+ */
+static int64_t lc_set_find_slot(LCRuntime* rt, LCSet* set, LCValue key, uint32_t hash) {
+    uint32_t mask = (1u << set->index_bits) - 1;
+    uint32_t slot = lc_set_slot_of(set, hash);
+    int32_t entry;
+
+    for (;;) {
+        entry = set->index[slot];
+        if (entry == LC_SET_EMPTY_SLOT) {
+            return -1;
+        }
 
-    if (likely(map->size > 0)) {
-        if (map->is_small) {
-            ptr = map->head;
+        if (entry >= 0 && set->entries[entry].hash == hash && LCMapKeyEq(rt, set->entries[entry].key, key)) {
+            return slot;
+        }
 
-            while (ptr != NULL) {
-                tmp = ptr->next;
+        slot = (slot + 1) & mask;
+    }
+}
 
-                lc_free_map_tuple(rt, ptr);
+/**
+ * Drop the deleted entries and rebuild the index,
+ * grow when the set is more than half full.
+ */
+static no_inline void lc_set_rebuild(LCRuntime* rt, LCSet* set) {
+    uint32_t i, j, mask, slot, index_size;
+    uint32_t new_cap = set->entries_cap;
 
-                ptr = tmp;
-            }
+    for (i = 0, j = 0; i < set->entries_len; i++) {
+        if (set->entries[i].key.tag != LC_TY_NULL) {
+            set->entries[j++] = set->entries[i];
+        }
+    }
+    set->entries_len = j;
 
-            goto clean;
+    if (set->size * 2 >= set->entries_cap) {
+        new_cap = set->entries_cap * 2;
+        set->entries = (LCSetEntry*)lc_realloc2(rt, set->entries, sizeof(LCSetEntry) * new_cap, NULL);
+        set->entries_cap = new_cap;
+
+        while ((1u << set->index_bits) < new_cap * 2) {
+            set->index_bits++;
         }
+        lc_free(rt, set->index);
+        set->index = (int32_t*)lc_malloc(rt, sizeof(int32_t) * (1u << set->index_bits));
+    }
 
-        for (int i = 0; i < map->bucket_size; i++) {
-            bucket = map->buckets[i];
+    index_size = 1u << set->index_bits;
+    mask = index_size - 1;
+    memset(set->index, 0xFF, sizeof(int32_t) * index_size);
 
-            while (bucket != NULL) {
-                bp = bucket->next;
+    for (i = 0; i < set->entries_len; i++) {
+        slot = lc_set_slot_of(set, set->entries[i].hash);
+        while (set->index[slot] != LC_SET_EMPTY_SLOT) {
+            slot = (slot + 1) & mask;
+        }
+        set->index[slot] = i;
+    }
+}
 
-                lc_free_map_tuple(rt, bucket->data);
+/**
+ * Returns 1 if the key is new
+ */
+static int lc_set_insert(LCRuntime* rt, LCSet* set, LCValue key, uint32_t hash) {
+    uint32_t mask, slot;
 
-                lc_free(rt, bucket);
+    if (lc_set_find_slot(rt, set, key, hash) >= 0) {
+        return 0;
+    }
 
-                bucket = bp;
-            }
-        }
-        lc_free(rt, map->buckets);
+    if (unlikely(set->entries_len == set->entries_cap)) {
+        lc_set_rebuild(rt, set);
     }
 
-clean:
-    if (rt->gc_phase != LC_GC_PHASE_REMOVING_CYCLES) {
-        lc_gc_objs_list_remove(&rt->gc_objs, (LCGCObject*)map);
+    mask = (1u << set->index_bits) - 1;
+    slot = lc_set_slot_of(set, hash);
+    // a deleted slot can be reused, the key is known to be absent
+    while (set->index[slot] >= 0) {
+        slot = (slot + 1) & mask;
     }
-    lc_free(rt, map);
+
+    LCRetain(key);
+    set->entries[set->entries_len].hash = hash;
+    set->entries[set->entries_len].key = key;
+    set->index[slot] = set->entries_len++;
+    set->size++;
+
+    return 1;
 }
 
-LCValue lc_std_map_get(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
-    LCMapTuple *t, *tmp;
-    LCMap* map = (LCMap*)this.ptr_val;
+LCValue lc_std_set_add(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* set = (LCSet*)this.ptr_val;
 
-    t = lc_std_map_find_tuple(rt, map, args[0]);
-    if (t == NULL) {
-        return /* None */MK_UNION(1);
-    }
+    lc_set_check_key(set, args[0]);
+    lc_set_insert(rt, set, args[0], LCValueHash(rt, args[0]));
 
-    return /* Some(result) */LCNewUnionObject(rt, 0, 1, (LCValue[]) { t->value });
+    return MK_NULL();
 }
 
-static void lc_std_map_become_small(LCRuntime* rt, LCMap* map) {
-    int i;
-    LCMapBucket *bucket, *next;
+LCValue lc_std_set_has(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* set = (LCSet*)this.ptr_val;
 
-    for (i = 0; i < map->bucket_size; i++) {
-        bucket = map->buckets[i];
+    if (set->size == 0 || set->key_ty != args[0].tag) {
+        return LCFalse;
+    }
 
-        while (bucket != NULL) {
-            next = bucket->next;
+    return MK_BOOL(lc_set_find_slot(rt, set, args[0], LCValueHash(rt, args[0])) >= 0);
+}
 
-            lc_free(rt, bucket);
+LCValue lc_std_set_remove(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* set = (LCSet*)this.ptr_val;
+    LCSetEntry* entry;
+    int64_t slot;
 
-            bucket = next;
-        }
+    if (set->size == 0 || set->key_ty != args[0].tag) {
+        return LCFalse;
     }
 
-    lc_free(rt, map->buckets);
-    map->buckets = NULL;
+    slot = lc_set_find_slot(rt, set, args[0], LCValueHash(rt, args[0]));
+    if (slot < 0) {
+        return LCFalse;
+    }
 
-    map->is_small = 1;
-}
+    entry = &set->entries[set->index[slot]];
+    LCRelease(rt, entry->key);
+    entry->key = MK_NULL();
+    set->index[slot] = LC_SET_DELETED_SLOT;
+    set->size--;
 
-static inline LCValue lc_std_map_remove_complex(LCRuntime* rt, LCMap* map, LCValue key) {
-    LCMapTuple* t;
-    LCMapBucket **bucket_ref, *next_bucket;
-    uint32_t hash = LCValueHash(rt, key);
-    int index = hash % map->bucket_size;
-    LCValue result;
+    return LCTrue;
+}
 
-    bucket_ref = &map->buckets[index];
+LCValue lc_std_set_size(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* set = (LCSet*)this.ptr_val;
+    return MK_I32(set->size);
+}
 
-    while ((*bucket_ref) != NULL) {
+static inline int lc_set_has_entry(LCRuntime* rt, LCSet* set, LCSetEntry* entry) {
+    if (set->size == 0 || set->key_ty != entry->key.tag) {
+        return 0;
+    }
+    return lc_set_find_slot(rt, set, entry->key, entry->hash) >= 0;
+}
 
-        if ((*bucket_ref)->hash == hash && LCMapKeyEq(rt, (*bucket_ref)->data->key, key)) {
-            t = (*bucket_ref)->data;
-            result = LCNewUnionObject(rt, 0, 1, (LCValue[]){ t->value });
+LCValue lc_std_set_union(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* a = (LCSet*)this.ptr_val;
+    LCSet* b = (LCSet*)args[0].ptr_val;
+    LCSet* result = lc_set_alloc(rt, a->key_ty, a->size + b->size);
+    LCSetEntry* entry;
+    uint32_t i;
 
-            if (t->prev) {
-                t->prev->next = t->next;
-            } else {  // is first
-                map->head = t->next;
-            }
+    if (result->key_ty == LC_TY_NULL) {
+        result->key_ty = b->key_ty;
+    }
 
-            if (t->next) {
-                t->next->prev = t->prev;
-            } else {  // is last
-                map->last = t->prev;
-            }
+    // the hashes are reused, no need to hash the strings again
+    for (i = 0; i < a->entries_len; i++) {
+        entry = &a->entries[i];
+        if (entry->key.tag != LC_TY_NULL) {
+            lc_set_insert(rt, result, entry->key, entry->hash);
+        }
+    }
 
-            lc_free_map_tuple(rt, t);
+    for (i = 0; i < b->entries_len; i++) {
+        entry = &b->entries[i];
+        if (entry->key.tag != LC_TY_NULL) {
+            lc_set_check_key(result, entry->key);
+            lc_set_insert(rt, result, entry->key, entry->hash);
+        }
+    }
 
-            next_bucket = (*bucket_ref)->next;
-            lc_free(rt, *bucket_ref);
-            (*bucket_ref) = next_bucket;
+    return (LCValue){ { .ptr_val = (LCObject*)result }, LC_TY_SET };
+}
 
-            if (--map->size < LC_SMALL_MAP_THRESHOLD) {
-                lc_std_map_become_small(rt, map);
-            }
+LCValue lc_std_set_intersect(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* a = (LCSet*)this.ptr_val;
+    LCSet* b = (LCSet*)args[0].ptr_val;
+    LCSet* result = lc_set_alloc(rt, a->key_ty, a->size < b->size ? a->size : b->size);
+    LCSetEntry* entry;
+    uint32_t i;
 
-            return result;
+    for (i = 0; i < a->entries_len; i++) {
+        entry = &a->entries[i];
+        if (entry->key.tag != LC_TY_NULL && lc_set_has_entry(rt, b, entry)) {
+            lc_set_insert(rt, result, entry->key, entry->hash);
         }
+    }
 
-        bucket_ref = &((*bucket_ref)->next);
+    return (LCValue){ { .ptr_val = (LCObject*)result }, LC_TY_SET };
+}
+
+LCValue lc_std_set_difference(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* a = (LCSet*)this.ptr_val;
+    LCSet* b = (LCSet*)args[0].ptr_val;
+    LCSet* result = lc_set_alloc(rt, a->key_ty, a->size);
+    LCSetEntry* entry;
+    uint32_t i;
+
+    for (i = 0; i < a->entries_len; i++) {
+        entry = &a->entries[i];
+        if (entry->key.tag != LC_TY_NULL && !lc_set_has_entry(rt, b, entry)) {
+            lc_set_insert(rt, result, entry->key, entry->hash);
+        }
     }
 
-    return  /* None */MK_UNION(1);
+    return (LCValue){ { .ptr_val = (LCObject*)result }, LC_TY_SET };
 }
 
-LCValue lc_std_map_remove(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
-    LCMapTuple *t, *tmp;
-    LCMap* map = (LCMap*)this.ptr_val;
-    LCValue result;
+/**
+ * The items in insertion order
+ */
+LCValue lc_std_set_to_array(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCSet* set = (LCSet*)this.ptr_val;
+    LCArray* arr = LCNewArrayWithCap(rt, set->size < 2 ? 2 : set->size);
+    uint32_t i;
 
-    if (map->is_small) {
-        t = map->head;
+    for (i = 0; i < set->entries_len; i++) {
+        if (set->entries[i].key.tag != LC_TY_NULL) {
+            LCRetain(set->entries[i].key);
+            arr->data[arr->len++] = set->entries[i].key;
+        }
+    }
 
-        while (t != NULL) {
-            tmp = t->next;
+    return (LCValue){ { .ptr_val = (LCObject*)arr }, LC_TY_ARRAY };
+}
 
-            if (LCMapKeyEq(rt, t->key, args[0])) {
-                result = LCNewUnionObject(rt, 0, 1, (LCValue[]){ t->value });
+static force_inline int64_t lc_monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-                if (t->prev) {
-                    t->prev->next = t->next;
-                } else {  // is first
-                    map->head = t->next;
-                }
+/**
+ * (seconds, nanoseconds) of the monotonic clock
+ */
+LCValue lc_std_time_monotonic(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return LCNewTuple(rt, MK_NULL(), 2, (LCValue[]) { MK_I32((int32_t)ts.tv_sec), MK_I32((int32_t)ts.tv_nsec) });
+}
 
-                if (t->next) {
-                    t->next->prev = t->prev;
-                } else {  // is last
-                    map->last = t->prev;
-                }
+static int lc_bench_compare_ns(const void* a, const void* b) {
+    int64_t left = *(const int64_t*)a;
+    int64_t right = *(const int64_t*)b;
+    return (left > right) - (left < right);
+}
 
-                lc_free_map_tuple(rt, t);
-                map->size--;
+/**
+ * args: name, lambda, iterations
+ *
+ * A tenth of the iterations are run to warm up, then every iteration is timed.
+ * The samples are allocated before the loop and the result of the lambda
+ * is released after the clock is read, the harness allocates nothing
+ * between the readings. The report goes to stderr.
+ */
+LCValue lc_std_bench_run(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
+    LCValue lambda = args[1];
+    int32_t iterations = args[2].int_val;
+    int32_t warmup, i;
+    int64_t start, end, total = 0;
+    int64_t* samples;
+    double mean, variance = 0;
+    LCValue ret;
+    LCString* name_str = (LCString*)args[0].ptr_val;
+    char* name;
 
-                return result;
-            }
+    if (iterations <= 0) {
+        return MK_NULL();
+    }
 
-            t = tmp;
-        }
+    warmup = iterations / 10 > 0 ? iterations / 10 : 1;
+    for (i = 0; i < warmup; i++) {
+        LCRelease(rt, LCEvalLambda(rt, lambda, 0, NULL));
+    }
 
-        return  /* None */MK_UNION(1);
+    samples = (int64_t*)lc_malloc(rt, sizeof(int64_t) * iterations);
+
+    for (i = 0; i < iterations; i++) {
+        start = lc_monotonic_ns();
+        ret = LCEvalLambda(rt, lambda, 0, NULL);
+        end = lc_monotonic_ns();
+        LCRelease(rt, ret);
+        samples[i] = end - start;
     }
 
-    return lc_std_map_remove_complex(rt, map, args[0]);
-}
+    for (i = 0; i < iterations; i++) {
+        total += samples[i];
+    }
+    mean = (double)total / iterations;
+    for (i = 0; i < iterations; i++) {
+        variance += ((double)samples[i] - mean) * ((double)samples[i] - mean);
+    }
+    variance /= iterations;
 
-LCValue lc_std_map_size(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
-    LCMap* map = (LCMap*)this.ptr_val;
-    return MK_I32(map->size);
+    qsort(samples, iterations, sizeof(int64_t), lc_bench_compare_ns);
+
+    name = name_str->is_wide_char ? LCStringToUTF8(rt, name_str) : (char*)name_str->u.str8;
+    fprintf(stderr,
+        "[bench] %s: %d iterations, mean: %.0fns, median: %" PRId64 "ns, p95: %" PRId64 "ns, min: %" PRId64 "ns, max: %" PRId64 "ns, stddev: %.0fns\n",
+        name, iterations, mean,
+        samples[iterations / 2],
+        samples[(int32_t)((iterations * 95 + 99) / 100) - 1],
+        samples[0],
+        samples[iterations - 1],
+        sqrt(variance));
+    if (name_str->is_wide_char) {
+        lc_free(rt, name);
+    }
+
+    lc_free(rt, samples);
+    return MK_NULL();
 }
 
 LCValue lc_std_exit(LCRuntime* rt, LCValue this, int argc, LCValue* args) {
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 #define likely(x)       __builtin_expect(!!(x), 1)
@@ -21,6 +22,17 @@
 #define force_inline inline __attribute__((always_inline))
 #define no_inline __attribute__((noinline))
 
+// the tail calls between functions with the same signature reuse the frame,
+// other compilers do it as the sibling call optimization with -O2
+#if defined(__clang__) && defined(__has_attribute)
+#if __has_attribute(musttail)
+#define LC_MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef LC_MUSTTAIL
+#define LC_MUSTTAIL
+#endif
+
 #define LC_NO_GC 0xFFFFFFFF
 #ifndef countof
 #define countof(x) (sizeof(x) / sizeof((x)[0]))
@@ -51,6 +63,11 @@ typedef enum LCObjectType {
     LC_TY_BOXED_I64,
     LC_TY_BOXED_U64,
     LC_TY_BOXED_F64,
+    LC_TY_DEQUE,
+    LC_TY_PRIORITY_QUEUE,
+    LC_TY_SORTED_MAP,
+    LC_TY_SET,
+    LC_TY_ENV,
     LC_TY_MAX = 127,
 } LCObjectType;
 
@@ -62,6 +79,12 @@ typedef enum LCGCObjectType {
     LC_GC_TUPLE,
     LC_GC_ARRAY,
     LC_GC_MAP,
+    LC_GC_DEQUE,
+    LC_GC_PRIORITY_QUEUE,
+    LC_GC_SORTED_MAP,
+    LC_GC_ENV,
+    LC_GC_STACK_CLASS_OBJECT,
+    LC_GC_STACK_TUPLE,
 } LCGCObjectType;
 
 typedef enum LCArithmeticType {
@@ -216,6 +239,16 @@ typedef struct LCRefCell {
     LCValue value;
 } LCRefCell;
 
+/*
+ * The captured variables of a scope live in one environment,
+ * all the lambdas capturing them share it.
+ */
+typedef struct LCEnv {
+    LCGCObjectHeader header;
+    uint32_t size;
+    LCValue values[];
+} LCEnv;
+
 typedef struct LCUnionObject {
     LCGCObjectHeader header;
     int tag;
@@ -236,6 +269,9 @@ typedef struct LCMallocState {
     size_t malloc_count;
     size_t malloc_size;
     size_t malloc_limit;
+    // never decreased, reported when LSC_MALLOC_STATS is set
+    size_t malloc_total_count;
+    size_t malloc_peak_size;
 } LCMallocState;
 
 typedef struct LCTuple {
@@ -245,10 +281,18 @@ typedef struct LCTuple {
 } LCTuple;
 
 LCValue LCNewTuple(LCRuntime* rt, LCValue this, int32_t arg_len, LCValue* args);
+// the number of LCValue slots to store a tuple of n values
+#define LC_STACK_TUPLE_SIZE(n) (LC_STACK_OBJECT_SIZE(sizeof(LCTuple)) + (n))
+LCValue LCInitStackTuple(LCValue* storage, int32_t arg_len, LCValue* args);
 
 #define LC_TUPLE_GET(v, index) (((LCTuple*)((v).ptr_val))->data[index])
 
-typedef struct LCArray LCArray;
+typedef struct LCArray {
+    LCGCObjectHeader header;
+    uint32_t len;
+    uint32_t capacity;
+    LCValue* data;
+} LCArray;
 
 typedef LCValue (*LCCFunction)(LCRuntime* rt, LCValue this, int32_t arg_len, LCValue* args);
 typedef void (*LCFinalizer)(LCRuntime* rt, LCGCObject*);
@@ -297,11 +341,24 @@ LCValue LCNewRefCell(LCRuntime* rt, LCValue value);
 void LCRefCellSetValue(LCRuntime* rt, LCValue cell, LCValue value);
 LCValue LCRefCellGetValue(LCValue cell);
 
+LCValue LCNewEnv(LCRuntime* rt, int size);
+void LCEnvSet(LCRuntime* rt, LCValue env, int index, LCValue value);
+LCValue LCEnvGetChecked(LCValue env, int index);
+#ifdef LSC_DEBUG
+#define LCEnvGet(env, index) LCEnvGetChecked(env, index)
+#else
+#define LCEnvGet(env, index) (((LCEnv*)(env).ptr_val)->values[index])
+#endif
+
 LCValue LCNewUnionObject(LCRuntime* rt, int tag, int size, LCValue* args);
 LCValue LCUnionObjectGet(LCRuntime* rt, LCValue this, int index);
 int LCUnionGetType(LCValue);
+#define LC_UNION_GET_TYPE(v) ((v).tag == LC_TY_UNION ? (v).int_val : ((LCUnionObject*)(v).ptr_val)->tag)
 
 LCValue LCNewLambda(LCRuntime* rt, LCCFunction c_fun, LCValue this, int argc, LCValue* args);
+// the number of LCValue slots to store a lambda with n captured values
+#define LC_STACK_LAMBDA_SIZE(n) ((sizeof(LCLambda) + sizeof(LCValue) - 1) / sizeof(LCValue) + (n))
+LCValue LCInitStackLambda(LCValue* storage, LCCFunction c_fun, LCValue this, int argc, LCValue* args);
 #define LC_LAMBDA_THIS(v) ((LCLambda*)v.ptr_val)->captured_this
 LCValue LCLambdaGetValue(LCRuntime* rt, LCValue lambda, int index);
 LCValue* LCLambdaGetValuePointer(LCRuntime* rt, LCValue lambda, int index);
@@ -311,6 +368,7 @@ void LCLambdaSetRefValue(LCRuntime* rt, LCValue lambda, int index, LCValue value
 
 LCValue LCNewArray(LCRuntime* rt);
 LCValue LCNewArrayLen(LCRuntime* rt, size_t size);
+LCValue LCNewArrayFromStatic(LCRuntime* rt, const LCValue* values, size_t size);
 LCValue LCArrayGetValue(LCRuntime* rt, LCValue this, int index);
 void LCArraySetValue(LCRuntime* rt, LCValue this, int argc, LCValue* args);
 
@@ -338,6 +396,9 @@ LCValue LCEvalLambda(LCRuntime* rt, LCValue this, int argc, LCValue* args);
 
 LCValue lc_std_print(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 void lc_init_object(LCRuntime* rt, LCClassID cls_id, LCGCObject* obj);
+// the number of LCValue slots to store an object of the size in bytes
+#define LC_STACK_OBJECT_SIZE(size) (((size) + sizeof(LCValue) - 1) / sizeof(LCValue))
+void lc_init_stack_object(LCClassID cls_id, LCGCObject* obj);
 
 LCValue lc_std_array_get_length(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 LCValue lc_std_array_resize(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
@@ -346,6 +407,15 @@ LCValue lc_std_array_slice(LCRuntime* rt, LCValue this, int arg_len, LCValue* ar
 LCValue lc_std_array_map(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 LCValue lc_std_array_filter(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 LCValue lc_std_array_push(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_reserve(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_shrink_to_fit(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_append(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_with_capacity(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_reduce(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_parallel_map(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_parallel_filter(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_parallel_sort(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
+LCValue lc_std_array_parallel_reduce(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 
 LCValue lc_std_char_code(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 LCValue lc_std_char_to_string(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
@@ -356,6 +426,15 @@ LCValue lc_std_string_cmp(LCRuntime* rt, LCCmpType cmp_type, LCValue left, LCVal
 LCValue lc_std_string_slice(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 LCValue lc_std_string_get_char(LCRuntime* rt, LCValue this, int arg_len, LCValue* args);
 
+/*
+ * Trivial externals expanded in place by the compiler,
+ * they can't be inlined from runtime.c, which is another translation unit.
+ */
+#define LC_ARRAY_GET_LENGTH(rt, this, arg_len, args) MK_I32(((LCArray*)(this).ptr_val)->len)
+#define LC_STRING_GET_LENGTH(rt, this, arg_len, args) MK_I32(((LCString*)(this).ptr_val)->length)
+#define LC_CHAR_CODE(rt, this, arg_len, args) MK_I32((this).int_val)
+#define LC_STRING_LENGTH(v) (((LCString*)(v).ptr_val)->length)
+
 typedef struct LCMapTuple LCMapTuple;
 typedef struct LCMapBucket LCMapBucket;
 
@@ -376,6 +455,46 @@ LCValue lc_std_map_set(LCRuntime* rt, LCValue this, int argc, LCValue* args);
 LCValue lc_std_map_get(LCRuntime* rt, LCValue this, int argc, LCValue* args);
 LCValue lc_std_map_remove(LCRuntime* rt, LCValue this, int argc, LCValue* args);
 LCValue lc_std_map_size(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+#define LC_MAP_SIZE(rt, this, argc, args) MK_I32(((LCMap*)(this).ptr_val)->size)
+
+LCValue lc_std_deque_new(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_deque_push_back(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_deque_push_front(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_deque_pop_back(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_deque_pop_front(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_deque_peek_back(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_deque_peek_front(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_deque_size(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+
+LCValue lc_std_priority_queue_new(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_priority_queue_with_comparator(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_priority_queue_push(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_priority_queue_pop(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_priority_queue_peek(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_priority_queue_size(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+
+LCValue lc_std_set_new(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_add(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_has(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_remove(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_size(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_union(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_intersect(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_difference(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_set_to_array(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+
+LCValue lc_std_sorted_map_new(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_set(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_get(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_remove(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_size(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_floor(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_ceil(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_range(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_sorted_map_keys(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+
+LCValue lc_std_time_monotonic(LCRuntime* rt, LCValue this, int argc, LCValue* args);
+LCValue lc_std_bench_run(LCRuntime* rt, LCValue this, int argc, LCValue* args);
 
 LCValue lc_std_exit(LCRuntime* rt, LCValue this, int argc, LCValue* args);
 LCValue lc_std_panic(LCRuntime* rt, LCValue this, int argc, LCValue* args);
@@ -162,6 +162,33 @@ function lc_std_array_sort(cmp) {
   return Array.prototype.sort.call(this, cmp);
 }
 
+function lc_std_array_reduce(f, init) {
+  return Array.prototype.reduce.call(this, f, init);
+}
+
+// the capacity is managed by the JS engine
+function lc_std_array_reserve(capacity) {}
+
+function lc_std_array_shrink_to_fit() {}
+
+function lc_std_array_append(other) {
+  const len = other.length;
+  for (let i = 0; i < len; i++) {
+    this.push(other[i]);
+  }
+}
+
+function lc_std_array_with_capacity(capacity) {
+  return [];
+}
+
+// there is no shared-memory worker pool in JS,
+// the parallel versions are the sequential ones.
+const lc_std_array_parallel_map = lc_std_array_map;
+const lc_std_array_parallel_filter = lc_std_array_filter;
+const lc_std_array_parallel_sort = lc_std_array_sort;
+const lc_std_array_parallel_reduce = lc_std_array_reduce;
+
 function lc_std_map_get(key, value) {
   const tmp = Map.prototype.get.call(this, key, value);
   if (tmp) {
@@ -186,6 +213,321 @@ function lc_std_map_size() {
   return this.size;
 }
 
+function lc_std_set_new() {
+  return new Set();
+}
+
+function lc_std_set_add(item) {
+  Set.prototype.add.call(this, item);
+}
+
+function lc_std_set_has(item) {
+  return Set.prototype.has.call(this, item);
+}
+
+function lc_std_set_remove(item) {
+  return Set.prototype.delete.call(this, item);
+}
+
+function lc_std_set_size() {
+  return this.size;
+}
+
+function lc_std_set_union(other) {
+  const result = new Set(this);
+  for (const item of other) {
+    result.add(item);
+  }
+  return result;
+}
+
+function lc_std_set_intersect(other) {
+  const result = new Set();
+  for (const item of this) {
+    if (other.has(item)) {
+      result.add(item);
+    }
+  }
+  return result;
+}
+
+function lc_std_set_difference(other) {
+  const result = new Set();
+  for (const item of this) {
+    if (!other.has(item)) {
+      result.add(item);
+    }
+  }
+  return result;
+}
+
+function lc_std_set_to_array() {
+  return Array.from(this);
+}
+
+// sorted arrays, good enough for the JS target
+class LCSortedMap {
+
+  constructor() {
+    this.keys = [];
+    this.values = [];
+  }
+
+  lowerBound(key) {
+    let lo = 0, hi = this.keys.length;
+    while (lo < hi) {
+      const mid = (lo + hi) >> 1;
+      if (this.keys[mid] < key) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  upperBound(key) {
+    let lo = 0, hi = this.keys.length;
+    while (lo < hi) {
+      const mid = (lo + hi) >> 1;
+      if (this.keys[mid] <= key) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+}
+
+function lc_std_sorted_map_new() {
+  return new LCSortedMap();
+}
+
+function lc_std_sorted_map_set(key, value) {
+  const pos = this.lowerBound(key);
+  if (pos < this.keys.length && this.keys[pos] === key) {
+    this.values[pos] = value;
+    return;
+  }
+  this.keys.splice(pos, 0, key);
+  this.values.splice(pos, 0, value);
+}
+
+function lc_std_sorted_map_get(key) {
+  const pos = this.lowerBound(key);
+  if (pos < this.keys.length && this.keys[pos] === key) {
+    return [0, this.values[pos]];
+  }
+  return [1];
+}
+
+function lc_std_sorted_map_remove(key) {
+  const pos = this.lowerBound(key);
+  if (pos < this.keys.length && this.keys[pos] === key) {
+    const value = this.values[pos];
+    this.keys.splice(pos, 1);
+    this.values.splice(pos, 1);
+    return [0, value];
+  }
+  return [1];
+}
+
+function lc_std_sorted_map_size() {
+  return this.keys.length;
+}
+
+function lc_std_sorted_map_floor(key) {
+  const pos = this.upperBound(key);
+  if (pos > 0) {
+    return [0, this.keys[pos - 1]];
+  }
+  return [1];
+}
+
+function lc_std_sorted_map_ceil(key) {
+  const pos = this.lowerBound(key);
+  if (pos < this.keys.length) {
+    return [0, this.keys[pos]];
+  }
+  return [1];
+}
+
+function lc_std_sorted_map_range(low, high) {
+  return this.keys.slice(this.lowerBound(low), this.lowerBound(high));
+}
+
+function lc_std_sorted_map_keys() {
+  return this.keys.slice();
+}
+
+class LCDeque {
+
+  constructor() {
+    this.data = new Array(8);
+    this.head = 0;
+    this.length = 0;
+  }
+
+  grow() {
+    const cap = this.data.length;
+    const data = new Array(cap * 2);
+    for (let i = 0; i < this.length; i++) {
+      data[i] = this.data[(this.head + i) % cap];
+    }
+    this.data = data;
+    this.head = 0;
+  }
+
+}
+
+function lc_std_deque_new() {
+  return new LCDeque();
+}
+
+function lc_std_deque_push_back(item) {
+  if (this.length === this.data.length) {
+    this.grow();
+  }
+  this.data[(this.head + this.length) % this.data.length] = item;
+  this.length++;
+}
+
+function lc_std_deque_push_front(item) {
+  if (this.length === this.data.length) {
+    this.grow();
+  }
+  this.head = (this.head + this.data.length - 1) % this.data.length;
+  this.data[this.head] = item;
+  this.length++;
+}
+
+function lc_std_deque_pop_back() {
+  if (this.length === 0) {
+    return [1];
+  }
+  this.length--;
+  const index = (this.head + this.length) % this.data.length;
+  const item = this.data[index];
+  this.data[index] = undefined;
+  return [0, item];
+}
+
+function lc_std_deque_pop_front() {
+  if (this.length === 0) {
+    return [1];
+  }
+  const item = this.data[this.head];
+  this.data[this.head] = undefined;
+  this.head = (this.head + 1) % this.data.length;
+  this.length--;
+  return [0, item];
+}
+
+function lc_std_deque_peek_back() {
+  if (this.length === 0) {
+    return [1];
+  }
+  return [0, this.data[(this.head + this.length - 1) % this.data.length]];
+}
+
+function lc_std_deque_peek_front() {
+  if (this.length === 0) {
+    return [1];
+  }
+  return [0, this.data[this.head]];
+}
+
+function lc_std_deque_size() {
+  return this.length;
+}
+
+function lc_heap_natural_cmp(a, b) {
+  if (a < b) {
+    return -1;
+  }
+  return a > b ? 1 : 0;
+}
+
+class LCPriorityQueue {
+
+  constructor(cmp) {
+    this.data = [];
+    this.cmp = cmp;
+  }
+
+  siftUp(i) {
+    const data = this.data;
+    const item = data[i];
+    while (i > 0) {
+      const parent = (i - 1) >> 1;
+      if (this.cmp(item, data[parent]) >= 0) {
+        break;
+      }
+      data[i] = data[parent];
+      i = parent;
+    }
+    data[i] = item;
+  }
+
+  siftDown(i) {
+    const data = this.data;
+    const len = data.length;
+    const item = data[i];
+    while (2 * i + 1 < len) {
+      let child = 2 * i + 1;
+      if (child + 1 < len && this.cmp(data[child + 1], data[child]) < 0) {
+        child++;
+      }
+      if (this.cmp(data[child], item) >= 0) {
+        break;
+      }
+      data[i] = data[child];
+      i = child;
+    }
+    data[i] = item;
+  }
+
+}
+
+function lc_std_priority_queue_new() {
+  return new LCPriorityQueue(lc_heap_natural_cmp);
+}
+
+function lc_std_priority_queue_with_comparator(cmp) {
+  return new LCPriorityQueue(cmp);
+}
+
+function lc_std_priority_queue_push(item) {
+  this.data.push(item);
+  this.siftUp(this.data.length - 1);
+}
+
+function lc_std_priority_queue_pop() {
+  if (this.data.length === 0) {
+    return [1];
+  }
+  const top = this.data[0];
+  const last = this.data.pop();
+  if (this.data.length > 0) {
+    this.data[0] = last;
+    this.siftDown(0);
+  }
+  return [0, top];
+}
+
+function lc_std_priority_queue_peek() {
+  if (this.data.length === 0) {
+    return [1];
+  }
+  return [0, this.data[0]];
+}
+
+function lc_std_priority_queue_size() {
+  return this.data.length;
+}
+
 function lc_std_string_slice() {
   return String.prototype.slice.apply(this, arguments);
 }
@@ -202,6 +544,52 @@ function lc_std_string_concat(a, b) {
   return a + b;
 }
 
+const lc_performance = typeof performance !== 'undefined' ? performance : require('perf_hooks').performance;
+
+function lc_std_time_monotonic() {
+  const ms = lc_performance.now();
+  const sec = Math.floor(ms / 1000);
+  const nsec = Math.min(Math.round((ms - sec * 1000) * 1000000), 999999999);
+  return [tupleSym, sec, nsec];
+}
+
+// the samples are allocated before the loop, the report goes to stderr
+function lc_std_bench_run(name, fn, iterations) {
+  if (iterations <= 0) {
+    return;
+  }
+  const warmup = Math.max(Math.floor(iterations / 10), 1);
+  for (let i = 0; i < warmup; i++) {
+    fn();
+  }
+
+  const samples = new Float64Array(iterations);
+  for (let i = 0; i < iterations; i++) {
+    const start = lc_performance.now();
+    fn();
+    samples[i] = (lc_performance.now() - start) * 1000000;
+  }
+
+  let total = 0;
+  for (let i = 0; i < iterations; i++) {
+    total += samples[i];
+  }
+  const mean = total / iterations;
+  let variance = 0;
+  for (let i = 0; i < iterations; i++) {
+    variance += (samples[i] - mean) * (samples[i] - mean);
+  }
+  variance /= iterations;
+
+  samples.sort();
+  const ns = (v) => Math.round(v) + 'ns';
+  console.error(
+    `[bench] ${name}: ${iterations} iterations, mean: ${ns(mean)}, median: ${ns(samples[Math.floor(iterations / 2)])}, ` +
+    `p95: ${ns(samples[Math.ceil(iterations * 95 / 100) - 1])}, min: ${ns(samples[0])}, max: ${ns(samples[iterations - 1])}, ` +
+    `stddev: ${ns(Math.sqrt(variance))}`
+  );
+}
+
 function lc_std_panic(message) {
   console.log("panic");
   throw new Error("panic: " + message);
@@ -15,6 +15,7 @@
  *)
 open Core
 open Lichenscript_common.Cli_utils
+module Spawn = Lichenscript_spawn.Spawn
 
 type test_suite = {
   mutable stdout:        Core.Unix.File_descr.t option;
@@ -285,29 +286,15 @@ and run_test_for_file env test_file =
   Out_channel.printf "Run test: %s\n" test_file;
   Out_channel.flush Out_channel.stdout;
 
-  let pipe_read, pipe_write = Unix.pipe () in
-  match Unix.fork() with
-  | `In_the_child -> (
-    Unix.dup2 ~src:pipe_write ~dst:Unix.stdout ();
-
-    Unix.close pipe_read;
-    Unix.close pipe_write;
-
-    let _ = Unix.exec ~prog:env.compiler_path ~argv:args () in
-    failwith "unreachable"
-  )
-  | `In_the_parent pid -> (
-    Unix.close pipe_write;
-
-    let suite = {
-      pid;
-      stdout = Some pipe_read;
-      test_file;
-      stdout_buffer = Buffer.create 1024;
-    } in
-    let fd = Unix.File_descr.to_int pipe_read in
-    Hashtbl.set env.suites ~key:fd ~data:suite
-  )
+  let pid, pipe_read = Spawn.spawn ~prog:env.compiler_path ~argv:args () in
+  let suite = {
+    pid;
+    stdout = Some pipe_read;
+    test_file;
+    stdout_buffer = Buffer.create 1024;
+  } in
+  let fd = Unix.File_descr.to_int pipe_read in
+  Hashtbl.set env.suites ~key:fd ~data:suite
 
 let () =
   main()
@@ -0,0 +1,69 @@
+(*
+ * Copyright 2022 Vincent Chan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *)
+
+(*
+ * Spawning the compiler and the compiled programs,
+ * shared by the test runner and the benchmark runner.
+ *)
+open Core
+
+(*
+ * Fork and exec `prog`, the stdout of the child is returned as the read end of a pipe.
+ * With `merge_stderr`, the stderr of the child goes to the same pipe.
+ *)
+let spawn ?env ?(merge_stderr=false) ~prog ~argv () =
+  let pipe_read, pipe_write = Unix.pipe () in
+  match Unix.fork () with
+  | `In_the_child -> (
+    Unix.dup2 ~src:pipe_write ~dst:Unix.stdout ();
+    if merge_stderr then
+      Unix.dup2 ~src:pipe_write ~dst:Unix.stderr ();
+
+    Unix.close pipe_read;
+    Unix.close pipe_write;
+
+    let _ = Unix.exec ~prog ~argv ?env () in
+    failwith "unreachable"
+  )
+  | `In_the_parent pid -> (
+    Unix.close pipe_write;
+    pid, pipe_read
+  )
+
+(* read til the end, the fd is closed *)
+let read_all fd =
+  let buffer = Buffer.create 1024 in
+  let content_bytes = Bytes.create 1024 in
+  let rec loop () =
+    let read_bytes =
+      try Unix.read ~len:1024 ~buf:content_bytes fd
+      with Stdlib.End_of_file -> 0
+    in
+    if read_bytes > 0 then (
+      Buffer.add_subbytes buffer content_bytes ~pos:0 ~len:read_bytes;
+      loop ()
+    )
+  in
+  loop ();
+  Unix.close fd;
+  Buffer.contents buffer
+
+(* spawn and wait, the output and the exit status are returned *)
+let run ?env ?merge_stderr ~prog ~argv () =
+  Out_channel.flush Out_channel.stdout;
+  let pid, stdout = spawn ?env ?merge_stderr ~prog ~argv () in
+  let output = read_all stdout in
+  output, Unix.waitpid pid
@@ -62,6 +62,16 @@ module JsFS : Resolver.FSProvider = struct
 
   let write_file_content path ~data =
     FileMap.set global_fs ~key:path ~data:(FS_file data)
+
+  let rename src dst =
+    Option.iter
+      ~f:(fun data ->
+        FileMap.remove global_fs src;
+        FileMap.set global_fs ~key:dst ~data
+      )
+      (FileMap.find global_fs src)
+
+  let map_files ~f paths = List.map ~f paths
   
 end
 
@@ -98,9 +108,12 @@ let _ =
         let config = { R.
           find_paths = ["/std"];
           runtime_dir = "/runtime";
+          runtime_cache_dir = None;
+          ast_cache_dir = None;
           build_dir = Some "/usr/build";
           platform = "js";
           verbose = false;
+          dump_ir = false;
           wasm_standalone = false;
         } in
         let profiles = R.compile_file_path ~config dummy_path